@@ -57,9 +57,14 @@ static void	hardware_init(void);
 //
 static void	bootloader(void);
 
+// Get a 16-bit little-endian value, adding it to the command CRC
+//
+static uint16_t	cin_word(void);
+
 
-uint8_t __data	buf[PROTO_PROG_MULTI_MAX];
+uint8_t __xdata	buf[PROTO_PROG_PAGE_CHUNK];
 
+uint16_t	crc;
 uint8_t		reset_source;
 uint8_t		debounce_count;
 bool		app_valid;
@@ -81,6 +86,9 @@ bl_main(void)
 	if (reset_source & (1 << 1))
 		reset_source = 1 << 1;
 
+	// Finish any update the application has staged
+	staging_apply();
+
 	// Check for app validity
 	app_valid = flash_app_valid();
 
@@ -137,6 +145,7 @@ bootloader(void)
 {
 	uint8_t		c;
 	uint8_t		count, i;
+	uint16_t	length;
 	static uint16_t	address;
 
 	// Wait for a command byte
@@ -147,7 +156,6 @@ bootloader(void)
 	// common tests for EOC
 	switch (c) {
 	case PROTO_GET_SYNC:
-	case PROTO_GET_DEVICE:
 	case PROTO_CHIP_ERASE:
 	case PROTO_PARAM_ERASE:
 	case PROTO_READ_FLASH:
@@ -162,8 +170,20 @@ bootloader(void)
 		break;
 
 	case PROTO_GET_DEVICE:
+		// v2 hosts ask for the bootloader version and capabilities too
+		c = cin();
+		if (c == PROTO_DEVICE_V2) {
+			if (cin() != PROTO_EOC)
+				goto cmd_bad;
+		} else if (c != PROTO_EOC) {
+			goto cmd_bad;
+		}
 		cout(BOARD_ID);
 		cout(board_frequency);
+		if (c == PROTO_DEVICE_V2) {
+			cout(BL_VERSION);
+			cout(PROTO_CAPABILITIES);
+		}
 		break;
 
 	case PROTO_CHIP_ERASE:		// erase the program area
@@ -195,7 +215,7 @@ bootloader(void)
 
 	case PROTO_PROG_MULTI:
 		count = cin();
-		if (count > sizeof(buf))
+		if (count > PROTO_PROG_MULTI_MAX)
 			goto cmd_bad;
 		for (i = 0; i < count; i++)
 			buf[i] = cin();
@@ -215,6 +235,67 @@ bootloader(void)
 		}
 		break;
 
+	case PROTO_PROG_PAGE:
+		// check the address and count before touching the flash, as
+		// a damaged address would program the wrong page. Then take
+		// the page a chunk at a time, doing nothing but store the
+		// bytes as they come, then add the chunk to the CRC and
+		// program it before asking for the next
+		crc = 0xffff;
+		address = cin_word();
+		length = cin_word();
+		c = cin();
+		if ((c | ((uint16_t)cin() << 8)) != crc) {
+			cout(PROTO_INSYNC);
+			cout(PROTO_FAILED);
+			goto cmd_bad;
+		}
+		if (length > PROTO_PROG_PAGE_MAX)
+			goto cmd_bad;
+		cout(PROTO_CONTINUE);
+		while (length != 0) {
+			count = (length > PROTO_PROG_PAGE_CHUNK) ? PROTO_PROG_PAGE_CHUNK : length;
+			for (i = 0; i < count; i++)
+				buf[i] = cin();
+			for (i = 0; i < count; i++) {
+				crc = crc16_byte(crc, buf[i]);
+				flash_write_byte(address++, buf[i]);
+			}
+			length -= count;
+			cout(PROTO_CONTINUE);
+		}
+		length = cin();
+		length |= (uint16_t)cin() << 8;
+		if (cin() != PROTO_EOC)
+			goto cmd_bad;
+		if (length != crc) {
+			cout(PROTO_INSYNC);
+			cout(PROTO_FAILED);
+			goto cmd_bad;
+		}
+		break;
+
+	case PROTO_READ_CRC:
+		address = cin_word();
+		length = cin_word();
+		if (cin() != PROTO_EOC)
+			goto cmd_bad;
+		crc = 0xffff;
+		while (length--) {
+			crc = crc16_byte(crc, flash_read_byte(address++));
+			cpoll();
+		}
+		cout(crc & 0xff);
+		cout(crc >> 8);
+		break;
+
+	case PROTO_ERASE_PAGE:
+		address = cin_word();
+		if (cin() != PROTO_EOC)
+			goto cmd_bad;
+		flash_erase_page(address);
+		break;
+
 	case PROTO_REBOOT:
 		// generate a software reset, which should boot to the application
 		RSTSRC |= (1 << 4);
@@ -231,6 +312,17 @@ cmd_bad:
 	return;
 }
 
+static uint16_t
+cin_word(void)
+{
+	uint8_t		lo, hi;
+
+	lo = cin();
+	hi = cin();
+	crc = crc16_byte(crc16_byte(crc, lo), hi);
+	return lo | ((uint16_t)hi << 8);
+}
+
 static void
 sync_response(void)
 {
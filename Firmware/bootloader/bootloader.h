@@ -68,9 +68,48 @@
 // PARAM_ERASE			optional - clear flash scratch/parameter page
 // RESET			resets chip and starts application
 //
+// Version 2 of the protocol adds commands for writing whole pages and
+// checking them by CRC rather than by reading them back. A host finds
+// out whether they are there by sending GET_DEVICE with a DEVICE_V2
+// argument; a version 1 bootloader silently drops that, so a host that
+// gets no reply carries on with the version 1 commands above. The
+// version 2 workflow is:
+//
+// GET_SYNC			verify that the board is present
+// GET_DEVICE DEVICE_V2		determine which board and what it can do
+// CHIP_ERASE			clear the program area
+// loop:
+//	PROG_PAGE		program a page
+// loop:
+//	READ_CRC		verify a page
+//	ERASE_PAGE + PROG_PAGE	rewrite it if that failed
+// PARAM_ERASE			optional - clear flash scratch/parameter page
+// RESET			resets chip and starts application
+//
+// The address and count of a PROG_PAGE are followed by their own CRC,
+// and the host must wait for a CONTINUE byte before sending the data. If
+// that CRC is wrong nothing is programmed, and the reply is INSYNC
+// FAILED instead.
+// The UART holds a single byte and flash writes take tens of
+// microseconds a byte, so PROG_PAGE data is sent in chunks of
+// PROTO_PROG_PAGE_CHUNK bytes, the last one possibly shorter. After each
+// chunk the host must wait for a CONTINUE byte, which the bootloader
+// sends once it has programmed the chunk, before sending any more.
+// Other commands, and their replies, are never overlapped, except that
+// a bootloader with CAP_RX_BUFFER keeps what arrives while it works out
+// a READ_CRC or sends a reply in a PROTO_RX_BUFFER byte buffer. A host
+// may then send further READ_CRC commands before the replies to earlier
+// ones come back, as long as no more than PROTO_RX_BUFFER bytes of them
+// are outstanding.
+// CRCs are CRC-16/CCITT, polynomial 0x1021 starting from 0xffff. The
+// final PROG_PAGE CRC covers the address and count bytes as well as the data,
+// and a mismatch is reported with a FAILED status; the bytes will have
+// been programmed anyway, so the page must be erased before retrying.
+//
 #define PROTO_OK		0x10	// 'ok' response
 #define PROTO_FAILED		0x11	// 'fail' response
 #define PROTO_INSYNC		0x12	// 'in sync' byte sent before status
+#define PROTO_CONTINUE		0x13	// PROG_PAGE header or chunk taken, send the next chunk
 
 #define PROTO_EOC		0x20	// end of command
 #define PROTO_GET_SYNC		0x21	// NOP for re-establishing sync
@@ -82,6 +121,9 @@
 #define PROTO_PROG_MULTI	0x27	// write bytes at address + increment         <command_data>: <count><databytes>
 #define PROTO_READ_MULTI	0x28	// read bytes at address + increment          <command_data>: <count>,  <reply_data>: <databytes>
 #define PROTO_PARAM_ERASE	0x29	// erase the parameter flash
+#define PROTO_PROG_PAGE		0x2a	// write bytes at address, v2                 <command_data>: <lowbyte><highbyte><count low><count high><crc low><crc high>, <reply_data>: <CONTINUE>, {<chunk>, <reply_data>: <CONTINUE>}<crc low><crc high>
+#define PROTO_READ_CRC		0x2b	// CRC of flash at address, v2                <command_data>: <lowbyte><highbyte><count low><count high>, <reply_data>: <crc low><crc high>
+#define PROTO_ERASE_PAGE	0x2c	// erase the page holding address, v2         <command_data>: <lowbyte><highbyte>
 
 #define PROTO_REBOOT		0x30	// reboot the board & start the app
 
@@ -89,5 +131,18 @@
 
 #define PROTO_PROG_MULTI_MAX	64	// maximum PROG_MULTI size
 #define PROTO_READ_MULTI_MAX	255	// size of the size field
+#define PROTO_PROG_PAGE_MAX	1024	// maximum PROG_PAGE size
+#define PROTO_PROG_PAGE_CHUNK	128	// PROG_PAGE bytes sent before each CONTINUE
+#define PROTO_RX_BUFFER		32	// receive buffer size, a power of two
+
+// GET_DEVICE DEVICE_V2 returns <board ID><frequency code><bootloader version><capabilities>
+#define PROTO_DEVICE_V2		0x02
+
+// capability bits
+#define PROTO_CAP_PROG_PAGE	0x01	// PROG_PAGE
+#define PROTO_CAP_READ_CRC	0x02	// READ_CRC
+#define PROTO_CAP_ERASE_PAGE	0x04	// ERASE_PAGE
+#define PROTO_CAP_RX_BUFFER	0x08	// READ_CRC commands may be overlapped
+#define PROTO_CAPABILITIES	(PROTO_CAP_PROG_PAGE | PROTO_CAP_READ_CRC | PROTO_CAP_ERASE_PAGE | PROTO_CAP_RX_BUFFER)
 
 #endif // _BOOTLOADER_H_
@@ -104,7 +104,14 @@ flash_erase_app(void)
 	uint16_t	address;
 
 	// start with the signature so that a partial erase will fail the signature check on startup
-	for (address = FLASH_INFO_PAGE - FLASH_PAGE_SIZE; address >= FLASH_APP_START; address -= FLASH_PAGE_SIZE) {
+	for (address = FLASH_INFO_PAGE - FLASH_PAGE_SIZE; address >= FLASH_APP_START; address -= FLASH_PAGE_SIZE)
+		flash_erase_page(address);
+}
+
+void
+flash_erase_page(uint16_t address)
+{
+	if (flash_address_visible(address)) {
 		flash_load_keys();
 		PSCTL = 0x03;				// set PSWE and PSEE
 		*(uint8_t __xdata *)address = 0xff;	// do the page erase
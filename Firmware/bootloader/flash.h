@@ -55,6 +55,12 @@ char	flash_app_valid(void);
 ///
 void	flash_erase_app(void);
 
+/// Erases the page holding an address, if it is in the application area.
+///
+/// @param	address		An address in the page to be erased
+///
+void	flash_erase_page(uint16_t address);
+
 /// Erases the scratch page, where applications keep their parameters.
 ///
 void	flash_erase_scratch(void);
@@ -74,6 +80,11 @@ void	flash_write_byte(uint16_t address, uint8_t c);
 ///
 uint8_t	flash_read_byte(uint16_t address);
 
+/// Copies the pages of an over the air update from the staging area
+/// into place, if one has been staged and checks out.
+///
+void	staging_apply(void);
+
 #ifdef BOARD_rfd900a
 void flash_transfer_calibration();
 #endif
@@ -0,0 +1,125 @@
+// -*- Mode: C; c-basic-offset: 8; -*-
+//
+// Copyright (c) 2026 agent, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+///
+/// @file	staging.c
+///
+/// Applying an over the air update staged by the application
+///
+/// The application leaves changed pages in the staging area with a
+/// directory saying where each one goes (see flash_layout.h). Nothing is
+/// copied unless every staged page matches the CRC recorded for it, and
+/// the directory records each page as it is done, so if power is lost
+/// part way through the copy is simply carried on with at the next reset.
+///
+/// An application built without OTA=1 has code where the staging area
+/// would be, so nothing there is written unless the directory checks
+/// out; a bad update is left for the application to erase when it
+/// starts the next one.
+///
+
+#ifndef OTA_TEST
+#include <compiler_defs.h>
+#include <Si1000_defs.h>
+
+#include <stdint.h>
+
+#include "flash.h"
+#include "util.h"
+
+// Keep the flash code together in the high page
+//
+#pragma codeseg HIGHCSEG
+#endif
+
+/// Checks the staged pages against the directory
+///
+/// @returns			True if there is at least one and they can
+///				all be copied
+///
+static bool
+staging_valid(void)
+{
+	uint8_t		slot, staged;
+	uint16_t	entry, crc, i;
+
+	staged = 0;
+	for (slot = 0; slot < FLASH_STAGING_SLOTS; slot++) {
+		entry = FLASH_STAGING_START + slot * STAGING_ENTRY_SIZE;
+		i = flash_read_byte(entry);
+		if (i == 0xff)
+			continue;
+		// check the page number itself, as the address would wrap
+		if ((i < (FLASH_APP_START >> FLASH_PAGE_SHIFT)) ||
+		    (i >= (FLASH_STAGING_START >> FLASH_PAGE_SHIFT)))
+			return false;
+
+		crc = 0xffff;
+		for (i = 0; i < FLASH_PAGE_SIZE; i++)
+			crc = crc16_byte(crc, flash_read_byte(FLASH_STAGING_SLOT(slot) + i));
+		if ((flash_read_byte(entry + 1) != (uint8_t)crc) ||
+		    (flash_read_byte(entry + 2) != (uint8_t)(crc >> 8)))
+			return false;
+		staged++;
+	}
+	return staged != 0;
+}
+
+void
+staging_apply(void)
+{
+	uint8_t		slot;
+	uint16_t	target, i;
+
+	if (flash_read_byte(FLASH_STAGING_START + STAGING_MAGIC_OFFSET) != STAGING_MAGIC)
+		return;
+
+	// check everything before any page is touched, even when carrying
+	// on with a copy, as without OTA=1 this may be application code
+	// that happens to look started. The staged pages are never written
+	// during the copy, so they still check out part way through
+	if (!staging_valid())
+		return;
+	if (flash_read_byte(FLASH_STAGING_START + STAGING_STARTED_OFFSET) == 0xff)
+		flash_write_byte(FLASH_STAGING_START + STAGING_STARTED_OFFSET, 0);
+
+	for (slot = 0; slot < FLASH_STAGING_SLOTS; slot++) {
+		target = flash_read_byte(FLASH_STAGING_START + slot * STAGING_ENTRY_SIZE);
+		if ((target == 0xff) ||
+		    (flash_read_byte(FLASH_STAGING_START + STAGING_DONE_OFFSET + slot) != 0xff))
+			continue;
+		target <<= FLASH_PAGE_SHIFT;
+		flash_erase_page(target);
+		for (i = 0; i < FLASH_PAGE_SIZE; i++)
+			flash_write_byte(target + i, flash_read_byte(FLASH_STAGING_SLOT(slot) + i));
+		flash_write_byte(FLASH_STAGING_START + STAGING_DONE_OFFSET + slot, 0);
+	}
+
+	// all done, the directory goes last
+	flash_erase_page(FLASH_STAGING_START);
+}
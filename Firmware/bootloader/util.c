@@ -42,11 +42,26 @@
 #include "util.h"
 #include "flash.h"
 
+// bytes received while the bootloader was busy sending a reply or
+// working out a CRC. The UART only holds one received byte, so without
+// this a host that sends the next command early would overrun it
+static uint8_t __xdata	rx_buf[PROTO_RX_BUFFER];
+static uint8_t		rx_head, rx_tail;
+
+void
+cpoll(void)
+{
+	if (RI0 && (uint8_t)(rx_head - rx_tail) < PROTO_RX_BUFFER) {
+		RI0 = 0;
+		rx_buf[rx_head++ & (PROTO_RX_BUFFER - 1)] = SBUF0;
+	}
+}
+
 void
 cout(uint8_t c)
 {
 	while (!TI0)
-		;
+		cpoll();
 	TI0 = 0;
 	SBUF0 = c;
 }
@@ -54,8 +69,22 @@ cout(uint8_t c)
 uint8_t
 cin(void)
 {
-	while (!RI0)
-		;
-	RI0 = 0;
-	return SBUF0;
+	while (rx_head == rx_tail)
+		cpoll();
+	return rx_buf[rx_tail++ & (PROTO_RX_BUFFER - 1)];
+}
+
+uint16_t
+crc16_byte(uint16_t crc, uint8_t c)
+{
+	uint8_t	i;
+
+	crc ^= (uint16_t)c << 8;
+	for (i = 0; i < 8; i++) {
+		if (crc & 0x8000)
+			crc = (crc << 1) ^ 0x1021;
+		else
+			crc <<= 1;
+	}
+	return crc;
 }
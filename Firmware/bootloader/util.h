@@ -48,4 +48,18 @@ void	cout(uint8_t c);
 ///
 uint8_t	cin(void);
 
+/// Move a received character, if there is one, from the UART into the
+/// receive buffer. Called while busy, so that characters sent meanwhile
+/// are not lost
+///
+void	cpoll(void);
+
+/// Add a byte to a CRC-16/CCITT
+///
+/// @param	crc		The CRC so far, 0xffff to start
+/// @param	c		The byte to add
+/// @returns			The new CRC
+///
+uint16_t crc16_byte(uint16_t crc, uint8_t c);
+
 #endif	// _UTIL_H_
@@ -0,0 +1,260 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Host test for the binary configuration protocol in radio/config.c.
+//
+// Frames are built as tools/radio_config.py builds them and passed to
+// config_handle(), with the parameter store replaced by a table that
+// rejects values above a limit. The replies written to the serial port
+// are checked, including that a bulk set with one bad value leaves
+// every parameter as it was, and that frames with a bad checksum get
+// no answer. The MAVLink checksum is checked against the standard
+// CRC-16/MCRF4XX check value first.
+
+#define CONFIG_TEST
+#define __pdata
+#define __xdata
+#define __data
+#define __code
+#define __reentrant
+
+#define MAX_PACKET_LENGTH	252
+#define BOARD_ID		0x4e
+#define APP_VERSION_HIGH	1
+#define APP_VERSION_LOW		7
+#define RADIO_SOURCE_SYSTEM	'3'
+#define RADIO_SOURCE_COMPONENT	'D'
+
+enum ParamID { PARAM_FORMAT = 0, PARAM_NETID = 3, PARAM_MAX = 19 };
+typedef uint32_t param_t;
+
+struct statistics {
+	uint8_t average_rssi;
+	uint8_t average_noise;
+	uint16_t receive_count;
+};
+struct error_counts {
+	uint16_t rx_errors;
+	uint16_t tx_errors;
+	uint16_t serial_tx_overflow;
+	uint16_t serial_rx_overflow;
+	uint16_t corrected_errors;
+	uint16_t corrected_packets;
+	uint16_t radio_rx_full;
+};
+
+// what config.c and mavlink.c need from the rest of the firmware
+uint8_t pbuf[MAX_PACKET_LENGTH];
+struct statistics statistics, remote_statistics;
+struct error_counts errors, remote_errors;
+uint8_t remote_serial_space = 77;
+uint8_t g_board_frequency = 0x43;
+uint8_t g_board_bl_version = 2;
+bool using_mavlink_10;
+
+#define PARAM_LIMIT	1000
+
+static param_t params[PARAM_MAX];
+static int saves;
+
+static param_t
+param_get(enum ParamID param)
+{
+	return param < PARAM_MAX ? params[param] : 0;
+}
+
+static bool
+param_set(enum ParamID param, param_t value)
+{
+	if (param >= PARAM_MAX || value > PARAM_LIMIT) {
+		return false;
+	}
+	params[param] = value;
+	return true;
+}
+
+static void
+param_save(void)
+{
+	saves++;
+}
+
+static uint8_t serial_out[1024];
+static unsigned serial_out_len;
+
+static uint8_t
+serial_read_space(void)
+{
+	return 100;
+}
+
+static uint16_t
+serial_write_space(void)
+{
+	return sizeof(serial_out) - serial_out_len;
+}
+
+static void
+serial_write_buf(uint8_t *buf, uint8_t count)
+{
+	memcpy(&serial_out[serial_out_len], buf, count);
+	serial_out_len += count;
+}
+
+uint16_t MAVLink_checksum(uint8_t *buf, uint8_t stoplen);
+
+#include "radio/config.h"
+#include "radio/mavlink.c"
+#include "radio/config.c"
+
+static uint8_t seq;
+
+// send a request, returning the reply payload length or -1 for none
+static int
+request(const uint8_t *payload, uint8_t len, uint8_t *reply, bool corrupt)
+{
+	uint8_t buf[MAX_PACKET_LENGTH];
+	uint16_t crc;
+
+	buf[0] = MAVLINK10_STX;
+	buf[1] = len;
+	buf[2] = ++seq;
+	buf[3] = RADIO_SOURCE_SYSTEM;
+	buf[4] = RADIO_SOURCE_COMPONENT;
+	buf[5] = CONFIG_MSG_ID;
+	memcpy(&buf[6], payload, len);
+	buf[6 + len] = CONFIG_CRC_EXTRA;
+	crc = MAVLink_checksum(buf, 7 + len);
+	buf[6 + len] = crc & 0xff;
+	buf[7 + len] = crc >> 8;
+	if (corrupt) {
+		buf[6] ^= 0x40;
+	}
+
+	serial_out_len = 0;
+	config_handle(buf, len + CONFIG_OVERHEAD);
+	if (serial_out_len == 0) {
+		return -1;
+	}
+
+	// check the reply frame
+	len = serial_out[1];
+	crc = serial_out[6 + len] | (serial_out[7 + len] << 8);
+	serial_out[6 + len] = CONFIG_CRC_EXTRA;
+	if (serial_out_len != (unsigned)len + CONFIG_OVERHEAD ||
+	    serial_out[0] != MAVLINK10_STX || serial_out[2] != seq ||
+	    serial_out[3] != RADIO_SOURCE_SYSTEM || serial_out[4] != RADIO_SOURCE_COMPONENT ||
+	    serial_out[5] != CONFIG_MSG_ID || serial_out[6] != (payload[0] | CONFIG_REPLY) ||
+	    MAVLink_checksum(serial_out, 7 + len) != crc) {
+		printf("bad reply frame\n");
+		exit(1);
+	}
+	memcpy(reply, &serial_out[7], len - 1);
+	return len - 1;
+}
+
+static bool passed = true;
+
+static void
+check(bool ok, const char *what)
+{
+	if (!ok) {
+		printf("%s FAILED\n", what);
+		passed = false;
+	}
+}
+
+int
+main(void)
+{
+	uint8_t req[64], reply[MAX_PACKET_LENGTH];
+	uint8_t check_value[] = "X123456789";
+	param_t before[PARAM_MAX];
+	int len, i;
+
+	check(MAVLink_checksum(check_value, 10) == 0x6f91, "checksum");
+
+	for (i = 0; i < PARAM_MAX; i++) {
+		params[i] = i * 10;
+	}
+
+	req[0] = CONFIG_OP_INFO;
+	len = request(req, 1, reply, false);
+	check(len == 7 && reply[0] == CONFIG_OK && reply[3] == BOARD_ID && reply[6] == PARAM_MAX, "info");
+
+	// all the parameters in one go
+	req[0] = CONFIG_OP_GET_PARAMS;
+	req[1] = 0;
+	req[2] = 255;
+	len = request(req, 3, reply, false);
+	check(len == 2 + PARAM_MAX * 4 && reply[0] == CONFIG_OK && reply[1] == 0, "get all");
+	for (i = 0; i < PARAM_MAX && len == 2 + PARAM_MAX * 4; i++) {
+		check(config_get32(&reply[2 + i * 4]) == params[i], "get all values");
+	}
+
+	// a run of three, saved
+	req[0] = CONFIG_OP_SET_PARAMS;
+	req[1] = CONFIG_SAVE;
+	req[2] = PARAM_NETID;
+	config_put32(&req[3], 30);
+	config_put32(&req[7], 17);
+	config_put32(&req[11], 999);
+	len = request(req, 15, reply, false);
+	check(len == 1 && reply[0] == CONFIG_OK && saves == 1 &&
+	      params[3] == 30 && params[4] == 17 && params[5] == 999, "set and save");
+
+	// the third value is rejected, so none of them change
+	memcpy(before, params, sizeof(params));
+	req[1] = CONFIG_SAVE;
+	config_put32(&req[3], 31);
+	config_put32(&req[7], 18);
+	config_put32(&req[11], PARAM_LIMIT + 1);
+	config_put32(&req[15], 5);
+	len = request(req, 19, reply, false);
+	check(len == 2 && reply[0] == CONFIG_ERR_PARAM && reply[1] == PARAM_NETID + 2 &&
+	      memcmp(before, params, sizeof(params)) == 0 && saves == 1, "set with a bad value");
+
+	// the format can't be written, nor past the last parameter
+	req[1] = 0;
+	req[2] = PARAM_FORMAT;
+	len = request(req, 7, reply, false);
+	check(len == 1 && reply[0] == CONFIG_ERR_ARGS && params[0] == 0, "set format");
+	req[2] = PARAM_MAX - 1;
+	len = request(req, 11, reply, false);
+	check(len == 1 && reply[0] == CONFIG_ERR_ARGS, "set past the end");
+
+	statistics.receive_count = 0x1234;
+	remote_errors.radio_rx_full = 0x5678;
+	req[0] = CONFIG_OP_GET_STATS;
+	len = request(req, 1, reply, false);
+	check(len == 1 + 2 * sizeof(struct statistics) + 2 * sizeof(struct error_counts) + 1 &&
+	      reply[3] == 0x34 && reply[4] == 0x12 && reply[len - 3] == 0x78 && reply[len - 2] == 0x56 &&
+	      reply[len - 1] == remote_serial_space, "stats");
+
+	req[0] = CONFIG_OP_GET_CALIBRATION;
+	len = request(req, 1, reply, false);
+	check(len == 2 && reply[0] == CONFIG_OK && reply[1] == 0, "calibration");
+
+	req[0] = 0x7f;
+	len = request(req, 1, reply, false);
+	check(len == 1 && reply[0] == CONFIG_ERR_ARGS, "unknown request");
+
+	// a damaged frame gets no answer and changes nothing
+	memcpy(before, params, sizeof(params));
+	req[0] = CONFIG_OP_SET_PARAMS;
+	req[1] = 0;
+	req[2] = PARAM_NETID;
+	config_put32(&req[3], 42);
+	check(request(req, 7, reply, true) == -1 && memcmp(before, params, sizeof(params)) == 0,
+	      "bad checksum");
+
+	if (!passed) {
+		printf("-- test FAILED\n");
+		exit(1);
+	}
+	printf("-- test passed.\n");
+	return 0;
+}
@@ -0,0 +1,173 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+// Host test for the fixed point duty cycle average in radio/duty_cycle.c.
+//
+// A saturated transmitter is run through a few thousand TDM rounds,
+// once with the original float filter and once with the fixed point
+// one, for each DUTY_CYCLE setting and a spread of air rates. The
+// long term duty cycle achieved by the two must agree, and must not
+// exceed what the float limiter allowed.
+
+#define DUTY_CYCLE_TEST
+#define __pdata
+#define __xdata
+#define __data
+#define __code
+
+#define DUTY_CYCLE_ONE_PERCENT 256
+
+#include "radio/duty_cycle.c"
+
+#define MAX_PACKET_LENGTH 252
+#define ROUNDS 5000
+
+struct timing {
+	uint16_t tx_window_width;
+	uint16_t silence_period;
+	uint16_t packet_ticks;
+};
+
+// the same arithmetic as tdm_init(), with golay enabled
+static struct timing
+timing_for_rate(unsigned air_rate)
+{
+	struct timing t;
+	uint32_t ticks_per_byte, packet_latency, max_len, window;
+
+	ticks_per_byte = (8+(8000000UL/(air_rate*1000UL)))/16;
+	packet_latency = (8+(10/2)) * ticks_per_byte + 13;
+	max_len = (MAX_PACKET_LENGTH/2) - (6+2);
+	ticks_per_byte *= 2;
+	packet_latency += 4*ticks_per_byte;
+	window = 3*(packet_latency+(max_len*ticks_per_byte));
+	if (window >= ((1000000UL/16)*4)/10) {
+		window = ((1000000UL/16)*4)/10;
+	}
+	if (window > 0x1FFF) {
+		window = 0x1FFF;
+	}
+	t.tx_window_width = window;
+	t.silence_period = 2*packet_latency;
+	t.packet_ticks = packet_latency + max_len*ticks_per_byte;
+	return t;
+}
+
+// ticks a busy sender transmits in one window, given a load in percent
+static uint16_t
+ticks_sent(const struct timing *t, unsigned load, unsigned round)
+{
+	uint16_t sent = 0;
+	unsigned pkts = 0;
+	while (sent + t->packet_ticks <= t->tx_window_width) {
+		// pseudo-random thinning for partial load
+		if (((round * 7 + pkts * 13) % 100) < load) {
+			sent += t->packet_ticks;
+		}
+		pkts++;
+		if (pkts > 20) break;
+	}
+	return sent;
+}
+
+static double
+run_float(const struct timing *t, unsigned duty, unsigned load)
+{
+	float average = 0;
+	bool wait = false;
+	double total = 0, elapsed = 0;
+	unsigned r;
+	uint16_t round_ticks = 2*(t->silence_period+t->tx_window_width);
+
+	for (r = 0; r < ROUNDS; r++) {
+		uint16_t tx = wait ? 0 : ticks_sent(t, load, r);
+		average = (0.95*average) + (0.05*(100.0*tx)/round_ticks);
+		wait = (average >= duty);
+		total += tx;
+		elapsed += round_ticks;
+	}
+	return 100.0 * total / elapsed;
+}
+
+static void
+reset_average(void)
+{
+	average_duty_cycle = 0;
+	average_remainder = 0;
+}
+
+static double
+run_fixed(const struct timing *t, unsigned duty, unsigned load)
+{
+	bool wait = false;
+	double total = 0, elapsed = 0;
+	unsigned r;
+	uint16_t round_ticks = 2*(t->silence_period+t->tx_window_width);
+
+	reset_average();
+	for (r = 0; r < ROUNDS; r++) {
+		uint16_t tx = wait ? 0 : ticks_sent(t, load, r);
+		duty_cycle_update(tx, round_ticks);
+		wait = (average_duty_cycle >= (uint16_t)duty * DUTY_CYCLE_ONE_PERCENT);
+		total += tx;
+		elapsed += round_ticks;
+	}
+	return 100.0 * total / elapsed;
+}
+
+int main()
+{
+	static const unsigned rates[] = { 2, 4, 8, 16, 19, 24, 32, 48, 64, 96, 128, 192, 250 };
+	unsigned i, duty, load;
+	double worst = 0;
+
+	printf("Testing duty_cycle_update() fixed point behaviour.\n");
+	reset_average();
+	for (i = 0; i < 1000; i++) {
+		duty_cycle_update(1000, 1000);
+	}
+	if (average_duty_cycle != 100*DUTY_CYCLE_ONE_PERCENT) {
+		printf("full duty did not converge to 100%%: %u\n", (unsigned)average_duty_cycle);
+		exit(-1);
+	}
+	for (i = 0; i < 1000; i++) {
+		duty_cycle_update(0, 1000);
+	}
+	if (average_duty_cycle != 0) {
+		printf("idle did not decay to 0%%: %u\n", (unsigned)average_duty_cycle);
+		exit(-1);
+	}
+	for (i = 0; i < 1000; i++) {
+		duty_cycle_update(333, 1000);
+	}
+	if (average_duty_cycle != (333UL*100*DUTY_CYCLE_ONE_PERCENT)/1000) {
+		printf("33.3%% duty converged to %u\n", (unsigned)average_duty_cycle);
+		exit(-1);
+	}
+	printf("  -- test passed.\n");
+
+	printf("Testing duty cycle enforcement against the float limiter.\n");
+	for (i = 0; i < sizeof(rates)/sizeof(rates[0]); i++) {
+		struct timing t = timing_for_rate(rates[i]);
+		for (duty = 10; duty < 100; duty += 5) {
+			for (load = 25; load <= 100; load += 25) {
+				double f = run_float(&t, duty, load);
+				double x = run_fixed(&t, duty, load);
+				double diff = x - f;
+				if (diff < 0) diff = -diff;
+				if (diff > worst) worst = diff;
+				if (diff > 0.5 || x > f + 0.1) {
+					printf("rate=%u duty=%u load=%u: float %.3f%% fixed %.3f%%\n",
+					       rates[i], duty, load, f, x);
+					exit(-1);
+				}
+			}
+		}
+		printf("."); fflush(stdout);
+	}
+	printf("\n  worst difference %.4f%%\n", worst);
+	printf("  -- test passed.\n");
+	return 0;
+}
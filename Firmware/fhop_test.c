@@ -0,0 +1,438 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Host simulation of frequency hopping lock acquisition.
+//
+// Two radios are run through the TDM round and link update logic of
+// radio/tdm.c, with the real hop sequencing from radio/freq_hopping.c,
+// and we measure how long it takes until both of them are hearing the
+// other every round. The original behaviour (a fixed 20 second unlock
+// timeout and one packet per transmit window) is compared against the
+// current one (an unlock timeout of a few rounds, beacons in both
+// halves of the round while searching, and hop sync answers to those
+// beacons) over a range of channel counts and packet loss rates.
+//
+// Timings are those of tdm_init() for 64kbps with no ECC.
+
+#define FHOP_TEST
+#define __pdata
+#define __xdata
+#define __data
+#define __code
+#define debug(fmt, args...)
+
+#include "radio/freq_hopping.c"
+
+#define TICKS_PER_BYTE	8
+#define PACKET_LATENCY	((8+(10/2))*TICKS_PER_BYTE + 13)
+#define SILENCE_PERIOD	(2*PACKET_LATENCY)
+#define TX_WINDOW_WIDTH	(3*(PACKET_LATENCY + 250*TICKS_PER_BYTE))
+#define ROUND_TICKS	(2*(SILENCE_PERIOD + TX_WINDOW_WIDTH))
+#define TICKS_PER_SEC	62500L
+#define LINK_UPDATE	32768
+
+// simulation time step; a zero length packet takes about two steps
+#define STEP		(PACKET_LATENCY/2)
+
+#define LOCK_BEACONS	2
+#define MAX_SIM_TICKS	(300*TICKS_PER_SEC)
+#define TRIALS		200
+
+enum tdm_state { TDM_TRANSMIT, TDM_SILENCE1, TDM_RECEIVE, TDM_SILENCE2 };
+enum policy { POLICY_OLD, POLICY_NEW };
+enum scenario { SCENARIO_COLD, SCENARIO_DRIFT, SCENARIO_FADE };
+enum kind { PKT_YIELD, PKT_STATS, PKT_BEACON, PKT_HOP_SYNC };
+
+struct sim_radio {
+	// hop state, swapped in and out of freq_hopping.c
+	uint8_t transmit_channel;
+	uint8_t receive_channel;
+	bool have_radio_lock;
+	uint8_t listen_phase;
+
+	enum tdm_state state;
+	int32_t remaining;
+	int32_t transmit_wait;
+	int32_t tx_until;
+	bool yield;
+	uint8_t beacon_count;
+	int16_t hop_sync;
+	bool send_statistics;
+
+	bool received_packet;
+	uint8_t unlock_count;
+	int32_t link_timer;
+
+	int32_t last_heard;
+};
+
+struct packet {
+	enum kind kind;
+	uint8_t channel;
+	uint8_t len;
+	uint8_t data[2];
+	int32_t window;
+};
+
+static enum policy policy;
+static double loss;
+static uint8_t unlock_limit;
+static int32_t now;
+
+static uint32_t rng_state = 1;
+
+static uint32_t
+rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static void
+load(struct sim_radio *r)
+{
+	transmit_channel = r->transmit_channel;
+	receive_channel = r->receive_channel;
+	have_radio_lock = r->have_radio_lock;
+	listen_phase = r->listen_phase;
+	if (policy == POLICY_OLD) {
+		// the original code never listened on its own
+		// transmit channel while unlocked
+		listen_phase = 1;
+	}
+	update_channels();
+}
+
+static void
+save(struct sim_radio *r)
+{
+	r->transmit_channel = transmit_channel;
+	r->receive_channel = receive_channel;
+	r->have_radio_lock = have_radio_lock;
+	r->listen_phase = listen_phase;
+}
+
+// tdm_state_update()
+static void
+state_update(struct sim_radio *r)
+{
+	r->remaining -= STEP;
+	while (r->remaining <= 0) {
+		r->state = (r->state+1) % 4;
+		if (r->state == TDM_TRANSMIT || r->state == TDM_RECEIVE) {
+			r->remaining += TX_WINDOW_WIDTH;
+		} else {
+			r->remaining += SILENCE_PERIOD;
+		}
+		if (r->state == TDM_TRANSMIT || r->state == TDM_SILENCE1) {
+			load(r);
+			fhop_window_change();
+			save(r);
+		}
+		r->yield = false;
+		r->beacon_count = 0;
+		r->transmit_wait = 0;
+	}
+}
+
+// link_update()
+static void
+link_update(struct sim_radio *r)
+{
+	if (r->received_packet) {
+		r->unlock_count = 0;
+		r->received_packet = false;
+	} else {
+		r->unlock_count++;
+	}
+	if (policy == POLICY_NEW && r->unlock_count == unlock_limit) {
+		load(r);
+		fhop_set_locked(false);
+		save(r);
+	}
+	if (r->unlock_count > 40) {
+		r->unlock_count = 5;
+		if (rng() & 1) {
+			if (r->remaining > SILENCE_PERIOD) {
+				r->remaining -= PACKET_LATENCY;
+			} else {
+				r->remaining = 1;
+			}
+		}
+		if (policy == POLICY_OLD) {
+			load(r);
+			fhop_set_locked(false);
+			save(r);
+		}
+	}
+	r->send_statistics = true;
+}
+
+// the receive half of tdm_serial_loop()
+static void
+receive(struct sim_radio *r, const struct packet *p)
+{
+	load(r);
+	fhop_set_locked(true);
+	if (p->kind == PKT_BEACON && p->data[0] < num_fh_channels) {
+		r->hop_sync = p->data[0];
+	} else if (p->kind == PKT_HOP_SYNC && p->data[1] == fhop_receive_channel()) {
+		fhop_sync(p->data[0]);
+	}
+	save(r);
+
+	r->received_packet = true;
+	r->transmit_wait = 0;
+	r->last_heard = now;
+
+	if (p->kind == PKT_YIELD) {
+		// sync_tx_windows() for a packet sent in the other
+		// radios transmit window
+		r->state = TDM_RECEIVE;
+		r->remaining = p->window;
+		r->yield = false;
+	}
+}
+
+// the transmit half of tdm_serial_loop()
+static bool
+transmit(struct sim_radio *r, struct sim_radio *other, struct packet *p)
+{
+	bool beacon;
+
+	beacon = policy == POLICY_NEW &&
+		!r->have_radio_lock &&
+		r->beacon_count < LOCK_BEACONS &&
+		(r->state == TDM_RECEIVE || r->yield);
+	if (r->hop_sync < 0 && !beacon) {
+		if (r->state != TDM_TRANSMIT || r->yield) {
+			return false;
+		}
+	}
+	if (r->transmit_wait > 0 || r->tx_until > now) {
+		return false;
+	}
+	if (other->tx_until > now) {
+		// we can hear their preamble
+		r->transmit_wait = PACKET_LATENCY;
+		return false;
+	}
+	if (r->remaining < PACKET_LATENCY + 5*TICKS_PER_BYTE) {
+		return false;
+	}
+
+	load(r);
+	memset(p, 0, sizeof(*p));
+	p->channel = fhop_transmit_channel();
+	if (r->hop_sync >= 0) {
+		p->kind = PKT_HOP_SYNC;
+		p->len = 2;
+		p->data[0] = fhop_transmit_index();
+		p->data[1] = r->hop_sync;
+		p->channel = r->hop_sync;
+		r->hop_sync = -1;
+	} else if (beacon) {
+		p->kind = PKT_BEACON;
+		p->len = 1;
+		p->data[0] = fhop_receive_channel();
+		r->beacon_count++;
+	} else if (r->send_statistics) {
+		p->kind = PKT_STATS;
+		p->len = 4;
+		r->send_statistics = false;
+	} else {
+		p->kind = PKT_YIELD;
+		p->len = 0;
+		r->yield = true;
+	}
+	p->window = r->remaining - (PACKET_LATENCY + (p->len+2)*TICKS_PER_BYTE);
+	r->tx_until = now + PACKET_LATENCY + (p->len+2)*TICKS_PER_BYTE;
+	r->transmit_wait = PACKET_LATENCY + (r->tx_until - now);
+	return true;
+}
+
+static void
+radio_step(struct sim_radio *r, struct sim_radio *other, bool link_ok)
+{
+	struct packet p;
+
+	state_update(r);
+	r->link_timer += STEP;
+	if (r->link_timer >= LINK_UPDATE) {
+		r->link_timer -= LINK_UPDATE;
+		link_update(r);
+	}
+	if (r->transmit_wait > 0) {
+		r->transmit_wait -= STEP;
+	}
+	if (!transmit(r, other, &p)) {
+		return;
+	}
+	if (!link_ok ||
+	    rng() < loss * 4294967296.0 ||
+	    other->tx_until > now) {
+		return;
+	}
+	load(other);
+	if (fhop_receive_channel() == p.channel) {
+		receive(other, &p);
+	}
+}
+
+static void
+radio_init(struct sim_radio *r, bool locked)
+{
+	memset(r, 0, sizeof(*r));
+	r->transmit_channel = rng() % num_fh_channels;
+	r->receive_channel = locked ? r->transmit_channel : rng() % num_fh_channels;
+	r->have_radio_lock = locked;
+	r->state = rng() % 4;
+	r->remaining = 1 + rng() % (r->state == TDM_TRANSMIT || r->state == TDM_RECEIVE ?
+				    TX_WINDOW_WIDTH : SILENCE_PERIOD);
+	r->hop_sync = -1;
+	r->link_timer = rng() % LINK_UPDATE;
+	r->last_heard = -MAX_SIM_TICKS;
+}
+
+// put the second radio exactly in step with the first
+static void
+radio_align(struct sim_radio *a, struct sim_radio *b)
+{
+	a->state = TDM_TRANSMIT;
+	a->remaining = 1 + rng() % TX_WINDOW_WIDTH;
+	b->transmit_channel = b->receive_channel = a->transmit_channel;
+	b->state = (a->state + 2) % 4;
+	b->remaining = a->remaining;
+}
+
+// run one trial, returning the ticks taken until both radios are
+// hearing each other every round
+static int32_t
+trial(enum scenario scenario)
+{
+	struct sim_radio r[2];
+	int32_t link_start = 0;
+	uint8_t i;
+
+	switch (scenario) {
+	case SCENARIO_COLD:
+		// both radios just booted
+		radio_init(&r[0], false);
+		radio_init(&r[1], false);
+		break;
+	case SCENARIO_DRIFT:
+		// a 10 second dropout, long enough for the clocks to
+		// have drifted the radios out of step
+		radio_init(&r[0], true);
+		radio_init(&r[1], true);
+		link_start = 10 * TICKS_PER_SEC;
+		break;
+	case SCENARIO_FADE:
+		// a 3 second fade, with the radios still in step
+		radio_init(&r[0], true);
+		radio_init(&r[1], true);
+		radio_align(&r[0], &r[1]);
+		link_start = 3 * TICKS_PER_SEC;
+		break;
+	}
+	r[0].received_packet = r[1].received_packet = true;
+
+	for (now = 0; now < link_start + MAX_SIM_TICKS; now += STEP) {
+		bool link_ok = now >= link_start;
+		i = rng() & 1;
+		radio_step(&r[i], &r[!i], link_ok);
+		radio_step(&r[!i], &r[i], link_ok);
+		if (link_ok &&
+		    r[0].last_heard >= link_start &&
+		    r[1].last_heard >= link_start &&
+		    now - r[0].last_heard < ROUND_TICKS &&
+		    now - r[1].last_heard < ROUND_TICKS) {
+			break;
+		}
+	}
+	return now - link_start;
+}
+
+static int
+compare_ticks(const void *a, const void *b)
+{
+	return *(const int32_t *)a - *(const int32_t *)b;
+}
+
+struct result {
+	double mean;
+	double p90;
+};
+
+static struct result
+run(enum scenario scenario)
+{
+	static int32_t t[TRIALS];
+	struct result res;
+	double sum = 0;
+	int i;
+
+	for (i = 0; i < TRIALS; i++) {
+		t[i] = trial(scenario);
+		sum += t[i];
+	}
+	qsort(t, TRIALS, sizeof(t[0]), compare_ticks);
+	res.mean = sum / TRIALS / TICKS_PER_SEC;
+	res.p90 = (double)t[(TRIALS*9)/10] / TICKS_PER_SEC;
+	return res;
+}
+
+int
+main(void)
+{
+	static const char *names[] = { "cold start", "10s dropout", "3s fade" };
+	static const uint8_t channels[] = { 10, 25, 50 };
+	static const double losses[] = { 0, 0.3, 0.6 };
+	uint32_t round_ticks = ROUND_TICKS;
+	unsigned s, c, l;
+	int failures = 0;
+
+	// the same limit as tdm_init()
+	unlock_limit = (8*round_ticks) / LINK_UPDATE + 1;
+	if (unlock_limit < 4) {
+		unlock_limit = 4;
+	}
+
+	printf("time to lock in seconds, mean/p90 of %u trials, 64kbps\n", TRIALS);
+	printf("%-12s %3s %5s %15s %15s\n", "scenario", "N", "loss", "old", "new");
+	for (s = SCENARIO_COLD; s <= SCENARIO_FADE; s++) {
+		for (c = 0; c < sizeof(channels); c++) {
+			num_fh_channels = channels[c];
+			fhop_init(25);
+			for (l = 0; l < sizeof(losses)/sizeof(losses[0]); l++) {
+				struct result old, new;
+
+				loss = losses[l];
+				rng_state = 1 + s*100 + c*10 + l;
+				policy = POLICY_OLD;
+				old = run(s);
+				rng_state = 1 + s*100 + c*10 + l;
+				policy = POLICY_NEW;
+				new = run(s);
+				printf("%-12s %3u %5.2f %7.2f/%7.2f %7.2f/%7.2f\n",
+				       names[s], channels[c], loss,
+				       old.mean, old.p90, new.mean, new.p90);
+
+				if (new.mean > old.mean) {
+					printf("FAIL: slower lock with the new scheme\n");
+					failures++;
+				}
+			}
+		}
+	}
+	if (failures != 0) {
+		return 1;
+	}
+	printf("All OK\n");
+	return 0;
+}
@@ -0,0 +1,209 @@
+// Host test for FRAME_GAP framing of non-MAVLink serial data.
+//
+// Traffic that isn't MAVLink is replayed through radio/packet.c with
+// the harness in packet_replay.c and MAVLINK=0, once sending serial
+// data as it comes and once with FRAME_GAP set. The first mix is a
+// GPS sending bursts of back to back RTCM3 messages and NMEA
+// sentences, which must never be split across packets if they fit in
+// one. The second is Modbus RTU style binary frames separated only by
+// a short pause on the serial line, which must nearly all go whole.
+// Neither may add more than a few milliseconds to the median latency.
+// Last the binary frames are mixed with MAVLink commands under
+// MAVLINK=2, which takes the commands out from behind the frames that
+// are waiting, and the frames must still go whole.
+
+#define PACKET_REPLAY_NO_MAIN
+#include "packet_replay.c"
+
+#define GAP			4
+#define BYTE_USEC		(10 * 1000000ULL / 57600)
+
+// lengths of the RTCM3 messages a base station sends each second. The
+// last one is too big for a packet
+static const uint16_t rtcm_lengths[] = { 19, 92, 104, 8, 61, 247 };
+
+static const char *nmea[] = {
+	"$GPGGA,123519.00,4807.03812,N,01131.00012,E,1,08,0.9,545.4,M,46.9,M,,*47\r\n",
+	"$GPRMC,123519.00,A,4807.03812,N,01131.00012,E,0.022,84.4,230394,,,A*6A\r\n",
+	"$GPVTG,84.4,T,,M,0.022,N,0.041,K,A*31\r\n",
+};
+
+static uint64_t
+rtcm_message(struct replay *r, uint64_t usec, uint16_t len)
+{
+	uint8_t buf[1100];
+	unsigned i;
+
+	buf[0] = RTCM3_PREAMBLE;
+	buf[1] = len >> 8;
+	buf[2] = len & 0xff;
+	for (i = 0; i < len + 3U; i++) {
+		buf[3 + i] = rand();
+	}
+	add_frame(r, usec, buf, len + 6);
+	return usec;
+}
+
+// NMEA and RTCM3 corrections once a second, each burst sent back to
+// back
+static void
+gps_traffic(struct replay *r, unsigned seconds)
+{
+	uint64_t usec;
+	unsigned s, i;
+
+	srand(1);
+	for (s = 0; s < seconds; s++) {
+		usec = s * 1000000ULL;
+		for (i = 0; i < ARRAY_LENGTH(nmea); i++) {
+			add_frame(r, usec, (const uint8_t *)nmea[i], strlen(nmea[i]));
+		}
+		usec += 500000;
+		for (i = 0; i < ARRAY_LENGTH(rtcm_lengths); i++) {
+			rtcm_message(r, usec, rtcm_lengths[i]);
+		}
+	}
+}
+
+// binary frames of 8 to 64 bytes with a pause of twice the gap
+// between them, 20 a second
+static void
+modbus_traffic(struct replay *r, unsigned seconds)
+{
+	uint8_t buf[64];
+	uint64_t usec = 0;
+	unsigned f, i, len;
+
+	srand(2);
+	for (f = 0; f < seconds * 20; f++) {
+		len = 8 + rand() % 57;
+		for (i = 0; i < len; i++) {
+			buf[i] = rand();
+		}
+		add_frame(r, usec, buf, len);
+		usec += (len + 2 * GAP) * BYTE_USEC;
+		if (f % 2 == 1) {
+			// a quiet spell before the next poll
+			usec += 80000 + rand() % 20000;
+		}
+	}
+}
+
+// the binary frames with a MAVLink command after some of them, sent
+// before the frame in front of it is likely to have gone
+static void
+command_traffic(struct replay *r, unsigned seconds)
+{
+	uint8_t buf[64];
+	uint64_t usec = 0;
+	unsigned f, i, len;
+
+	srand(3);
+	for (f = 0; f < seconds * 20; f++) {
+		len = 8 + rand() % 57;
+		for (i = 0; i < len; i++) {
+			// nothing that starts a MAVLink, RTCM3 or NMEA frame
+			do {
+				buf[i] = rand();
+			} while (buf[i] == MAVLINK09_STX || buf[i] == MAVLINK10_STX ||
+				 buf[i] == RTCM3_PREAMBLE || buf[i] == '$' || buf[i] == '!');
+		}
+		add_frame(r, usec, buf, len);
+		usec += (len + 2 * GAP) * BYTE_USEC;
+		if (f % 3 != 2) {
+			// COMMAND_LONG
+			synthetic_frame(r, usec, 76, 33);
+			usec += (41 + 2 * GAP) * BYTE_USEC;
+		}
+		if (f % 2 == 1) {
+			usec += 80000 + rand() % 20000;
+		}
+	}
+}
+
+static uint32_t
+split_frames(struct replay *r, uint16_t max_len)
+{
+	uint32_t f, n = 0;
+
+	for (f = 0; f < r->nframes; f++) {
+		n += r->frames[f].split && r->frames[f].len <= max_len;
+	}
+	return n;
+}
+
+// the median time from the last byte of a frame arriving to the frame
+// going out whole
+static double
+median_delay(struct replay *r)
+{
+	uint64_t *delays = malloc(r->nframes * sizeof(uint64_t));
+	uint64_t median;
+	uint32_t n;
+
+	n = frame_delays(r, delays, false);
+	median = n ? delays[n / 2] : 0;
+	free(delays);
+	return ticks_to_ms(median);
+}
+
+static void
+run(struct replay *r, bool gps, uint8_t gap)
+{
+	replay_init(r);
+	feature_frame_gap = gap;
+	if (gps) {
+		gps_traffic(r, 10);
+	} else if (feature_mavlink_priority) {
+		command_traffic(r, 10);
+	} else {
+		modbus_traffic(r, 10);
+	}
+	replay_run(r);
+	printf("-- %s, FRAME_GAP=%u\n", gps ? "RTCM3 and NMEA" :
+	       feature_mavlink_priority ? "binary frames and commands, MAVLINK=2" : "binary frames", gap);
+	replay_report(r);
+	check(r->mismatches == 0, "bytes sent");
+	check(r->drops == 0, "serial overflow");
+}
+
+int
+main(void)
+{
+	struct replay plain, gap;
+	struct link_timing t;
+	uint32_t f;
+
+	feature_mavlink_framing = false;
+	timing_init(&t, 64, true);
+
+	run(&plain, true, 0);
+	run(&gap, true, GAP);
+	check(split_frames(&plain, t.max_data) != 0, "GPS frames split without FRAME_GAP");
+	check(split_frames(&gap, t.max_data) == 0, "GPS frames split with FRAME_GAP");
+	for (f = 0; f < gap.nframes; f++) {
+		if (gap.frames[f].len > t.max_data && gap.frames[f].done == 0) {
+			check(false, "big RTCM3 messages sent");
+			break;
+		}
+	}
+	check(median_delay(&gap) < median_delay(&plain) + 5, "GPS latency");
+
+	run(&plain, false, 0);
+	run(&gap, false, GAP);
+	check(split_frames(&gap, t.max_data) * 20 < gap.nframes, "binary frames split with FRAME_GAP");
+	check(split_frames(&gap, t.max_data) * 4 < split_frames(&plain, t.max_data),
+	      "binary frames split against no FRAME_GAP");
+	check(median_delay(&gap) < median_delay(&plain) + 5, "binary frame latency");
+
+	feature_mavlink_framing = true;
+	feature_mavlink_priority = true;
+	run(&plain, false, 0);
+	run(&gap, false, GAP);
+	check(split_frames(&gap, t.max_data) * 20 < gap.nframes, "binary frames split with MAVLINK=2");
+	check(split_frames(&gap, t.max_data) * 4 < split_frames(&plain, t.max_data),
+	      "binary frames split with MAVLINK=2 against no FRAME_GAP");
+	check(median_delay(&gap) < median_delay(&plain) + 5, "binary frame latency with MAVLINK=2");
+
+	return test_result();
+}
@@ -46,6 +46,34 @@
 #define FLASH_APP_START		0x0400		// 1 page reserved for bootloader
 #define FLASH_INFO_PAGE		0xf800		// 1 page reserved for bootloader
 #define FLASH_LOCK_BYTE		0xfbff
+#define FLASH_SCRATCH_SIZE	0x0400		// scratch page, holds the parameters
+
+// Staging area for over the air updates, just below the page holding
+// the signature. Pages of a new image are received into it while the
+// application runs, and the bootloader copies them into place. The
+// first page is a directory, the rest hold one staged page each. An
+// application built with OTA=1 must fit below it.
+//
+#define FLASH_STAGING_PAGES	8
+#define FLASH_STAGING_START	(FLASH_INFO_PAGE - FLASH_PAGE_SIZE - FLASH_STAGING_PAGES * FLASH_PAGE_SIZE)
+#define FLASH_STAGING_SLOTS	(FLASH_STAGING_PAGES - 1)
+#define FLASH_STAGING_SLOT(_n)	(FLASH_STAGING_START + ((_n) + 1) * FLASH_PAGE_SIZE)
+
+// Staging directory layout. Each field is written once between erases,
+// in this order:
+//
+// <target page><crc low><crc high>	one entry per slot as it is staged, 0xff if unused
+// <magic>				once every staged page has been checked
+// <started>			cleared by the bootloader before it copies anything
+// <done>				one per slot, cleared once the slot has been copied
+//
+// CRCs are CRC-16/CCITT over the whole page, as in the bootloader protocol.
+//
+#define STAGING_ENTRY_SIZE	3
+#define STAGING_MAGIC_OFFSET	(FLASH_STAGING_SLOTS * STAGING_ENTRY_SIZE)
+#define STAGING_STARTED_OFFSET	(STAGING_MAGIC_OFFSET + 1)
+#define STAGING_DONE_OFFSET	(STAGING_STARTED_OFFSET + 1)
+#define STAGING_MAGIC		0x5c
 
 // Anticipated flash signature bytes
 //
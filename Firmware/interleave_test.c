@@ -18,6 +18,7 @@ uint8_t radio_buffer[252];
 uint8_t radio_buffer_count;
 uint8_t netid[2]={0xaa,0x55};
 #define debug(fmt, args...)
+#define panic(msg) do { printf("panic: %s\n", msg); exit(-1); } while (0)
 
 int verbose=0;
 
@@ -168,6 +169,35 @@ int main()
 	}
       }
   printf("  -- test passed.\n");
+
+  // Make sure that encoding a packet ahead and finishing it with its
+  // trailer gives the same as encoding it all at once
+  printf("Testing golay_encode_{ahead,finish}().\n");
+  for(n=2;n<=120;n++)
+    for(interleave_flag=0;interleave_flag<2;interleave_flag++)
+      {
+	uint8_t ahead[252];
+	uint8_t elen;
+	setInterleaveP(interleave_flag);
+	prefill(in);
+	// the padding is left as zeros
+	in[n]=in[n+1]=in[n+2]=0;
+	golay_encode_packet(n,in);
+	bcopy(radio_buffer,out,radio_buffer_count);
+
+	bzero(radio_buffer,sizeof(radio_buffer));
+	elen=golay_encode_ahead(n,2,in,ahead);
+	bcopy(ahead,radio_buffer,elen);
+	golay_encode_finish(&in[n-2],radio_buffer);
+	if (elen!=radio_buffer_count||memcmp(out,radio_buffer,elen)!=0) {
+	  printf("Encoding ahead differs: interleave=%d, n=%d\n",
+		 interleave_flag,n);
+	  show("encoded at once",elen,out);
+	  show("encoded ahead",elen,radio_buffer);
+	  exit(-1);
+	}
+      }
+  printf("  -- test passed.\n");
   
   // Try interleaving and golay protecting a block of data
   // 256 bytes of golay protected data = 128 bytes of raw data.
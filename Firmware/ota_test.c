@@ -0,0 +1,703 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <setjmp.h>
+
+// Host simulation of an over the air update.
+//
+// Two radios run the real radio/ota.c, swapped in and out like the hop
+// state in fhop_test.c, joined by a link that loses and repeats packets,
+// while this file plays the part of tools/ota_update.py on the serial
+// port of the local radio. The remote radio's flash is modelled with
+// writes that only clear bits, and the bootloader's bootloader/staging.c
+// is run on it whenever it resets.
+//
+// The update is run over a lossy link, then with the power cut after
+// every few flash operations of the transfer and after every single one
+// of the copy done by the bootloader. Each time the radio must come back
+// up with exactly the old image or exactly the new one, and with the new
+// one only if the update had been committed. Finally a staged page is
+// damaged after the commit, which must leave the old image in place,
+// application code where the staging area would be must be left alone,
+// and a radio whose bootloader can't apply an update must refuse one.
+
+#define OTA_TEST
+#define ENABLE_OTA
+#define __pdata
+#define __xdata
+#define __data
+#define __code
+
+#include "include/flash_layout.h"
+#include "radio/ota.h"
+
+static void ota_test_reset(void);
+
+// what ota.c needs from the rest of the firmware
+bool at_mode_active;
+static uint8_t g_board_bl_version = OTA_BL_VERSION;
+
+static uint16_t now;
+
+static uint16_t
+timer2_tick(void)
+{
+	return now;
+}
+
+// serial ports of the local radio; the remote one isn't used
+struct fifo {
+	uint8_t buf[4096];
+	unsigned head, tail;
+};
+static struct fifo host_to_radio, radio_to_host;
+
+static void
+fifo_put(struct fifo *f, uint8_t c)
+{
+	f->buf[f->head++ % sizeof(f->buf)] = c;
+}
+
+static unsigned
+fifo_count(struct fifo *f)
+{
+	return f->head - f->tail;
+}
+
+static uint8_t
+fifo_get(struct fifo *f)
+{
+	return f->buf[f->tail++ % sizeof(f->buf)];
+}
+
+static uint16_t
+serial_read_available(void)
+{
+	return fifo_count(&host_to_radio);
+}
+
+static uint8_t
+serial_read(void)
+{
+	return fifo_get(&host_to_radio);
+}
+
+static uint8_t
+serial_peek(void)
+{
+	return host_to_radio.buf[host_to_radio.tail % sizeof(host_to_radio.buf)];
+}
+
+static uint8_t
+serial_peek2(void)
+{
+	return host_to_radio.buf[(host_to_radio.tail + 1) % sizeof(host_to_radio.buf)];
+}
+
+static bool
+serial_read_buf(uint8_t *buf, uint8_t count)
+{
+	while (count--) {
+		*buf++ = fifo_get(&host_to_radio);
+	}
+	return true;
+}
+
+static bool
+serial_write(uint8_t c)
+{
+	fifo_put(&radio_to_host, c);
+	return true;
+}
+
+static void
+serial_write_buf(uint8_t *buf, uint8_t count)
+{
+	while (count--) {
+		fifo_put(&radio_to_host, *buf++);
+	}
+}
+
+// the remote radio's flash, with the power cut after a set number of
+// writes and erases
+static uint8_t flash[0x10000];
+static long flash_ops_left = -1;
+static long flash_ops;
+static jmp_buf power_cut;
+
+static void
+flash_op(void)
+{
+	flash_ops++;
+	if (flash_ops_left > 0 && --flash_ops_left == 0) {
+		longjmp(power_cut, 1);
+	}
+}
+
+static void
+flash_erase(uint16_t address)
+{
+	flash_op();
+	memset(&flash[address & ~(FLASH_PAGE_SIZE - 1)], 0xff, FLASH_PAGE_SIZE);
+}
+
+static void
+flash_write(uint16_t address, uint8_t c)
+{
+	flash_op();
+	flash[address] &= c;
+}
+
+static bool
+in_staging(uint16_t address)
+{
+	return address >= FLASH_STAGING_START &&
+		address < FLASH_STAGING_START + FLASH_STAGING_PAGES * FLASH_PAGE_SIZE;
+}
+
+static bool
+in_app(uint16_t address)
+{
+	return address >= FLASH_APP_START && address < FLASH_INFO_PAGE;
+}
+
+// radio/flash.c
+static void
+flash_erase_code(uint16_t address)
+{
+	if (in_staging(address)) {
+		flash_erase(address);
+	}
+}
+
+static uint8_t
+flash_read_code(uint16_t address)
+{
+	return flash[address];
+}
+
+static void
+flash_write_code(uint16_t address, uint8_t c)
+{
+	if (in_staging(address)) {
+		flash_write(address, c);
+	}
+}
+
+// bootloader/flash.c and util.c
+static void
+flash_erase_page(uint16_t address)
+{
+	if (in_app(address)) {
+		flash_erase(address);
+	}
+}
+
+static void
+flash_write_byte(uint16_t address, uint8_t c)
+{
+	if (in_app(address)) {
+		flash_write(address, c);
+	}
+}
+
+static uint8_t
+flash_read_byte(uint16_t address)
+{
+	return flash[address];
+}
+
+static uint16_t
+crc16_byte(uint16_t crc, uint8_t c)
+{
+	uint8_t i;
+
+	crc ^= (uint16_t)c << 8;
+	for (i = 0; i < 8; i++) {
+		crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+#include "radio/ota.c"
+#include "bootloader/staging.c"
+
+#define ROUND_TICKS	20000	// a TDM round at a low air rate
+#define ROUND_STEPS	20
+#define TRY_ROUNDS	4
+#define TRIES		50
+
+// the OTA state of one radio, swapped in and out of ota.c
+struct radio {
+	bool relay_active;
+	uint8_t tx[OTA_BLOCK_MAX];
+	uint8_t tx_len;
+	bool tx_sent;
+	uint8_t reply[OTA_REPLY_MAX];
+	uint8_t reply_len;
+	bool reply_pending;
+	bool apply_pending;
+	uint16_t apply_time;
+};
+
+static struct radio local, remote;
+static bool remote_reset;
+
+static void
+swap_in(struct radio *r)
+{
+	ota_relay_active = r->relay_active;
+	memcpy(ota_tx, r->tx, sizeof(ota_tx));
+	ota_tx_len = r->tx_len;
+	ota_tx_sent = r->tx_sent;
+	memcpy(ota_reply, r->reply, sizeof(ota_reply));
+	ota_reply_len = r->reply_len;
+	ota_reply_pending = r->reply_pending;
+	ota_apply_pending = r->apply_pending;
+	ota_apply_time = r->apply_time;
+}
+
+static void
+swap_out(struct radio *r)
+{
+	r->relay_active = ota_relay_active;
+	memcpy(r->tx, ota_tx, sizeof(ota_tx));
+	r->tx_len = ota_tx_len;
+	r->tx_sent = ota_tx_sent;
+	memcpy(r->reply, ota_reply, sizeof(ota_reply));
+	r->reply_len = ota_reply_len;
+	r->reply_pending = ota_reply_pending;
+	r->apply_pending = ota_apply_pending;
+	r->apply_time = ota_apply_time;
+}
+
+static void
+ota_test_reset(void)
+{
+	remote_reset = true;
+}
+
+// the remote radio resets, and its bootloader runs
+static void
+reboot_remote(void)
+{
+	memset(&remote, 0, sizeof(remote));
+	staging_apply();
+}
+
+// link loss and duplication, in percent
+static int loss, dups;
+
+static bool
+link_ok(void)
+{
+	return (rand() % 100) >= loss;
+}
+
+// send a block over the link, losing or repeating it
+static void
+deliver(struct radio *to, uint8_t *buf, uint8_t len)
+{
+	int n = link_ok() ? 1 : 0;
+
+	if (n && (rand() % 100) < dups) {
+		n = 2;
+	}
+	while (n--) {
+		swap_in(to);
+		ota_handle(buf, len);
+		swap_out(to);
+	}
+}
+
+// one TDM round: the local radio's transmit window then the remote's
+static void
+run_round(void)
+{
+	uint8_t buf[252];
+	uint8_t len;
+	int i;
+
+	swap_in(&local);
+	ota_poll(true);
+	ota_window();
+	len = ota_next_block(buf, sizeof(buf));
+	swap_out(&local);
+	if (len != 0) {
+		deliver(&remote, buf, len);
+	}
+
+	swap_in(&remote);
+	ota_window();
+	len = ota_next_block(buf, sizeof(buf));
+	swap_out(&remote);
+	if (len != 0) {
+		deliver(&local, buf, len);
+	}
+
+	for (i = 0; i < ROUND_STEPS; i++) {
+		now += ROUND_TICKS / ROUND_STEPS;
+		swap_in(&remote);
+		ota_poll(true);
+		swap_out(&remote);
+		if (remote_reset) {
+			remote_reset = false;
+			reboot_remote();
+		}
+	}
+}
+
+// the host side, as tools/ota_update.py does it
+static uint8_t host_seq;
+
+static int
+host_request(uint8_t op, const uint8_t *args, uint8_t nargs, uint8_t *data)
+{
+	uint8_t frame[OTA_BLOCK_MAX + 1];
+	int tries, rounds;
+	unsigned i;
+
+	host_seq++;
+	for (tries = 0; tries < TRIES; tries++) {
+		fifo_put(&host_to_radio, OTA_MAGIC);
+		fifo_put(&host_to_radio, nargs + 2);
+		fifo_put(&host_to_radio, host_seq);
+		fifo_put(&host_to_radio, op);
+		for (i = 0; i < nargs; i++) {
+			fifo_put(&host_to_radio, args[i]);
+		}
+		for (rounds = 0; rounds < TRY_ROUNDS; rounds++) {
+			run_round();
+			while (fifo_count(&radio_to_host) >= 2) {
+				uint8_t len;
+
+				if (fifo_get(&radio_to_host) != OTA_MAGIC) {
+					continue;
+				}
+				len = fifo_get(&radio_to_host);
+				if (len < 3 || len > sizeof(frame) || fifo_count(&radio_to_host) < len) {
+					printf("bad reply frame\n");
+					exit(1);
+				}
+				for (i = 0; i < len; i++) {
+					frame[i] = fifo_get(&radio_to_host);
+				}
+				if (frame[0] == host_seq && frame[1] == (op | OTA_REPLY)) {
+					if (data != NULL) {
+						memcpy(data, &frame[3], len - 3);
+					}
+					return frame[2];
+				}
+			}
+		}
+	}
+	return -1;
+}
+
+static uint16_t
+image_crc(const uint8_t *image, unsigned page)
+{
+	uint16_t crc = 0xffff;
+	unsigned i;
+
+	for (i = 0; i < FLASH_PAGE_SIZE; i++) {
+		crc = crc16_byte(crc, image[(page << FLASH_PAGE_SHIFT) + i]);
+	}
+	return crc;
+}
+
+static bool
+expect(int status, int wanted, const char *what)
+{
+	if (status != wanted) {
+		printf("%s: status %d, expected %d\n", what, status, wanted);
+		return false;
+	}
+	return true;
+}
+
+// run an update to image, stopping after commit if apply is false
+static bool
+update(const uint8_t *image, bool apply)
+{
+	uint8_t args[3 + OTA_DATA_MAX], data[2];
+	uint8_t pages[FLASH_STAGING_SLOTS];
+	unsigned page, npages = 0, slot, offset;
+	uint16_t crc;
+
+	memset(&local, 0, sizeof(local));
+	local.relay_active = true;
+	host_to_radio.head = host_to_radio.tail = 0;
+	radio_to_host.head = radio_to_host.tail = 0;
+
+	for (page = FLASH_APP_START >> FLASH_PAGE_SHIFT; page < FLASH_STAGING_START >> FLASH_PAGE_SHIFT; page++) {
+		args[0] = page;
+		if (!expect(host_request(OTA_OP_PAGE_CRC, args, 1, data), OTA_OK, "page crc")) {
+			return false;
+		}
+		crc = image_crc(image, page);
+		if (data[0] != (crc & 0xff) || data[1] != (crc >> 8)) {
+			if (npages == FLASH_STAGING_SLOTS) {
+				printf("too many changed pages\n");
+				return false;
+			}
+			pages[npages++] = page;
+		}
+	}
+
+	if (npages == 0) {
+		// up to date
+		return expect(host_request(OTA_OP_END, NULL, 0, NULL), OTA_OK, "end");
+	}
+	if (!expect(host_request(OTA_OP_START, NULL, 0, NULL), OTA_OK, "start")) {
+		return false;
+	}
+	for (slot = 0; slot < npages; slot++) {
+		for (offset = 0; offset < FLASH_PAGE_SIZE; offset += OTA_DATA_MAX) {
+			args[0] = slot;
+			args[1] = offset & 0xff;
+			args[2] = offset >> 8;
+			memcpy(&args[3], &image[(pages[slot] << FLASH_PAGE_SHIFT) + offset], OTA_DATA_MAX);
+			if (!expect(host_request(OTA_OP_WRITE, args, 3 + OTA_DATA_MAX, NULL), OTA_OK, "write")) {
+				return false;
+			}
+		}
+		crc = image_crc(image, pages[slot]);
+		args[0] = slot;
+		args[1] = pages[slot];
+		args[2] = crc & 0xff;
+		args[3] = crc >> 8;
+		if (!expect(host_request(OTA_OP_STAGE, args, 4, NULL), OTA_OK, "stage")) {
+			return false;
+		}
+	}
+	if (!expect(host_request(OTA_OP_COMMIT, NULL, 0, NULL), OTA_OK, "commit")) {
+		return false;
+	}
+	if (!apply) {
+		return true;
+	}
+	if (!expect(host_request(OTA_OP_APPLY, NULL, 0, NULL), OTA_OK, "apply")) {
+		return false;
+	}
+	// the remote resets a second later
+	run_round();
+	run_round();
+	run_round();
+	run_round();
+	return expect(host_request(OTA_OP_END, NULL, 0, NULL), OTA_OK, "end");
+}
+
+static bool
+running(const uint8_t *image)
+{
+	return memcmp(&flash[FLASH_APP_START], &image[FLASH_APP_START],
+		      FLASH_STAGING_START - FLASH_APP_START) == 0;
+}
+
+static bool
+committed(void)
+{
+	return flash[FLASH_STAGING_START + STAGING_MAGIC_OFFSET] == STAGING_MAGIC;
+}
+
+// load an image into the remote radio, as the serial uploader would
+static void
+install(const uint8_t *image)
+{
+	memset(flash, 0xff, sizeof(flash));
+	memcpy(&flash[FLASH_APP_START], &image[FLASH_APP_START], FLASH_STAGING_START - FLASH_APP_START);
+	memset(&remote, 0, sizeof(remote));
+}
+
+static uint8_t old_image[0x10000], new_image[0x10000], staged[0x10000];
+
+static const unsigned changed_pages[] = { 0x01, 0x10, 0x22, 0x34 };
+
+static bool passed = true;
+
+int
+main(void)
+{
+	long transfer_ops, apply_ops, cut;
+	unsigned i, trials, old_count, new_count;
+
+	srand(1);
+	for (i = FLASH_APP_START; i < FLASH_STAGING_START; i++) {
+		old_image[i] = rand();
+	}
+	memcpy(new_image, old_image, sizeof(new_image));
+	for (i = 0; i < sizeof(changed_pages) / sizeof(changed_pages[0]); i++) {
+		new_image[(changed_pages[i] << FLASH_PAGE_SHIFT) + 100] ^= 0x55;
+		new_image[(changed_pages[i] << FLASH_PAGE_SHIFT) + 1000] ^= 0xaa;
+	}
+
+	// a plain update over a link losing a quarter of the packets
+	// and repeating some of the rest
+	loss = 25;
+	dups = 10;
+	install(old_image);
+	flash_ops = 0;
+	if (!update(new_image, true) || !running(new_image) || committed()) {
+		printf("update over a lossy link FAILED\n");
+		passed = false;
+	}
+	transfer_ops = flash_ops;
+	printf("update over a lossy link: %ld flash operations\n", transfer_ops);
+
+	// a second update to the same image has nothing to send
+	flash_ops = 0;
+	if (!update(new_image, true) || !running(new_image)) {
+		printf("repeated update FAILED\n");
+		passed = false;
+	}
+
+	// the remote radio loses power part way through the transfer,
+	// after which a fresh update must still work
+	loss = 10;
+	dups = 5;
+	trials = old_count = new_count = 0;
+	for (cut = 1; cut < transfer_ops; cut += 13) {
+		install(old_image);
+		flash_ops_left = cut;
+		if (setjmp(power_cut) == 0) {
+			update(new_image, true);
+		}
+		flash_ops_left = -1;
+		i = committed();
+		reboot_remote();
+		trials++;
+		if (running(new_image) && i) {
+			new_count++;
+		} else if (running(old_image) && !i) {
+			old_count++;
+		} else {
+			printf("power cut after %ld operations of the transfer left a bad image\n", cut);
+			passed = false;
+			continue;
+		}
+		if (!update(new_image, true) || !running(new_image)) {
+			printf("update after a power cut at %ld FAILED\n", cut);
+			passed = false;
+		}
+	}
+	printf("power cut during the transfer: %u trials, %u came back old, %u new\n",
+	       trials, old_count, new_count);
+
+	// the power goes while the bootloader is copying the pages in,
+	// after every single flash operation
+	install(old_image);
+	update(new_image, false);
+	memcpy(staged, flash, sizeof(flash));
+	flash_ops = 0;
+	staging_apply();
+	apply_ops = flash_ops;
+	trials = 0;
+	for (cut = 1; cut <= apply_ops; cut++) {
+		memcpy(flash, staged, sizeof(flash));
+		flash_ops_left = cut;
+		if (setjmp(power_cut) == 0) {
+			staging_apply();
+		}
+		flash_ops_left = -1;
+		staging_apply();
+		trials++;
+		if (!running(new_image) || committed()) {
+			printf("power cut after %ld operations of the copy left a bad image\n", cut);
+			passed = false;
+		}
+	}
+	printf("power cut during the copy: %u trials\n", trials);
+
+	// a staged page is damaged after it was committed
+	memcpy(flash, staged, sizeof(flash));
+	flash[FLASH_STAGING_SLOT(2) + 500] ^= 0x01;
+	memcpy(staged, flash, sizeof(flash));
+	reboot_remote();
+	if (memcmp(flash, staged, sizeof(flash)) != 0) {
+		printf("a damaged staged page changed the flash\n");
+		passed = false;
+	}
+
+	// a directory entry whose page number wraps to a code page when
+	// shifted into an address
+	install(old_image);
+	update(new_image, false);
+	flash[FLASH_STAGING_START] += 0x40;
+	memcpy(staged, flash, sizeof(flash));
+	reboot_remote();
+	if (memcmp(flash, staged, sizeof(flash)) != 0) {
+		printf("a staged page outside the application was applied\n");
+		passed = false;
+	}
+
+	// an image built without OTA has code in the staging area, which
+	// may look like a committed directory, started or not, with any
+	// page numbers in it, or with nothing staged
+	for (trials = 0; trials < 1000; trials++) {
+		for (i = FLASH_STAGING_START; i < FLASH_INFO_PAGE - FLASH_PAGE_SIZE; i++) {
+			flash[i] = rand();
+		}
+		flash[FLASH_STAGING_START + STAGING_MAGIC_OFFSET] = STAGING_MAGIC;
+		if (trials % 2 == 0) {
+			flash[FLASH_STAGING_START + STAGING_STARTED_OFFSET] = 0xff;
+		}
+		if (trials % 4 < 2) {
+			flash[FLASH_STAGING_START] = changed_pages[0];
+		}
+		if (trials % 8 >= 4) {
+			for (i = 0; i < FLASH_STAGING_SLOTS; i++) {
+				flash[FLASH_STAGING_START + i * STAGING_ENTRY_SIZE] = 0xff;
+			}
+		}
+		memcpy(staged, flash, sizeof(flash));
+		reboot_remote();
+		if (memcmp(flash, staged, sizeof(flash)) != 0) {
+			printf("application code in the staging area was changed\n");
+			passed = false;
+			break;
+		}
+	}
+
+	// a remote radio whose bootloader would not apply the update
+	// refuses it
+	install(old_image);
+	g_board_bl_version = OTA_BL_VERSION - 1;
+	memset(&local, 0, sizeof(local));
+	local.relay_active = true;
+	host_to_radio.head = host_to_radio.tail = 0;
+	radio_to_host.head = radio_to_host.tail = 0;
+	if (!expect(host_request(OTA_OP_START, NULL, 0, NULL), OTA_ERR_NO_REMOTE, "old bootloader")) {
+		passed = false;
+	}
+	g_board_bl_version = OTA_BL_VERSION;
+	host_to_radio.head = host_to_radio.tail = 0;
+	radio_to_host.head = radio_to_host.tail = 0;
+
+	// a remote radio without the update code gets an error
+	memset(&local, 0, sizeof(local));
+	local.relay_active = true;
+	swap_in(&local);
+	fifo_put(&host_to_radio, OTA_MAGIC);
+	fifo_put(&host_to_radio, 2);
+	fifo_put(&host_to_radio, 0x42);
+	fifo_put(&host_to_radio, OTA_OP_START);
+	ota_poll(false);
+	swap_out(&local);
+	if (fifo_count(&radio_to_host) != 5 || fifo_get(&radio_to_host) != OTA_MAGIC ||
+	    fifo_get(&radio_to_host) != 3 || fifo_get(&radio_to_host) != 0x42 ||
+	    fifo_get(&radio_to_host) != (OTA_OP_START | OTA_REPLY) ||
+	    fifo_get(&radio_to_host) != OTA_ERR_NO_REMOTE) {
+		printf("no error without a remote radio\n");
+		passed = false;
+	}
+
+	if (!passed) {
+		printf("-- test FAILED\n");
+		exit(1);
+	}
+	printf("-- test passed.\n");
+	return 0;
+}
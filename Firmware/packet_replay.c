@@ -0,0 +1,744 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+// Replay MAVLink traffic through a host build of radio/packet.c and
+// radio/serial.c, to see how well packet_get_next() frames it.
+//
+// The traffic comes from a MAVProxy/Mission Planner tlog, or from a
+// built in mix of typical autopilot telemetry. Each message goes into
+// the serial receive interrupt one byte at a time at the serial speed,
+// starting at its timestamp, or straight after the message before it
+// if that is still arriving. A transmitter is modelled with the same
+// window arithmetic as tdm_init(), asking packet_get_next() for a
+// packet whenever there is room for one in our transmit window.
+//
+// The report gives how full the radio packets were, how many messages
+// were split across packets, how many bytes went out as opportunistic
+// resends, and how long each message waited in the radio from its last
+// byte arriving to its last byte going out. With -m 2 it also gives the
+// wait of the priority messages on their own, and how many messages
+// were shed to keep the serial buffer from overflowing.
+//
+//   make bench_packet TLOG=flight.tlog
+//   ./packet_replay flight.tlog
+//   ./packet_replay -b 115200 -a 128 -e 0 flight.tlog
+//   ./packet_replay -g 60		(a minute of the built in mix)
+
+#define __pdata
+#define __xdata
+#define __data
+#define __code
+#define __reentrant
+#define __critical
+#define __bit		bool
+#define __interrupt(_n)
+#define __using(_n)
+
+// the declarations below stand in for radio.h
+#define _RADIO_H_
+#define MAX_PACKET_LENGTH	252
+#define ARRAY_LENGTH(_a)	(sizeof(_a) / sizeof(_a[0]))
+
+struct error_counts {
+	uint16_t rx_errors;
+	uint16_t tx_errors;
+	uint16_t serial_tx_overflow;
+	uint16_t serial_rx_overflow;
+	uint16_t corrected_errors;
+	uint16_t corrected_packets;
+	uint16_t radio_rx_full;
+};
+
+// the 8051 registers serial.c uses
+static bool RI0, TI0, ES0, TR1;
+static uint8_t SBUF0, TMOD, SCON0, TH1, CKCON;
+
+// what packet.c and serial.c need from the rest of the firmware
+struct error_counts errors;
+bool feature_mavlink_framing = true;
+bool feature_mavlink_priority;
+bool feature_opportunistic_resend = true;
+bool feature_rtscts;
+uint8_t feature_frame_gap;
+bool at_mode_active;
+volatile uint8_t at_plus_count;
+volatile bool at_plus_other;
+
+// the simulated time, in 16usec ticks
+static uint64_t now;
+
+uint16_t
+timer2_tick(void)
+{
+	return (uint16_t)now;
+}
+
+// configuration frames come from the ground station, not the
+// autopilot, so there are none in a tlog
+bool
+config_header(uint8_t *hdr, uint8_t n)
+{
+	(void)hdr;
+	(void)n;
+	return false;
+}
+
+void
+config_handle(uint8_t *buf, uint8_t len)
+{
+	(void)buf;
+	(void)len;
+}
+
+// bytes taken out of the middle of the serial buffer have to come out
+// of the mirror of it below too
+static void replay_cut(uint16_t ofs, uint16_t count);
+
+#define putchar serial_putchar
+#define serial_read_cut serial_read_cut_real
+#include "radio/serial.c"
+#undef putchar
+#undef serial_read_cut
+
+void
+serial_read_cut(uint16_t ofs, uint16_t count)
+{
+	replay_cut(ofs, count);
+	serial_read_cut_real(ofs, count);
+}
+
+#include "radio/packet.c"
+
+// the trailer and statistics slice tdm.c adds to each data packet
+#define TRAILER_LEN		2
+#define STATS_SLICE_LEN		3
+
+// how often the main loop asks for a packet while it has nothing to
+// send, in ticks
+#define POLL_TICKS		4
+
+// give up this long after the last byte arrives, in ticks
+#define DRAIN_TICKS		(10 * 62500UL)
+
+struct link_timing {
+	uint32_t ticks_per_byte;
+	uint32_t packet_latency;
+	uint32_t window;
+	uint32_t silence;
+	uint8_t max_data;
+};
+
+// the same arithmetic as tdm_init()
+static void
+timing_init(struct link_timing *t, unsigned air_rate, bool golay)
+{
+	uint32_t window;
+
+	t->ticks_per_byte = (8+(8000000UL/(air_rate*1000UL)))/16;
+	t->packet_latency = (8+(10/2)) * t->ticks_per_byte + 13;
+	if (golay) {
+		t->max_data = (MAX_PACKET_LENGTH/2) - (6+TRAILER_LEN);
+		t->ticks_per_byte *= 2;
+		t->packet_latency += 4*t->ticks_per_byte;
+	} else {
+		t->max_data = MAX_PACKET_LENGTH - TRAILER_LEN;
+	}
+	t->silence = 2*t->packet_latency;
+	window = 3*(t->packet_latency+(t->max_data*t->ticks_per_byte));
+	if (window >= ((1000000UL/16)*4)/10) {
+		window = ((1000000UL/16)*4)/10;
+	}
+	if (window > 0x1FFF) {
+		window = 0x1FFF;
+	}
+	t->window = window;
+}
+
+// one MAVLink message as it arrives at the radio
+struct frame {
+	uint64_t time;		// timestamp, in ticks
+	uint32_t start;		// offset of its first byte in the stream
+	uint16_t len;
+	uint8_t msgid;
+	uint64_t last_arrival;	// when its last byte reached the radio
+	uint64_t done;		// when its last byte went out, 0 if it hasn't
+	int32_t first_packet;
+	bool split;
+	uint16_t sent;
+	uint16_t dropped;
+	uint16_t shed;
+};
+
+struct replay {
+	// the traffic
+	uint8_t *bytes;
+	uint32_t nbytes;
+	struct frame *frames;
+	uint32_t nframes;
+	uint32_t *byte_frame;
+	uint64_t *byte_time;
+
+	// the bytes in the serial buffer, mirrored so each byte sent
+	// can be traced back to its message
+	uint32_t *queue;
+	uint32_t queue_head, queue_tail;
+	uint32_t next_byte;
+
+	// bytes packet_get_next() cut from the middle of the serial
+	// buffer for the packet it is making
+	bool getting;
+	uint32_t taken[MAX_PACKET_LENGTH];
+	uint32_t ntaken;
+
+	// settings
+	uint32_t baud;
+	unsigned air_rate;
+	bool golay;
+	uint16_t rx_buf_size;
+
+	// results
+	uint32_t packets;
+	uint64_t packet_bytes;
+	uint64_t packet_room;
+	uint32_t resends;
+	uint64_t resend_bytes;
+	uint32_t drops;
+	uint32_t shed_bytes;
+	uint32_t mismatches;
+};
+
+static uint8_t serial_buffers[32768 + 512];
+static struct replay *replaying;
+
+static void
+replay_init(struct replay *r)
+{
+	memset(r, 0, sizeof(*r));
+	r->baud = 57600;
+	r->air_rate = 64;
+	r->golay = true;
+	r->rx_buf_size = SERIAL_RX_BUF_DEFAULT;
+}
+
+static void
+add_frame(struct replay *r, uint64_t usec, const uint8_t *data, uint16_t len)
+{
+	r->frames = realloc(r->frames, (r->nframes + 1) * sizeof(struct frame));
+	r->bytes = realloc(r->bytes, r->nbytes + len);
+	memset(&r->frames[r->nframes], 0, sizeof(struct frame));
+	r->frames[r->nframes].time = usec / 16;
+	r->frames[r->nframes].start = r->nbytes;
+	r->frames[r->nframes].len = len;
+	r->frames[r->nframes].msgid = len < 8 ? 0 : data[0] == 0xFD ? data[7] : data[5];
+	r->frames[r->nframes].first_packet = -1;
+	memcpy(&r->bytes[r->nbytes], data, len);
+	r->nbytes += len;
+	r->nframes++;
+}
+
+#ifndef PACKET_REPLAY_NO_MAIN
+// the length of the MAVLink frame at p, or 0 if it isn't one
+static uint16_t
+frame_length(const uint8_t *p, size_t avail)
+{
+	if (avail < 2) {
+		return 0;
+	}
+	switch (p[0]) {
+	case MAVLINK09_STX:
+	case MAVLINK10_STX:
+		return p[1] + 8;
+	case 0xFD:
+		// MAVLink 2, which may be signed
+		if (avail < 3) {
+			return 0;
+		}
+		return p[1] + 12 + ((p[2] & 1) ? 13 : 0);
+	}
+	return 0;
+}
+
+// read a tlog, which is each message preceded by a big endian
+// timestamp in microseconds
+static bool
+load_tlog(struct replay *r, const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	uint8_t *data;
+	size_t size, ofs;
+	uint64_t first = 0, usec;
+	uint16_t len;
+	int i;
+
+	if (f == NULL) {
+		perror(path);
+		return false;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	data = malloc(size);
+	if (fread(data, 1, size, f) != size) {
+		perror(path);
+		return false;
+	}
+	fclose(f);
+
+	ofs = 0;
+	while (ofs + 8 < size) {
+		usec = 0;
+		for (i = 0; i < 8; i++) {
+			usec = (usec << 8) | data[ofs + i];
+		}
+		len = frame_length(&data[ofs + 8], size - ofs - 8);
+		if (len == 0 || ofs + 8 + len > size) {
+			// lost our place, look for the next message
+			ofs++;
+			continue;
+		}
+		if (r->nframes == 0) {
+			first = usec;
+		}
+		if (usec < first) {
+			usec = first;
+		}
+		add_frame(r, usec - first, &data[ofs + 8], len);
+		ofs += 8 + len;
+	}
+	free(data);
+	return r->nframes != 0;
+}
+#endif
+
+// a mix of the streams an autopilot sends a ground station, with a
+// parameter download part way through
+static const struct {
+	uint8_t msgid;
+	uint8_t len;
+	uint8_t rate;
+} telemetry_mix[] = {
+	{ 0,	9,	1 },	// HEARTBEAT
+	{ 1,	31,	2 },	// SYS_STATUS
+	{ 24,	30,	5 },	// GPS_RAW_INT
+	{ 30,	28,	10 },	// ATTITUDE
+	{ 33,	28,	5 },	// GLOBAL_POSITION_INT
+	{ 35,	22,	2 },	// RC_CHANNELS_RAW
+	{ 74,	20,	4 },	// VFR_HUD
+};
+#define PARAM_VALUE_ID		22
+#define PARAM_VALUE_LEN		25
+#define PARAM_COUNT		300
+#define PARAM_BURST		1	///< sent every 10ms
+
+static void
+synthetic_frame(struct replay *r, uint64_t usec, uint8_t msgid, uint8_t len)
+{
+	uint8_t buf[MAX_PACKET_LENGTH];
+	static uint8_t seq;
+	int i;
+
+	buf[0] = MAVLINK10_STX;
+	buf[1] = len;
+	buf[2] = seq++;
+	buf[3] = 1;
+	buf[4] = 1;
+	buf[5] = msgid;
+	for (i = 0; i < len + 2; i++) {
+		buf[6 + i] = rand();
+	}
+	add_frame(r, usec, buf, len + 8);
+}
+
+#ifndef PACKET_REPLAY_NO_MAIN
+static void
+generate(struct replay *r, unsigned seconds)
+{
+	uint64_t tick, usec;
+	unsigned i, p;
+
+	srand(1);
+	// the autopilot sends whatever is due every 10ms
+	for (tick = 0; tick < seconds * 100ULL; tick++) {
+		usec = tick * 10000 + rand() % 500;
+		for (i = 0; i < ARRAY_LENGTH(telemetry_mix); i++) {
+			if (tick % (100 / telemetry_mix[i].rate) == i % (100 / telemetry_mix[i].rate)) {
+				synthetic_frame(r, usec, telemetry_mix[i].msgid, telemetry_mix[i].len);
+			}
+		}
+		if (tick >= 200 && tick < 200 + PARAM_COUNT / PARAM_BURST) {
+			for (p = 0; p < PARAM_BURST; p++) {
+				synthetic_frame(r, usec, PARAM_VALUE_ID, PARAM_VALUE_LEN);
+			}
+		}
+	}
+}
+#endif
+
+// work out when each byte reaches the radio
+static void
+replay_prepare(struct replay *r)
+{
+	uint64_t t = 0;
+	uint32_t f, i;
+	double byte_ticks = 10.0 * 62500 / r->baud;
+	double when = 0;
+
+	r->byte_frame = malloc(r->nbytes * sizeof(uint32_t));
+	r->byte_time = malloc(r->nbytes * sizeof(uint64_t));
+	r->queue = malloc(r->nbytes * sizeof(uint32_t));
+	for (f = 0; f < r->nframes; f++) {
+		if (when < r->frames[f].time) {
+			when = r->frames[f].time;
+		}
+		for (i = 0; i < r->frames[f].len; i++) {
+			when += byte_ticks;
+			t = when;
+			r->byte_frame[r->frames[f].start + i] = f;
+			r->byte_time[r->frames[f].start + i] = t;
+		}
+		r->frames[f].last_arrival = t;
+	}
+}
+
+// move time on to t, feeding the serial interrupt the bytes that
+// arrive by then
+static void
+advance(struct replay *r, uint64_t t)
+{
+	uint16_t before;
+	uint32_t b;
+
+	while (r->next_byte < r->nbytes && r->byte_time[r->next_byte] <= t) {
+		b = r->next_byte++;
+		// the main loop runs far more often than bytes
+		// arrive, so it sees the line quiet before each one
+		now = r->byte_time[b];
+		packet_poll();
+		before = serial_read_available();
+		SBUF0 = r->bytes[b];
+		RI0 = 1;
+		serial_interrupt();
+		if (serial_read_available() != before) {
+			r->queue[r->queue_tail++] = b;
+		} else {
+			r->frames[r->byte_frame[b]].dropped++;
+			r->drops++;
+		}
+		packet_poll();
+	}
+	now = t;
+	packet_poll();
+}
+
+// serial_read_cut() is taking count bytes ofs bytes into the serial
+// buffer, either for the packet being made or to shed them
+static void
+replay_cut(uint16_t ofs, uint16_t count)
+{
+	struct replay *r = replaying;
+	uint32_t i, b;
+
+	for (i = 0; i < count; i++) {
+		b = r->queue[r->queue_head + ofs + i];
+		if (r->getting) {
+			r->taken[r->ntaken++] = b;
+		} else {
+			r->frames[r->byte_frame[b]].shed++;
+			r->shed_bytes++;
+		}
+	}
+	while (ofs--) {
+		r->queue[r->queue_head + ofs + count] = r->queue[r->queue_head + ofs];
+	}
+	r->queue_head += count;
+}
+
+// account for a packet of user data going out, finishing at time t,
+// checking that each byte is the one the mirror says it is
+static void
+packet_sent(struct replay *r, const uint8_t *buf, uint8_t len, uint64_t t)
+{
+	struct frame *f;
+	uint32_t b, i;
+
+	if (r->ntaken != 0 && r->ntaken != len) {
+		r->mismatches++;
+		return;
+	}
+	for (i = 0; i < len; i++) {
+		b = r->ntaken != 0 ? r->taken[i] : r->queue[r->queue_head++];
+		if (r->bytes[b] != buf[i]) {
+			r->mismatches++;
+		}
+		f = &r->frames[r->byte_frame[b]];
+		if (f->first_packet == -1) {
+			f->first_packet = r->packets;
+		} else if (f->first_packet != (int32_t)r->packets) {
+			f->split = true;
+		}
+		if (++f->sent + f->dropped == f->len) {
+			f->done = t;
+		}
+	}
+}
+
+static void
+replay_run(struct replay *r)
+{
+	struct link_timing t;
+	uint8_t buf[MAX_PACKET_LENGTH];
+	uint64_t round, phase, next;
+	uint32_t remaining, max_xmit, i;
+	uint8_t data_max, len;
+
+	timing_init(&t, r->air_rate, r->golay);
+	round = 2 * (t.window + t.silence);
+
+	serial_set_buffers(serial_buffers, r->rx_buf_size, &serial_buffers[r->rx_buf_size], SERIAL_TX_BUF_DEFAULT);
+	serial_init(r->baud / 1000);
+	i = (t.window - t.packet_latency) / t.ticks_per_byte;
+	packet_set_max_xmit(i > t.max_data ? t.max_data : i);
+
+	replay_prepare(r);
+	replaying = r;
+	now = 0;
+	for (;;) {
+		advance(r, now);
+		if (r->next_byte == r->nbytes &&
+		    (serial_read_available() == 0 ||
+		     now > r->byte_time[r->nbytes - 1] + DRAIN_TICKS)) {
+			break;
+		}
+
+		// wait for our transmit window, with room for a packet
+		phase = now % round;
+		remaining = phase < t.window ? t.window - phase : 0;
+		if (remaining < t.packet_latency + (TRAILER_LEN+1) * t.ticks_per_byte) {
+			advance(r, now - phase + round);
+			continue;
+		}
+		max_xmit = (remaining - t.packet_latency) / t.ticks_per_byte - (TRAILER_LEN+1);
+		if (max_xmit > t.max_data) {
+			max_xmit = t.max_data;
+		}
+		data_max = max_xmit > STATS_SLICE_LEN ? max_xmit - STATS_SLICE_LEN : 0;
+
+		r->getting = true;
+		r->ntaken = 0;
+		len = packet_get_next(data_max, buf);
+		r->getting = false;
+		if (r->ntaken != 0 && (len == 0 || packet_is_resend())) {
+			r->mismatches++;
+		}
+		if (len == 0) {
+			next = now + POLL_TICKS;
+			if (r->next_byte < r->nbytes && r->byte_time[r->next_byte] > next) {
+				// nothing will change till the next byte
+				// comes, other than timeouts
+				next = r->byte_time[r->next_byte] < now + 4 * POLL_TICKS ?
+					r->byte_time[r->next_byte] : now + 4 * POLL_TICKS;
+			}
+			advance(r, next);
+			continue;
+		}
+
+		next = now + t.packet_latency + (len + STATS_SLICE_LEN + TRAILER_LEN) * t.ticks_per_byte;
+		if (packet_is_resend()) {
+			r->resends++;
+			r->resend_bytes += len;
+		} else {
+			packet_sent(r, buf, len, next);
+			r->packet_bytes += len;
+			r->packet_room += data_max;
+			r->packets++;
+		}
+		advance(r, next);
+	}
+}
+
+static int
+compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static double
+ticks_to_ms(uint64_t ticks)
+{
+	return ticks * 0.016;
+}
+
+// queueing delay of every message that got through whole, or just of
+// the priority messages, sorted
+static uint32_t
+frame_delays(struct replay *r, uint64_t *delays, bool priority)
+{
+	uint32_t f, n = 0;
+
+	for (f = 0; f < r->nframes; f++) {
+		if (priority && !msg_listed(priority_msgs, sizeof(priority_msgs), r->frames[f].msgid)) {
+			continue;
+		}
+		if (r->frames[f].done != 0 && r->frames[f].dropped == 0) {
+			delays[n++] = r->frames[f].done - r->frames[f].last_arrival;
+		}
+	}
+	qsort(delays, n, sizeof(delays[0]), compare_u64);
+	return n;
+}
+
+static void
+print_delays(const char *what, uint64_t *delays, uint32_t n)
+{
+	uint64_t sum = 0;
+	uint32_t i;
+
+	if (n == 0) {
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		sum += delays[i];
+	}
+	printf("%-17smean %.1f p50 %.1f p90 %.1f p99 %.1f max %.1f\n", what,
+	       ticks_to_ms(sum / n), ticks_to_ms(delays[n / 2]), ticks_to_ms(delays[n * 9 / 10]),
+	       ticks_to_ms(delays[n * 99 / 100]), ticks_to_ms(delays[n - 1]));
+}
+
+static void
+replay_report(struct replay *r)
+{
+	uint64_t *delays = malloc(r->nframes * sizeof(uint64_t));
+	uint32_t f, split = 0, damaged = 0, unsent = 0, shed = 0;
+
+	for (f = 0; f < r->nframes; f++) {
+		split += r->frames[f].split;
+		damaged += r->frames[f].dropped != 0;
+		shed += r->frames[f].shed != 0;
+		unsent += r->frames[f].done == 0 && r->frames[f].shed == 0;
+	}
+
+	printf("%u messages, %u bytes over %.1fs at %u baud, %ukbps air rate%s\n",
+	       r->nframes, r->nbytes, ticks_to_ms(r->byte_time[r->nbytes - 1]) / 1000,
+	       r->baud, r->air_rate, r->golay ? " with golay" : "");
+	printf("packets:         %u, %.1f%% full\n",
+	       r->packets, r->packet_room ? 100.0 * r->packet_bytes / r->packet_room : 0);
+	printf("split messages:  %u (%.1f%%)\n", split, 100.0 * split / r->nframes);
+	printf("resent bytes:    %llu in %u packets (%.1f%% of bytes sent)\n",
+	       (unsigned long long)r->resend_bytes, r->resends,
+	       100.0 * r->resend_bytes / (r->resend_bytes + r->packet_bytes + (r->packet_bytes == 0)));
+	printf("serial overflow: %u bytes dropped, %u messages damaged, %u never sent\n",
+	       r->drops, damaged, unsent);
+	if (feature_mavlink_priority) {
+		printf("shed messages:   %u, %u bytes\n", shed, r->shed_bytes);
+	}
+	print_delays("queueing ms:", delays, frame_delays(r, delays, false));
+	if (feature_mavlink_priority) {
+		print_delays("priority ms:", delays, frame_delays(r, delays, true));
+	}
+	if (r->mismatches != 0) {
+		printf("%u bytes sent were not the ones expected\n", r->mismatches);
+	}
+	free(delays);
+}
+
+#ifdef PACKET_REPLAY_NO_MAIN
+// for the tests built on the harness, which check() as they go and
+// finish with test_result()
+static bool passed = true;
+
+static void
+check(bool ok, const char *what)
+{
+	if (!ok) {
+		printf("%s FAILED\n", what);
+		passed = false;
+	}
+}
+
+static int
+test_result(void)
+{
+	if (!passed) {
+		printf("-- test FAILED\n");
+		exit(1);
+	}
+	printf("-- test passed.\n");
+	return 0;
+}
+#else
+static void
+usage(void)
+{
+	printf("usage: packet_replay [options] <tlog>\n"
+	       "       packet_replay [options] -g <seconds>\n"
+	       "  -b <baud>     serial speed (57600)\n"
+	       "  -a <kbps>     air rate (64)\n"
+	       "  -e <0|1>      golay error correction (1)\n"
+	       "  -m <0|1|2>    MAVLink framing, 2 with priority messages (1)\n"
+	       "  -o <0|1>      opportunistic resend (1)\n"
+	       "  -f <bytes>    FRAME_GAP, serial idle gap that ends a frame (0)\n"
+	       "  -r <bytes>    serial receive buffer, a power of two (%u)\n"
+	       "  -g <seconds>  replay a built in telemetry mix instead of a tlog\n",
+	       SERIAL_RX_BUF_DEFAULT);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct replay r;
+	unsigned seconds = 0;
+	int opt;
+
+	replay_init(&r);
+	while ((opt = getopt(argc, argv, "b:a:e:m:o:f:r:g:")) != -1) {
+		switch (opt) {
+		case 'b':
+			r.baud = atoi(optarg);
+			break;
+		case 'a':
+			r.air_rate = atoi(optarg);
+			break;
+		case 'e':
+			r.golay = atoi(optarg) != 0;
+			break;
+		case 'm':
+			feature_mavlink_framing = atoi(optarg) != 0;
+			feature_mavlink_priority = atoi(optarg) == 2;
+			break;
+		case 'o':
+			feature_opportunistic_resend = atoi(optarg) != 0;
+			break;
+		case 'f':
+			feature_frame_gap = atoi(optarg);
+			break;
+		case 'r':
+			r.rx_buf_size = atoi(optarg);
+			break;
+		case 'g':
+			seconds = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!serial_device_valid_speed(r.baud / 1000) || r.air_rate == 0 || r.air_rate > 256 ||
+	    r.rx_buf_size < SERIAL_BUF_MIN || r.rx_buf_size > 32768 || (r.rx_buf_size & (r.rx_buf_size - 1))) {
+		usage();
+	}
+	if (seconds != 0) {
+		generate(&r, seconds);
+	} else if (optind != argc - 1 || !load_tlog(&r, argv[optind])) {
+		usage();
+	}
+
+	replay_run(&r);
+	replay_report(&r);
+	return 0;
+}
+#endif
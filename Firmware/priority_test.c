@@ -0,0 +1,131 @@
+// Host test for MAVLink message priority, MAVLINK=2.
+//
+// Mixed traffic is replayed through radio/packet.c with the harness in
+// packet_replay.c, once with plain MAVLink framing and once with
+// priority messages. Commands and manual control are sent while a
+// parameter download fills the link, and with priority on they must
+// all get through whole within a TDM round of arriving, well ahead of
+// how they do without it. Then
+// the telemetry streams are sped up past what the link can carry
+// alongside a log download, and with priority on the streams must be
+// shed so that no log message is damaged by the serial buffer
+// overflowing. In every run each byte sent must be the byte the
+// harness expects, wherever in the serial buffer it was taken from.
+
+#define PACKET_REPLAY_NO_MAIN
+#include "packet_replay.c"
+
+#define MANUAL_CONTROL_ID	69
+#define MANUAL_CONTROL_LEN	11
+#define COMMAND_LONG_ID		76
+#define COMMAND_LONG_LEN	33
+#define LOG_DATA_ID		120
+#define LOG_DATA_LEN		97
+
+// the built in telemetry mix, at speedup times its usual rates, with
+// either a parameter download and commands from the ground station,
+// or a log download
+static void
+mixed_traffic(struct replay *r, unsigned seconds, unsigned speedup, bool commands)
+{
+	uint64_t tick, usec;
+	unsigned i, every;
+
+	srand(1);
+	for (tick = 0; tick < seconds * 100ULL; tick++) {
+		usec = tick * 10000 + rand() % 500;
+		for (i = 0; i < ARRAY_LENGTH(telemetry_mix); i++) {
+			every = 100 / (telemetry_mix[i].rate * speedup);
+			if (every == 0) {
+				every = 1;
+			}
+			if (tick % every == i % every) {
+				synthetic_frame(r, usec, telemetry_mix[i].msgid, telemetry_mix[i].len);
+			}
+		}
+		if (commands) {
+			if (tick >= 100 && tick % 3 == 0 && tick < 100 + 3 * PARAM_COUNT) {
+				synthetic_frame(r, usec, PARAM_VALUE_ID, PARAM_VALUE_LEN);
+			}
+			if (tick % 10 == 3) {
+				synthetic_frame(r, usec, MANUAL_CONTROL_ID, MANUAL_CONTROL_LEN);
+			}
+			if (tick % 50 == 27) {
+				synthetic_frame(r, usec, COMMAND_LONG_ID, COMMAND_LONG_LEN);
+			}
+		} else if (tick % 10 == 5) {
+			synthetic_frame(r, usec, LOG_DATA_ID, LOG_DATA_LEN);
+		}
+	}
+}
+
+static void
+run(struct replay *r, unsigned speedup, bool commands, bool priority)
+{
+	replay_init(r);
+	feature_mavlink_priority = priority;
+	mixed_traffic(r, 10, speedup, commands);
+	replay_run(r);
+	printf("-- %s, MAVLINK=%u\n", commands ? "commands during a parameter download" :
+	       "streams overloading a log download", priority ? 2 : 1);
+	replay_report(r);
+	check(r->mismatches == 0, "bytes sent");
+}
+
+// how many messages with this ID got through whole
+static uint32_t
+delivered(struct replay *r, uint8_t msgid, uint32_t *total)
+{
+	uint32_t f, n = 0;
+
+	*total = 0;
+	for (f = 0; f < r->nframes; f++) {
+		if (r->frames[f].msgid == msgid) {
+			(*total)++;
+			n += r->frames[f].done != 0 && r->frames[f].dropped == 0;
+		}
+	}
+	return n;
+}
+
+int
+main(void)
+{
+	struct replay fifo, prio;
+	struct link_timing t;
+	uint64_t *delays;
+	uint64_t fifo_p90, prio_max;
+	uint32_t f, n, total;
+	bool only_streams = true;
+
+	run(&fifo, 1, true, false);
+	run(&prio, 1, true, true);
+
+	delays = malloc(prio.nframes * sizeof(uint64_t));
+	n = frame_delays(&fifo, delays, true);
+	fifo_p90 = n ? delays[n * 9 / 10] : 0;
+	n = frame_delays(&prio, delays, true);
+	prio_max = n ? delays[n - 1] : ~0ULL;
+	free(delays);
+
+	check(delivered(&prio, MANUAL_CONTROL_ID, &total) == total, "manual control delivered");
+	check(delivered(&prio, COMMAND_LONG_ID, &total) == total, "commands delivered");
+	timing_init(&t, prio.air_rate, prio.golay);
+	check(prio_max < 2 * (t.window + t.silence), "priority latency within a round");
+	check(prio_max * 4 < fifo_p90, "priority latency against plain framing");
+
+	run(&fifo, 3, false, false);
+	run(&prio, 3, false, true);
+	check(fifo.drops != 0, "streams overflow the serial buffer");
+	check(prio.drops == 0, "no serial overflow with shedding");
+	check(delivered(&prio, LOG_DATA_ID, &total) == total, "log data delivered");
+	for (f = 0; f < prio.nframes; f++) {
+		if (prio.frames[f].shed != 0 &&
+		    !msg_listed(shed_msgs, sizeof(shed_msgs), prio.frames[f].msgid)) {
+			only_streams = false;
+		}
+	}
+	check(prio.shed_bytes != 0 && only_streams, "only streams shed");
+
+	return test_result();
+}
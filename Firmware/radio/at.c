@@ -34,6 +34,7 @@
 
 #include "radio.h"
 #include "tdm.h"
+#include "ota.h"
 
 
 // canary data for ram wrap. It is in at.c as the compiler
@@ -48,6 +49,7 @@ __pdata uint8_t	at_cmd_len;
 // mode flags
 bool		at_mode_active;	///< if true, incoming bytes are for AT command
 bool		at_cmd_ready;	///< if true, at_cmd / at_cmd_len contain valid data
+bool		at_cmd_error;	///< if true, the last command run failed
 
 // test bits
 __pdata uint8_t		at_testmode;    ///< test modes enabled (AT_TEST_*)
@@ -60,9 +62,12 @@ static void	at_s(void);
 static void	at_ampersand(void);
 static void	at_plus(void);
 
-#pragma save
-#pragma nooverlay
-void
+static void	at_input(register uint8_t c);
+static void	at_plus_detector(register uint8_t c);
+
+// AT command character input
+//
+static void
 at_input(register uint8_t c)
 {
 	// AT mode is active and waiting for a command
@@ -107,7 +112,6 @@ at_input(register uint8_t c)
 		break;
 	}
 }
-#pragma restore
 
 // +++ detector state machine
 //
@@ -132,9 +136,20 @@ at_input(register uint8_t c)
 static __pdata uint8_t	at_plus_state;
 static __pdata uint8_t	at_plus_counter = ATP_COUNT_1S;
 
+// where AT mode input starts in the serial buffer. The bytes in front
+// of it, including the +++, were queued for the link before AT mode
+// started, and are left there for it
+static __pdata uint16_t	at_input_mark;
+
+// what the serial interrupt has received since the last timer tick
+__data volatile uint8_t	at_plus_count;
+volatile __bit		at_plus_other;
+
+// run one received character through the state machine. Only the
+// difference between '+' and anything else matters
 #pragma save
 #pragma nooverlay
-void
+static void
 at_plus_detector(register uint8_t c)
 {
 	// If we get a character that's not '+', unconditionally
@@ -174,6 +189,24 @@ at_plus_detector(register uint8_t c)
 void
 at_timer(void)
 {
+	// catch up with the characters received in the last tick. The
+	// serial interrupt can't run while we do this. A character
+	// other than '+' always leaves us waiting for idle, whatever
+	// order it came in with any '+' characters
+	if (at_mode_active) {
+		at_plus_count = 0;
+		at_plus_other = false;
+	} else if (at_plus_other) {
+		at_plus_other = false;
+		at_plus_count = 0;
+		at_plus_detector(0);
+	} else {
+		while (at_plus_count != 0) {
+			at_plus_count--;
+			at_plus_detector('+');
+		}
+	}
+
 	// if the counter is running
 	if (at_plus_counter > 0) {
 
@@ -189,6 +222,7 @@ at_timer(void)
 			case ATP_WAIT_FOR_ENABLE:
 				at_mode_active = true;
 				at_plus_state = ATP_WAIT_FOR_IDLE;
+				at_input_mark = serial_read_mark_isr();
 
 				// stuff an empty 'AT' command to get the OK prompt
 				at_cmd[0] = 'A';
@@ -208,8 +242,31 @@ at_timer(void)
 void
 at_command(void)
 {
+	__pdata uint16_t avail, ofs, n;
+
+	// feed the command line from what arrived after AT mode
+	// started, a command at a time, then take those bytes out from
+	// behind anything still queued for the link
+	if (at_mode_active && !at_cmd_ready) {
+		avail = serial_read_available();
+		ofs = serial_mark_offset(at_input_mark);
+		if (ofs > avail) {
+			// the bytes in front have gone
+			at_input_mark -= ofs;
+			ofs = 0;
+		}
+		for (n = 0; at_mode_active && !at_cmd_ready && ofs + n < avail; n++) {
+			at_input(serial_peek_at(ofs + n));
+		}
+		if (n != 0) {
+			serial_read_cut(ofs, n);
+			at_input_mark += n;
+		}
+	}
+
 	// require a command with the AT prefix
 	if (at_cmd_ready) {
+		at_cmd_error = false;
 		if ((at_cmd_len >= 2) && (at_cmd[0] == 'R') && (at_cmd[1] == 'T')) {
 			// remote AT command - send it to the tdm
 			// system to send to the remote radio
@@ -269,6 +326,7 @@ at_ok(void)
 static void
 at_error(void)
 {
+	at_cmd_error = true;
 	printf("%s\n", "ERROR");
 }
 
@@ -328,6 +386,9 @@ at_i(void)
 	case '7':
 		tdm_show_rssi();
 		return;
+	case '8':
+		buffers_show();
+		return;
 	default:
 		at_error();
 		return;
@@ -392,10 +453,44 @@ at_ampersand(void)
 		at_error();
 		break;
 
+#ifdef ENABLE_OTA
+	case 'O':
+		if (!strcmp(at_cmd + 4, "TA")) {
+			// relay an over the air update from the host,
+			// leaving command mode as ATO does
+			ota_relay_start();
+			at_ok();
+			at_plus_counter = ATP_COUNT_1S;
+			at_mode_active = 0;
+			break;
+		}
+		at_error();
+		break;
+#endif
+
 	case 'P':
 		tdm_change_phase();
 		break;
 
+	case 'R':
+		// AT&RB, AT&RC and AT&RA batch remote commands
+		if (at_cmd[5] == '\0' && tdm_remote_batch(at_cmd[4])) {
+			at_ok();
+		} else {
+			at_error();
+		}
+		break;
+
+	case 'C':
+		// measure packet timings, use AT&W to keep them
+		if (tdm_calibrate_timing()) {
+			tdm_report_timing();
+			at_ok();
+		} else {
+			at_error();
+		}
+		break;
+
 	case 'T':
 		// enable test modes
 		if (!strcmp(at_cmd + 4, "")) {
@@ -37,34 +37,25 @@
 
 extern bool	at_mode_active;	///< if true, the AT interpreter is in command mode
 extern bool	at_cmd_ready;	///< if true, at_cmd / at_cmd_len contain valid data
+extern bool	at_cmd_error;	///< if true, the last command run failed
 
 /// Timer tick handler for the AT command interpreter
 ///
 extern void	at_timer(void);
 
-/// +++ detector.  Handles the state machine for detecting the AT escape
-/// sequence.
+/// +++ detector input.  The serial interrupt counts the '+' characters
+/// it receives, and notes any other character, and at_timer() runs the
+/// state machine for detecting the AT escape sequence from these.
 ///
-/// Call this at interrupt time for every incoming character when at_mode_active
-/// is false.
-///
-/// @param	c		Received character.
-///
-extern void	at_plus_detector(register uint8_t c);
-
-/// AT command character input method.
-///
-/// Call this at interrupt time for every incoming character when at_mode_active
-/// is true, and don't buffer those characters.
-///
-///  @param	c		Received character.
-///
-extern void	at_input(register uint8_t c);
+extern __data volatile uint8_t	at_plus_count;	///< '+' characters received since the last tick
+extern volatile __bit		at_plus_other;	///< true if anything else was received
 
 /// Check for and execute AT commands
 ///
 /// Call this from non-interrupt context when it's safe for an AT command
-/// to be executed.  It's cheap if at_mode_active is false.
+/// to be executed.  When AT mode is active this also takes the command
+/// characters out of the serial receive buffer.  It's cheap if
+/// at_mode_active is false.
 ///
 extern void	at_command(void);
 
@@ -0,0 +1,248 @@
+// -*- Mode: C; c-basic-offset: 8; -*-
+//
+// Copyright (c) 2026 agent, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+///
+/// @file	config.c
+///
+/// Binary configuration protocol, see config.h
+///
+
+#ifndef CONFIG_TEST
+#include <stdarg.h>
+#include "radio.h"
+#include "config.h"
+#endif
+
+#define MAVLINK10_STX		254
+
+/// the most parameter values that fit in one frame
+#define CONFIG_MAX_VALUES	((MAX_PACKET_LENGTH - CONFIG_OVERHEAD - 3) / 4)
+
+static void
+config_put32(__xdata uint8_t * __data p, __pdata uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint32_t
+config_get32(__xdata uint8_t * __data p)
+{
+	return p[0] | ((uint16_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/// set a run of parameters, putting the old values in place of the
+/// new ones so they can all be put back if one is rejected
+///
+/// @return		the number of values set
+///
+static uint8_t
+config_set_params(__pdata uint8_t first, __xdata uint8_t * __data values, __pdata uint8_t count)
+{
+	__pdata uint8_t i;
+	__pdata param_t old;
+
+	for (i = 0; i < count; i++) {
+		old = param_get(first + i);
+		if (!param_set(first + i, config_get32(&values[i * 4]))) {
+			break;
+		}
+		config_put32(&values[i * 4], old);
+	}
+	return i;
+}
+
+/// the answer to one request, starting at the payload of the frame
+///
+/// @return		the length of the payload
+///
+static uint8_t
+config_request(__xdata uint8_t * __data p, __pdata uint8_t len)
+{
+	__pdata uint8_t op = p[0];
+	__pdata uint8_t arg = p[1];
+	__pdata uint8_t first, count, i;
+
+	p[0] = op | CONFIG_REPLY;
+	p[1] = CONFIG_ERR_ARGS;
+
+	switch (op) {
+	case CONFIG_OP_INFO:
+		p[2] = APP_VERSION_HIGH;
+		p[3] = APP_VERSION_LOW;
+		p[4] = BOARD_ID;
+		p[5] = g_board_frequency;
+		p[6] = g_board_bl_version;
+		p[7] = PARAM_MAX;
+		p[1] = CONFIG_OK;
+		return 8;
+
+	case CONFIG_OP_GET_PARAMS:
+		if (len != 3 || arg >= PARAM_MAX) {
+			break;
+		}
+		first = arg;
+		count = p[2];
+		if (count > PARAM_MAX - first) {
+			count = PARAM_MAX - first;
+		}
+		if (count > CONFIG_MAX_VALUES) {
+			count = CONFIG_MAX_VALUES;
+		}
+		p[2] = first;
+		for (i = 0; i < count; i++) {
+			config_put32(&p[3 + i * 4], param_get(first + i));
+		}
+		p[1] = CONFIG_OK;
+		return 3 + count * 4;
+
+	case CONFIG_OP_SET_PARAMS:
+		if (len < 3 || ((len - 3) & 3) != 0) {
+			break;
+		}
+		first = p[2];
+		count = (len - 3) / 4;
+		if (first == PARAM_FORMAT || first >= PARAM_MAX || count > PARAM_MAX - first) {
+			break;
+		}
+		i = config_set_params(first, &p[3], count);
+		if (i != count) {
+			// one was rejected, put back the ones before it
+			config_set_params(first, &p[3], i);
+			p[1] = CONFIG_ERR_PARAM;
+			p[2] = first + i;
+			return 3;
+		}
+		if (arg & CONFIG_SAVE) {
+			param_save();
+		}
+		p[1] = CONFIG_OK;
+		return 2;
+
+	case CONFIG_OP_GET_STATS:
+		memcpy(&p[2], &statistics, sizeof(statistics));
+		i = 2 + sizeof(statistics);
+		memcpy(&p[i], &remote_statistics, sizeof(remote_statistics));
+		i += sizeof(remote_statistics);
+		memcpy(&p[i], &errors, sizeof(errors));
+		i += sizeof(errors);
+		memcpy(&p[i], &remote_errors, sizeof(remote_errors));
+		i += sizeof(remote_errors);
+		p[i++] = remote_serial_space;
+		p[1] = CONFIG_OK;
+		return i;
+
+	case CONFIG_OP_GET_CALIBRATION:
+#ifdef BOARD_rfd900a
+		p[2] = BOARD_MAXTXPOWER + 1;
+		for (i = 0; i <= BOARD_MAXTXPOWER; i++) {
+			p[3 + i] = calibration_get(i);
+		}
+#else
+		p[2] = 0;
+#endif
+		p[1] = CONFIG_OK;
+		return 3 + p[2];
+
+	case CONFIG_OP_SET_CALIBRATION:
+#ifdef BOARD_rfd900a
+		if (len < 2) {
+			break;
+		}
+		first = arg;
+		p[1] = CONFIG_OK;
+		for (i = 2; i < len; i++) {
+			if (!calibration_set(first + i - 2, p[i])) {
+				// already written, or out of range
+				p[1] = CONFIG_ERR_PARAM;
+				p[2] = first + i - 2;
+				return 3;
+			}
+		}
+		return 2;
+#else
+		p[1] = CONFIG_ERR_UNSUPPORTED;
+		break;
+#endif
+	}
+	return 2;
+}
+
+bool
+config_header(__pdata uint8_t * __data hdr, __pdata uint8_t n)
+{
+	if (n > 0 && hdr[0] != MAVLINK10_STX) {
+		return false;
+	}
+	if (n > 1 && (hdr[1] == 0 || hdr[1] > MAX_PACKET_LENGTH - CONFIG_OVERHEAD)) {
+		return false;
+	}
+	if (n > 3 && hdr[3] != RADIO_SOURCE_SYSTEM) {
+		return false;
+	}
+	if (n > 4 && hdr[4] != RADIO_SOURCE_COMPONENT) {
+		return false;
+	}
+	if (n > 5 && hdr[5] != CONFIG_MSG_ID) {
+		return false;
+	}
+	return true;
+}
+
+void
+config_handle(__xdata uint8_t * __data buf, __pdata uint8_t len)
+{
+	__pdata uint16_t crc;
+
+	if (len != buf[1] + CONFIG_OVERHEAD) {
+		return;
+	}
+	crc = buf[len - 2] | ((uint16_t)buf[len - 1] << 8);
+	buf[len - 2] = CONFIG_CRC_EXTRA;
+	if (MAVLink_checksum(buf, len - 1) != crc) {
+		return;
+	}
+
+	len = config_request(&buf[CONFIG_HEADER_LEN], buf[1]);
+
+	// the reply goes back with the same header
+	buf[1] = len;
+	buf[CONFIG_HEADER_LEN + len] = CONFIG_CRC_EXTRA;
+	crc = MAVLink_checksum(buf, CONFIG_HEADER_LEN + len + 1);
+	buf[CONFIG_HEADER_LEN + len] = crc & 0xFF;
+	buf[CONFIG_HEADER_LEN + len + 1] = crc >> 8;
+	len += CONFIG_OVERHEAD;
+
+	if (serial_write_space() < len) {
+		// don't cause an overflow
+		return;
+	}
+	serial_write_buf(buf, len);
+}
@@ -0,0 +1,96 @@
+// -*- Mode: C; c-basic-offset: 8; -*-
+//
+// Copyright (c) 2026 agent, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+///
+/// @file	config.h
+///
+/// Binary configuration protocol
+///
+/// Ground software can read and write the parameters, read the
+/// statistics and handle calibration with binary frames sent in with
+/// the serial data, without the +++ guard time of AT command mode and
+/// without stopping the data flowing. A frame is a MAVLink 1.0 message
+/// from the radio's own system and component IDs:
+///
+/// <254><len><seq><'3'><'D'><CONFIG_MSG_ID><op><args><crc low><crc high>
+///
+/// with the MAVLink checksum seeded with CONFIG_CRC_EXTRA. The radio
+/// takes the frame out of the serial stream when it is at a frame
+/// boundary, which MAVLink framing (the MAVLINK parameter) ensures, and
+/// answers within a TDM round with the same header and seq and a
+/// payload of:
+///
+/// <op|CONFIG_REPLY><status><data>
+///
+/// Multibyte values are little endian. Frames with a bad checksum are
+/// dropped without an answer. tools/radio_config.py is the host side.
+///
+
+#ifndef _CONFIG_H_
+#define _CONFIG_H_
+
+#define CONFIG_MSG_ID		238
+#define CONFIG_CRC_EXTRA	104
+#define CONFIG_REPLY		0x80
+
+#define CONFIG_OP_INFO		0	///< -> <major><minor><board><frequency><bootloader><param count>
+#define CONFIG_OP_GET_PARAMS	1	///< <first><count> -> <first><values, 32 bits each>
+#define CONFIG_OP_SET_PARAMS	2	///< <flags><first><values>, all or none of them
+#define CONFIG_OP_GET_STATS	3	///< -> <statistics><remote statistics><errors><remote errors><remote serial space>
+#define CONFIG_OP_GET_CALIBRATION 4	///< -> <count><transmit power calibration>
+#define CONFIG_OP_SET_CALIBRATION 5	///< <first level><values>
+
+/// CONFIG_OP_SET_PARAMS flags
+#define CONFIG_SAVE		0x01	///< save the parameters once set, as AT&W
+
+#define CONFIG_OK		0
+#define CONFIG_ERR_ARGS		1
+#define CONFIG_ERR_PARAM	2	///< followed by the index of the rejected value
+#define CONFIG_ERR_UNSUPPORTED	3
+
+/// bytes before the payload, and the checksum after it
+#define CONFIG_HEADER_LEN	6
+#define CONFIG_OVERHEAD		8
+
+/// check whether the start of a frame is a configuration frame
+///
+/// @param hdr		the first bytes of the frame
+/// @param n		how many there are, up to CONFIG_HEADER_LEN
+/// @return		true if they are the start of a configuration frame
+///
+extern bool config_header(__pdata uint8_t * __data hdr, __pdata uint8_t n);
+
+/// check and answer a configuration frame, writing the reply to the
+/// serial port. The frame buffer is used to build the reply
+///
+/// @param buf		the frame, which must have room for MAX_PACKET_LENGTH bytes
+/// @param len		the length of the frame
+///
+extern void config_handle(__xdata uint8_t * __data buf, __pdata uint8_t len);
+
+#endif // _CONFIG_H_
@@ -81,15 +81,15 @@ static __code uint8_t crc_tab2[256] =
 };
 
 
-// calculate the CRC16 of a buffer
-// this costs about 2.2 microseconds per byte
-uint16_t 
-crc16(__data uint8_t n, __xdata uint8_t * __data buf)
+// carry on a CRC16 over more bytes
+uint16_t
+crc16_continue(__data uint8_t n, __xdata uint8_t * __data buf, __data uint16_t crc)
 {
 	register uint8_t k;
 	register uint8_t high, low;
 
-	high = low = 0;
+	high = crc >> 8;
+	low = crc & 0xFF;
 
 	while (n--) {
 		register uint8_t b = *buf++;
@@ -104,3 +104,11 @@ crc16(__data uint8_t n, __xdata uint8_t * __data buf)
 	}
 	return (((uint16_t)high)<<8) | low;
 }
+
+// calculate the CRC16 of a buffer
+// this costs about 2.2 microseconds per byte
+uint16_t 
+crc16(__data uint8_t n, __xdata uint8_t * __data buf)
+{
+	return crc16_continue(n, buf, 0);
+}
@@ -33,3 +33,13 @@
 /// @return		CRC16 value
 ///
 extern uint16_t crc16(__data uint8_t n, __xdata uint8_t * __data buf);
+
+/// carry on a CRC16 over more bytes, so that a buffer can be done in
+/// pieces
+/// @param n		number of bytes
+/// @param buf		buffer
+/// @param crc		CRC16 of the bytes before buf
+///
+/// @return		CRC16 value
+///
+extern uint16_t crc16_continue(__data uint8_t n, __xdata uint8_t * __data buf, __data uint16_t crc);
@@ -0,0 +1,72 @@
+// -*- Mode: C; c-basic-offset: 8; -*-
+//
+// Copyright (c) 2026 agent, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+///
+/// @file	duty_cycle.c
+///
+/// fixed point duty cycle averaging
+///
+/// The average is held as a percentage in 8.8 fixed point, so 100%
+/// is 25600. Each TDM round the new sample is folded in with weights
+/// of exactly 19/20 and 1/20, which is the 0.95/0.05 filter the TDM
+/// code has always used, without pulling in the soft-float library.
+///
+
+#ifndef DUTY_CYCLE_TEST
+#include <stdarg.h>
+#include "radio.h"
+#include "tdm.h"
+#endif
+
+/// the average duty cycle we have been transmitting
+__pdata uint16_t average_duty_cycle;
+
+/// what was left over from the last division by 20. Carrying this
+/// into the next update means nothing is lost to rounding, so the
+/// average settles on exactly the input duty cycle
+static __pdata uint8_t average_remainder;
+
+void
+duty_cycle_update(__pdata uint16_t transmitted_ticks, __pdata uint16_t round_ticks)
+{
+	__pdata uint32_t sample;
+
+	if (round_ticks == 0) {
+		return;
+	}
+
+	// percentage of the round we spent transmitting, in 8.8 fixed point
+	sample = (transmitted_ticks * (uint32_t)DUTY_CYCLE_ONE_PERCENT * 100) / round_ticks;
+	if (sample > 0xFFFF) {
+		sample = 0xFFFF;
+	}
+
+	sample += 19 * (uint32_t)average_duty_cycle + average_remainder;
+	average_duty_cycle = sample / 20;
+	average_remainder = sample % 20;
+}
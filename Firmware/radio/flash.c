@@ -85,3 +85,45 @@ __critical {
 	*(uint8_t __xdata *)address = c;
 	PSCTL = 0x00;
 }
+
+#ifdef ENABLE_OTA
+
+// The code page functions are used to stage over the air updates. They
+// refuse anything outside the staging area, so the running code and the
+// signature can't be touched.
+//
+static bool
+flash_staging(__pdata uint16_t address)
+{
+	return (address >= FLASH_STAGING_START) && (address < FLASH_STAGING_START + FLASH_STAGING_PAGES * FLASH_PAGE_SIZE);
+}
+
+void
+flash_erase_code(__pdata uint16_t address)
+__critical {
+	if (flash_staging(address)) {
+		flash_load_keys();
+		PSCTL = 0x03;			// set PSWE and PSEE
+		*(uint8_t __xdata *)address = 0xff;
+		PSCTL = 0x00;
+	}
+}
+
+uint8_t
+flash_read_code(__pdata uint16_t address)
+{
+	return *(uint8_t __code *)address;
+}
+
+void
+flash_write_code(__pdata uint16_t address, __pdata uint8_t c)
+__critical {
+	if (flash_staging(address)) {
+		flash_load_keys();
+		PSCTL = 0x01;			// set PSWE, clear PSEE
+		*(uint8_t __xdata *)address = c;
+		PSCTL = 0x00;
+	}
+}
+
+#endif // ENABLE_OTA
@@ -34,3 +34,11 @@
 extern void	flash_erase_scratch(void);
 extern uint8_t	flash_read_scratch(__pdata uint16_t address);
 extern void	flash_write_scratch(__pdata uint16_t address, __pdata uint8_t c);
+
+/// Erase, read and write the code flash, in OTA=1 builds only. Erasing
+/// and writing are only allowed in the OTA staging area (see
+/// flash_layout.h); erasing a page stalls the CPU for about 30ms.
+///
+extern void	flash_erase_code(__pdata uint16_t address);
+extern uint8_t	flash_read_code(__pdata uint16_t address);
+extern void	flash_write_code(__pdata uint16_t address, __pdata uint8_t c);
@@ -33,7 +33,9 @@
 ///
 
 #include <stdarg.h>
+#ifndef FHOP_TEST
 #include "radio.h"
+#endif
 #include "freq_hopping.h"
 
 /// how many channels are we hopping over
@@ -54,9 +56,34 @@ __pdata static volatile uint8_t transmit_channel;
 /// very slowly - it moves only when the transmit channel wraps
 __pdata static volatile uint8_t receive_channel;
 
+/// when we don't have lock we listen on our own transmit channel on
+/// every third hop, so a radio that is still in step with us is heard
+/// straight away. This is odd so that it can't stay in step with the
+/// other radios transmit window, which comes every second hop
+#define LISTEN_TRANSMIT_HOPS 3
+__pdata static uint8_t listen_phase;
+
 /// map between hopping channel numbers and physical channel numbers
 __xdata static uint8_t channel_map[MAX_FREQ_CHANNELS];
 
+/// the physical transmit and receive channels for the current hopping
+/// state, worked out whenever the state changes so the TDM loop can
+/// look them up on every pass without touching channel_map
+__pdata static uint8_t transmit_physical;
+__pdata static uint8_t receive_physical;
+
+// work out the physical channels for the current hopping state
+static void
+update_channels(void)
+{
+	transmit_physical = channel_map[transmit_channel];
+	if (!have_radio_lock && listen_phase == 0) {
+		receive_physical = transmit_physical;
+	} else {
+		receive_physical = channel_map[receive_channel];
+	}
+}
+
 // a vary simple array shuffle
 // based on shuffle from
 // http://benpfaff.org/writings/clc/shuffle.html
@@ -83,20 +110,21 @@ fhop_init(uint16_t netid)
 	}
 	srand(netid);
 	shuffle(channel_map, num_fh_channels);
+	update_channels();
 }
 
 // tell the TDM code what channel to transmit on
 uint8_t 
 fhop_transmit_channel(void)
 {
-	return channel_map[transmit_channel];
+	return transmit_physical;
 }
 
 // tell the TDM code what channel to receive on
 uint8_t 
 fhop_receive_channel(void)
 {
-	return channel_map[receive_channel];
+	return receive_physical;
 }
 
 // called when the transmit windows changes owner
@@ -104,6 +132,16 @@ void
 fhop_window_change(void)
 {
 	transmit_channel = (transmit_channel + 1) % num_fh_channels;
+	listen_phase++;
+	if (transmit_channel == 0 &&
+	    (num_fh_channels+1) % LISTEN_TRANSMIT_HOPS == 0) {
+		// our receive channel moves on by one each time the
+		// transmit channel wraps, so with this many channels
+		// the other radio would always reach it on the same
+		// listen phase. Skip a phase to break that up
+		listen_phase++;
+	}
+	listen_phase %= LISTEN_TRANSMIT_HOPS;
 	if (have_radio_lock) {
 		// when we have lock, the receive channel follows the
 		// transmit channel
@@ -114,17 +152,21 @@ fhop_window_change(void)
 		receive_channel = (receive_channel + 1) % num_fh_channels;
 		debug("Trying RCV on channel %d\n", (int)receive_channel);
 	}
+	update_channels();
 }
 
 // called when we get or lose radio lock
 void 
 fhop_set_locked(bool locked)
 {
-#if DEBUG
 	if (locked && !have_radio_lock) {
 		debug("FH lock\n");
+		if (listen_phase == 0) {
+			// we heard them on our own transmit channel,
+			// so we are still in step
+			receive_channel = transmit_channel;
+		}
 	}
-#endif
 	have_radio_lock = locked;
 	if (have_radio_lock) {
 		// we have just received a packet, so we know the
@@ -135,5 +177,31 @@ fhop_set_locked(bool locked)
 		// try the next receive channel
 		receive_channel = (receive_channel+1) % num_fh_channels;
 	}
+	update_channels();
 }
 
+// tell the TDM code if we are following the other radios hops
+bool
+fhop_locked(void)
+{
+	return have_radio_lock;
+}
+
+// tell the TDM code where we are in the hopping sequence
+uint8_t
+fhop_transmit_index(void)
+{
+	return transmit_channel;
+}
+
+// called when the other radio tells us where it is in the sequence
+void
+fhop_sync(uint8_t index)
+{
+	if (index >= num_fh_channels) {
+		return;
+	}
+	have_radio_lock = true;
+	transmit_channel = receive_channel = index;
+	update_channels();
+}
@@ -63,6 +63,28 @@ extern void fhop_window_change(void);
 ///
 extern void fhop_set_locked(bool locked);
 
+/// tell the TDM code if we are following the other radios hops
+///
+/// @return		True if we have lock with the other radio.
+///
+extern bool fhop_locked(void);
+
+/// tell the TDM code where we are in the hopping sequence
+///
+/// @return		The index of our transmit channel in the
+///			hopping sequence.
+///
+extern uint8_t fhop_transmit_index(void);
+
+/// called when the other radio tells us where it is in the hopping
+/// sequence, giving us lock without waiting for it to hop onto our
+/// receive channel
+///
+/// @param index	The other radios transmit index, as returned
+///			by fhop_transmit_index() on that radio.
+///
+extern void fhop_sync(uint8_t index);
+
 /// how many channels are we hopping over
 extern __pdata uint8_t num_fh_channels;
 
@@ -287,11 +287,84 @@ golay_encode_packet(uint8_t length, __xdata uint8_t * __pdata buf)
 	radio_buffer_count=elen;
 }
 
+// what golay_encode_ahead() leaves for golay_encode_finish()
+static __pdata uint8_t ahead_length, ahead_tail, ahead_head, ahead_elen;
+static __pdata uint16_t ahead_crc;
+static __pdata uint8_t ahead_rest[2];
+
+uint8_t
+golay_encode_ahead(uint8_t length, uint8_t tail, __xdata uint8_t * __pdata buf, __xdata uint8_t * __pdata out)
+{
+	__xdata uint8_t gin[3];
+	__xdata uint8_t rlen;
+
+	if (length > (sizeof(radio_buffer)/2)-6 || tail > length || tail > 4) {
+		debug("golay ahead size %u/%u\n", (unsigned)length, (unsigned)tail);
+		panic("oversized golay packet");
+	}
+
+	rlen = ((length+2)/3)*3;
+	ahead_elen = (rlen+6)*2;
+	ahead_length = length;
+	ahead_tail = tail;
+
+	// the header, as in golay_encode_packet()
+	gin[0] = netid[0];
+	gin[1] = netid[1];
+	gin[2] = length;
+	offset_start=0; offset_end=2;
+	golay_encode_portion(ahead_elen, gin, out);
+
+	// the whole groups before the tail. The CRC covers the tail, so
+	// it can only be started here
+	ahead_head = ((length-tail)/3)*3;
+	if (ahead_head > 0) {
+		offset_start=6; offset_end=6+ahead_head-1;
+		golay_encode_portion(ahead_elen, buf, out);
+	}
+	ahead_crc = crc16(length-tail, buf);
+	ahead_rest[0] = buf[ahead_head];
+	ahead_rest[1] = buf[ahead_head+1];
+	return ahead_elen;
+}
+
+void
+golay_encode_finish(__xdata uint8_t * __pdata tail, __xdata uint8_t * __pdata out)
+{
+	__xdata uint8_t gin[6];
+	__pdata uint8_t i, rest;
+	__pdata uint16_t crc;
+
+	// the bytes after the last whole group, then the tail, padded
+	// out to whole groups
+	rest = ahead_length - ahead_tail - ahead_head;
+	gin[0] = ahead_rest[0];
+	gin[1] = ahead_rest[1];
+	for (i = 0; i < ahead_tail; i++) {
+		gin[rest+i] = tail[i];
+	}
+	for (i = rest+ahead_tail; i < sizeof(gin); i++) {
+		gin[i] = 0;
+	}
+	offset_start=6+ahead_head; offset_end=6+((ahead_length+2)/3)*3-1;
+	golay_encode_portion(ahead_elen, gin, out);
+
+	// and the CRC
+	crc = crc16_continue(ahead_tail, tail, ahead_crc);
+	gin[0] = crc&0xFF;
+	gin[1] = crc>>8;
+	gin[2] = ahead_length;
+	offset_start=3; offset_end=5;
+	golay_encode_portion(ahead_elen, gin, out);
+
+	radio_buffer_count=ahead_elen;
+}
+
 bool 
 golay_decode_packet(uint8_t *length,__xdata uint8_t * __pdata buf,__xdata uint8_t elen)
 {
 	// Packet is already in radio_interleave_buffer, and length
-	// is in receive_packet_length
+	// is in elen
 
 	__xdata uint16_t crc1, crc2;
 	__xdata uint8_t errcount = 0;
@@ -55,5 +55,24 @@ extern uint8_t golay_decode(__pdata uint8_t n, __xdata uint8_t * __pdata in, __x
 // Prepare a packet for transmission
 extern void golay_encode_packet(uint8_t length, __xdata uint8_t * __pdata buf);
 
+/// Prepare a packet for transmission before its last few bytes are
+/// known. Everything but the CRC and the groups holding the last tail
+/// bytes is encoded into out, and golay_encode_finish() does the rest.
+///
+/// @param length	length of the packet, including the tail
+/// @param tail		number of bytes still to come, at most 4
+/// @param buf		the packet, without its tail
+/// @param out		the encoded packet
+/// @return		the encoded length
+extern uint8_t golay_encode_ahead(uint8_t length, uint8_t tail, __xdata uint8_t * __pdata buf, __xdata uint8_t * __pdata out);
+
+/// Finish the packet started by the last golay_encode_ahead(). Apart
+/// from the padding it ends up as golay_encode_packet() would have
+/// made it, in out, which must hold what golay_encode_ahead() made.
+///
+/// @param tail		the last bytes of the packet
+/// @param out		the encoded packet
+extern void golay_encode_finish(__xdata uint8_t * __pdata tail, __xdata uint8_t * __pdata out);
+
 // The reverse of the above: take such a prepared packet and decode it.
 extern bool golay_decode_packet(uint8_t *length,__xdata uint8_t * __pdata buf,__xdata uint8_t elen);
@@ -51,7 +51,7 @@
 
 /// Serial rx/tx interrupt handler.
 ///
-extern void	serial_interrupt(void)	__interrupt(INTERRUPT_UART0);
+extern void	serial_interrupt(void)	__interrupt(INTERRUPT_UART0) __using(1);
 
 /// Radio event interrupt handler.
 ///
@@ -87,12 +87,25 @@ static void radio_init(void);
 __pdata struct error_counts errors;
 __pdata struct statistics statistics, remote_statistics;
 
+/// error counts and serial buffer space of the other radio, if it sends
+/// them in its packet trailers
+__pdata struct error_counts remote_errors;
+__pdata uint8_t remote_serial_space;
+
+/// the buffer arena, shared between the serial buffers and the radio
+/// receive slots by buffers_init()
+static __xdata uint8_t buffer_arena[BUFFER_ARENA_SIZE];
+static __xdata uint16_t serial_rx_size, serial_tx_size;
+static __xdata uint8_t radio_rx_slots;
+
 /// optional features
 bool feature_golay;
 bool feature_golay_interleaving;
 bool feature_opportunistic_resend;
 bool feature_mavlink_framing;
+bool feature_mavlink_priority;
 bool feature_rtscts;
+__pdata uint8_t feature_frame_gap;
 
 void
 main(void)
@@ -112,10 +125,15 @@ main(void)
 
 	// setup boolean features
 	feature_mavlink_framing = param_get(PARAM_MAVLINK)?true:false;
+	feature_mavlink_priority = (param_get(PARAM_MAVLINK)==2)?true:false;
 	feature_opportunistic_resend = param_get(PARAM_OPPRESEND)?true:false;
 	feature_golay = param_get(PARAM_ECC)?true:false;
 	feature_golay_interleaving = (param_get(PARAM_ECC)==2)?true:false;
 	feature_rtscts = param_get(PARAM_RTSCTS)?true:false;
+	feature_frame_gap = param_get(PARAM_FRAME_GAP);
+
+	// share out the buffer arena before anything uses it
+	buffers_init();
 
 	// Do hardware initialisation.
 	hardware_init();
@@ -239,6 +257,49 @@ hardware_init(void)
 	XBR2	 =  0x40;		// Crossbar (GPIO) enable
 }
 
+void
+buffers_init(void)
+{
+	__pdata uint16_t spare;
+
+	serial_rx_size = param_get(PARAM_SER_RX_BUF);
+	serial_tx_size = param_get(PARAM_SER_TX_BUF);
+
+	// each size has been checked against the other when set, but
+	// fall back to the defaults if the pair doesn't fit anyway
+	if (serial_rx_size + serial_tx_size + MAX_PACKET_LENGTH > BUFFER_ARENA_SIZE) {
+		serial_rx_size = SERIAL_RX_BUF_DEFAULT;
+		serial_tx_size = SERIAL_TX_BUF_DEFAULT;
+	}
+
+	// the rest goes to radio receive slots
+	spare = BUFFER_ARENA_SIZE - serial_rx_size - serial_tx_size;
+	radio_rx_slots = 1 + spare / MAX_PACKET_LENGTH;
+	if (radio_rx_slots > RADIO_RX_SLOTS_MAX) {
+		radio_rx_slots = RADIO_RX_SLOTS_MAX;
+	}
+
+	serial_set_buffers(&buffer_arena[0], serial_rx_size,
+			   &buffer_arena[serial_rx_size], serial_tx_size);
+	radio_set_rx_slots(&buffer_arena[serial_rx_size + serial_tx_size], radio_rx_slots);
+}
+
+void
+buffers_show(void)
+{
+	printf("serial rx %u peak %u ovf %u\n",
+	       (unsigned)serial_rx_size,
+	       (unsigned)serial_rx_peak,
+	       (unsigned)errors.serial_rx_overflow);
+	printf("serial tx %u peak %u ovf %u\n",
+	       (unsigned)serial_tx_size,
+	       (unsigned)serial_tx_peak,
+	       (unsigned)errors.serial_tx_overflow);
+	printf("radio rx slots %u full %u\n",
+	       (unsigned)radio_rx_slots,
+	       (unsigned)errors.radio_rx_full);
+}
+
 static void
 radio_init(void)
 {
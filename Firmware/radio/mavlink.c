@@ -32,10 +32,12 @@
 /// mavlink reporting code
 ///
 
+#ifndef CONFIG_TEST
 #include <stdarg.h>
 #include "radio.h"
 #include "packet.h"
 #include "timer.h"
+#endif
 
 extern __xdata uint8_t pbuf[MAX_PACKET_LENGTH];
 static __pdata uint8_t seqnum;
@@ -44,9 +46,22 @@ extern bool using_mavlink_10;
 #define MAVLINK_MSG_ID_RADIO 166
 #define MAVLINK_RADIO_CRC_EXTRA 21
 
-// use '3D' for 3DRadio
-#define RADIO_SOURCE_SYSTEM '3'
-#define RADIO_SOURCE_COMPONENT 'D'
+uint16_t
+MAVLink_checksum(__xdata uint8_t * __data buf, __pdata uint8_t stoplen)
+{
+        __pdata uint16_t sum = 0xFFFF;
+	__pdata uint8_t i;
+
+	i = 1;
+	while (i<stoplen) {
+		register uint8_t tmp;
+		tmp = buf[i] ^ (uint8_t)(sum&0xff);
+		tmp ^= (tmp<<4);
+		sum = (sum>>8) ^ (tmp<<8) ^ (tmp<<3) ^ (tmp>>4);
+		i++;
+        }
+	return sum;
+}
 
 /*
  * Calculates the MAVLink checksum on a packet in pbuf[] 
@@ -55,8 +70,8 @@ extern bool using_mavlink_10;
 static void mavlink_crc(void)
 {
 	register uint8_t length = pbuf[1];
-        __pdata uint16_t sum = 0xFFFF;
-	__pdata uint8_t i, stoplen;
+        __pdata uint16_t sum;
+	__pdata uint8_t stoplen;
 
 	stoplen = length + 6;
 
@@ -66,14 +81,7 @@ static void mavlink_crc(void)
 		stoplen++;
 	}
 
-	i = 1;
-	while (i<stoplen) {
-		register uint8_t tmp;
-		tmp = pbuf[i] ^ (uint8_t)(sum&0xff);
-		tmp ^= (tmp<<4);
-		sum = (sum>>8) ^ (tmp<<8) ^ (tmp<<3) ^ (tmp>>4);
-		i++;
-        }
+	sum = MAVLink_checksum(pbuf, stoplen);
 
 	pbuf[length+6] = sum&0xFF;
 	pbuf[length+7] = sum>>8;
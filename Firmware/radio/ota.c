@@ -0,0 +1,393 @@
+// -*- Mode: C; c-basic-offset: 8; -*-
+//
+// Copyright (c) 2026 agent, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+///
+/// @file	ota.c
+///
+/// Over the air firmware update of the remote radio, see ota.h
+///
+
+#ifndef OTA_TEST
+#include <stdarg.h>
+#include <flash_layout.h>
+#include "radio.h"
+#include "timer.h"
+#include "ota.h"
+#endif
+
+#ifdef ENABLE_OTA
+
+/// the longest reply, to OTA_OP_PAGE_CRC
+#define OTA_REPLY_MAX		6
+
+/// how long to wait after an apply request before resetting, so the
+/// reply can get back to the host first, in 16usec ticks
+#define OTA_APPLY_DELAY		62500
+
+bool ota_relay_active;
+
+/// the request we are relaying to the other radio, waiting for its reply
+static __xdata uint8_t ota_tx[OTA_BLOCK_MAX];
+static __pdata uint8_t ota_tx_len;
+
+/// set when the request has been sent in this transmit window
+static bool ota_tx_sent;
+
+/// the last reply we made to the other radio, kept to answer a repeated
+/// request
+static __xdata uint8_t ota_reply[OTA_REPLY_MAX];
+static __pdata uint8_t ota_reply_len;
+
+/// set when the reply is waiting to be sent
+static bool ota_reply_pending;
+
+/// set when we should reset to apply a committed update
+static bool ota_apply_pending;
+static __pdata uint16_t ota_apply_time;
+
+/// add a byte to a CRC-16/CCITT, as the bootloader does
+///
+static uint16_t
+ota_crc_byte(__pdata uint16_t crc, __pdata uint8_t c)
+{
+	__pdata uint8_t i;
+
+	crc ^= (uint16_t)c << 8;
+	for (i = 0; i < 8; i++) {
+		if (crc & 0x8000) {
+			crc = (crc << 1) ^ 0x1021;
+		} else {
+			crc <<= 1;
+		}
+	}
+	return crc;
+}
+
+/// CRC-16/CCITT of a whole page of code flash
+///
+static uint16_t
+ota_page_crc(__pdata uint16_t address)
+{
+	__pdata uint16_t crc = 0xffff;
+	__pdata uint16_t i;
+
+	for (i = 0; i < FLASH_PAGE_SIZE; i++) {
+		crc = ota_crc_byte(crc, flash_read_code(address + i));
+	}
+	return crc;
+}
+
+/// check that the page in a staging slot matches its directory entry
+///
+/// @return		true if the entry is unused or the page matches
+///
+static bool
+ota_slot_valid(__pdata uint8_t slot)
+{
+	__pdata uint16_t entry = FLASH_STAGING_START + slot * STAGING_ENTRY_SIZE;
+	__pdata uint16_t crc;
+
+	if (flash_read_code(entry) == 0xff) {
+		return true;
+	}
+	crc = ota_page_crc(FLASH_STAGING_SLOT(slot));
+	return flash_read_code(entry + 1) == (uint8_t)crc &&
+		flash_read_code(entry + 2) == (uint8_t)(crc >> 8);
+}
+
+/// write a staging directory entry, unless it has been written already
+///
+static uint8_t
+ota_stage(__xdata uint8_t * __data args)
+{
+	__pdata uint16_t entry = FLASH_STAGING_START + args[0] * STAGING_ENTRY_SIZE;
+	__pdata uint8_t i, c;
+
+	if (args[0] >= FLASH_STAGING_SLOTS ||
+	    args[1] < (FLASH_APP_START >> FLASH_PAGE_SHIFT) ||
+	    args[1] >= (FLASH_STAGING_START >> FLASH_PAGE_SHIFT)) {
+		return OTA_ERR_ARGS;
+	}
+	if (flash_read_code(FLASH_STAGING_START + STAGING_MAGIC_OFFSET) != 0xff) {
+		// already committed
+		return OTA_ERR_STATE;
+	}
+	if (ota_page_crc(FLASH_STAGING_SLOT(args[0])) != (args[2] | ((uint16_t)args[3] << 8))) {
+		return OTA_ERR_CRC;
+	}
+	for (i = 0; i < STAGING_ENTRY_SIZE; i++) {
+		c = flash_read_code(entry + i);
+		if (c != args[i + 1]) {
+			if (c != 0xff) {
+				// a different entry, or half of one
+				return OTA_ERR_STATE;
+			}
+			flash_write_code(entry + i, args[i + 1]);
+		}
+	}
+	return OTA_OK;
+}
+
+/// run a request from the other radio, leaving the reply in ota_reply
+///
+static void
+ota_request(__xdata uint8_t * __data buf, __pdata uint8_t len)
+{
+	__xdata uint8_t * __data args = buf + 3;
+	__pdata uint8_t nargs = len - 3;
+	__pdata uint8_t status = OTA_ERR_ARGS;
+	__pdata uint16_t address, crc;
+	__pdata uint8_t i;
+
+	ota_reply_len = 4;
+
+	if (!ota_supported()) {
+		// our bootloader would boot the old image without
+		// applying anything
+		status = OTA_ERR_NO_REMOTE;
+		goto reply;
+	}
+
+	switch (buf[2]) {
+	case OTA_OP_START:
+		flash_erase_code(FLASH_STAGING_START);
+		status = OTA_OK;
+		break;
+
+	case OTA_OP_PAGE_CRC:
+		if (nargs == 1 &&
+		    args[0] >= (FLASH_APP_START >> FLASH_PAGE_SHIFT) &&
+		    args[0] < (FLASH_INFO_PAGE >> FLASH_PAGE_SHIFT)) {
+			crc = ota_page_crc((uint16_t)args[0] << FLASH_PAGE_SHIFT);
+			ota_reply[4] = crc & 0xff;
+			ota_reply[5] = crc >> 8;
+			ota_reply_len = 6;
+			status = OTA_OK;
+		}
+		break;
+
+	case OTA_OP_WRITE:
+		if (nargs < 3 || args[0] >= FLASH_STAGING_SLOTS) {
+			break;
+		}
+		address = args[1] | ((uint16_t)args[2] << 8);
+		nargs -= 3;
+		if (address + nargs > FLASH_PAGE_SIZE) {
+			break;
+		}
+		address += FLASH_STAGING_SLOT(args[0]);
+		if ((address & (FLASH_PAGE_SIZE - 1)) == 0) {
+			flash_erase_code(address);
+		}
+		status = OTA_OK;
+		for (i = 0; i < nargs; i++) {
+			flash_write_code(address + i, args[3 + i]);
+			if (flash_read_code(address + i) != args[3 + i]) {
+				// the slot wasn't erased first
+				status = OTA_ERR_CRC;
+			}
+		}
+		break;
+
+	case OTA_OP_STAGE:
+		if (nargs == 4) {
+			status = ota_stage(args);
+		}
+		break;
+
+	case OTA_OP_COMMIT:
+		// the bootloader ignores a directory with nothing staged
+		status = OTA_ERR_STATE;
+		for (i = 0; i < FLASH_STAGING_SLOTS; i++) {
+			if (!ota_slot_valid(i)) {
+				status = OTA_ERR_CRC;
+				break;
+			}
+			if (flash_read_code(FLASH_STAGING_START + i * STAGING_ENTRY_SIZE) != 0xff) {
+				status = OTA_OK;
+			}
+		}
+		if (status == OTA_OK) {
+			flash_write_code(FLASH_STAGING_START + STAGING_MAGIC_OFFSET, STAGING_MAGIC);
+		}
+		break;
+
+	case OTA_OP_APPLY:
+		if (flash_read_code(FLASH_STAGING_START + STAGING_MAGIC_OFFSET) != STAGING_MAGIC) {
+			status = OTA_ERR_STATE;
+			break;
+		}
+		ota_apply_pending = true;
+		ota_apply_time = timer2_tick();
+		status = OTA_OK;
+		break;
+	}
+
+reply:
+	ota_reply[0] = OTA_MAGIC;
+	ota_reply[1] = buf[1];
+	ota_reply[2] = buf[2] | OTA_REPLY;
+	ota_reply[3] = status;
+	ota_reply_pending = true;
+}
+
+/// answer the host directly, for requests that don't go over the air
+///
+static void
+ota_serial_reply(__pdata uint8_t status)
+{
+	serial_write(OTA_MAGIC);
+	serial_write(3);
+	serial_write(ota_tx[1]);
+	serial_write(ota_tx[2] | OTA_REPLY);
+	serial_write(status);
+}
+
+bool
+ota_supported(void)
+{
+	return g_board_bl_version >= OTA_BL_VERSION;
+}
+
+void
+ota_relay_start(void)
+{
+	ota_relay_active = true;
+	ota_tx_len = 0;
+}
+
+void
+ota_poll(bool remote_ota)
+{
+	__pdata uint8_t len;
+
+	if (ota_apply_pending && !ota_reply_pending &&
+	    (uint16_t)(timer2_tick() - ota_apply_time) > OTA_APPLY_DELAY) {
+#ifdef OTA_TEST
+		ota_test_reset();
+		return;
+#else
+		// the bootloader applies the update
+		RSTSRC |= (1 << 4);
+		for (;;)
+			;
+#endif
+	}
+
+	if (at_mode_active) {
+		// +++ gets the user out of a stuck update
+		ota_relay_active = false;
+	}
+	if (!ota_relay_active || serial_read_available() < 2) {
+		return;
+	}
+
+	// resynchronise on the magic byte and a sensible length
+	len = serial_peek2();
+	if (serial_peek() != OTA_MAGIC || len < 2 || len >= OTA_BLOCK_MAX) {
+		serial_read();
+		return;
+	}
+	if (serial_read_available() < 2 + (uint16_t)len) {
+		return;
+	}
+	serial_read();
+	serial_read();
+
+	// a new request replaces any that wasn't answered
+	ota_tx[0] = OTA_MAGIC;
+	serial_read_buf(&ota_tx[1], len);
+	ota_tx_len = 0;
+
+	if (ota_tx[2] == OTA_OP_END) {
+		ota_relay_active = false;
+		ota_serial_reply(OTA_OK);
+	} else if (!remote_ota) {
+		ota_serial_reply(OTA_ERR_NO_REMOTE);
+	} else {
+		ota_tx_len = len + 1;
+		ota_tx_sent = false;
+	}
+}
+
+void
+ota_handle(__xdata uint8_t * __data buf, __pdata uint8_t len)
+{
+	if (len < 3) {
+		return;
+	}
+
+	if (buf[2] & OTA_REPLY) {
+		// the answer to our request, if it is still wanted
+		if (ota_tx_len != 0 &&
+		    buf[1] == ota_tx[1] &&
+		    buf[2] == (ota_tx[2] | OTA_REPLY)) {
+			serial_write(OTA_MAGIC);
+			serial_write(len - 1);
+			serial_write_buf(buf + 1, len - 1);
+			ota_tx_len = 0;
+		}
+		return;
+	}
+
+	if (ota_reply_len != 0 &&
+	    buf[1] == ota_reply[1] &&
+	    (buf[2] | OTA_REPLY) == ota_reply[2]) {
+		// our reply was lost, send it again
+		ota_reply_pending = true;
+		return;
+	}
+	ota_request(buf, len);
+}
+
+uint8_t
+ota_next_block(__xdata uint8_t * __data buf, __pdata uint8_t max)
+{
+	if (ota_reply_pending) {
+		if (ota_reply_len > max) {
+			return 0;
+		}
+		memcpy(buf, ota_reply, ota_reply_len);
+		ota_reply_pending = false;
+		return ota_reply_len;
+	}
+	if (ota_tx_len != 0 && !ota_tx_sent && ota_tx_len <= max) {
+		memcpy(buf, ota_tx, ota_tx_len);
+		ota_tx_sent = true;
+		return ota_tx_len;
+	}
+	return 0;
+}
+
+void
+ota_window(void)
+{
+	ota_tx_sent = false;
+}
+
+#endif // ENABLE_OTA
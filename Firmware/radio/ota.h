@@ -0,0 +1,130 @@
+// -*- Mode: C; c-basic-offset: 8; -*-
+//
+// Copyright (c) 2026 agent, All Rights Reserved
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+//  o Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  o Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in
+//    the documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+///
+/// @file	ota.h
+///
+/// Over the air firmware update of the remote radio
+///
+/// A host on the serial port of the local radio sends AT&OTA, and then
+/// talks to the remote radio in frames which the local radio relays over
+/// the TDM link as command packets. The remote radio writes the pages
+/// that differ from its running image into the staging area (see
+/// flash_layout.h), and the bootloader copies them into place on the
+/// next reset. tools/ota_update.py is the host side.
+///
+/// None of this is built without OTA=1, as then the application is
+/// allowed to use the flash where the staging area would be.
+///
+/// Serial frames, host to local radio and back:
+///
+/// <OTA_MAGIC><len><seq><op><args>			request, len counts from seq
+/// <OTA_MAGIC><len><seq><op|OTA_REPLY><status><data>	reply
+///
+/// Over the air the length is dropped, as the packet carries it:
+///
+/// <OTA_MAGIC><seq><op><args>
+/// <OTA_MAGIC><seq><op|OTA_REPLY><status><data>
+///
+/// The host sends one request at a time. The local radio sends it in
+/// each transmit window until the reply comes back, and the remote radio
+/// answers a repeated request with its last reply rather than running it
+/// again, so lost and duplicated packets are harmless.
+///
+
+#ifndef _OTA_H_
+#define _OTA_H_
+
+#define OTA_MAGIC		0xb7
+#define OTA_REPLY		0x80
+
+#define OTA_OP_START		1	///< erase the staging directory
+#define OTA_OP_PAGE_CRC		2	///< <page> -> <crc low><crc high> of a code page
+#define OTA_OP_WRITE		3	///< <slot><offset low><offset high><data>, erasing the slot at offset 0
+#define OTA_OP_STAGE		4	///< <slot><page><crc low><crc high>, mark a slot as holding a page
+#define OTA_OP_COMMIT		5	///< mark the staged pages as ready to apply
+#define OTA_OP_APPLY		6	///< reset into the bootloader to apply them
+#define OTA_OP_END		7	///< local radio only, stop relaying
+
+#define OTA_OK			0
+#define OTA_ERR_ARGS		1
+#define OTA_ERR_CRC		2
+#define OTA_ERR_STATE		3
+#define OTA_ERR_NO_REMOTE	4	///< the other radio is not there or can't update
+
+/// most data bytes in one OTA_OP_WRITE
+#define OTA_DATA_MAX		64
+
+/// longest block sent over the air
+#define OTA_BLOCK_MAX		(3 + 3 + OTA_DATA_MAX)
+
+/// the first bootloader version that copies staged pages into place;
+/// older ones boot straight back into the old image
+#define OTA_BL_VERSION		2
+
+/// check whether this radio can take an update
+///
+/// @return		true if started by a bootloader that will apply it
+///
+extern bool ota_supported(void);
+
+/// set while the serial port carries OTA frames rather than user data
+extern bool ota_relay_active;
+
+/// start relaying OTA frames from the serial port, after AT&OTA
+///
+extern void ota_relay_start(void);
+
+/// read OTA frames from the serial port, and reset to apply an update
+/// once one has been committed and the host has asked for it
+///
+/// @param remote_ota	true if the other radio can take OTA requests
+///
+extern void ota_poll(bool remote_ota);
+
+/// handle an OTA block received from the other radio
+///
+/// @param buf		the block, starting with OTA_MAGIC
+/// @param len		its length
+///
+extern void ota_handle(__xdata uint8_t * __data buf, __pdata uint8_t len);
+
+/// get the next OTA block to send to the other radio
+///
+/// @param buf		buffer for the block
+/// @param max		the most bytes that can be sent
+/// @return		the block length, or 0 if there is nothing to send
+///
+extern uint8_t ota_next_block(__xdata uint8_t * __data buf, __pdata uint8_t max);
+
+/// called at the start of each of our transmit windows, to allow an
+/// unanswered request to be sent again
+///
+extern void ota_window(void);
+
+#endif // _OTA_H_
@@ -36,6 +36,8 @@
 #include "radio.h"
 #include "packet.h"
 #include "timer.h"
+#include "ota.h"
+#include "config.h"
 
 static __bit last_sent_is_resend;
 static __bit last_sent_is_injected;
@@ -62,9 +64,18 @@ static __pdata uint16_t mav_pkt_max_time;
 
 static __pdata uint8_t mav_max_xmit;
 
+// the bytes at the head of the serial buffer that are the rest of a
+// MAVLink frame that was split across packets, if known
+static __pdata uint8_t split_rest;
+
 // true if we have a injected packet to send
 static bool injected_packet;
 
+// set while a configuration frame is at the head of the serial
+// buffer, and when it first got there
+static bool config_waiting;
+static __pdata uint16_t config_start_time;
+
 // have we seen a mavlink packet?
 bool seen_mavlink;
 bool using_mavlink_10;
@@ -74,6 +85,58 @@ bool using_mavlink_10;
 #define MAVLINK09_STX 85 // 'U'
 #define MAVLINK10_STX 254
 
+// MAVLink messages that jump the queue with MAVLINK=2. These are the
+// ones someone is waiting on: commands and manual control
+static const __code uint8_t priority_msgs[] = {
+	11,	// SET_MODE
+	69,	// MANUAL_CONTROL
+	70,	// RC_CHANNELS_OVERRIDE
+	75,	// COMMAND_INT
+	76,	// COMMAND_LONG
+	77,	// COMMAND_ACK
+};
+
+// MAVLink streams that are sent over and over. With MAVLINK=2 the
+// oldest of these are dropped when the serial buffer is about to
+// overflow, as a newer copy will follow, rather than losing bytes
+// from whatever arrives next
+static const __code uint8_t shed_msgs[] = {
+	1,	// SYS_STATUS
+	24,	// GPS_RAW_INT
+	27,	// RAW_IMU
+	29,	// SCALED_PRESSURE
+	30,	// ATTITUDE
+	33,	// GLOBAL_POSITION_INT
+	35,	// RC_CHANNELS_RAW
+	36,	// SERVO_OUTPUT_RAW
+	62,	// NAV_CONTROLLER_OUTPUT
+	65,	// RC_CHANNELS
+	74,	// VFR_HUD
+};
+
+// start shedding streams when less than this percentage of the
+// serial buffer is free
+#define PACKET_SHED_SPACE 25
+
+// frames that FRAME_GAP keeps whole without waiting for the serial
+// line to go idle
+#define RTCM3_PREAMBLE	0xD3
+#define NMEA_MAX	82
+
+// where the serial line last went quiet for FRAME_GAP byte times, as
+// serial_read_mark() positions, oldest first
+#define GAP_MARKS	8
+static __pdata uint16_t gap_marks[GAP_MARKS];
+static __pdata uint8_t gap_count;
+
+// the serial_read_mark() position when more last came in, and when
+static __pdata uint16_t gap_mark;
+static __pdata uint16_t gap_time;
+static bool gap_idle;
+
+// the biggest packet we have been asked for with FRAME_GAP set
+static __pdata uint8_t gap_max;
+
 // check if a buffer looks like a MAVLink heartbeat packet - this
 // is used to determine if we will inject RADIO status MAVLink
 // messages into the serial stream for ground station and aircraft
@@ -93,16 +156,94 @@ static void check_heartbeat(__xdata uint8_t * __pdata buf)
 	}
 }
 
+// count the bytes at the head of the serial buffer before the next
+// MAVLink start byte, looking at no more than max bytes. This looks at
+// the serial buffer in place
+static uint8_t
+bytes_before_stx(register uint8_t max)
+{
+	__pdata struct serial_span spans[2];
+	__xdata uint8_t * __data p;
+	__pdata uint16_t len;
+	__pdata uint8_t i, n;
+
+	serial_read_spans(spans);
+	n = 0;
+	for (i = 0; i < 2; i++) {
+		p = spans[i].ptr;
+		len = spans[i].len;
+		while (len-- != 0) {
+			if (n == max ||
+			    *p == MAVLINK09_STX || *p == MAVLINK10_STX) {
+				return n;
+			}
+			p++;
+			n++;
+		}
+	}
+	return n;
+}
+
+// check whether the serial buffer starts with a configuration frame
+// for us, rather than data to send
+static bool
+config_frame_next(register uint16_t slen)
+{
+	__pdata uint8_t hdr[CONFIG_HEADER_LEN];
+
+	if (slen > CONFIG_HEADER_LEN) {
+		slen = CONFIG_HEADER_LEN;
+	}
+	serial_peek_buf(hdr, slen);
+	return config_header(hdr, slen);
+}
+
+// answer a configuration frame at the head of the serial buffer,
+// waiting up to its time on the serial link for all of it
+//
+// @return		true if there is nothing to send this time
+static bool
+config_frame(register uint16_t slen, __xdata uint8_t * __pdata buf)
+{
+	__pdata uint8_t len;
+
+	if (slen == 0 || !config_frame_next(slen)) {
+		config_waiting = false;
+		return false;
+	}
+	len = CONFIG_HEADER_LEN;
+	if (slen > 1) {
+		len = serial_peek2() + CONFIG_OVERHEAD;
+	}
+	if (slen < len) {
+		if (!config_waiting) {
+			config_waiting = true;
+			config_start_time = timer2_tick();
+		}
+		// if the rest never comes, send it on as data
+		return (uint16_t)(timer2_tick() - config_start_time) <= len * serial_rate;
+	}
+	config_waiting = false;
+
+	// any MAVLink frame we were waiting for was this one
+	mav_pkt_len = 0;
+	split_rest = 0;
+
+	serial_read_buf(buf, len);
+	config_handle(buf, len);
+	return true;
+}
+
 // return a complete MAVLink frame, possibly expanding
 // to include other complete frames that fit in the max_xmit limit
 static 
 uint8_t mavlink_frame(uint8_t max_xmit, __xdata uint8_t * __pdata buf)
 {
 	__data uint16_t slen;
+	__pdata uint8_t hdr[2];
 
-	serial_read_buf(last_sent, mav_pkt_len);
+	serial_read_buf(buf, mav_pkt_len);
 	last_sent_len = mav_pkt_len;
-	memcpy(buf, last_sent, last_sent_len);
 	mav_pkt_len = 0;
 
 	check_heartbeat(buf);
@@ -112,12 +253,18 @@ uint8_t mavlink_frame(uint8_t max_xmit, __xdata uint8_t * __pdata buf)
 	// see if we have more complete MAVLink frames in the serial
 	// buffer that we can fit in this packet
 	while (slen >= 8) {
-		register uint8_t c = serial_peek();
-		if (c != MAVLINK09_STX && c != MAVLINK10_STX) {
+		register uint8_t c;
+
+		serial_peek_buf(hdr, 2);
+		if (hdr[0] != MAVLINK09_STX && hdr[0] != MAVLINK10_STX) {
 			// its not a MAVLink packet
-			return last_sent_len;			
+			break;
+		}
+		if (config_frame_next(slen)) {
+			// it is for us, not the other radio
+			break;
 		}
-		c = serial_peek2();
+		c = hdr[1];
 		if (c >= 255 - 8 || 
 		    c+8 > max_xmit - last_sent_len) {
 			// it won't fit
@@ -132,8 +279,7 @@ uint8_t mavlink_frame(uint8_t max_xmit, __xdata uint8_t * __pdata buf)
 		c += 8;
 
 		// we can add another MAVLink frame to the packet
-		serial_read_buf(&last_sent[last_sent_len], c);
-		memcpy(&buf[last_sent_len], &last_sent[last_sent_len], c);
+		serial_read_buf(&buf[last_sent_len], c);
 
 		check_heartbeat(buf+last_sent_len);
 
@@ -141,15 +287,261 @@ uint8_t mavlink_frame(uint8_t max_xmit, __xdata uint8_t * __pdata buf)
 		slen -= c;
 	}
 
+	memcpy(last_sent, buf, last_sent_len);
 	return last_sent_len;
 }
 
 
+// the length of the complete MAVLink frame ofs bytes into the serial
+// buffer, or zero if there isn't one there
+static uint8_t
+frame_at(__pdata uint16_t ofs, __pdata uint16_t slen)
+{
+	register uint8_t c;
+
+	if (ofs + 8 > slen) {
+		return 0;
+	}
+	c = serial_peek_at(ofs);
+	if (c != MAVLINK09_STX && c != MAVLINK10_STX) {
+		return 0;
+	}
+	c = serial_peek_at(ofs + 1);
+	if (c >= 255 - 8 || ofs + c + 8 > slen) {
+		return 0;
+	}
+	return c + 8;
+}
+
+// where the first whole MAVLink frame in the serial buffer starts,
+// after the rest of any frame that was split across packets
+static uint16_t
+first_frame(void)
+{
+	if (split_rest != 0) {
+		return split_rest;
+	}
+	return bytes_before_stx(255);
+}
+
+// check if a message ID is in one of the lists above
+static bool
+msg_listed(__code const uint8_t * __pdata list, __pdata uint8_t n, register uint8_t msgid)
+{
+	while (n--) {
+		if (*list++ == msgid) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// take count bytes out of the serial buffer ofs bytes in. The bytes in
+// front of them move up, so the FRAME_GAP marks among them move too,
+// and a mark inside the bytes cut goes to where they were
+static void
+packet_cut(__pdata uint16_t ofs, __pdata uint16_t count)
+{
+	__pdata uint16_t len;
+	__pdata uint8_t i;
+
+	for (i = 0; i < gap_count; i++) {
+		len = serial_mark_offset(gap_marks[i]);
+		if (len <= ofs) {
+			gap_marks[i] += count;
+		} else if (len < ofs + count) {
+			gap_marks[i] += ofs + count - len;
+		}
+	}
+	serial_read_cut(ofs, count);
+}
+
+// take the priority MAVLink frames out of the serial buffer, wherever
+// they are in it, as long as they fit in max_xmit. The walk through
+// the frames stops at anything that isn't a complete MAVLink frame
+static uint8_t
+priority_frames(register uint8_t max_xmit, __xdata uint8_t * __pdata buf)
+{
+	__pdata uint16_t ofs, slen;
+	__pdata uint8_t i, n, len;
+
+	slen = serial_read_available();
+	ofs = first_frame();
+	len = 0;
+	while ((n = frame_at(ofs, slen)) != 0) {
+		if (!msg_listed(priority_msgs, sizeof(priority_msgs), serial_peek_at(ofs + 5))) {
+			ofs += n;
+			continue;
+		}
+		if (n > max_xmit - len) {
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			buf[len + i] = serial_peek_at(ofs + i);
+		}
+		packet_cut(ofs, n);
+		if (ofs == 0) {
+			// any MAVLink frame we were waiting for was
+			// this one
+			mav_pkt_len = 0;
+		}
+		len += n;
+		slen -= n;
+	}
+	if (len != 0) {
+		memcpy(last_sent, buf, len);
+		last_sent_len = len;
+		last_sent_is_resend = false;
+	}
+	return len;
+}
+// the length of the whole RTCM3 message or NMEA sentence ofs bytes
+// into the serial buffer, or zero if there isn't one there
+static uint16_t
+known_frame_at(__pdata uint16_t ofs, __pdata uint16_t avail)
+{
+	__pdata uint16_t len;
+	register uint8_t c;
+
+	if (ofs >= avail) {
+		return 0;
+	}
+	c = serial_peek_at(ofs);
+	if (c == RTCM3_PREAMBLE) {
+		// 10 bit length after 6 reserved zero bits, then the
+		// message and a 24 bit CRC
+		if (ofs + 3 > avail) {
+			return 0;
+		}
+		c = serial_peek_at(ofs + 1);
+		if (c & 0xFC) {
+			return 0;
+		}
+		len = (((uint16_t)c << 8) | serial_peek_at(ofs + 2)) + 6;
+		return ofs + len <= avail ? len : 0;
+	}
+	if (c == '$' || c == '!') {
+		// printable characters up to CR LF
+		for (len = 1; len < NMEA_MAX && ofs + len < avail; len++) {
+			c = serial_peek_at(ofs + len);
+			if (c == '\n') {
+				return len + 1;
+			}
+			if ((c < ' ' || c > '~') && c != '\r') {
+				break;
+			}
+		}
+	}
+	return 0;
+}
+
+// with FRAME_GAP set, how many bytes at the head of the serial buffer
+// to send now, at most max, so that packets end where the frames of
+// the application's protocol end. Whole RTCM3 messages and NMEA
+// sentences go as soon as they are in, and anything else up to where
+// the serial line went quiet for FRAME_GAP byte times. Frames that
+// won't fit in any packet are sent as they come
+static uint8_t
+gap_frames(__pdata uint8_t max, __pdata uint8_t max_xmit)
+{
+	__pdata uint16_t avail, n, len;
+	__pdata uint8_t i;
+
+	avail = serial_read_available();
+	if (max_xmit > gap_max) {
+		gap_max = max_xmit;
+	}
+
+	// forget the ends of frames that have been sent
+	while (gap_count != 0) {
+		len = serial_mark_offset(gap_marks[0]);
+		if (len != 0 && len <= avail) {
+			break;
+		}
+		gap_count--;
+		for (i = 0; i < gap_count; i++) {
+			gap_marks[i] = gap_marks[i + 1];
+		}
+	}
+
+	// as many whole frames as fit
+	n = 0;
+	for (;;) {
+		len = known_frame_at(n, avail);
+		if (len == 0 || n + len > max) {
+			break;
+		}
+		n += len;
+	}
+	if (len > gap_max) {
+		// the next frame won't fit in any packet, so start it
+		// in the space left in this one
+		return max;
+	}
+	if (n != 0) {
+		return n;
+	}
+	if (len != 0) {
+		// a whole frame that will fit in a later packet
+		return 0;
+	}
+
+	// up to the last quiet spell that fits
+	for (i = gap_count; i-- != 0; ) {
+		len = serial_mark_offset(gap_marks[i]);
+		if (len <= max) {
+			return len;
+		}
+	}
+	len = gap_count != 0 ? serial_mark_offset(gap_marks[0]) : avail;
+	if (len <= gap_max) {
+		// the frame is still arriving, or will fit in a
+		// later packet
+		return 0;
+	}
+	return max;
+}
+
+// with FRAME_GAP set, note where the serial line goes quiet
+static void
+gap_poll(void)
+{
+	__pdata uint16_t mark;
+	__pdata uint8_t i;
+
+	mark = serial_read_mark();
+	if (mark != gap_mark) {
+		// more has come in
+		gap_mark = mark;
+		gap_time = timer2_tick();
+		gap_idle = false;
+		return;
+	}
+	if (gap_idle ||
+	    (uint16_t)(timer2_tick() - gap_time) < feature_frame_gap * serial_rate) {
+		return;
+	}
+	// a frame ends here
+	gap_idle = true;
+	if (gap_count == GAP_MARKS) {
+		gap_count--;
+		for (i = 0; i < gap_count; i++) {
+			gap_marks[i] = gap_marks[i + 1];
+		}
+	}
+	gap_marks[gap_count++] = mark;
+}
+
 // return the next packet to be sent
+//
+// The packet is read from the serial buffer straight into buf, and
+// copied to last_sent once it is complete in case it needs resending
 uint8_t
 packet_get_next(register uint8_t max_xmit, __xdata uint8_t * __pdata buf)
 {
 	register uint16_t slen;
+	__pdata uint8_t hdr[2];
+	__pdata uint8_t n;
 
 	if (injected_packet) {
 		// send a previously injected packet
@@ -170,7 +562,29 @@ packet_get_next(register uint8_t max_xmit, __xdata uint8_t * __pdata buf)
 	}
 	last_sent_is_injected = false;
 
+	if (at_mode_active) {
+		// what is in the serial buffer is for the AT command
+		// processor
+		return 0;
+	}
+#ifdef ENABLE_OTA
+	if (ota_relay_active) {
+		// or is an over the air update
+		return 0;
+	}
+#endif
+
 	slen = serial_read_available();
+	if (config_frame(slen, buf)) {
+		// a configuration frame was answered, or is
+		// on its way
+		return 0;
+	}
+	if (feature_mavlink_priority && !force_resend &&
+	    (n = priority_frames(max_xmit, buf)) != 0) {
+		// commands and manual control go first
+		return n;
+	}
 	if (force_resend ||
 	    (feature_opportunistic_resend &&
 	     last_sent_is_resend == false && 
@@ -201,6 +615,9 @@ packet_get_next(register uint8_t max_xmit, __xdata uint8_t * __pdata buf)
 	}
 
 	if (!feature_mavlink_framing) {
+		if (feature_frame_gap != 0) {
+			slen = gap_frames(slen, max_xmit);
+		}
 		// simple framing
 		if (slen > 0 && serial_read_buf(buf, slen)) {
 			memcpy(last_sent, buf, slen);
@@ -217,9 +634,15 @@ packet_get_next(register uint8_t max_xmit, __xdata uint8_t * __pdata buf)
 		// we're waiting for the MAVLink length byte
 		if (slen == 1) {
 			if ((uint16_t)(timer2_tick() - mav_pkt_start_time) > mav_pkt_max_time) {
-				// we didn't get the length byte in time
-				last_sent[last_sent_len++] = serial_read();
-				memcpy(buf, last_sent, last_sent_len);				
+				// we didn't get the length byte in time,
+				// or there was no room for more
+				if (serial_read_available() > 1 &&
+				    serial_peek2() < 255 - 8) {
+					split_rest = serial_peek2() + 7;
+				}
+				serial_read_buf(buf, 1);
+				last_sent_len = 1;
+				memcpy(last_sent, buf, last_sent_len);
 				mav_pkt_len = 0;
 				return last_sent_len;
 			}
@@ -236,10 +659,12 @@ packet_get_next(register uint8_t max_xmit, __xdata uint8_t * __pdata buf)
 		if (slen < mav_pkt_len) {
 			if ((uint16_t)(timer2_tick() - mav_pkt_start_time) > mav_pkt_max_time) {
 				// timeout waiting for the rest of
-				// it. Send what we have now.
-				serial_read_buf(last_sent, slen);
+				// it. Send what we have now, and keep
+				// track of the rest
+				serial_read_buf(buf, slen);
+				split_rest = mav_pkt_len - slen;
 				last_sent_len = slen;
-				memcpy(buf, last_sent, last_sent_len);
+				memcpy(last_sent, buf, last_sent_len);
 				mav_pkt_len = 0;
 				return last_sent_len;
 			}
@@ -253,60 +678,78 @@ packet_get_next(register uint8_t max_xmit, __xdata uint8_t * __pdata buf)
 	}
 		
 	while (slen > 0) {
-		register uint8_t c = serial_peek();
-		if (c == MAVLINK09_STX || c == MAVLINK10_STX) {
-			if (slen == 1) {
-				// we got a bare MAVLink header byte
-				if (last_sent_len == 0) {
-					// wait for the next byte to
-					// give us the length
-					mav_pkt_len = 1;
-					mav_pkt_start_time = timer2_tick();
-					mav_pkt_max_time = serial_rate;
-					return 0;
+		// take the rest of a split frame, or everything up
+		// to the next MAVLink header, in one go
+		if (split_rest != 0) {
+			n = split_rest < slen ? split_rest : slen;
+			split_rest -= n;
+		} else {
+			n = bytes_before_stx(slen);
+			if (n == slen && feature_frame_gap != 0) {
+				// they run to the end of what has come
+				// in, so may be a frame still arriving
+				n = gap_frames(n, max_xmit);
+				if (n == 0) {
+					break;
 				}
-				break;
-			}
-			mav_pkt_len = serial_peek2();
-			if (mav_pkt_len >= 255-8 ||
-			    mav_pkt_len+8 > mav_max_xmit) {
-				// its too big for us to cope with
-				mav_pkt_len = 0;
-				last_sent[last_sent_len++] = serial_read();
-				slen--;				
-				continue;
 			}
+		}
+		if (n != 0) {
+			serial_read_buf(&buf[last_sent_len], n);
+			last_sent_len += n;
+			slen -= n;
+			continue;
+		}
 
-			// the length byte doesn't include
-			// the header or CRC
-			mav_pkt_len += 8;
-			
-			if (last_sent_len != 0) {
-				// send what we've got so far,
-				// and send the MAVLink payload
-				// in the next packet
-				memcpy(buf, last_sent, last_sent_len);
-				mav_pkt_start_time = timer2_tick();
-				mav_pkt_max_time = mav_pkt_len * serial_rate;
-				return last_sent_len;
-			} else if (mav_pkt_len > slen) {
-				// the whole MAVLink packet isn't in
-				// the serial buffer yet. 
+		if (slen == 1) {
+			// we got a bare MAVLink header byte
+			if (last_sent_len == 0) {
+				// wait for the next byte to
+				// give us the length
+				mav_pkt_len = 1;
 				mav_pkt_start_time = timer2_tick();
-				mav_pkt_max_time = mav_pkt_len * serial_rate;
-				return 0;					
-			} else {
-				// the whole packet is there
-				// and ready to be read
-				return mavlink_frame(max_xmit, buf);
+				mav_pkt_max_time = serial_rate;
+				return 0;
 			}
+			break;
+		}
+		serial_peek_buf(hdr, 2);
+		mav_pkt_len = hdr[1];
+		if (mav_pkt_len >= 255-8 ||
+		    mav_pkt_len+8 > mav_max_xmit) {
+			// its too big for us to cope with
+			mav_pkt_len = 0;
+			serial_read_buf(&buf[last_sent_len++], 1);
+			slen--;				
+			continue;
+		}
+
+		// the length byte doesn't include
+		// the header or CRC
+		mav_pkt_len += 8;
+			
+		if (last_sent_len != 0) {
+			// send what we've got so far,
+			// and send the MAVLink payload
+			// in the next packet
+			memcpy(last_sent, buf, last_sent_len);
+			mav_pkt_start_time = timer2_tick();
+			mav_pkt_max_time = mav_pkt_len * serial_rate;
+			return last_sent_len;
+		} else if (mav_pkt_len > slen) {
+			// the whole MAVLink packet isn't in
+			// the serial buffer yet. 
+			mav_pkt_start_time = timer2_tick();
+			mav_pkt_max_time = mav_pkt_len * serial_rate;
+			return 0;					
 		} else {
-			last_sent[last_sent_len++] = serial_read();
-			slen--;
+			// the whole packet is there
+			// and ready to be read
+			return mavlink_frame(max_xmit, buf);
 		}
 	}
 
-	memcpy(buf, last_sent, last_sent_len);
+	memcpy(last_sent, buf, last_sent_len);
 	return last_sent_len;
 }
 
@@ -326,6 +769,13 @@ packet_is_injected(void)
 	return last_sent_is_injected;
 }
 
+// return true if an injected packet is waiting to be sent
+bool
+packet_injected_waiting(void)
+{
+	return injected_packet;
+}
+
 // force the last packet to be resent. Used when transmit fails
 void
 packet_force_resend(void)
@@ -333,6 +783,51 @@ packet_force_resend(void)
 	force_resend = true;
 }
 
+// with MAVLINK=2, drop the oldest repeated stream messages from the
+// serial buffer when it is close to overflowing
+static void
+shed_streams(void)
+{
+	__pdata uint16_t ofs, slen;
+	__pdata uint8_t n;
+
+	if (!feature_mavlink_priority || at_mode_active ||
+	    serial_read_space() >= PACKET_SHED_SPACE) {
+		return;
+	}
+#ifdef ENABLE_OTA
+	if (ota_relay_active) {
+		return;
+	}
+#endif
+	slen = serial_read_available();
+	ofs = first_frame();
+	while ((n = frame_at(ofs, slen)) != 0) {
+		if (!msg_listed(shed_msgs, sizeof(shed_msgs), serial_peek_at(ofs + 5))) {
+			ofs += n;
+			continue;
+		}
+		packet_cut(ofs, n);
+		if (ofs == 0) {
+			mav_pkt_len = 0;
+		}
+		slen -= n;
+		if (serial_read_space() >= PACKET_SHED_SPACE) {
+			break;
+		}
+	}
+}
+
+// look after the serial buffer, called from the main loop
+void
+packet_poll(void)
+{
+	if (feature_frame_gap != 0) {
+		gap_poll();
+	}
+	shed_streams();
+}
+
 // set the maximum size of a packet
 void
 packet_set_max_xmit(uint8_t max)
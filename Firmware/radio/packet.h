@@ -45,6 +45,11 @@ extern bool packet_is_resend(void);
 /// @return			true is injected
 extern bool packet_is_injected(void);
 
+/// return true if an injected packet is waiting to be sent
+///
+/// @return			true if packet_get_next() will return it
+extern bool packet_injected_waiting(void);
+
 /// determine if a received packet is a duplicate
 ///
 /// @return			true if this is a duplicate
@@ -54,6 +59,12 @@ extern bool packet_is_duplicate(uint8_t len, __xdata uint8_t * __pdata buf, bool
 /// failed
 extern void packet_force_resend(void);
 
+/// look after the serial buffer, called from the main loop. With
+/// FRAME_GAP set this notes where the serial line goes quiet, and with
+/// MAVLINK=2 it makes room in the buffer when it is close to
+/// overflowing by dropping old copies of repeated MAVLink streams
+extern void packet_poll(void);
+
 /// set the maximum size of a packet
 ///
 extern void packet_set_max_xmit(uint8_t max);
@@ -35,8 +35,17 @@
 /// It is up to the caller to decide how large a parameter is and to
 /// access it accordingly.
 ///
-/// When saved, parameters are copied bitwise to the flash scratch page,
-/// with an 8-bit XOR checksum appended to the end of the flash range.
+/// Parameters are saved to the flash scratch page as a log. The page
+/// starts with a header holding PARAM_LOG_MAGIC and the parameter
+/// format, followed by records of one parameter value each. A save
+/// appends records for just the parameters that have changed since
+/// the last save, and a load takes the newest record for each
+/// parameter. The page is only erased and rewritten with a record for
+/// every parameter when the log fills up.
+///
+/// Radios upgraded from firmware that saved the whole parameter array
+/// in one go have their settings carried over into a new log the first
+/// time they load them.
 ///
 
 
@@ -64,7 +73,12 @@ __code const struct parameter_info {
 	{"DUTY_CYCLE",		100},
 	{"LBT_RSSI",		0},
 	{"MANCHESTER",		0},
-	{"RTSCTS",		0}
+	{"RTSCTS",		0},
+	{"CAL_LATENCY",		0}, // set by AT&C
+	{"CAL_BYTE_TICKS",	0},
+	{"SER_RX_BUF",		SERIAL_RX_BUF_DEFAULT},
+	{"SER_TX_BUF",		SERIAL_TX_BUF_DEFAULT},
+	{"FRAME_GAP",		0}
 };
 
 /// In-RAM parameter store.
@@ -91,7 +105,7 @@ param_check(__pdata enum ParamID id, __data uint32_t val)
 		return false;
 
 	case PARAM_SERIAL_SPEED:
-		return serial_device_valid_speed(val);
+		return val <= 0xFFFF && serial_device_valid_speed(val);
 
 	case PARAM_AIR_SPEED:
 		if (val > 256)
@@ -118,12 +132,47 @@ param_check(__pdata enum ParamID id, __data uint32_t val)
 			return false;
 		break;
 	case PARAM_MAVLINK:
+		// 0 = raw
+		// 1 = MAVLink framing
+		// 2 = MAVLink framing + priority messages
+		if (val > 2)
+			return false;
+		break;
+
 	case PARAM_OPPRESEND:
 		// boolean 0/1 only
 		if (val > 1)
 			return false;
 		break;
 
+	case PARAM_FRAME_GAP:
+		// 0 = send serial data as it comes
+		// n = keep RTCM3 and NMEA frames whole, and end
+		//     other frames after n idle byte times
+		if (val > FRAME_GAP_MAX)
+			return false;
+		break;
+
+	case PARAM_CAL_LATENCY:
+	case PARAM_CAL_BYTE_TICKS:
+		// must fit in a 16 bit tick count
+		if (val > 0xFFFF)
+			return false;
+		break;
+
+	case PARAM_SER_RX_BUF:
+	case PARAM_SER_TX_BUF:
+		// a power of two, and leaving room in the buffer arena
+		// for the other serial buffer and a radio receive
+		// slot. To move space from one buffer to the other,
+		// shrink one before growing the other
+		if (val < SERIAL_BUF_MIN || (val & (val - 1)) != 0)
+			return false;
+		if (val + param_get(id == PARAM_SER_RX_BUF ? PARAM_SER_TX_BUF : PARAM_SER_RX_BUF) +
+		    MAX_PACKET_LENGTH > BUFFER_ARENA_SIZE)
+			return false;
+		break;
+
 	default:
 		// no sanity check for this value
 		break;
@@ -163,7 +212,7 @@ param_set(__data enum ParamID param, __pdata param_t value)
 
 	case PARAM_MAVLINK:
 		feature_mavlink_framing = value?true:false;
-		value = feature_mavlink_framing?1:0;
+		feature_mavlink_priority = (value==2)?true:false;
 		break;
 
 	case PARAM_OPPRESEND:
@@ -176,6 +225,21 @@ param_set(__data enum ParamID param, __pdata param_t value)
 		value = feature_rtscts?1:0;
 		break;
 
+	case PARAM_FRAME_GAP:
+		feature_frame_gap = value;
+		break;
+
+	case PARAM_AIR_SPEED:
+	case PARAM_ECC:
+	case PARAM_MANCHESTER:
+		// measured timings only hold for the configuration
+		// they were measured with
+		if (value != parameter_values[param].val) {
+			parameter_values[PARAM_CAL_LATENCY].val = 0;
+			parameter_values[PARAM_CAL_BYTE_TICKS].val = 0;
+		}
+		break;
+
 	default:
 		break;
 	}
@@ -193,80 +257,221 @@ param_get(__data enum ParamID param)
 	return parameter_values[param].val;
 }
 
-bool
-param_load(void)
-__critical {
-	__pdata uint8_t		d;
-	__pdata uint8_t		i;
-	__pdata uint8_t		sum;
-	__pdata uint8_t         count;
+// parameter log layout. A record is the parameter value, an 8-bit
+// XOR checksum of the value and ID, then the ID. The ID is written
+// last, so a record whose ID reads as erased was never finished
+#define PARAM_LOG_MAGIC		0x5A
+#define PARAM_LOG_START		2
+#define PARAM_REC_CHECK		sizeof(param_t)
+#define PARAM_REC_ID		(sizeof(param_t) + 1)
+#define PARAM_REC_SIZE		(sizeof(param_t) + 2)
+#define PARAM_LOG_END		FLASH_SCRATCH_SIZE
+#define PARAM_REC_EMPTY		0xFF
+
+// read the log record at offset, returning its parameter ID,
+// PARAM_REC_EMPTY if it has never been written, or PARAM_MAX if it is
+// damaged or unfinished
+static uint8_t
+param_log_read(__pdata uint16_t offset, __xdata union param_private * __pdata value)
+{
+	__pdata uint8_t	i, d, id, sum, all;
+
+	id = flash_read_scratch(offset + PARAM_REC_ID);
+	sum = id;
+	all = id;
+	for (i = 0; i < sizeof(param_t); i++) {
+		d = flash_read_scratch(offset + i);
+		value->bytes[i] = d;
+		sum ^= d;
+		all &= d;
+	}
+	d = flash_read_scratch(offset + PARAM_REC_CHECK);
+	if (id == PARAM_REC_EMPTY) {
+		if ((all & d) == 0xFF) {
+			return PARAM_REC_EMPTY;
+		}
+		return PARAM_MAX;
+	}
+	if (id >= PARAM_MAX || d != sum) {
+		return PARAM_MAX;
+	}
+	return id;
+}
 
-	// start with defaults
-	for (i = 0; i < sizeof(parameter_values); i++) {
-		parameter_values[i].val = parameter_info[i].default_value;
+// append a record for a parameter at offset
+static void
+param_log_write(__pdata uint16_t offset, __pdata uint8_t id)
+{
+	__pdata uint8_t	i, d, sum;
+
+	sum = id;
+	for (i = 0; i < sizeof(param_t); i++) {
+		d = parameter_values[id].bytes[i];
+		sum ^= d;
+		flash_write_scratch(offset + i, d);
 	}
+	flash_write_scratch(offset + PARAM_REC_CHECK, sum);
+	flash_write_scratch(offset + PARAM_REC_ID, id);
+}
+
+// check that the log has a header for this parameter format
+static bool
+param_log_valid(void)
+{
+	return flash_read_scratch(0) == PARAM_LOG_MAGIC &&
+		flash_read_scratch(1) == (uint8_t)PARAM_FORMAT_CURRENT;
+}
+
+// the layout saved by firmware before the log: a byte count, the raw
+// parameter_values array and an XOR checksum of it. The count is a
+// whole number of parameters, so it is never PARAM_LOG_MAGIC. Formats
+// from PARAM_FORMAT_LEGACY on only added parameters at the end, which
+// keep their defaults
+#define PARAM_FORMAT_LEGACY	0x19UL
+
+static bool
+param_load_legacy(void)
+{
+	__pdata uint8_t	i, d, sum, count;
 
-	// initialise checksum
-	sum = 0;
 	count = flash_read_scratch(0);
 	if (count > sizeof(parameter_values) ||
-	    count < 12*sizeof(param_t)) {
+	    count < 12*sizeof(param_t) ||
+	    (count % sizeof(param_t)) != 0) {
 		return false;
 	}
 
-	// loop reading the parameters array
-	for (i = 0; i < count; i ++) {
+	sum = 0;
+	for (i = 0; i < count; i++) {
 		d = flash_read_scratch(i+1);
 		parameter_values[0].bytes[i] = d;
 		sum ^= d;
 	}
-
-	// verify checksum
-	d = flash_read_scratch(i+1);
-	if (sum != d)
+	if (flash_read_scratch(i+1) != sum ||
+	    parameter_values[PARAM_FORMAT].val < PARAM_FORMAT_LEGACY ||
+	    parameter_values[PARAM_FORMAT].val > PARAM_FORMAT_CURRENT) {
+		param_default();
 		return false;
+	}
+	return true;
+}
+
+// erase the log and start it again with every parameter
+static void
+param_log_compact(void)
+{
+	__pdata uint16_t offset;
+	__pdata uint8_t	id;
+
+	flash_erase_scratch();
+
+	offset = PARAM_LOG_START;
+	for (id = 1; id < PARAM_MAX; id++) {
+		param_log_write(offset, id);
+		offset += PARAM_REC_SIZE;
+	}
+
+	// the header goes last, so a page that was only partly
+	// rewritten is ignored
+	flash_write_scratch(0, PARAM_LOG_MAGIC);
+	flash_write_scratch(1, (uint8_t)PARAM_FORMAT_CURRENT);
+}
+
+bool
+param_load(void)
+{
+	__pdata uint16_t	offset;
+	__pdata uint8_t		id;
+	__xdata union param_private value;
+	bool			legacy;
 
-	// decide whether we read a supported version of the structure
-	if (param_get(PARAM_FORMAT) != PARAM_FORMAT_CURRENT) {
-		debug("parameter format %lu expecting %lu", parameters[PARAM_FORMAT], PARAM_FORMAT_CURRENT);
+	// start with defaults
+	param_default();
+
+	legacy = false;
+	if (param_log_valid()) {
+		// the newest record for each parameter wins
+		for (offset = PARAM_LOG_START; offset + PARAM_REC_SIZE <= PARAM_LOG_END; offset += PARAM_REC_SIZE) {
+			id = param_log_read(offset, &value);
+			if (id == PARAM_REC_EMPTY) {
+				break;
+			}
+			if (id < PARAM_MAX) {
+				parameter_values[id].val = value.val;
+			}
+		}
+	} else if (param_load_legacy()) {
+		legacy = true;
+	} else {
+		debug("no parameter log for format %lu", PARAM_FORMAT_CURRENT);
 		return false;
 	}
 
-	for (i = 0; i < sizeof(parameter_values); i++) {
-		if (!param_check(i, parameter_values[i].val)) {
-			parameter_values[i].val = parameter_info[i].default_value;
+	for (id = 0; id < PARAM_MAX; id++) {
+		if (!param_check(id, parameter_values[id].val)) {
+			parameter_values[id].val = parameter_info[id].default_value;
 		}
 	}
 
+	if (legacy) {
+		// keep the settings of an upgraded radio in a new log.
+		// The format was put back to the current one above
+		param_log_compact();
+	}
+
 	return true;
 }
 
 void
 param_save(void)
-__critical {
-	__pdata uint8_t		d;
-	__pdata uint8_t		i;
-	__pdata uint8_t		sum;
+{
+	__pdata uint16_t	offset;
+	__pdata uint8_t		id, count;
+	__xdata union param_private value;
+	__xdata uint8_t		changed[PARAM_MAX];
 
 	// tag parameters with the current format
 	parameter_values[PARAM_FORMAT].val = PARAM_FORMAT_CURRENT;
 
-	// erase the scratch space
-	flash_erase_scratch();
+	// find the parameters whose newest saved value is out of
+	// date, and the end of the log. Each flash access only turns
+	// interrupts off briefly
+	memset(changed, 1, sizeof(changed));
+	offset = PARAM_LOG_END;
+	if (param_log_valid()) {
+		for (offset = PARAM_LOG_START; offset + PARAM_REC_SIZE <= PARAM_LOG_END; offset += PARAM_REC_SIZE) {
+			id = param_log_read(offset, &value);
+			if (id == PARAM_REC_EMPTY) {
+				break;
+			}
+			if (id < PARAM_MAX) {
+				changed[id] = (value.val != parameter_values[id].val);
+			}
+		}
+	}
 
-	// initialise checksum
-	sum = 0;
-	flash_write_scratch(0, sizeof(parameter_values));
+	// the format is in the header
+	changed[PARAM_FORMAT] = 0;
+	count = 0;
+	for (id = 0; id < PARAM_MAX; id++) {
+		count += changed[id];
+	}
+	if (count == 0) {
+		return;
+	}
 
-	// save parameters to the scratch page
-	for (i = 0; i < sizeof(parameter_values); i++) {
-		d = parameter_values[0].bytes[i];	// byte we are going to write
-		sum ^= d;
-		flash_write_scratch(i+1, d);
+	// start again if there isn't room for them all
+	if (offset + count * PARAM_REC_SIZE > PARAM_LOG_END) {
+		param_log_compact();
+		return;
 	}
 
-	// write checksum
-	flash_write_scratch(i+1, sum);
+	for (id = 1; id < PARAM_MAX; id++) {
+		if (changed[id]) {
+			param_log_write(offset, id);
+			offset += PARAM_REC_SIZE;
+		}
+	}
 }
 
 void
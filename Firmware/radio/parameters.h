@@ -61,10 +61,15 @@ enum ParamID {
 	PARAM_LBT_RSSI,			// listen before talk threshold
 	PARAM_MANCHESTER,		// enable manchester encoding
 	PARAM_RTSCTS,			// enable hardware flow control
+	PARAM_CAL_LATENCY,		// measured packet latency (16usec ticks)
+	PARAM_CAL_BYTE_TICKS,		// measured ticks per byte (16usec ticks)
+	PARAM_SER_RX_BUF,		// serial receive buffer size (bytes)
+	PARAM_SER_TX_BUF,		// serial transmit buffer size (bytes)
+	PARAM_FRAME_GAP,		// serial idle gap ending a frame (bytes)
         PARAM_MAX			// must be last
 };
 
-#define PARAM_FORMAT_CURRENT	0x19UL				///< current parameter format ID
+#define PARAM_FORMAT_CURRENT	0x1AUL				///< current parameter format ID
 
 /// Parameter type.
 ///
@@ -37,6 +37,16 @@ CFLAGS		+=	-DAPP_VERSION_HIGH=$(VERSION_MAJOR) -DAPP_VERSION_LOW=$(VERSION_MINOR
 CFLAGS		+=	--model-large --opt-code-speed --Werror --std-sdcc99 --fomit-frame-pointer
 #CFLAGS		+=	--fverbose-asm 
 
-LDFLAGS		+=	 --model-large --iram-size 256 --xram-size 4096 --code-loc 0x400 --code-size 0x00f400 --stack-size 64
+# Over the air updates (make OTA=1) stage pages below the signature
+# page, which takes 9KB from the application (see flash_layout.h).
+#
+ifeq ($(OTA),1)
+CFLAGS		+=	-DENABLE_OTA
+CODE_SIZE	 =	0x00d000
+else
+CODE_SIZE	 =	0x00f400
+endif
+
+LDFLAGS		+=	 --model-large --iram-size 256 --xram-size 4096 --code-loc 0x400 --code-size $(CODE_SIZE) --stack-size 64
 
 include $(SRCROOT)/include/rules.mk
@@ -42,7 +42,6 @@ __xdata uint8_t radio_buffer_count;
 // We need this now because the interleaving golay handling can no longer
 // be done in place.
 __xdata uint8_t radio_interleave_buffer[MAX_PACKET_LENGTH];
-__pdata uint8_t receive_packet_length;
 __pdata uint8_t partial_packet_length;
 
 // Collect timing stats for golay decoding
@@ -56,9 +55,54 @@ __xdata uint8_t golay_decode_time_bytes;
 __pdata uint8_t last_rssi;
 __pdata uint8_t netid[2];
 
-static volatile __bit packet_received;
 static volatile __bit preamble_detected;
 
+/// the ring of receive slots. The receiver is restarted as soon as a
+/// packet arrives, so the next packet can come in to the next free
+/// slot while the main loop decodes the last one, and the other radio
+/// can send a burst of packets back to back. The receiver stops when
+/// all the slots are full.
+///
+/// radio_buffer is slot zero. It is also where packets are built for
+/// transmit, so starting a transmit drops any packets not yet taken,
+/// as turning the receiver back on afterwards always has. The other
+/// slots come from the buffer arena, see radio_set_rx_slots().
+__xdata static uint8_t * __xdata rx_slots[RADIO_RX_SLOTS_MAX];
+__pdata static uint8_t rx_slot_count;
+__pdata static uint8_t rx_length[RADIO_RX_SLOTS_MAX];
+__pdata static volatile uint8_t rx_head;	///< the slot being filled
+__pdata static volatile uint8_t rx_tail;	///< the oldest full slot
+__pdata static volatile uint8_t rx_count;	///< the number of full slots
+
+/// transmit state, shared with the radio interrupt which refills the
+/// transmit FIFO from radio_buffer as it drains
+static volatile __bit transmit_active;
+static volatile __bit transmit_failed;
+__xdata static uint8_t * __pdata transmit_next;
+__pdata static volatile uint8_t transmit_remaining;
+__pdata static uint16_t transmit_start_time;
+__pdata static uint16_t transmit_timeout;
+
+/// a packet golay encoded ahead in radio_interleave_buffer by
+/// radio_transmit_prepare(). Decoding a received packet overwrites it
+static __bit transmit_prepared;
+__pdata static uint8_t prepared_count;
+
+/// the preamble for a packet following another in a burst, in nibbles.
+/// This is the shortest the Si4432 datasheet recommends for our 5 nibble
+/// detection threshold with AFC on, and no antenna diversity
+#define SHORT_PREAMBLE_LENGTH	10
+
+/// set by radio_transmit_short_preamble() for the next transmit only
+static __bit transmit_short_preamble;
+
+/// the preamble length last written to the radio, in nibbles
+__pdata static uint8_t preamble_written;
+
+/// set while the receiver switches antennas on the preamble, when it
+/// needs all of it
+static __bit diversity_enabled;
+
 __pdata struct radio_settings settings;
 
 
@@ -66,10 +110,19 @@ __pdata struct radio_settings settings;
 //
 static void	register_write(uint8_t reg, uint8_t value) __reentrant;
 static uint8_t	register_read(uint8_t reg);
+static void	register_write_burst(uint8_t reg, uint8_t *values, uint8_t n) __reentrant;
+static void	register_read_burst(uint8_t reg, __data uint8_t *buf, uint8_t n) __reentrant;
+static void	interrupt_enable(uint8_t enable1, uint8_t enable2) __reentrant;
 static bool	software_reset(void);
 static void	set_frequency_registers(uint32_t frequency);
 static uint32_t scale_uint32(uint32_t value, uint32_t scale);
 static void	clear_status_registers(void);
+static void	receiver_restart(void) __reentrant;
+static void	transmit_claim(void);
+static void	transmit_begin(__pdata uint16_t timeout_ticks);
+static void	receive_next(void);
+static __xdata uint8_t *rx_slot(uint8_t i) __reentrant;
+static void	transmit_finish(bool ok) __reentrant;
 
 // save and restore radio interrupt. We use this rather than
 // __critical to ensure we don't disturb the timer interrupt at all.
@@ -78,12 +131,18 @@ static void	clear_status_registers(void);
 #define EX0_RESTORE EX0 = EX0_saved
 
 #define RADIO_RX_INTERRUPTS (EZRADIOPRO_ENRXFFAFULL|EZRADIOPRO_ENPKVALID|EZRADIOPRO_ENCRCERROR)
+#define RADIO_TX_INTERRUPTS (EZRADIOPRO_ENTXFFAEM|EZRADIOPRO_ENPKSENT|EZRADIOPRO_ENFFERR)
 
 // FIFO thresholds to allow for packets larger than 64 bytes
 #define TX_FIFO_THRESHOLD_LOW 32
 #define TX_FIFO_THRESHOLD_HIGH 60
 #define RX_FIFO_THRESHOLD_HIGH 50
 
+// bytes added to the transmit FIFO on each almost empty interrupt. The
+// FIFO holds 64 bytes and is below TX_FIFO_THRESHOLD_LOW when the
+// interrupt fires, so this leaves a few bytes of slack
+#define TX_FIFO_REFILL (64 - TX_FIFO_THRESHOLD_LOW - 4)
+
 // return a received packet
 //
 // returns true on success, false on no packet available
@@ -93,19 +152,20 @@ radio_receive_packet(uint8_t *length, __xdata uint8_t * __xdata buf)
 {
 	__xdata uint8_t elen;
 
-	if (!packet_received) {
+	if (rx_count == 0) {
 		return false;
 	}
 
-	if (receive_packet_length > MAX_PACKET_LENGTH) {
-		radio_receiver_on();
+	elen = rx_length[rx_tail];
+	if (elen > MAX_PACKET_LENGTH) {
+		receive_next();
 		goto failed;
 	}
 
 #if 0
 	// useful for testing high packet loss
 	if ((timer_entropy() & 0x7) != 0) {
-		radio_receiver_on();
+		receive_next();
 		goto failed;		
 	}
 #endif
@@ -113,9 +173,9 @@ radio_receive_packet(uint8_t *length, __xdata uint8_t * __xdata buf)
 	if (!feature_golay) {
 		// simple unencoded packets
 		// When golay encoding is disabled, the netid is in the packet headers.
-		*length = receive_packet_length;
-		memcpy(buf, radio_buffer, receive_packet_length);
-		radio_receiver_on();
+		*length = elen;
+		memcpy(buf, rx_slot(rx_tail), elen);
+		receive_next();
 		return true;
 	}
 
@@ -136,15 +196,12 @@ radio_receive_packet(uint8_t *length, __xdata uint8_t * __xdata buf)
 	// relies on the headers.  Of course, the general improved tolerance of
 	// burst errors (typically upto about 10% of a packet) is expected to help
 	// with data delivery in general.
-	memcpy(radio_interleave_buffer, radio_buffer, receive_packet_length);
+	memcpy(radio_interleave_buffer, rx_slot(rx_tail), elen);
+	transmit_prepared = false;
 
 	// radio_interleave_buffer now contains the interleaved golay encoded
-	// packet, and the radio buffer is now free to receive the next packet.
-
-	// enable the receiver for the next packet. This also
-	// enables the EX0 interrupt
-	elen = receive_packet_length;
-	radio_receiver_on();	
+	// packet, so hand the slot back to the receiver while we decode
+	receive_next();
 	
 	{
 		bool result = golay_decode_packet(length,buf,elen);
@@ -160,10 +217,53 @@ radio_receive_packet(uint8_t *length, __xdata uint8_t * __xdata buf)
 	return false;
 }
 
+// release the oldest receive slot
+//
+// The receiver is left running unless it stopped because all the
+// slots were full, in which case it is restarted
+//
+static void
+receive_next(void)
+{
+	EX0_SAVE_DISABLE;
+
+	if (++rx_tail == rx_slot_count) {
+		rx_tail = 0;
+	}
+	if (rx_count-- == rx_slot_count) {
+		receiver_restart();
+	}
+
+	EX0_RESTORE;
+}
+
+// return the start of a receive slot
+//
+static __xdata uint8_t *
+rx_slot(uint8_t i) __reentrant
+{
+	return rx_slots[i];
+}
+
+// set up the receive slots
+//
+void
+radio_set_rx_slots(__xdata uint8_t *buf, uint8_t count)
+{
+	__pdata uint8_t i;
+
+	rx_slots[0] = radio_buffer;
+	for (i = 1; i < count; i++) {
+		rx_slots[i] = buf;
+		buf += MAX_PACKET_LENGTH;
+	}
+	rx_slot_count = count;
+}
+
 // write to the radios transmit FIFO
 //
 static void
-radio_write_transmit_fifo(register uint8_t n, __xdata uint8_t * __pdata buffer)
+radio_write_transmit_fifo(register uint8_t n, __xdata uint8_t * buffer) __reentrant
 {
 	NSS1 = 0;
 	SPIF1 = 0;
@@ -186,7 +286,7 @@ radio_write_transmit_fifo(register uint8_t n, __xdata uint8_t * __pdata buffer)
 bool
 radio_receive_in_progress(void)
 {
-	if (packet_received ||
+	if (rx_count != 0 ||
 	    partial_packet_length != 0) {
 		return true;
 	}
@@ -243,7 +343,7 @@ radio_air_rate(void)
 // clear the transmit FIFO
 //
 static void
-radio_clear_transmit_fifo(void)
+radio_clear_transmit_fifo(void) __reentrant
 {
 	register uint8_t control;
 	control = register_read(EZRADIOPRO_OPERATING_AND_FUNCTION_CONTROL_2);
@@ -263,148 +363,215 @@ radio_clear_receive_fifo(void) __reentrant
 	register_write(EZRADIOPRO_OPERATING_AND_FUNCTION_CONTROL_2, control & ~EZRADIOPRO_FFCLRRX);
 }
 
-// simple transmit with no golay
-//
-// @param length		number of data bytes to send
-// @param timeout_ticks		number of 16usec RTC ticks to allow
-//				for the send
+// start a transmit
 //
-// @return	    true if packet sent successfully
+// The packet goes out of radio_buffer. The first part of it is put in
+// the FIFO here, and the radio interrupt tops the FIFO up as it drains
+// and notes when the packet has been sent.
 //
-static bool
-radio_transmit_simple(__data uint8_t length, __xdata uint8_t * __pdata buf, __pdata uint16_t timeout_ticks)
+void
+radio_transmit_start(uint8_t length, __xdata uint8_t * __pdata buf, __pdata uint16_t timeout_ticks)
 {
-	__pdata uint16_t tstart;
-	bool transmit_started;
-	__data uint8_t n;
-
 	if (length > sizeof(radio_buffer)) {
 		panic("oversized packet");
 	}
 
+	transmit_claim();
+
+	if (!feature_golay) {
+		// simple unencoded packets
+		memcpy(radio_buffer, buf, length);
+		radio_buffer_count = length;
+	} else {
+		golay_encode_packet(length, buf);
+	}
+
+	transmit_begin(timeout_ticks);
+}
+
+// golay encode the next packet into radio_interleave_buffer, all but
+// its last tail bytes
+//
+bool
+radio_transmit_prepare(uint8_t length, uint8_t tail, __xdata uint8_t * __pdata buf)
+{
+	if (!feature_golay) {
+		// there is nothing to gain
+		return false;
+	}
+	prepared_count = golay_encode_ahead(length, tail, buf, radio_interleave_buffer);
+	transmit_prepared = true;
+	return true;
+}
+
+// check the prepared packet is still there
+//
+bool
+radio_transmit_prepared(void)
+{
+	return transmit_prepared;
+}
+
+// start a transmit of the prepared packet, adding its last bytes
+//
+void
+radio_transmit_start_prepared(__xdata uint8_t * __pdata tail, __pdata uint16_t timeout_ticks)
+{
+	if (!transmit_prepared) {
+		panic("no prepared packet");
+	}
+	transmit_prepared = false;
+
+	transmit_claim();
+	memcpy(radio_buffer, radio_interleave_buffer, prepared_count);
+	golay_encode_finish(tail, radio_buffer);
+	transmit_begin(timeout_ticks);
+}
+
+// wait for the last transmit to finish and take radio_buffer for the
+// next, leaving the radio interrupt disabled
+//
+static void
+transmit_claim(void)
+{
+	// only one packet at a time
+	while (radio_transmit_busy()) /* noop */ ;
+
+	EX0 = 0;
+
+	// the packet is built in receive slot zero
+	rx_head = rx_tail = rx_count = 0;
+	partial_packet_length = 0;
+
+#ifdef _BOARD_RFD900A
+	PA_ENABLE = 1;		// Set PA_Enable to turn on PA prior to TX cycle
+#endif
+}
+
+// send the packet in radio_buffer
+//
+static void
+transmit_begin(__pdata uint16_t timeout_ticks)
+{
+	__data uint8_t n;
+
 	radio_clear_transmit_fifo();
 
-	register_write(EZRADIOPRO_TRANSMIT_PACKET_LENGTH, length);
+	n = transmit_short_preamble ? SHORT_PREAMBLE_LENGTH : settings.preamble_length;
+	if (n != preamble_written) {
+		register_write(EZRADIOPRO_PREAMBLE_LENGTH, n);
+		preamble_written = n;
+	}
+	transmit_short_preamble = false;
+
+	register_write(EZRADIOPRO_TRANSMIT_PACKET_LENGTH, radio_buffer_count);
 
-	// put packet in the FIFO
-	n = length;
-	if (n > TX_FIFO_THRESHOLD_LOW) {
-		n = TX_FIFO_THRESHOLD_LOW;
+	// put as much of the packet in the FIFO as we can. The FIFO
+	// starts above the low threshold if there is more to come, so
+	// the first almost empty interrupt is a real one
+	n = radio_buffer_count;
+	if (n > TX_FIFO_THRESHOLD_HIGH) {
+		n = TX_FIFO_THRESHOLD_HIGH;
 	}
-	radio_write_transmit_fifo(n, buf);
-	length -= n;
-	buf += n;
+	radio_write_transmit_fifo(n, radio_buffer);
+	transmit_next = &radio_buffer[n];
+	transmit_remaining = radio_buffer_count - n;
 
-	// no interrupts
-	register_write(EZRADIOPRO_INTERRUPT_ENABLE_1, 0);
-	register_write(EZRADIOPRO_INTERRUPT_ENABLE_2, 0);
+	// only transmit interrupts, with no stale status left over
+	interrupt_enable(RADIO_TX_INTERRUPTS, 0);
+	clear_status_registers();
 
 	preamble_detected = 0;
-	transmit_started = false;
+	transmit_failed = false;
+	transmit_active = true;
+	transmit_timeout = timeout_ticks;
 
 	// start TX
 	register_write(EZRADIOPRO_OPERATING_AND_FUNCTION_CONTROL_1, EZRADIOPRO_TXON | EZRADIOPRO_XTON);
+	transmit_start_time = timer2_tick();
 
-	// wait for transmit complete or timeout
-	tstart = timer2_tick();
-	while ((uint16_t)(timer2_tick() - tstart) < timeout_ticks) {
-		__data uint8_t status;
-
-		// see if we can put some more bytes into the FIFO
-		status = register_read(EZRADIOPRO_INTERRUPT_STATUS_1);
-		if (transmit_started && length != 0 && (status & EZRADIOPRO_ITXFFAEM)) {
-			// the FIFO is below the low threshold. We
-			// should be able to put in
-			// 64-TX_FIFO_THRESHOLD_LOW more bytes, but 
-			// it seems that this gives us an occasional
-			// fifo overflow error, so put in just 4 bytes
-			// at a time
-			n = 4;
-			if (n > length) {
-				n = length;
-			}
-			radio_write_transmit_fifo(n, buf);
-			length -= n;
-			buf += n;
-			continue;
-		}
-		if (transmit_started && length != 0 && (status & EZRADIOPRO_ITXFFAFULL) == 0) {
-			// the FIFO is below the high threshold. See
-			// comment above on how many bytes we add to
-			// the FIFO
-			n = 4;
-			if (n > length) {
-				n = length;
-			}
-			radio_write_transmit_fifo(n, buf);
-			length -= n;
-			buf += n;
-			continue;
-		}
-
-		if (status & EZRADIOPRO_IFFERR) {
-			// we ran out of bytes in the FIFO
-			radio_clear_transmit_fifo();
-			debug("FFERR %u\n", (unsigned)length);
-			if (errors.tx_errors != 0xFFFF) {
-				errors.tx_errors++;
-			}
-			return false;
-		}
+	EX0 = 1;
+}
 
-		// the interrupt status bits only become valid once
-		// the transmitter is in full tx state
-		status = register_read(EZRADIOPRO_DEVICE_STATUS);
-		if (status & 0x02) {
-			// the chip power status is in TX mode
-			transmit_started = true;
-			continue;
-		}
-		if (transmit_started && (status & 0x02) == 0) {
-			// transmitter has finished. See if we got the
-			// whole packet out
-			if (length != 0) {
-				debug("TX short %u\n", (unsigned)length);
-				if (errors.tx_errors != 0xFFFF) {
-					errors.tx_errors++;
-				}
-				return false;
-			}
-			return true;			
-		}
+// check if a transmit is still going
+//
+bool
+radio_transmit_busy(void)
+{
+	EX0_SAVE_DISABLE;
 
+	if (transmit_active &&
+	    (uint16_t)(timer2_tick() - transmit_start_time) >= transmit_timeout) {
+		debug("TX timeout %u ts=%u tn=%u len=%u\n",
+		      transmit_timeout,
+		      transmit_start_time,
+		      timer2_tick(),
+		      (unsigned)transmit_remaining);
+		transmit_finish(false);
 	}
 
-	// transmit timeout ... clear the FIFO
-	debug("TX timeout %u ts=%u tn=%u len=%u\n",
-	      timeout_ticks,
-	      tstart,
-	      timer2_tick(),
-	      (unsigned)length);
-	if (errors.tx_errors != 0xFFFF) {
-		errors.tx_errors++;
-	}
+	EX0_RESTORE;
+	return transmit_active;
+}
 
-	return false;
+// send the next packet with a short preamble
+//
+void
+radio_transmit_short_preamble(void)
+{
+	transmit_short_preamble = true;
 }
 
+// check if we can pick up a packet with a short preamble
+//
+bool
+radio_receive_short_preamble(void)
+{
+	return !diversity_enabled;
+}
 
-// start transmitting a packet from the transmit FIFO
+// check if all of the packet being sent is in the FIFO
 //
-// @param length		number of data bytes to send
-// @param timeout_ticks		number of 16usec RTC ticks to allow
-//				for the send
+bool
+radio_transmit_loaded(void)
+{
+	return transmit_remaining == 0;
+}
+
+// return true if the last packet was sent whole
 //
-// @return	    true if packet sent successfully
+bool
+radio_transmit_result(void)
+{
+	return !transmit_failed;
+}
+
+// end a transmit, counting a failure. Called from the radio
+// interrupt, or with it disabled
 //
-static bool
-radio_transmit_golay(uint8_t length, __xdata uint8_t * __pdata buf, __pdata uint16_t timeout_ticks)
+static void
+transmit_finish(bool ok) __reentrant
 {
-	golay_encode_packet(length,buf);	
-	return radio_transmit_simple(radio_buffer_count, radio_buffer, timeout_ticks);
+	interrupt_enable(0, 0);
+
+	if (!ok) {
+		// stop the transmitter and drop what is left
+		register_write(EZRADIOPRO_OPERATING_AND_FUNCTION_CONTROL_1, EZRADIOPRO_XTON);
+		radio_clear_transmit_fifo();
+		if (errors.tx_errors != 0xFFFF) {
+			errors.tx_errors++;
+		}
+	}
+
+#ifdef _BOARD_RFD900A
+	PA_ENABLE = 0;		// Set PA_Enable to off the PA after TX cycle
+#endif
+
+	transmit_failed = !ok;
+	transmit_active = false;
 }
 
-// start transmitting a packet from the transmit FIFO
+// transmit a packet and wait for it to go
 //
 // @param length		number of data bytes to send
 // @param timeout_ticks		number of 16usec RTC ticks to allow
@@ -415,23 +582,9 @@ radio_transmit_golay(uint8_t length, __xdata uint8_t * __pdata buf, __pdata uint
 bool
 radio_transmit(uint8_t length, __xdata uint8_t * __pdata buf, __pdata uint16_t timeout_ticks)
 {
-	bool ret;
-	EX0_SAVE_DISABLE;
-
-#ifdef _BOARD_RFD900A
-	PA_ENABLE = 1;		// Set PA_Enable to turn on PA prior to TX cycle
-#endif
-	
-	if (!feature_golay) {
-		ret = radio_transmit_simple(length, buf, timeout_ticks);
-	} else {
-		ret = radio_transmit_golay(length, buf, timeout_ticks);
-	}
-#ifdef _BOARD_RFD900A
-	PA_ENABLE = 0;		// Set PA_Enable to off the PA after TX cycle
-#endif
-	EX0_RESTORE;
-	return ret;
+	radio_transmit_start(length, buf, timeout_ticks);
+	while (radio_transmit_busy()) /* noop */ ;
+	return radio_transmit_result();
 }
 
 
@@ -442,14 +595,27 @@ radio_receiver_on(void)
 {
 	EX0 = 0;
 
-	packet_received = 0;
-	receive_packet_length = 0;
+	rx_head = rx_tail = rx_count = 0;
+
+	receiver_restart();
+
+	// enable receive interrupt
+	EX0 = 1;
+
+	return true;
+}
+
+// start receiving the next packet, leaving any packets we already
+// have alone
+//
+static void
+receiver_restart(void) __reentrant
+{
 	preamble_detected = 0;
 	partial_packet_length = 0;
 
 	// enable receive interrupts
-	register_write(EZRADIOPRO_INTERRUPT_ENABLE_1, RADIO_RX_INTERRUPTS);
-	register_write(EZRADIOPRO_INTERRUPT_ENABLE_2, EZRADIOPRO_ENPREAVAL);
+	interrupt_enable(RADIO_RX_INTERRUPTS, EZRADIOPRO_ENPREAVAL);
 
 	clear_status_registers();
 	radio_clear_transmit_fifo();
@@ -457,11 +623,6 @@ radio_receiver_on(void)
 
 	// put the radio in receive mode
 	register_write(EZRADIOPRO_OPERATING_AND_FUNCTION_CONTROL_1, EZRADIOPRO_RXON | EZRADIOPRO_XTON);
-
-	// enable receive interrupt
-	EX0 = 1;
-
-	return true;
 }
 
 
@@ -494,8 +655,7 @@ radio_initialise(void)
 	}
 
 	// enable chip ready interrupt
-	register_write(EZRADIOPRO_INTERRUPT_ENABLE_1, 0);
-	register_write(EZRADIOPRO_INTERRUPT_ENABLE_2, EZRADIOPRO_ENCHIPRDY);
+	interrupt_enable(0, EZRADIOPRO_ENCHIPRDY);
 
 	// wait for the chip ready bit for 10ms
 	delay_set(50);
@@ -558,95 +718,92 @@ radio_get_channel(void)
 	return settings.current_channel;
 }
 
-// This table gives the register settings for the radio core indexed by
-// the desired air data rate.
+// These tables give the register settings for the radio core indexed by
+// the desired air data rate. Each row holds the modem registers for one
+// rate, in the order below. tools/modem_regs.py can generate rows for
+// other rates.
 //
 #define NUM_DATA_RATES 13
 #define NUM_RADIO_REGISTERS 12
 
-// this is the list of registers that we will use the register tables for
-__code static const uint8_t reg_index[NUM_RADIO_REGISTERS] = {
-		EZRADIOPRO_IF_FILTER_BANDWIDTH, // 0x1C
-		EZRADIOPRO_CLOCK_RECOVERY_GEARSHIFT_OVERRIDE, // 0x1F
-		EZRADIOPRO_CLOCK_RECOVERY_OVERSAMPLING_RATIO, // 0x20
-		EZRADIOPRO_CLOCK_RECOVERY_OFFSET_2, // 0x21
-		EZRADIOPRO_CLOCK_RECOVERY_OFFSET_1, // 0x22
-		EZRADIOPRO_CLOCK_RECOVERY_OFFSET_0, // 0x23
-		EZRADIOPRO_CLOCK_RECOVERY_TIMING_LOOP_GAIN_1, // 0x24
-		EZRADIOPRO_CLOCK_RECOVERY_TIMING_LOOP_GAIN_0, // 0x25
-		EZRADIOPRO_AFC_LIMITER, // 0x2A
-		EZRADIOPRO_TX_DATA_RATE_1, // 0x6E
-		EZRADIOPRO_TX_DATA_RATE_0, // 0x6F
-		EZRADIOPRO_FREQUENCY_DEVIATION, // 0x72
-};
+#define REG_IF_FILTER_BANDWIDTH		0	// 0x1C
+#define REG_CLOCK_RECOVERY		1	// 0x1F to 0x25
+#define REG_CLOCK_RECOVERY_COUNT	7
+#define REG_AFC_LIMITER			8	// 0x2A
+#define REG_TX_DATA_RATE		9	// 0x6E and 0x6F
+#define REG_FREQUENCY_DEVIATION		11	// 0x72
 
 // air data rates in kbps units
 __code static const uint8_t air_data_rates[NUM_DATA_RATES] = {
 	2,	4,	8,	16,	19,	24,	32,	48,	64,	96,	128,	192,	250
 };
 
-// register table for 433MHz radios
-__code static const uint8_t reg_table_433[NUM_RADIO_REGISTERS][NUM_DATA_RATES] = {
-	{0x27,	0x27,	0x27,	0x2E,	0x16,	0x01,	0x05,	0x0B,	0x9A,	0x88,	0x8A,	0x8C,	0x8D},
-	{0x03,	0x03,	0x03,	0x03,	0x03,	0x03,	0x03,	0x03,	0x03,	0x03,	0x03,	0x03,	0x03},
-	{0xF4,	0xFA,	0x7D,	0x3F,	0x69,	0xA7,	0x7D,	0x53,	0x5E,	0x7D,	0x5E,	0x3F,	0x30},
-	{0x20,	0x00,	0x01,	0x02,	0x01,	0x00,	0x01,	0x01,	0x01,	0x01,	0x01,	0x02,	0x02},
-	{0x41,	0x83,	0x06,	0x0C,	0x37,	0xC4,	0x06,	0x89,	0x5D,	0x06,	0x5D,	0x0C,	0xAA},
-	{0x89,	0x12,	0x25,	0x4A,	0x4C,	0x9C,	0x25,	0x37,	0x86,	0x25,	0x86,	0x4A,	0xAB},
-	{0x00,	0x01,	0x02,	0x04,	0x02,	0x01,	0x02,	0x03,	0x02,	0x02,	0x02,	0x04,	0x07},
-	{0x85,	0x08,	0x0E,	0x12,	0x72,	0x8A,	0x0E,	0x18,	0xBB,	0x0E,	0xBB,	0xEA,	0xFF},
-	{0x1D,	0x1D,	0x1D,	0x1E,	0x1E,	0x1E,	0x20,	0x30,	0x41,	0x50,	0x50,	0x50,	0x50},
-	{0x10,	0x20,	0x41,	0x83,	0x9B,	0xC4,	0x08,	0x0C,	0x10,	0x18,	0x20,	0x31,	0x40},
-	{0x62,	0xC5,	0x89,	0x12,	0xA6,	0x9C,	0x31,	0x4A,	0x62,	0x93,	0xC5,	0x27,	0x00},
-	{0x03,	0x06,	0x0D,	0x1A,	0x1E,	0x26,	0x33,	0x4D,	0x66,	0x9A,	0xCD,	0xFE,	0xFE}
+// register images for 433MHz radios, one row per air data rate
+__code static const uint8_t reg_table_433[NUM_DATA_RATES][NUM_RADIO_REGISTERS] = {
+	{0x27,	0x03,	0xF4,	0x20,	0x41,	0x89,	0x00,	0x85,	0x1D,	0x10,	0x62,	0x03},	// 2
+	{0x27,	0x03,	0xFA,	0x00,	0x83,	0x12,	0x01,	0x08,	0x1D,	0x20,	0xC5,	0x06},	// 4
+	{0x27,	0x03,	0x7D,	0x01,	0x06,	0x25,	0x02,	0x0E,	0x1D,	0x41,	0x89,	0x0D},	// 8
+	{0x2E,	0x03,	0x3F,	0x02,	0x0C,	0x4A,	0x04,	0x12,	0x1E,	0x83,	0x12,	0x1A},	// 16
+	{0x16,	0x03,	0x69,	0x01,	0x37,	0x4C,	0x02,	0x72,	0x1E,	0x9B,	0xA6,	0x1E},	// 19
+	{0x01,	0x03,	0xA7,	0x00,	0xC4,	0x9C,	0x01,	0x8A,	0x1E,	0xC4,	0x9C,	0x26},	// 24
+	{0x05,	0x03,	0x7D,	0x01,	0x06,	0x25,	0x02,	0x0E,	0x20,	0x08,	0x31,	0x33},	// 32
+	{0x0B,	0x03,	0x53,	0x01,	0x89,	0x37,	0x03,	0x18,	0x30,	0x0C,	0x4A,	0x4D},	// 48
+	{0x9A,	0x03,	0x5E,	0x01,	0x5D,	0x86,	0x02,	0xBB,	0x41,	0x10,	0x62,	0x66},	// 64
+	{0x88,	0x03,	0x7D,	0x01,	0x06,	0x25,	0x02,	0x0E,	0x50,	0x18,	0x93,	0x9A},	// 96
+	{0x8A,	0x03,	0x5E,	0x01,	0x5D,	0x86,	0x02,	0xBB,	0x50,	0x20,	0xC5,	0xCD},	// 128
+	{0x8C,	0x03,	0x3F,	0x02,	0x0C,	0x4A,	0x04,	0xEA,	0x50,	0x31,	0x27,	0xFE},	// 192
+	{0x8D,	0x03,	0x30,	0x02,	0xAA,	0xAB,	0x07,	0xFF,	0x50,	0x40,	0x00,	0xFE}	// 250
 };
 
-// register table for 470MHz radios
-__code static const uint8_t reg_table_470[NUM_RADIO_REGISTERS][NUM_DATA_RATES] = {
-        {0x2B,  0x2B,   0x2B,   0x2E,   0x16,   0x01,   0x05,   0x0B,   0x9A,   0x88,   0x8A,   0x8C,   0x8D},
-        {0x03,  0x03,   0x03,   0x03,   0x03,   0x03,   0x03,   0x03,   0x03,   0x03,   0x03,   0x03,   0x03},
-        {0xF4,  0xFA,   0x7D,   0x3F,   0x69,   0xA7,   0x7D,   0x53,   0x5E,   0x7D,   0x5E,   0x3F,   0x30},
-        {0x20,  0x00,   0x01,   0x02,   0x01,   0x00,   0x01,   0x01,   0x01,   0x01,   0x01,   0x02,   0x02},
-        {0x41,  0x83,   0x06,   0x0C,   0x37,   0xC4,   0x06,   0x89,   0x5D,   0x06,   0x5D,   0x0C,   0xAA},
-        {0x89,  0x12,   0x25,   0x4A,   0x4C,   0x9C,   0x25,   0x37,   0x86,   0x25,   0x86,   0x4A,   0xAB},
-        {0x00,  0x01,   0x02,   0x04,   0x02,   0x01,   0x02,   0x03,   0x02,   0x02,   0x02,   0x04,   0x07},
-        {0x85,  0x08,   0x0E,   0x12,   0x72,   0x8A,   0x0E,   0x18,   0xBB,   0x0E,   0xBB,   0xEA,   0xFF},
-        {0x1E,  0x1E,   0x1E,   0x21,   0x21,   0x21,   0x21,   0x30,   0x41,   0x50,   0x50,   0x50,   0x50},
-        {0x10,  0x20,   0x41,   0x83,   0x9B,   0xC4,   0x08,   0x0C,   0x10,   0x18,   0x20,   0x31,   0x40},
-        {0x62,  0xC5,   0x89,   0x12,   0xA6,   0x9C,   0x31,   0x4A,   0x62,   0x93,   0xC5,   0x27,   0x00},
-        {0x03,  0x06,   0x0D,   0x1A,   0x1E,   0x26,   0x33,   0x4D,   0x66,   0x9A,   0xCD,   0xFE,   0xFE}
+// register images for 470MHz radios, one row per air data rate
+__code static const uint8_t reg_table_470[NUM_DATA_RATES][NUM_RADIO_REGISTERS] = {
+	{0x2B,	0x03,	0xF4,	0x20,	0x41,	0x89,	0x00,	0x85,	0x1E,	0x10,	0x62,	0x03},	// 2
+	{0x2B,	0x03,	0xFA,	0x00,	0x83,	0x12,	0x01,	0x08,	0x1E,	0x20,	0xC5,	0x06},	// 4
+	{0x2B,	0x03,	0x7D,	0x01,	0x06,	0x25,	0x02,	0x0E,	0x1E,	0x41,	0x89,	0x0D},	// 8
+	{0x2E,	0x03,	0x3F,	0x02,	0x0C,	0x4A,	0x04,	0x12,	0x21,	0x83,	0x12,	0x1A},	// 16
+	{0x16,	0x03,	0x69,	0x01,	0x37,	0x4C,	0x02,	0x72,	0x21,	0x9B,	0xA6,	0x1E},	// 19
+	{0x01,	0x03,	0xA7,	0x00,	0xC4,	0x9C,	0x01,	0x8A,	0x21,	0xC4,	0x9C,	0x26},	// 24
+	{0x05,	0x03,	0x7D,	0x01,	0x06,	0x25,	0x02,	0x0E,	0x21,	0x08,	0x31,	0x33},	// 32
+	{0x0B,	0x03,	0x53,	0x01,	0x89,	0x37,	0x03,	0x18,	0x30,	0x0C,	0x4A,	0x4D},	// 48
+	{0x9A,	0x03,	0x5E,	0x01,	0x5D,	0x86,	0x02,	0xBB,	0x41,	0x10,	0x62,	0x66},	// 64
+	{0x88,	0x03,	0x7D,	0x01,	0x06,	0x25,	0x02,	0x0E,	0x50,	0x18,	0x93,	0x9A},	// 96
+	{0x8A,	0x03,	0x5E,	0x01,	0x5D,	0x86,	0x02,	0xBB,	0x50,	0x20,	0xC5,	0xCD},	// 128
+	{0x8C,	0x03,	0x3F,	0x02,	0x0C,	0x4A,	0x04,	0xEA,	0x50,	0x31,	0x27,	0xFE},	// 192
+	{0x8D,	0x03,	0x30,	0x02,	0xAA,	0xAB,	0x07,	0xFF,	0x50,	0x40,	0x00,	0xFE}	// 250
 };
 
-// register table for 868MHz radios
-__code static const uint8_t reg_table_868[NUM_RADIO_REGISTERS][NUM_DATA_RATES] = {
-        {0x01,  0x01,   0x01,   0x01,   0x01,   0x01,   0x05,   0x0B,   0x9A,   0x88,   0x8A,   0x8C,   0x8D},
-        {0x03,  0x03,   0x03,   0x03,   0x03,   0x03,   0x03,   0x03,   0x03,   0x03,   0x03,   0x03,   0x03},
-        {0xD0,  0xE8,   0xF4,   0xFA,   0xD3,   0xA7,   0x7D,   0x53,   0x5E,   0x7D,   0x5E,   0x3F,   0x30},
-        {0xE0,  0x60,   0x20,   0x00,   0x00,   0x00,   0x01,   0x01,   0x01,   0x01,   0x01,   0x02,   0x02},
-        {0x10,  0x20,   0x41,   0x83,   0x9B,   0xC4,   0x06,   0x89,   0x5D,   0x06,   0x5D,   0x0C,   0xAA},
-        {0x62,  0xC5,   0x89,   0x12,   0xA6,   0x9C,   0x25,   0x37,   0x86,   0x25,   0x86,   0x4A,   0xAB},
-        {0x00,  0x00,   0x00,   0x01,   0x01,   0x01,   0x02,   0x03,   0x02,   0x02,   0x02,   0x04,   0x07},
-        {0x23,  0x44,   0x85,   0x08,   0x39,   0x8A,   0x0E,   0x18,   0xBB,   0x0E,   0xBB,   0xEA,   0xFF},
-        {0x1C,  0x1C,   0x1C,   0x1C,   0x1C,   0x1E,   0x20,   0x30,   0x41,   0x50,   0x50,   0x50,   0x50},
-        {0x10,  0x20,   0x41,   0x83,   0x9B,   0xC4,   0x08,   0x0C,   0x10,   0x18,   0x20,   0x31,   0x40},
-        {0x62,  0xC5,   0x89,   0x12,   0xA6,   0x9C,   0x31,   0x4A,   0x62,   0x93,   0xC5,   0x27,   0x00},
-        {0x03,  0x06,   0x0D,   0x1A,   0x1E,   0x26,   0x33,   0x4D,   0x66,   0x9A,   0xCD,   0xFE,   0xFE}
+// register images for 868MHz radios, one row per air data rate
+__code static const uint8_t reg_table_868[NUM_DATA_RATES][NUM_RADIO_REGISTERS] = {
+	{0x01,	0x03,	0xD0,	0xE0,	0x10,	0x62,	0x00,	0x23,	0x1C,	0x10,	0x62,	0x03},	// 2
+	{0x01,	0x03,	0xE8,	0x60,	0x20,	0xC5,	0x00,	0x44,	0x1C,	0x20,	0xC5,	0x06},	// 4
+	{0x01,	0x03,	0xF4,	0x20,	0x41,	0x89,	0x00,	0x85,	0x1C,	0x41,	0x89,	0x0D},	// 8
+	{0x01,	0x03,	0xFA,	0x00,	0x83,	0x12,	0x01,	0x08,	0x1C,	0x83,	0x12,	0x1A},	// 16
+	{0x01,	0x03,	0xD3,	0x00,	0x9B,	0xA6,	0x01,	0x39,	0x1C,	0x9B,	0xA6,	0x1E},	// 19
+	{0x01,	0x03,	0xA7,	0x00,	0xC4,	0x9C,	0x01,	0x8A,	0x1E,	0xC4,	0x9C,	0x26},	// 24
+	{0x05,	0x03,	0x7D,	0x01,	0x06,	0x25,	0x02,	0x0E,	0x20,	0x08,	0x31,	0x33},	// 32
+	{0x0B,	0x03,	0x53,	0x01,	0x89,	0x37,	0x03,	0x18,	0x30,	0x0C,	0x4A,	0x4D},	// 48
+	{0x9A,	0x03,	0x5E,	0x01,	0x5D,	0x86,	0x02,	0xBB,	0x41,	0x10,	0x62,	0x66},	// 64
+	{0x88,	0x03,	0x7D,	0x01,	0x06,	0x25,	0x02,	0x0E,	0x50,	0x18,	0x93,	0x9A},	// 96
+	{0x8A,	0x03,	0x5E,	0x01,	0x5D,	0x86,	0x02,	0xBB,	0x50,	0x20,	0xC5,	0xCD},	// 128
+	{0x8C,	0x03,	0x3F,	0x02,	0x0C,	0x4A,	0x04,	0xEA,	0x50,	0x31,	0x27,	0xFE},	// 192
+	{0x8D,	0x03,	0x30,	0x02,	0xAA,	0xAB,	0x07,	0xFF,	0x50,	0x40,	0x00,	0xFE}	// 250
 };
 
-// register table for 915MHz radios
-__code static const uint8_t reg_table_915[NUM_RADIO_REGISTERS][NUM_DATA_RATES] = {
-	{0x01,	0x01,	0x01,	0x01,	0x01,	0x01,	0x05,	0x0B,	0x9A,	0x88,	0x8A,	0x8C,	0x8D},
-	{0x03,	0x03,	0x03,	0x03,	0x03,	0x03,	0x03,	0x03,	0x03,	0x03,	0x03,	0x03,	0x03},
-	{0xD0,	0xE8,	0xF4,	0xFA,	0xD3,	0xA7,	0x7D,	0x53,	0x5E,	0x7D,	0x5E,	0x3F,	0x30},
-	{0xE0,	0x60,	0x20,	0x00,	0x00,	0x00,	0x01,	0x01,	0x01,	0x01,	0x01,	0x02,	0x02},
-	{0x10,	0x20,	0x41,	0x83,	0x9B,	0xC4,	0x06,	0x89,	0x5D,	0x06,	0x5D,	0x0C,	0xAA},
-	{0x62,	0xC5,	0x89,	0x12,	0xA6,	0x9C,	0x25,	0x37,	0x86,	0x25,	0x86,	0x4A,	0xAB},
-	{0x00,	0x00,	0x00,	0x01,	0x01,	0x01,	0x02,	0x03,	0x02,	0x02,	0x02,	0x04,	0x07},
-	{0x23,	0x44,	0x85,	0x08,	0x39,	0x8A,	0x0E,	0x18,	0xBB,	0x0E,	0xBB,	0xEA,	0xFF},
-	{0x1E,	0x1E,	0x1E,	0x1E,	0x1E,	0x1E,	0x20,	0x30,	0x41,	0x50,	0x50,	0x50,	0x50},
-	{0x10,	0x20,	0x41,	0x83,	0x9B,	0xC4,	0x08,	0x0C,	0x10,	0x18,	0x20,	0x31,	0x40},
-	{0x62,	0xC5,	0x89,	0x12,	0xA6,	0x9C,	0x31,	0x4A,	0x62,	0x93,	0xC5,	0x27,	0x00},
-	{0x03,	0x06,	0x0D,	0x1A,	0x1E,	0x26,	0x33,	0x4D,	0x66,	0x9A,	0xCD,	0xFE,	0xFE}
+// register images for 915MHz radios, one row per air data rate
+__code static const uint8_t reg_table_915[NUM_DATA_RATES][NUM_RADIO_REGISTERS] = {
+	{0x01,	0x03,	0xD0,	0xE0,	0x10,	0x62,	0x00,	0x23,	0x1E,	0x10,	0x62,	0x03},	// 2
+	{0x01,	0x03,	0xE8,	0x60,	0x20,	0xC5,	0x00,	0x44,	0x1E,	0x20,	0xC5,	0x06},	// 4
+	{0x01,	0x03,	0xF4,	0x20,	0x41,	0x89,	0x00,	0x85,	0x1E,	0x41,	0x89,	0x0D},	// 8
+	{0x01,	0x03,	0xFA,	0x00,	0x83,	0x12,	0x01,	0x08,	0x1E,	0x83,	0x12,	0x1A},	// 16
+	{0x01,	0x03,	0xD3,	0x00,	0x9B,	0xA6,	0x01,	0x39,	0x1E,	0x9B,	0xA6,	0x1E},	// 19
+	{0x01,	0x03,	0xA7,	0x00,	0xC4,	0x9C,	0x01,	0x8A,	0x1E,	0xC4,	0x9C,	0x26},	// 24
+	{0x05,	0x03,	0x7D,	0x01,	0x06,	0x25,	0x02,	0x0E,	0x20,	0x08,	0x31,	0x33},	// 32
+	{0x0B,	0x03,	0x53,	0x01,	0x89,	0x37,	0x03,	0x18,	0x30,	0x0C,	0x4A,	0x4D},	// 48
+	{0x9A,	0x03,	0x5E,	0x01,	0x5D,	0x86,	0x02,	0xBB,	0x41,	0x10,	0x62,	0x66},	// 64
+	{0x88,	0x03,	0x7D,	0x01,	0x06,	0x25,	0x02,	0x0E,	0x50,	0x18,	0x93,	0x9A},	// 96
+	{0x8A,	0x03,	0x5E,	0x01,	0x5D,	0x86,	0x02,	0xBB,	0x50,	0x20,	0xC5,	0xCD},	// 128
+	{0x8C,	0x03,	0x3F,	0x02,	0x0C,	0x4A,	0x04,	0xEA,	0x50,	0x31,	0x27,	0xFE},	// 192
+	{0x8D,	0x03,	0x30,	0x02,	0xAA,	0xAB,	0x07,	0xFF,	0x50,	0x40,	0x00,	0xFE}	// 250
 };
 
 // configure radio based on the air data rate
@@ -654,20 +811,22 @@ __code static const uint8_t reg_table_915[NUM_RADIO_REGISTERS][NUM_DATA_RATES] =
 bool
 radio_configure(__pdata uint8_t air_rate)
 {
-	__pdata uint8_t i, rate_selection, control;
+	__pdata uint8_t i, rate_selection;
+	__pdata uint8_t regs[10];
+	__code const uint8_t *image;
 
 	// disable interrupts
-	register_write(EZRADIOPRO_INTERRUPT_ENABLE_1, 0x00);
-	register_write(EZRADIOPRO_INTERRUPT_ENABLE_2, 0x00);
+	interrupt_enable(0, 0);
 
 	clear_status_registers();
 
 #ifdef ENABLE_RF_SWITCH
 	//set GPIO0 to GND
-	register_write(EZRADIOPRO_GPIO0_CONFIGURATION, 0x14);	// RX data (output)
+	regs[0] = 0x14;		// RX data (output)
 	//set GPIO1 & GPIO2 to control the TRX switch
-	register_write(EZRADIOPRO_GPIO1_CONFIGURATION, 0x12);	// TX state (output)
-	register_write(EZRADIOPRO_GPIO2_CONFIGURATION, 0x15);	// RX state (output)
+	regs[1] = 0x12;		// TX state (output)
+	regs[2] = 0x15;		// RX state (output)
+	register_write_burst(EZRADIOPRO_GPIO0_CONFIGURATION, regs, 3);
 #elif ENABLE_RFM50_SWITCH
 	//set GPIO0 & GPIO1 to control the TRX switch
 	register_write(EZRADIOPRO_GPIO0_CONFIGURATION, 0x15);	// RX state (output)
@@ -683,9 +842,8 @@ radio_configure(__pdata uint8_t air_rate)
 #endif
 #else
 	//set GPIOx to GND
-	register_write(EZRADIOPRO_GPIO0_CONFIGURATION, 0x14);	// RX data (output)
-	register_write(EZRADIOPRO_GPIO1_CONFIGURATION, 0x14);	// RX data (output)
-	register_write(EZRADIOPRO_GPIO2_CONFIGURATION, 0x14);	// RX data (output)
+	regs[0] = regs[1] = regs[2] = 0x14;	// RX data (output)
+	register_write_burst(EZRADIOPRO_GPIO0_CONFIGURATION, regs, 3);
 #endif
 
 	// set capacitance
@@ -722,19 +880,21 @@ radio_configure(__pdata uint8_t air_rate)
 		register_write(EZRADIOPRO_HEADER_CONTROL_2, EZRADIOPRO_HDLEN_2BYTE | EZRADIOPRO_SYNCLEN_2BYTE);
 		// check 2 bytes of header
 		register_write(EZRADIOPRO_HEADER_CONTROL_1, 0x0C);
-		register_write(EZRADIOPRO_HEADER_ENABLE_3, 0xFF);
-		register_write(EZRADIOPRO_HEADER_ENABLE_2, 0xFF);
+		regs[0] = regs[1] = 0xFF;
+		register_write_burst(EZRADIOPRO_HEADER_ENABLE_3, regs, 2);
 	}
 
 
 	// set FIFO limits to allow for sending larger than 64 byte packets
-	register_write(EZRADIOPRO_TX_FIFO_CONTROL_1, TX_FIFO_THRESHOLD_HIGH);
-	register_write(EZRADIOPRO_TX_FIFO_CONTROL_2, TX_FIFO_THRESHOLD_LOW);
-	register_write(EZRADIOPRO_RX_FIFO_CONTROL, RX_FIFO_THRESHOLD_HIGH);
+	regs[0] = TX_FIFO_THRESHOLD_HIGH;
+	regs[1] = TX_FIFO_THRESHOLD_LOW;
+	regs[2] = RX_FIFO_THRESHOLD_HIGH;
+	register_write_burst(EZRADIOPRO_TX_FIFO_CONTROL_1, regs, 3);
 
 	settings.preamble_length = 16;
 
 	register_write(EZRADIOPRO_PREAMBLE_LENGTH, settings.preamble_length); // nibbles 
+	preamble_written = settings.preamble_length;
 	register_write(EZRADIOPRO_PREAMBLE_DETECTION_CONTROL, 5<<3); // 5 nibbles
 
 	// setup minimum output power during startup
@@ -748,53 +908,50 @@ radio_configure(__pdata uint8_t air_rate)
 
 	settings.air_data_rate = air_data_rates[rate_selection];
 
-	if (settings.air_data_rate >= 32) {
-		control = 0x0D;
+	if (g_board_frequency == FREQ_433) {
+		image = reg_table_433[rate_selection];
+	} else if (g_board_frequency == FREQ_470) {
+		image = reg_table_470[rate_selection];
+	} else if (g_board_frequency == FREQ_868) {
+		image = reg_table_868[rate_selection];
 	} else {
-		control = 0x2D;
+		image = reg_table_915[rate_selection];
 	}
-	if (param_get(PARAM_MANCHESTER) && settings.air_data_rate <= 128) {
-		// manchester encoding is not possible at above 128kbps
-		control |= EZRADIOPRO_ENMANCH;
-	}
-	register_write(EZRADIOPRO_MODULATION_MODE_CONTROL_1, control);
 
-	register_write(EZRADIOPRO_MODULATION_MODE_CONTROL_2, 0x23);
+	// IF filter, AFC and clock recovery, registers 0x1C to 0x25
+	regs[0] = image[REG_IF_FILTER_BANDWIDTH];
 
 	// note that EZRADIOPRO_AFCBD does not seem to work, which
 	// is a pity!
-	register_write(EZRADIOPRO_AFC_LOOP_GEARSHIFT_OVERRIDE, 0x44);
+	regs[1] = 0x44;		// AFC loop gearshift override
 
 	// this follows the recommendation in the register spreadsheet
 	// for AFC enabled and manchester disabled
 	if (settings.air_data_rate < 200) {
-		register_write(EZRADIOPRO_AFC_TIMING_CONTROL, 0x0A);
+		regs[2] = 0x0A;	// AFC timing control
 	} else {
-		register_write(EZRADIOPRO_AFC_TIMING_CONTROL, 0x02);
+		regs[2] = 0x02;
 	}
+	memcpy(&regs[3], &image[REG_CLOCK_RECOVERY], REG_CLOCK_RECOVERY_COUNT);
+	register_write_burst(EZRADIOPRO_IF_FILTER_BANDWIDTH, regs, 3 + REG_CLOCK_RECOVERY_COUNT);
 
-	// set the registers from the tables
-	if (g_board_frequency == FREQ_433) {
-		for (i = 0; i < NUM_RADIO_REGISTERS; i++) {
-			register_write(reg_index[i],
-				       reg_table_433[i][rate_selection]);
-		}
-	} else if (g_board_frequency == FREQ_470) {
-		for (i = 0; i < NUM_RADIO_REGISTERS; i++) {
-			register_write(reg_index[i],
-				       reg_table_470[i][rate_selection]);
-		}
-	} else if (g_board_frequency == FREQ_868) {
-		for (i = 0; i < NUM_RADIO_REGISTERS; i++) {
-			register_write(reg_index[i],
-				       reg_table_868[i][rate_selection]);
-		}
+	register_write(EZRADIOPRO_AFC_LIMITER, image[REG_AFC_LIMITER]);
+
+	// data rate, modulation and deviation, registers 0x6E to 0x72
+	regs[0] = image[REG_TX_DATA_RATE];
+	regs[1] = image[REG_TX_DATA_RATE+1];
+	if (settings.air_data_rate >= 32) {
+		regs[2] = 0x0D;	// modulation mode control 1
 	} else {
-		for (i = 0; i < NUM_RADIO_REGISTERS; i++) {
-			register_write(reg_index[i],
-				       reg_table_915[i][rate_selection]);
-		}
+		regs[2] = 0x2D;
 	}
+	if (param_get(PARAM_MANCHESTER) && settings.air_data_rate <= 128) {
+		// manchester encoding is not possible at above 128kbps
+		regs[2] |= EZRADIOPRO_ENMANCH;
+	}
+	regs[3] = 0x23;		// modulation mode control 2
+	regs[4] = image[REG_FREQUENCY_DEVIATION];
+	register_write_burst(EZRADIOPRO_TX_DATA_RATE_1, regs, 5);
 
 	return true;
 }
@@ -866,15 +1023,17 @@ radio_get_transmit_power(void)
 void
 radio_set_network_id(uint16_t id)
 {
+	__pdata uint8_t regs[2];
+
 	netid[0] = id&0xFF;
 	netid[1] = id>>8;
 	if (!feature_golay) {
 		// when not using golay encoding we use the hardware
 		// headers for network ID
-		register_write(EZRADIOPRO_TRANSMIT_HEADER_3, id >> 8);
-		register_write(EZRADIOPRO_TRANSMIT_HEADER_2, id & 0xFF);
-		register_write(EZRADIOPRO_CHECK_HEADER_3, id >> 8);
-		register_write(EZRADIOPRO_CHECK_HEADER_2, id & 0xFF);
+		regs[0] = id >> 8;
+		regs[1] = id & 0xFF;
+		register_write_burst(EZRADIOPRO_TRANSMIT_HEADER_3, regs, 2);
+		register_write_burst(EZRADIOPRO_CHECK_HEADER_3, regs, 2);
 	}
 }
 
@@ -931,6 +1090,78 @@ register_read(uint8_t reg) __reentrant
 	return value;
 }
 
+/// write to a run of consecutive radio registers in a single SPI burst
+///
+/// @param reg			The first register to write
+/// @param values		The values to write
+/// @param n			The number of registers to write
+///
+static void
+register_write_burst(uint8_t reg, uint8_t *values, uint8_t n) __reentrant
+{
+	EX0_SAVE_DISABLE;
+
+	NSS1 = 0;                           // drive NSS low
+	SPIF1 = 0;                          // clear SPIF
+	SPI1DAT = (reg | 0x80);             // write first reg address
+	while (n--) {
+		while (!TXBMT1);            // wait on TXBMT
+		SPI1DAT = *values++;        // write value, address increments
+	}
+	while (!TXBMT1);                    // wait on TXBMT
+	while ((SPI1CFG & 0x80) == 0x80);   // wait on SPIBSY
+
+	SPIF1 = 0;                          // leave SPIF cleared
+	NSS1 = 1;                           // drive NSS high
+
+	EX0_RESTORE;
+}
+
+/// read a run of consecutive radio registers in a single SPI burst
+///
+/// @param reg			The first register to read
+/// @param buf			Where to put the values
+/// @param n			The number of registers to read
+///
+static void
+register_read_burst(uint8_t reg, __data uint8_t *buf, uint8_t n) __reentrant
+{
+	EX0_SAVE_DISABLE;
+
+	NSS1 = 0;				// drive NSS low
+	SPIF1 = 0;				// clear SPIF
+	SPI1DAT = reg;				// write first reg address
+	while (!SPIF1);				// wait on SPIF
+	ACC = SPI1DAT;				// discard first byte
+
+	while (n--) {
+		SPIF1 = 0;			// clear SPIF
+		SPI1DAT = 0x00;			// write anything
+		while (!SPIF1);			// wait on SPIF
+		*buf++ = SPI1DAT;		// copy to buffer
+	}
+
+	SPIF1 = 0;				// leave SPIF cleared
+	NSS1 = 1;				// drive NSS high
+
+	EX0_RESTORE;
+}
+
+/// set both radio interrupt enable registers
+///
+/// @param enable1		Value for interrupt enable 1
+/// @param enable2		Value for interrupt enable 2
+///
+static void
+interrupt_enable(uint8_t enable1, uint8_t enable2) __reentrant
+{
+	uint8_t values[2];
+
+	values[0] = enable1;
+	values[1] = enable2;
+	register_write_burst(EZRADIOPRO_INTERRUPT_ENABLE_1, values, 2);
+}
+
 /// read some bytes from the receive FIFO into a buffer
 ///
 /// @param n			The number of bytes to read
@@ -959,8 +1190,9 @@ read_receive_fifo(register uint8_t n, __xdata uint8_t * buf) __reentrant
 static void
 clear_status_registers(void)
 {
-	register_read(EZRADIOPRO_INTERRUPT_STATUS_1);
-	register_read(EZRADIOPRO_INTERRUPT_STATUS_2);
+	__data uint8_t status[2];
+
+	register_read_burst(EZRADIOPRO_INTERRUPT_STATUS_1, status, 2);
 }
 
 /// scale a uint32_t, rounding to nearest multiple
@@ -985,8 +1217,7 @@ software_reset(void)
 	uint8_t status;
 
 	// Clear interrupt enable and interrupt flag bits
-	register_write(EZRADIOPRO_INTERRUPT_ENABLE_1, 0);
-	register_write(EZRADIOPRO_INTERRUPT_ENABLE_2, 0);
+	interrupt_enable(0, 0);
 
 	clear_status_registers();
 
@@ -1002,8 +1233,7 @@ software_reset(void)
 	}
 
 	// enable chip ready interrupt
-	register_write(EZRADIOPRO_INTERRUPT_ENABLE_1, 0);
-	register_write(EZRADIOPRO_INTERRUPT_ENABLE_2, EZRADIOPRO_ENCHIPRDY);
+	interrupt_enable(0, EZRADIOPRO_ENCHIPRDY);
 
 	delay_set(20);
 	while (!delay_expired()) {
@@ -1024,6 +1254,7 @@ set_frequency_registers(__pdata uint32_t frequency)
 {
 	uint8_t band;
 	__pdata uint16_t carrier;
+	__pdata uint8_t regs[3];
 
 	if (frequency > 480000000UL) {
 		frequency -= 480000000UL;
@@ -1043,9 +1274,10 @@ set_frequency_registers(__pdata uint32_t frequency)
 	band |= EZRADIOPRO_SBSEL;
 	carrier = (uint16_t)frequency;
 
-	register_write(EZRADIOPRO_FREQUENCY_BAND_SELECT, band);
-	register_write(EZRADIOPRO_NOMINAL_CARRIER_FREQUENCY_1, carrier >> 8);
-	register_write(EZRADIOPRO_NOMINAL_CARRIER_FREQUENCY_0, carrier & 0xFF);
+	regs[0] = band;
+	regs[1] = carrier >> 8;
+	regs[2] = carrier & 0xFF;
+	register_write_burst(EZRADIOPRO_FREQUENCY_BAND_SELECT, regs, 3);
 }
 
 
@@ -1062,8 +1294,11 @@ radio_temperature(void)
 	while (AD0BUSY) ;  	// Wait for completion of conversion
 
 	temp_local = (ADC0H << 8) | ADC0L;
-	temp_local *= 1.64060;  // convert reading into mV ( (val/1024) * 1680 )  vref=1680mV
-	temp_local = 25.0 + (temp_local - 1025) / 3.4; // convert mV reading into degC.
+	// convert reading into mV ( (val/1024) * 1680 )  vref=1680mV
+	// 1680/1024 is exactly 1 + 41/64, which keeps us out of float
+	temp_local += ((uint16_t)temp_local * 41) >> 6;
+	// convert mV reading into degC, at 3.4mV/degC
+	temp_local = 25 + ((temp_local - 1025) * 5) / 17;
 
 	return temp_local;
 }
@@ -1073,6 +1308,7 @@ radio_temperature(void)
 void
 radio_set_diversity(bool enable)
 {
+	diversity_enabled = enable;
 	if (enable)
 	{
 		register_write(EZRADIOPRO_GPIO2_CONFIGURATION, 0x18);
@@ -1097,19 +1333,55 @@ radio_set_diversity(bool enable)
 ///   - CRC error, when a packet fails the CRC check
 ///   - preamble valid, when a packet has started arriving
 ///
+/// and while transmitting:
+///
+///  - TX FIFO almost empty, when more of the packet is needed
+///  - packet sent, when the transmitter has finished
+///  - FIFO error, when the FIFO has under or overflowed
+///
 INTERRUPT(Receiver_ISR, INTERRUPT_INT0)
 {
 	__data uint8_t status, status2;
+	__data uint8_t regs[2];
+	__xdata uint8_t * __data buf;
 
-	status2 = register_read(EZRADIOPRO_INTERRUPT_STATUS_2);
-	status  = register_read(EZRADIOPRO_INTERRUPT_STATUS_1);
+	register_read_burst(EZRADIOPRO_INTERRUPT_STATUS_1, regs, 2);
+	status  = regs[0];
+	status2 = regs[1];
+
+	if (transmit_active) {
+		if (status & EZRADIOPRO_IFFERR) {
+			// the FIFO ran dry or overflowed
+			debug("FFERR %u\n", (unsigned)transmit_remaining);
+			transmit_finish(false);
+		} else if (status & EZRADIOPRO_IPKSENT) {
+			// the transmitter has finished. See if we
+			// got the whole packet out
+			if (transmit_remaining != 0) {
+				debug("TX short %u\n", (unsigned)transmit_remaining);
+			}
+			transmit_finish(transmit_remaining == 0);
+		} else if ((status & EZRADIOPRO_ITXFFAEM) && transmit_remaining != 0) {
+			// the FIFO is below the low threshold, top it up
+			status = transmit_remaining;
+			if (status > TX_FIFO_REFILL) {
+				status = TX_FIFO_REFILL;
+			}
+			radio_write_transmit_fifo(status, transmit_next);
+			transmit_next += status;
+			transmit_remaining -= status;
+		}
+		return;
+	}
+
+	buf = rx_slot(rx_head);
 
 	if (status & EZRADIOPRO_IRXFFAFULL) {
 		if (RX_FIFO_THRESHOLD_HIGH + (uint16_t)partial_packet_length > MAX_PACKET_LENGTH) {
 			debug("rx pplen=%u\n", (unsigned)partial_packet_length);
 			goto rxfail;
 		}
-		read_receive_fifo(RX_FIFO_THRESHOLD_HIGH, &radio_buffer[partial_packet_length]);
+		read_receive_fifo(RX_FIFO_THRESHOLD_HIGH, &buf[partial_packet_length]);
 		partial_packet_length += RX_FIFO_THRESHOLD_HIGH;
 		last_rssi = register_read(EZRADIOPRO_RECEIVED_SIGNAL_STRENGTH_INDICATOR);
 	}
@@ -1133,16 +1405,26 @@ INTERRUPT(Receiver_ISR, INTERRUPT_INT0)
 			goto rxfail;
 		}
 		if (partial_packet_length < len) {
-			read_receive_fifo(len-partial_packet_length, &radio_buffer[partial_packet_length]);
+			read_receive_fifo(len-partial_packet_length, &buf[partial_packet_length]);
 		}
-		receive_packet_length = len;
 
 		// we have a full packet
-		packet_received = true;
+		rx_length[rx_head] = len;
+		if (++rx_head == rx_slot_count) {
+			rx_head = 0;
+		}
+		if (++rx_count != rx_slot_count) {
+			// listen straight away for the next packet
+			receiver_restart();
+			return;
+		}
+		if (errors.radio_rx_full != 0xFFFF) {
+			errors.radio_rx_full++;
+		}
 
-		// disable interrupts until the tdm code has grabbed the packet
-		register_write(EZRADIOPRO_INTERRUPT_ENABLE_1, 0);
-		register_write(EZRADIOPRO_INTERRUPT_ENABLE_2, 0);
+		// all the slots are full. Disable interrupts until
+		// the tdm code has taken a packet
+		interrupt_enable(0, 0);
 
 		// go into tune mode
 		register_write(EZRADIOPRO_OPERATING_AND_FUNCTION_CONTROL_1, EZRADIOPRO_PLLON);
@@ -1153,6 +1435,7 @@ rxfail:
 	if (errors.rx_errors != 0xFFFF) {
 		errors.rx_errors++;
 	}
-	radio_receiver_on();
+	// keep any packets we already have
+	receiver_restart();
 }
 
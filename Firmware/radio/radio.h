@@ -60,6 +60,25 @@ extern __xdata uint8_t radio_interleave_buffer[MAX_PACKET_LENGTH];
 
 #include "board.h"
 #include "serial.h"
+
+/// number of received packets the radio holds by default. Boards with
+/// xdata to spare can raise this in their board header
+#ifndef RADIO_RX_SLOTS
+#define RADIO_RX_SLOTS 2
+#endif
+#if RADIO_RX_SLOTS < 2
+#error RADIO_RX_SLOTS must be at least 2
+#endif
+
+/// the most receive slots the radio will use
+#define RADIO_RX_SLOTS_MAX 8
+
+/// xdata shared out at boot between the serial buffers and the radio
+/// receive slots other than radio_buffer, which is always slot zero.
+/// It is sized for the default serial buffers and RADIO_RX_SLOTS, and
+/// any room the buffer parameters leave goes to more receive slots
+#define BUFFER_ARENA_SIZE	(SERIAL_RX_BUF_DEFAULT + SERIAL_TX_BUF_DEFAULT + \
+				 (RADIO_RX_SLOTS - 1) * MAX_PACKET_LENGTH)
 #include "board_info.h"
 #include "parameters.h"
 #include "at.h"
@@ -74,8 +93,14 @@ extern bool feature_golay;
 extern bool feature_golay_interleaving;
 extern bool feature_opportunistic_resend;
 extern bool feature_mavlink_framing;
+extern bool feature_mavlink_priority;
 extern bool feature_rtscts;
 
+/// serial idle time in byte times that ends a frame of non-MAVLink
+/// data, or zero to send serial data as it comes
+extern __pdata uint8_t feature_frame_gap;
+#define FRAME_GAP_MAX	32
+
 /// System clock frequency
 ///
 /// @todo This is standard for the Si1000 if running off the internal
@@ -140,8 +165,29 @@ struct error_counts {
 	uint16_t serial_rx_overflow;    ///< count of serial receive overflows
 	uint16_t corrected_errors;      ///< count of words corrected by golay code
 	uint16_t corrected_packets;     ///< count of packets corrected by golay code
+	uint16_t radio_rx_full;		///< count of times all the receive slots filled
 };
 __pdata extern struct error_counts errors;
+__pdata extern struct error_counts remote_errors;
+__pdata extern uint8_t remote_serial_space;	///< percentage of the other radios serial buffer free
+
+/// share the buffer arena between the serial buffers and the radio
+/// receive slots, as set by the SER_RX_BUF and SER_TX_BUF parameters.
+/// Must be called before the serial port and radio are initialised
+///
+extern void buffers_init(void);
+
+/// print the buffer sizes and how full they have been
+///
+extern void buffers_show(void);
+
+/// give the radio its receive slots beyond radio_buffer
+///
+/// @param buf			Storage for count-1 packets
+/// @param count		Number of receive slots, including
+///				radio_buffer, from 2 to RADIO_RX_SLOTS_MAX
+///
+extern void radio_set_rx_slots(__xdata uint8_t *buf, uint8_t count);
 
 /// receives a packet from the radio
 ///
@@ -157,10 +203,10 @@ extern bool radio_receive_packet(uint8_t *length, __xdata uint8_t * __xdata buf)
 ///
 extern bool radio_preamble_detected(void);
 
-/// begin transmission of a packet
+/// transmit a packet, waiting for it to go out
 ///
-/// @param length		Packet length to be transmitted; assumes
-///				the data is already present in the FIFO.
+/// @param length		Packet length to be transmitted
+/// @param buf			The packet data
 /// @param timeout_ticks	The number of ticks to wait before assiming
 ///				that transmission has failed.
 ///
@@ -168,6 +214,91 @@ extern bool radio_preamble_detected(void);
 ///
 extern bool radio_transmit(uint8_t length, __xdata uint8_t * __pdata buf, __pdata uint16_t timeout_ticks);
 
+/// begin transmission of a packet
+///
+/// The packet is copied (or encoded) into the radio buffer and the
+/// rest of it is fed to the radio from the radio interrupt, so buf
+/// is free again as soon as this returns. Use radio_transmit_busy()
+/// to find out when the packet has gone, and radio_transmit_result()
+/// to find out if it went out whole. The receiver must not be turned
+/// back on until the transmit has finished.
+///
+/// @param length		Packet length to be transmitted
+/// @param buf			The packet data
+/// @param timeout_ticks	The number of ticks to wait before assiming
+///				that transmission has failed.
+///
+extern void radio_transmit_start(uint8_t length, __xdata uint8_t * __pdata buf, __pdata uint16_t timeout_ticks);
+
+/// check if a packet is still being transmitted
+///
+/// This also ends a transmit that has run past its timeout.
+///
+/// @return			true if the transmitter is busy
+///
+extern bool radio_transmit_busy(void);
+
+/// check if the whole of the packet being transmitted has been put
+/// in the radio FIFO, so only a timeout can still make it fail
+///
+/// @return			true if nothing is left to load
+///
+extern bool radio_transmit_loaded(void);
+
+/// send the next packet with a short preamble
+///
+/// Only a receiver that is already listening for it, and that is not
+/// switching antennas on the preamble, will pick it up. The preamble
+/// goes back to its full length for the packet after.
+///
+extern void radio_transmit_short_preamble(void);
+
+/// check if we pick up packets sent with a short preamble
+///
+/// @return			true unless antenna diversity needs the
+///				full preamble
+///
+extern bool radio_receive_short_preamble(void);
+
+/// golay encode the next packet while the last one goes out
+///
+/// Everything but the CRC and the last tail bytes is encoded, into
+/// radio_interleave_buffer, so buf is free again as soon as this
+/// returns. Receiving a packet overwrites the result, which
+/// radio_transmit_prepared() shows.
+///
+/// @param length		Packet length, including the tail
+/// @param tail			Bytes to be given when the packet is sent, at most 4
+/// @param buf			The packet data, without the tail
+///
+/// @return			false if packets aren't golay encoded, when
+///				nothing is done
+///
+extern bool radio_transmit_prepare(uint8_t length, uint8_t tail, __xdata uint8_t * __pdata buf);
+
+/// check if the packet from radio_transmit_prepare() is still there
+///
+/// @return			true if it can be sent
+///
+extern bool radio_transmit_prepared(void);
+
+/// begin transmission of the packet from radio_transmit_prepare()
+///
+/// This is radio_transmit_start() for a prepared packet, finishing
+/// its encoding with the tail.
+///
+/// @param tail			The last bytes of the packet
+/// @param timeout_ticks	The number of ticks to wait before assuming
+///				that transmission has failed.
+///
+extern void radio_transmit_start_prepared(__xdata uint8_t * __pdata tail, __pdata uint16_t timeout_ticks);
+
+/// check how the last transmit went
+///
+/// @return			true if the last packet was sent successfully
+///
+extern bool radio_transmit_result(void);
+
 /// switch the radio to receive mode
 ///
 /// @return			Always true.
@@ -268,6 +399,20 @@ extern bool radio_receive_in_progress(void);
 /// send a MAVLink status report packet
 void MAVLink_report(void);
 
+/// the MAVLink system and component IDs of the radio, '3D' for 3DRadio
+#define RADIO_SOURCE_SYSTEM '3'
+#define RADIO_SOURCE_COMPONENT 'D'
+
+/// MAVLink checksum of a frame, skipping the start byte
+///
+/// @param buf		the frame
+/// @param stoplen	the number of bytes to check, including the start
+///			byte and any MAVLink 1.0 CRC seed placed after the
+///			payload
+/// @return		the checksum
+///
+extern uint16_t MAVLink_checksum(__xdata uint8_t * __data buf, __pdata uint8_t stoplen);
+
 struct radio_settings {
 	uint32_t frequency;
 	uint32_t channel_spacing;
@@ -44,14 +44,22 @@
 // would be about 16x larger than the largest air packet if we have
 // 8 TDM time slots
 //
-__xdata uint8_t rx_buf[1024] = {0};
-__xdata uint8_t tx_buf[512] = {0};
-__pdata const uint16_t  rx_mask = sizeof(rx_buf) - 1;
-__pdata const uint16_t  tx_mask = sizeof(tx_buf) - 1;
+// The buffers are carved out of the shared buffer arena at boot, see
+// serial_set_buffers(). Their sizes are powers of two
+//
+static __xdata uint8_t * __pdata	rx_buf;
+static __xdata uint8_t * __pdata	tx_buf;
+static __pdata uint16_t			rx_mask;
+static __pdata uint16_t			tx_mask;
+
+// the most bytes seen waiting in each buffer, for tuning the sizes
+__pdata uint16_t serial_rx_peak;
+__pdata uint16_t serial_tx_peak;
 
-// FIFO insert/remove pointers
-static volatile __pdata uint16_t				rx_insert, rx_remove;
-static volatile __pdata uint16_t				tx_insert, tx_remove;
+// FIFO insert/remove pointers. These are looked at on every serial
+// interrupt, so they live in directly addressed memory
+static volatile __data uint16_t				rx_insert, rx_remove;
+static volatile __data uint16_t				tx_insert, tx_remove;
 
 
 
@@ -82,7 +90,7 @@ static volatile bool			tx_idle;
 
 static void			_serial_write(register uint8_t c);
 static void			serial_restart(void);
-static void serial_device_set_speed(register uint8_t speed);
+static void serial_device_set_speed(register uint16_t speed);
 
 // save and restore serial interrupt. We use this rather than
 // __critical to ensure we don't disturb the timer interrupt at all.
@@ -94,10 +102,18 @@ static void serial_device_set_speed(register uint8_t speed);
 #define SERIAL_CTS_THRESHOLD_LOW  17
 #define SERIAL_CTS_THRESHOLD_HIGH 34
 
+// The serial interrupt runs once per byte at up to 46k bytes/sec, so
+// it is kept to the bare minimum. It has a register bank of its own
+// so that it doesn't need to save any registers, and it must not call
+// any functions, as they would use the wrong bank. AT mode input and
+// the +++ detector are handled outside it, see at_command() and
+// at_timer(). serial_bench.c measures it in the simulator.
+//
 void
-serial_interrupt(void) __interrupt(INTERRUPT_UART0)
+serial_interrupt(void) __interrupt(INTERRUPT_UART0) __using(1)
 {
 	register uint8_t	c;
+	register uint16_t	space;
 
 	// check for received byte first
 	if (RI0) {
@@ -105,30 +121,26 @@ serial_interrupt(void) __interrupt(INTERRUPT_UART0)
 		RI0 = 0;
 		c = SBUF0;
 
-		// if AT mode is active, the AT processor owns the byte
-		if (at_mode_active) {
-			// If an AT command is ready/being processed, we would ignore this byte
-			if (!at_cmd_ready) {
-				at_input(c);
-			}
+		// count it for the +++ detector
+		if (c == '+') {
+			at_plus_count++;
 		} else {
-			// run the byte past the +++ detector
-			at_plus_detector(c);
-
-			// and queue it for general reception
-			if (BUF_NOT_FULL(rx)) {
-				BUF_INSERT(rx, c);
-			} else {
-				if (errors.serial_rx_overflow != 0xFFFF) {
-					errors.serial_rx_overflow++;
-				}
-			}
+			at_plus_other = true;
+		}
+
+		// and queue it for general reception, or for the AT
+		// command processor if AT mode is active
+		space = BUF_FREE(rx);
+		if (space != 0) {
+			BUF_INSERT(rx, c);
+		} else if (errors.serial_rx_overflow != 0xFFFF) {
+			errors.serial_rx_overflow++;
+		}
 #ifdef SERIAL_CTS
-			if (BUF_FREE(rx) < SERIAL_CTS_THRESHOLD_LOW) {
-				SERIAL_CTS = true;
-			}
-#endif
+		if (space <= SERIAL_CTS_THRESHOLD_LOW) {
+			SERIAL_CTS = true;
 		}
+#endif
 	}
 
 	// check for anything to transmit
@@ -168,14 +180,24 @@ serial_check_rts(void)
 }
 
 void
-serial_init(register uint8_t speed)
+serial_set_buffers(__xdata uint8_t *rx, uint16_t rx_size,
+		   __xdata uint8_t *tx, uint16_t tx_size)
+{
+	rx_buf = rx;
+	rx_mask = rx_size - 1;
+	tx_buf = tx;
+	tx_mask = tx_size - 1;
+}
+
+void
+serial_init(register uint16_t speed)
 {
 	// disable UART interrupts
 	ES0 = 0;
 
 	// reset buffer state, discard all data
 	rx_insert = 0;
-	tx_remove = 0;
+	rx_remove = 0;
 	tx_insert = 0;
 	tx_remove = 0;
 	tx_idle = true;
@@ -252,10 +274,14 @@ serial_write_buf(__xdata uint8_t * __data buf, __pdata uint8_t count)
 		}
 	}
 
+	if (tx_mask - space + count > serial_tx_peak) {
+		serial_tx_peak = tx_mask - space + count;
+	}
+
 	// write to the end of the ring buffer
 	n1 = count;
-	if (n1 > sizeof(tx_buf) - tx_insert) {
-		n1 = sizeof(tx_buf) - tx_insert;
+	if (n1 > tx_mask + 1 - tx_insert) {
+		n1 = tx_mask + 1 - tx_insert;
 	}
 	memcpy(&tx_buf[tx_insert], buf, n1);
 	buf += n1;
@@ -350,45 +376,141 @@ serial_peek2(void)
 	return c;
 }
 
-// read count bytes from the serial buffer. This implementation
-// tries to be as efficient as possible, while disabling interrupts
-// for as short a time as possible
+// copy count bytes from the head of the serial buffer without
+// removing them. The caller must ensure they are available. Only
+// main code moves rx_remove, so the bytes can't go away under us
+void
+serial_peek_buf(__pdata uint8_t * __data buf, __pdata uint8_t count)
+{
+	__pdata uint16_t i = rx_remove;
+
+	while (count--) {
+		*buf++ = rx_buf[i];
+		i = (i + 1) & rx_mask;
+	}
+}
+
+// look at the byte ofs bytes into the serial buffer without removing
+// it. The caller must ensure it is there
+uint8_t
+serial_peek_at(__pdata uint16_t ofs)
+{
+	return rx_buf[(rx_remove + ofs) & rx_mask];
+}
+
+// remove count bytes starting ofs bytes into the serial buffer, moving
+// the bytes in front of them up to close the gap. The interrupt only
+// writes beyond the bytes waiting, so it can be left enabled while
+// they are moved
+void
+serial_read_cut(__pdata uint16_t ofs, __pdata uint16_t count)
+{
+	__pdata uint16_t from, to;
+
+	from = (rx_remove + ofs) & rx_mask;
+	to = (from + count) & rx_mask;
+	while (ofs--) {
+		from = (from - 1) & rx_mask;
+		to = (to - 1) & rx_mask;
+		rx_buf[to] = rx_buf[from];
+	}
+	serial_read_consume(count);
+}
+
+// where the next byte received will go in the serial buffer, which
+// marks the end of the bytes received so far
+uint16_t
+serial_read_mark(void)
+{
+	register uint16_t ret;
+
+	ES0_SAVE_DISABLE;
+	ret = rx_insert;
+	ES0_RESTORE;
+	return ret;
+}
+
+// serial_read_mark() for interrupt code. The serial interrupt runs at
+// the same priority, so it can't move rx_insert while we look
+uint16_t
+serial_read_mark_isr(void)
+{
+	return rx_insert;
+}
+
+// how many bytes into the serial buffer a mark is. Once the bytes
+// before it have been read this is zero, and after that more than
+// serial_read_available()
+uint16_t
+serial_mark_offset(__pdata uint16_t mark)
+{
+	return (mark - rx_remove) & rx_mask;
+}
+
+// describe the bytes waiting in the serial buffer as at most two
+// contiguous runs. The insert pointer is sampled once with the serial
+// interrupt disabled; anything that arrives after that shows up on
+// the next call
+uint16_t
+serial_read_spans(__pdata struct serial_span * __data spans)
+{
+	__pdata uint16_t insert;
+
+	ES0_SAVE_DISABLE;
+	insert = rx_insert;
+	ES0_RESTORE;
+
+	spans[0].ptr = &rx_buf[rx_remove];
+	spans[1].ptr = &rx_buf[0];
+	if (insert >= rx_remove) {
+		spans[0].len = insert - rx_remove;
+		spans[1].len = 0;
+	} else {
+		spans[0].len = rx_mask + 1 - rx_remove;
+		spans[1].len = insert;
+	}
+	return spans[0].len + spans[1].len;
+}
+
+// release count bytes previously returned by serial_read_spans
+void
+serial_read_consume(__pdata uint16_t count)
+{
+	ES0_SAVE_DISABLE;
+	rx_remove = (rx_remove + count) & rx_mask;
+#ifdef SERIAL_CTS
+	if (BUF_FREE(rx) > SERIAL_CTS_THRESHOLD_HIGH) {
+		SERIAL_CTS = false;
+	}
+#endif
+	ES0_RESTORE;
+}
+
+// read count bytes from the serial buffer. This copies straight out
+// of the buffer spans, with the serial interrupt only disabled while
+// the pointers are looked at
 bool
 serial_read_buf(__xdata uint8_t * __data buf, __pdata uint8_t count)
 {
-	__pdata uint16_t n1;
+	__pdata struct serial_span spans[2];
+	__pdata uint8_t n;
+
 	// the caller should have already checked this, 
 	// but lets be sure
-	if (count > serial_read_available()) {
+	if (count > serial_read_spans(spans)) {
 		return false;
 	}
 	// see how much we can copy from the tail of the buffer
-	n1 = count;
-	if (n1 > sizeof(rx_buf) - rx_remove) {
-		n1 = sizeof(rx_buf) - rx_remove;
-	}
-	memcpy(buf, &rx_buf[rx_remove], n1);
-	count -= n1;
-	buf += n1;
-	// update the remove marker with interrupts disabled
-	__critical {
-		rx_remove = (rx_remove + n1) & rx_mask;
+	n = count;
+	if (n > spans[0].len) {
+		n = spans[0].len;
 	}
+	memcpy(buf, spans[0].ptr, n);
 	// any more bytes to do?
-	if (count > 0) {
-		memcpy(buf, &rx_buf[0], count);
-		__critical {
-			rx_remove = count;
-		}		
-	}
-
-#ifdef SERIAL_CTS
-	__critical {
-		if (BUF_FREE(rx) > SERIAL_CTS_THRESHOLD_HIGH) {
-			SERIAL_CTS = false;
-		}
+	if (count > n) {
+		memcpy(buf + n, spans[1].ptr, count - n);
 	}
-#endif
+	serial_read_consume(count);
 	return true;
 }
 
@@ -399,6 +521,9 @@ serial_read_available(void)
 	ES0_SAVE_DISABLE;
 	ret = BUF_USED(rx);
 	ES0_RESTORE;
+	if (ret > serial_rx_peak) {
+		serial_rx_peak = ret;
+	}
 	return ret;
 }
 
@@ -406,8 +531,8 @@ serial_read_available(void)
 uint8_t
 serial_read_space(void)
 {
-	uint16_t space = sizeof(rx_buf) - serial_read_available();
-	space = (100 * (space/8)) / (sizeof(rx_buf)/8);
+	uint16_t space = rx_mask + 1 - serial_read_available();
+	space = (100 * (space/8)) / ((rx_mask + 1)/8);
 	return space;
 }
 
@@ -426,8 +551,14 @@ putchar(char c) __reentrant
 /// serial rate scheme that APM uses. If an unsupported
 /// rate is chosen then 57600 is used
 ///
+/// The UART runs from timer 1, which overflows at twice the bit
+/// rate. Above 115200 it is clocked straight from SYSCLK, so 460800
+/// would be {460, 0xe5, 0x08}, 27 counts of 24.5MHz and 1.5% slow. It
+/// is left out until "make bench_serial" has shown that the interrupt
+/// keeps up with it. 921600 would be 2.2% out, which is too far.
+///
 static const __code struct {
-	uint8_t rate;
+	uint16_t rate;
 	uint8_t th1;
 	uint8_t ckcon;
 } serial_rates[] = {
@@ -446,7 +577,7 @@ static const __code struct {
 // check if a serial speed is valid
 //
 bool 
-serial_device_valid_speed(register uint8_t speed)
+serial_device_valid_speed(register uint16_t speed)
 {
 	uint8_t i;
 	uint8_t num_rates = ARRAY_LENGTH(serial_rates);
@@ -460,7 +591,7 @@ serial_device_valid_speed(register uint8_t speed)
 }
 
 static 
-void serial_device_set_speed(register uint8_t speed)
+void serial_device_set_speed(register uint16_t speed)
 {
 	uint8_t i;
 	uint8_t num_rates = ARRAY_LENGTH(serial_rates);
@@ -471,7 +602,8 @@ void serial_device_set_speed(register uint8_t speed)
 		}
 	}
 	if (i == num_rates) {
-		i = 3; // 57600 default
+		i = 6; // 57600 default
+		speed = 57;
 	}
 
 	// set the rates in the UART
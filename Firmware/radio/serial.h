@@ -39,19 +39,46 @@
 #include <stdint.h>
 #include "radio.h"
 
+/// A contiguous run of bytes in the serial receive buffer
+///
+struct serial_span {
+	__xdata uint8_t	*ptr;	///< first byte of the run
+	uint16_t	len;	///< number of bytes in the run
+};
+
+/// default and smallest serial buffer sizes. The sizes are set by the
+/// SER_RX_BUF and SER_TX_BUF parameters, and must be powers of two
+#define SERIAL_RX_BUF_DEFAULT	1024
+#define SERIAL_TX_BUF_DEFAULT	512
+#define SERIAL_BUF_MIN		256
+
+/// the most bytes seen waiting in the receive and transmit buffers
+extern __pdata uint16_t serial_rx_peak;
+extern __pdata uint16_t serial_tx_peak;
+
+/// Give the serial port its buffers. Must be called before serial_init.
+///
+/// @param	rx		The receive buffer.
+/// @param	rx_size		Size of the receive buffer, a power of two.
+/// @param	tx		The transmit buffer.
+/// @param	tx_size		Size of the transmit buffer, a power of two.
+///
+extern void	serial_set_buffers(__xdata uint8_t *rx, uint16_t rx_size,
+				   __xdata uint8_t *tx, uint16_t tx_size);
+
 /// Initialise the serial port.
 ///
 /// @param	speed		The serial speed to configure, passed
 ///				to serial_device_set_speed at the appropriate
 ///				point during initialisation.
 ///
-extern void	serial_init(register uint8_t speed);
+extern void	serial_init(register uint16_t speed);
 
 /// check if a serial speed is valid
 ///
 /// @param	speed		The serial speed to configure
 ///
-extern bool serial_device_valid_speed(register uint8_t speed);
+extern bool serial_device_valid_speed(register uint16_t speed);
 
 /// Write a byte to the serial port.
 ///
@@ -113,6 +140,75 @@ extern uint8_t	serial_peek2(void);
 ///
 extern bool	serial_read_buf(__xdata uint8_t * __data buf, __pdata uint8_t count);
 
+/// Look at the bytes in the read FIFO in place.
+///
+/// The FIFO is a ring, so the bytes waiting in it are returned as up
+/// to two runs, the second of which may be empty. The bytes stay in
+/// the FIFO until released with serial_read_consume(), and the runs
+/// stay valid until then.
+///
+/// @param	spans		Array of two spans to fill in.
+/// @return			The total number of bytes in the spans.
+///
+extern uint16_t	serial_read_spans(__pdata struct serial_span * __data spans);
+
+/// Remove bytes from the read FIFO after looking at them with
+/// serial_read_spans().
+///
+/// @param	count		The number of bytes to remove, which must
+///				be no more than serial_read_spans() returned.
+///
+extern void	serial_read_consume(__pdata uint16_t count);
+
+/// Copy bytes from the read FIFO without removing them.
+/// caller must ensure serial available is >= count
+///
+/// @param	buf		Buffer for the bytes.
+/// @param	count		The number of bytes to copy.
+///
+extern void	serial_peek_buf(__pdata uint8_t * __data buf, __pdata uint8_t count);
+
+/// Look at a byte further into the read FIFO without removing it.
+/// caller must ensure serial available is > ofs
+///
+/// @param	ofs		How many bytes in from the head to look.
+/// @return			The byte at that offset.
+///
+extern uint8_t	serial_peek_at(__pdata uint16_t ofs);
+
+/// Remove bytes from the middle of the read FIFO, leaving the bytes
+/// in front of them waiting.
+/// caller must ensure serial available is >= ofs + count
+///
+/// @param	ofs		How many bytes in from the head they start.
+/// @param	count		The number of bytes to remove.
+///
+extern void	serial_read_cut(__pdata uint16_t ofs, __pdata uint16_t count);
+
+/// Mark the end of the bytes received so far, to find it again with
+/// serial_mark_offset() as bytes are read.
+///
+/// @return			The mark.
+///
+extern uint16_t	serial_read_mark(void);
+
+/// serial_read_mark() for use from interrupt context, where it must
+/// not touch ES0.
+///
+/// @return			The mark.
+///
+extern uint16_t	serial_read_mark_isr(void);
+
+/// Find a mark from serial_read_mark() in the read FIFO.
+///
+/// @param	mark		The mark.
+/// @return			The number of bytes in the FIFO before
+///				the mark, zero if they have all been read,
+///				or more than serial_read_available() once
+///				bytes after the mark have been read too.
+///
+extern uint16_t	serial_mark_offset(__pdata uint16_t mark);
+
 /// Check for bytes in the read FIFO
 ///
 /// @return			The number of bytes available to be read
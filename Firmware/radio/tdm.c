@@ -41,6 +41,7 @@
 #include "golay.h"
 #include "freq_hopping.h"
 #include "crc.h"
+#include "ota.h"
 
 #define USE_TICK_YIELD 1
 
@@ -100,9 +101,6 @@ __pdata uint16_t transmit_wait;
 /// the long term duty cycle we are aiming for
 __pdata uint8_t duty_cycle;
 
-/// the average duty cycle we have been transmitting
-__data static float average_duty_cycle;
-
 /// duty cycle offset due to temperature
 __pdata uint8_t duty_cycle_offset;
 
@@ -131,6 +129,125 @@ __pdata uint8_t test_display;
 /// set when we should send a statistics packet on the next round
 static __bit send_statistics;
 
+/// set while a packet we started sending is going out, with whether
+/// it held user data and lit the activity LED
+static __bit transmit_pending;
+static __bit transmit_user_data;
+static __bit transmit_activity;
+
+/// set when the packet going out is the start of a burst, until the
+/// next packet has had a chance to be got ready by prepare_next()
+static __bit transmit_burst;
+
+/// set when the last packet we sent was followed by a burst gap, and
+/// nothing has been received since, so the other radio is listening
+/// for the next packet straight away
+static __bit burst_follows;
+
+/// set while prepare_next() holds the next packet of a burst, golay
+/// encoded but for its trailer, with next_len bytes before the trailer
+static __bit next_prepared;
+__pdata static uint8_t next_len;
+
+/// how many link updates without a packet before we decide we have
+/// lost the other radio and start searching for it
+__pdata static uint8_t unlock_limit;
+
+/// number of zero window beacons we send in each TDM state while we are
+/// searching for the other radio
+#define LOCK_BEACONS 2
+
+/// how many beacons we have sent in this TDM state
+__pdata static uint8_t beacon_count;
+
+/// the channel a searching radio told us it is listening on, or
+/// HOP_SYNC_NONE. We answer with a hop sync packet on that channel
+#define HOP_SYNC_NONE 0xFF
+__pdata static uint8_t hop_sync_channel;
+
+/// capabilities control packet, telling the other radio which optional
+/// parts of the protocol we understand. Older firmware ignores it
+struct tdm_capabilities {
+	uint8_t magic;
+	uint8_t version;
+	uint8_t flags;
+};
+#define TDM_CAPABILITY_MAGIC	'C'
+#define TDM_CAPABILITY_VERSION	1
+
+/// we can receive packets sent back to back
+#define TDM_CAP_BURST		(1<<0)
+
+/// we understand data packets with an extended trailer holding a slice
+/// of the senders statistics
+#define TDM_CAP_STATS_TRAILER	(1<<1)
+
+/// we take over the air update requests in command packets, which needs
+/// an OTA=1 build and a bootloader that applies them (see ota.h)
+#define TDM_CAP_OTA		(1<<2)
+
+/// we take batches of remote AT commands
+#define TDM_CAP_AT_BATCH	(1<<3)
+
+/// we pick up the packets after the first of a burst when they are
+/// sent with a short preamble, which a receiver switching antennas on
+/// the preamble can't do
+#define TDM_CAP_SHORT_PREAMBLE	(1<<4)
+
+/// we have the capabilities of the radio this is sent to. Until it
+/// sees this it can't tell what we send apart from older packets
+#define TDM_CAP_HEARD		(1<<7)
+
+/// a radio sends statistics slices once the other radio understands
+/// them and knows it does
+#define TDM_CAP_STATS_SEND	(TDM_CAP_STATS_TRAILER | TDM_CAP_HEARD)
+
+/// the capabilities the other radio last told us about
+__pdata static uint8_t remote_capabilities;
+
+/// set when we should send a capabilities packet on the next round
+static __bit send_capabilities;
+
+/// set until a capabilities packet has gone out since the link came
+/// up. It then goes in place of data, so a link that is busy from the
+/// start can't hold it back
+static __bit capabilities_due;
+
+/// a slice of our statistics, sent just before the trailer of data
+/// packets when the other radio understands them. The trailer of
+/// such a packet has both command and resend set, and the real values
+/// of those bits move into the slice id. Older firmware sends that
+/// combination too, with an opportunistic resend of a remote AT
+/// command, so only radios that have exchanged TDM_CAP_STATS_TRAILER
+/// and TDM_CAP_HEARD send or look for the slice
+struct stats_slice {
+	uint8_t id;
+	uint16_t value;
+};
+#define STATS_SLICE_COMMAND		0x80
+#define STATS_SLICE_RESEND		0x40
+#define STATS_SLICE_ID_MASK		0x3F
+
+#define STATS_SLICE_SIGNAL		0	///< average rssi and noise
+#define STATS_SLICE_RECEIVE_COUNT	1
+#define STATS_SLICE_RX_ERRORS		2
+#define STATS_SLICE_TX_ERRORS		3
+#define STATS_SLICE_SERIAL_RX_OVERFLOW	4
+#define STATS_SLICE_SERIAL_TX_OVERFLOW	5
+#define STATS_SLICE_CORRECTED_PACKETS	6
+#define STATS_SLICE_SERIAL_SPACE	7
+#define STATS_SLICE_COUNT		8
+
+/// the next slice of our statistics to send
+__pdata static uint8_t next_stats_slice;
+
+/// set when our rssi and noise have gone out in a packet trailer since
+/// the last link update, so no statistics packet is needed
+static __bit signal_in_trailer;
+
+/// the gap we leave between packets in a burst, in 16usec ticks
+__pdata static uint16_t burst_gap;
+
 /// set when we should send a MAVLink report pkt
 extern bool seen_mavlink;
 
@@ -142,9 +259,30 @@ struct tdm_trailer {
 };
 __pdata struct tdm_trailer trailer;
 
-/// buffer to hold a remote AT command before sending
-static bool send_at_command;
-static __pdata char remote_at_cmd[AT_CMD_MAXLEN + 1];
+/// a command packet holding a batch of remote AT commands:
+///
+/// <AT_BATCH_MAGIC><flags><command>\0<command>\0...
+///
+/// with each command missing its AT prefix. The other radio runs them
+/// in order and sends back all of their output together
+#define AT_BATCH_MAGIC		0xb8
+#define AT_BATCH_ATOMIC		(1<<0)	///< all parameter changes or none, see tdm_remote_batch()
+
+/// remote AT commands waiting to be sent, without their RT prefix and
+/// nul terminated. Radios that take batches get as many as fit in a
+/// packet, older ones get them one at a time
+#define REMOTE_AT_QUEUE_SIZE	64
+static __xdata char remote_at_queue[REMOTE_AT_QUEUE_SIZE];
+static __pdata uint8_t remote_at_len;
+
+/// set while AT&RB is holding remote AT commands back
+static bool remote_at_hold;
+
+/// set when the queue is to go as one atomic batch
+static bool remote_at_atomic;
+
+/// parameters as they were before an atomic batch from the other radio
+static __xdata param_t at_batch_saved[PARAM_MAX];
 
 /// display RSSI output
 ///
@@ -166,6 +304,15 @@ tdm_show_rssi(void)
 	       (unsigned)errors.corrected_packets,
 	       (int)radio_temperature(),
 	       (unsigned)duty_cycle_offset);
+	if (remote_capabilities & TDM_CAP_STATS_TRAILER) {
+		printf("remote txe=%u rxe=%u stx=%u srx=%u ecc=%u space=%u%%\n",
+		       (unsigned)remote_errors.tx_errors,
+		       (unsigned)remote_errors.rx_errors,
+		       (unsigned)remote_errors.serial_tx_overflow,
+		       (unsigned)remote_errors.serial_rx_overflow,
+		       (unsigned)remote_errors.corrected_packets,
+		       (unsigned)remote_serial_space);
+	}
 	printf("TIMING: Last golay decode: start=0x%x, end=0x%x, bytes decoded=0x%x\n",
 	       golay_decode_start_time,golay_decode_end_time,golay_decode_time_bytes);
 	statistics.receive_count = 0;
@@ -304,10 +451,17 @@ tdm_state_update(__pdata uint16_t tdelta)
 
 		if (tdm_state == TDM_TRANSMIT && (duty_cycle - duty_cycle_offset) != 100) {
 			// update duty cycle averages
-			average_duty_cycle = (0.95*average_duty_cycle) + (0.05*(100.0*transmitted_ticks)/(2*(silence_period+tx_window_width)));
+			duty_cycle_update(transmitted_ticks, 2*(silence_period+tx_window_width));
 			transmitted_ticks = 0;
-			duty_cycle_wait = (average_duty_cycle >= (duty_cycle - duty_cycle_offset));
+			duty_cycle_wait = (average_duty_cycle >= (uint16_t)(duty_cycle - duty_cycle_offset) * DUTY_CYCLE_ONE_PERCENT);
+		}
+
+#ifdef ENABLE_OTA
+		if (tdm_state == TDM_TRANSMIT) {
+			// an unanswered OTA request can go again
+			ota_window();
 		}
+#endif
 
 		// we lose the bonus on all state changes
 		bonus_transmit = 0;
@@ -315,6 +469,9 @@ tdm_state_update(__pdata uint16_t tdelta)
 		// reset yield flag on all state changes
 		transmit_yield = 0;
 
+		// and start a new set of beacons
+		beacon_count = 0;
+
 		// no longer waiting for a packet
 		transmit_wait = 0;
 	}
@@ -322,6 +479,110 @@ tdm_state_update(__pdata uint16_t tdelta)
 	tdm_state_remaining -= tdelta;
 }
 
+/// add the next slice of our statistics to a data packet
+///
+/// @param len		length of the data in pbuf
+/// @return		length with the slice added
+///
+static uint8_t
+send_stats_slice(__pdata uint8_t len)
+{
+	__pdata struct stats_slice slice;
+
+	slice.id = next_stats_slice;
+	if (trailer.command) {
+		slice.id |= STATS_SLICE_COMMAND;
+	}
+	if (trailer.resend) {
+		slice.id |= STATS_SLICE_RESEND;
+	}
+
+	switch (next_stats_slice) {
+	case STATS_SLICE_SIGNAL:
+		slice.value = statistics.average_rssi | ((uint16_t)statistics.average_noise << 8);
+		signal_in_trailer = true;
+		break;
+	case STATS_SLICE_RECEIVE_COUNT:
+		slice.value = statistics.receive_count;
+		break;
+	case STATS_SLICE_RX_ERRORS:
+		slice.value = errors.rx_errors;
+		break;
+	case STATS_SLICE_TX_ERRORS:
+		slice.value = errors.tx_errors;
+		break;
+	case STATS_SLICE_SERIAL_RX_OVERFLOW:
+		slice.value = errors.serial_rx_overflow;
+		break;
+	case STATS_SLICE_SERIAL_TX_OVERFLOW:
+		slice.value = errors.serial_tx_overflow;
+		break;
+	case STATS_SLICE_CORRECTED_PACKETS:
+		slice.value = errors.corrected_packets;
+		break;
+	default:
+		slice.value = serial_read_space();
+		break;
+	}
+	if (++next_stats_slice == STATS_SLICE_COUNT) {
+		next_stats_slice = 0;
+	}
+
+	memcpy(&pbuf[len], &slice, sizeof(slice));
+
+	// mark the trailer as extended
+	trailer.command = 1;
+	trailer.resend = 1;
+
+	return len + sizeof(slice);
+}
+
+/// take a slice of the other radios statistics off a data packet
+///
+/// @param len		length of the packet in pbuf, without the trailer
+/// @return		length of the data
+///
+static uint8_t
+receive_stats_slice(__pdata uint8_t len)
+{
+	__pdata struct stats_slice slice;
+
+	len -= sizeof(slice);
+	memcpy(&slice, &pbuf[len], sizeof(slice));
+
+	trailer.command = (slice.id & STATS_SLICE_COMMAND) != 0;
+	trailer.resend = (slice.id & STATS_SLICE_RESEND) != 0;
+
+	switch (slice.id & STATS_SLICE_ID_MASK) {
+	case STATS_SLICE_SIGNAL:
+		remote_statistics.average_rssi = slice.value & 0xFF;
+		remote_statistics.average_noise = slice.value >> 8;
+		break;
+	case STATS_SLICE_RECEIVE_COUNT:
+		remote_statistics.receive_count = slice.value;
+		break;
+	case STATS_SLICE_RX_ERRORS:
+		remote_errors.rx_errors = slice.value;
+		break;
+	case STATS_SLICE_TX_ERRORS:
+		remote_errors.tx_errors = slice.value;
+		break;
+	case STATS_SLICE_SERIAL_RX_OVERFLOW:
+		remote_errors.serial_rx_overflow = slice.value;
+		break;
+	case STATS_SLICE_SERIAL_TX_OVERFLOW:
+		remote_errors.serial_tx_overflow = slice.value;
+		break;
+	case STATS_SLICE_CORRECTED_PACKETS:
+		remote_errors.corrected_packets = slice.value;
+		break;
+	case STATS_SLICE_SERIAL_SPACE:
+		remote_serial_space = slice.value;
+		break;
+	}
+	return len;
+}
+
 /// change tdm phase
 ///
 void
@@ -379,9 +640,18 @@ link_update(void)
 		LED_RADIO = blink_state;
 		blink_state = !blink_state;
 	}
+	if (unlock_count == unlock_limit) {
+		// we have missed several rounds of packets, so start
+		// frequency scanning. Waiting longer just gives the
+		// clocks more time to drift us out of step
+		if (at_testmode & AT_TEST_TDM) {
+			printf("TDM: scanning\n");
+		}
+		fhop_set_locked(false);
+	}
 	if (unlock_count > 40) {
 		// if we have been unlocked for 20 seconds
-		// then start frequency scanning again
+		// then shift our timing
 
 		unlock_count = 5;
 		// randomise the next transmit window using some
@@ -400,10 +670,6 @@ link_update(void)
 				       (unsigned)tdm_state_remaining);
 			}
 		}
-		if (at_testmode & AT_TEST_TDM) {
-			printf("TDM: scanning\n");
-		}
-		fhop_set_locked(false);
 	}
 
 	if (unlock_count != 0) {
@@ -414,31 +680,231 @@ link_update(void)
 	}
 	if (unlock_count > 5) {
 		memset(&remote_statistics, 0, sizeof(remote_statistics));
+		memset(&remote_errors, 0, sizeof(remote_errors));
+		remote_capabilities = 0;
+		capabilities_due = 1;
 	}
 
 	test_display = at_testmode;
-	send_statistics = 1;
+
+	// a statistics packet is only needed if our signal levels
+	// haven't gone out in a packet trailer
+	send_statistics = !signal_in_trailer;
+	signal_in_trailer = false;
 
 	temperature_count++;
 	if (temperature_count == 4) {
 		// check every 2 seconds
 		temperature_update();
 		temperature_count = 0;
+
+		// and remind the other radio of our capabilities
+		send_capabilities = 1;
 	}
 }
 
-// dispatch an AT command to the remote system
+// queue an AT command for the remote system
 void
 tdm_remote_at(void)
 {
-	memcpy(remote_at_cmd, at_cmd, strlen(at_cmd)+1);
-	send_at_command = true;
+	__pdata uint8_t len = at_cmd_len - 1;
+
+	if (remote_at_len + len > sizeof(remote_at_queue)) {
+		printf("%s\n", "ERROR");
+		return;
+	}
+	memcpy(&remote_at_queue[remote_at_len], &at_cmd[2], len);
+	remote_at_len += len;
+}
+
+bool
+tdm_remote_batch(char op)
+{
+	switch (op) {
+	case 'B':
+		if (remote_at_hold || remote_at_len != 0) {
+			// wait for the commands already queued to go
+			return false;
+		}
+		remote_at_hold = true;
+		return true;
+	case 'C':
+		if (!remote_at_hold) {
+			return false;
+		}
+		remote_at_hold = false;
+		remote_at_atomic = true;
+		return true;
+	case 'A':
+		remote_at_hold = false;
+		remote_at_atomic = false;
+		remote_at_len = 0;
+		return true;
+	}
+	return false;
+}
+
+/// put the next remote AT commands in pbuf
+///
+/// @param max		the most bytes the packet can hold
+/// @return		the length of the packet, or zero for none
+///
+static uint8_t
+remote_at_next(__pdata uint8_t max)
+{
+	__pdata uint8_t n, len;
+
+	if (remote_at_len == 0 || remote_at_hold) {
+		return 0;
+	}
+
+	if ((remote_capabilities & TDM_CAP_AT_BATCH) == 0) {
+		if (remote_at_atomic) {
+			// the other radio can't do it
+			printf("%s\n", "ERROR");
+			tdm_remote_batch('A');
+			return 0;
+		}
+		// one at a time, as older firmware expects
+		len = strlen(remote_at_queue);
+		if (max < len + 2) {
+			return 0;
+		}
+		pbuf[0] = 'R';
+		pbuf[1] = 'T';
+		memcpy(&pbuf[2], remote_at_queue, len);
+		n = len + 1;
+		len += 2;
+	} else {
+		// as many whole commands as fit, or all of an atomic
+		// batch
+		for (n = 0; n < remote_at_len; n += len) {
+			len = strlen(&remote_at_queue[n]) + 1;
+			if (n + len + 2 > max) {
+				break;
+			}
+		}
+		if (n == 0 || (remote_at_atomic && n != remote_at_len)) {
+			return 0;
+		}
+		pbuf[0] = AT_BATCH_MAGIC;
+		pbuf[1] = remote_at_atomic ? AT_BATCH_ATOMIC : 0;
+		memcpy(&pbuf[2], remote_at_queue, n);
+		len = n + 2;
+		remote_at_atomic = false;
+	}
+
+	// take them off the queue
+	remote_at_len -= n;
+	memcpy(remote_at_queue, &remote_at_queue[n], remote_at_len);
+	return len;
+}
+
+/// put back the parameters an atomic batch changed
+static void
+at_batch_restore(void)
+{
+	__pdata uint8_t i, pass;
+
+	// twice over, as one serial buffer size may only go back
+	// once the other has
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < PARAM_MAX; i++) {
+			if (param_get(i) != at_batch_saved[i]) {
+				param_set(i, at_batch_saved[i]);
+			}
+		}
+	}
+}
+
+/// run a batch of AT commands from the remote radio, sending back all
+/// of their output in one reply
+///
+/// @param len		the length of the packet in pbuf
+///
+static void
+handle_at_batch(__pdata uint8_t len)
+{
+	__pdata uint8_t flags = pbuf[1];
+	__pdata uint8_t cmd, out, n;
+	bool failed = false;
+	bool save = false;
+
+	// check every command will fit in at_cmd
+	if (len < 3 || pbuf[len - 1] != 0) {
+		return;
+	}
+	for (cmd = 2; cmd < len; cmd += n + 1) {
+		n = strlen((char *)&pbuf[cmd]);
+		if (n > AT_CMD_MAXLEN - 2) {
+			return;
+		}
+	}
+
+	// move the commands to the end of pbuf, so the output can
+	// be captured from the start as they are used up
+	len -= 2;
+	cmd = sizeof(pbuf) - len;
+	for (n = len; n != 0; n--) {
+		pbuf[cmd + n - 1] = pbuf[n + 1];
+	}
+
+	if (flags & AT_BATCH_ATOMIC) {
+		for (n = 0; n < PARAM_MAX; n++) {
+			at_batch_saved[n] = param_get(n);
+		}
+	}
+
+	out = 0;
+	while (cmd < sizeof(pbuf)) {
+		at_cmd[0] = 'A';
+		at_cmd[1] = 'T';
+		n = strlen((char *)&pbuf[cmd]) + 1;
+		memcpy(&at_cmd[2], &pbuf[cmd], n);
+		at_cmd_len = n + 1;
+		cmd += n;
+
+		if ((flags & AT_BATCH_ATOMIC) && !strcmp(at_cmd, "AT&W")) {
+			// only save once everything has been applied
+			save = true;
+			continue;
+		}
+
+		at_cmd_ready = true;
+		printf_start_capture(&pbuf[out], cmd - out);
+		at_command();
+		out += printf_end_capture();
+
+		if (at_cmd_error && (flags & AT_BATCH_ATOMIC)) {
+			failed = true;
+			break;
+		}
+	}
+
+	if (flags & AT_BATCH_ATOMIC) {
+		if (failed) {
+			at_batch_restore();
+		} else if (save) {
+			param_save();
+		}
+		printf_start_capture(&pbuf[out], sizeof(pbuf) - out);
+		printf("%s\n", failed ? "ERROR" : "OK");
+		out += printf_end_capture();
+	}
+
+	if (out > 0) {
+		packet_inject(pbuf, out);
+	}
 }
 
 // handle an incoming at command from the remote radio
 static void
 handle_at_command(__pdata uint8_t len)
 {
+	if (len != 0 && pbuf[0] == AT_BATCH_MAGIC) {
+		handle_at_batch(len);
+		return;
+	}
 	if (len < 2 || len > AT_CMD_MAXLEN || 
 	    pbuf[0] != (uint8_t)'R' || 
 	    pbuf[1] != (uint8_t)'T') {
@@ -468,6 +934,113 @@ handle_at_command(__pdata uint8_t len)
 	}
 }
 
+/// give up on the packet from prepare_next(), leaving the packet
+/// system to send it again
+///
+static void
+drop_next(void)
+{
+	next_prepared = false;
+	packet_force_resend();
+
+	// its slice of our statistics isn't going out
+	signal_in_trailer = false;
+}
+
+/// called when the transmit started by the main loop has finished
+///
+static void
+transmit_done(void)
+{
+	transmit_pending = false;
+
+	if (!radio_transmit_result() && transmit_user_data) {
+		if (next_prepared) {
+			// the packet system only holds the next
+			// packet now, so that is the one to resend
+			drop_next();
+		} else {
+			packet_force_resend();
+		}
+	}
+
+	if (lbt_rssi != 0) {
+		// reset the LBT listen time
+		lbt_listen_time = 0;
+		lbt_rand = 0;
+	}
+
+	// set right receive channel
+	radio_set_channel(fhop_receive_channel());
+
+	// re-enable the receiver
+	radio_receiver_on();
+
+	if (transmit_activity) {
+		LED_ACTIVITY = LED_OFF;
+	}
+}
+
+/// get the next packet of a burst ready while the last one is still
+/// going out, so only its trailer is left to do when its turn comes
+///
+static void
+prepare_next(void)
+{
+	__pdata uint16_t remaining, n;
+	__pdata uint8_t max_xmit, len;
+
+	transmit_burst = false;
+
+	if (packet_injected_waiting()) {
+		// an injected packet can't be put back if we end up
+		// not sending it
+		return;
+	}
+
+	// the ticks left after the last packet and the gap behind it,
+	// less a packet latency of slack for getting round the loop
+	remaining = trailer.window;
+	if (remaining < burst_gap + 2*packet_latency) {
+		return;
+	}
+	n = (remaining - burst_gap - 2*packet_latency) / ticks_per_byte;
+	if (n < sizeof(trailer)+1) {
+		return;
+	}
+	n -= sizeof(trailer)+1;
+	if (n > max_data_packet_length) {
+		n = max_data_packet_length;
+	}
+	max_xmit = n;
+	if ((remote_capabilities & TDM_CAP_STATS_SEND) == TDM_CAP_STATS_SEND) {
+		if (max_xmit <= sizeof(struct stats_slice)) {
+			return;
+		}
+		max_xmit -= sizeof(struct stats_slice);
+	}
+
+	len = packet_get_next(max_xmit, pbuf);
+	if (len == 0) {
+		return;
+	}
+
+	// the trailer isn't known yet, but the stats slice has to
+	// go in now
+	trailer.command = 0;
+	trailer.resend = packet_is_resend();
+	if ((remote_capabilities & TDM_CAP_STATS_SEND) == TDM_CAP_STATS_SEND) {
+		len = send_stats_slice(len);
+	}
+
+	if (!radio_transmit_prepare(len + sizeof(trailer), sizeof(trailer), pbuf)) {
+		packet_force_resend();
+		return;
+	}
+	next_len = len;
+	next_prepared = true;
+}
+
 // a stack carary to detect a stack overflow
 __at(0xFF) uint8_t __idata _canary;
 
@@ -485,6 +1058,8 @@ tdm_serial_loop(void)
 		__pdata uint8_t	len;
 		__pdata uint16_t tnow, tdelta;
 		__pdata uint8_t max_xmit;
+		__pdata uint8_t channel, data_max;
+		bool beacon, control, user_data, prepared;
 
 		if (_canary != 42) {
 			panic("stack blown\n");
@@ -497,6 +1072,15 @@ tdm_serial_loop(void)
 		// give the AT command processor a chance to handle a command
 		at_command();
 
+#ifdef ENABLE_OTA
+		// and relay any over the air update requests
+		ota_poll((remote_capabilities & TDM_CAP_OTA) != 0);
+#endif
+
+		// watch the serial buffer for frame boundaries, and
+		// keep room in it for what matters
+		packet_poll();
+
 		// display test data if needed
 		if (test_display) {
 			display_test_output();
@@ -508,6 +1092,20 @@ tdm_serial_loop(void)
 			MAVLink_report();
 		}
 
+		if (transmit_pending) {
+			if (radio_transmit_busy()) {
+				// our last packet is still going out. Once
+				// it is all in the FIFO, get the next one of
+				// a burst ready
+				if (transmit_burst && !next_prepared &&
+				    feature_golay && radio_transmit_loaded()) {
+					prepare_next();
+				}
+				continue;
+			}
+			transmit_done();
+		}
+
 		// set right receive channel
 		radio_set_channel(fhop_receive_channel());
 
@@ -528,6 +1126,7 @@ tdm_serial_loop(void)
 			// we're not waiting for a preamble
 			// any more
 			transmit_wait = 0;
+			burst_follows = false;
 
 			if (len < 2) {
 				// not a valid packet. We always send
@@ -539,10 +1138,36 @@ tdm_serial_loop(void)
 			memcpy(&trailer, &pbuf[len-sizeof(trailer)], sizeof(trailer));
 			len -= sizeof(trailer);
 
+			if (trailer.window != 0 &&
+			    trailer.command == 1 && trailer.resend == 1 &&
+			    (remote_capabilities & TDM_CAP_STATS_TRAILER) &&
+			    len > sizeof(struct stats_slice)) {
+				// an extended trailer, with a slice of
+				// the other radios statistics
+				len = receive_stats_slice(len);
+			}
+
 			if (trailer.window == 0 && len != 0) {
 				// its a control packet
 				if (len == sizeof(struct statistics)) {
 					memcpy(&remote_statistics, pbuf, len);
+				} else if (len == 1 && pbuf[0] < num_fh_channels) {
+					// a beacon from a radio searching
+					// for us, giving its receive channel
+					hop_sync_channel = pbuf[0];
+				} else if (len == 2 && pbuf[1] == fhop_receive_channel()) {
+					// the answer to one of our beacons,
+					// giving the other radios hop index
+					fhop_sync(pbuf[0]);
+				} else if (len == sizeof(struct tdm_capabilities) &&
+					   pbuf[0] == TDM_CAPABILITY_MAGIC) {
+					if (remote_capabilities == 0 ||
+					    (pbuf[2] & TDM_CAP_HEARD) == 0) {
+						// answer straight away, so
+						// it learns we have heard it
+						send_capabilities = 1;
+					}
+					remote_capabilities = pbuf[2];
 				}
 
 				// don't count control packets in the stats
@@ -553,7 +1178,12 @@ tdm_serial_loop(void)
 				sync_tx_windows(len);
 				last_t = tnow;
 
-				if (trailer.command == 1) {
+				if (trailer.command == 1 && len != 0 &&
+				    pbuf[0] == OTA_MAGIC) {
+#ifdef ENABLE_OTA
+					ota_handle(pbuf, len);
+#endif
+				} else if (trailer.command == 1) {
 					handle_at_command(len);
 				} else if (len != 0 && 
 					   !packet_is_duplicate(len, pbuf, trailer.resend) &&
@@ -600,24 +1230,36 @@ tdm_serial_loop(void)
 			}
 		}
 
-		// we are allowed to transmit in our transmit window
-		// or in the other radios transmit window if we have
-		// bonus ticks
+		// while we are searching for the other radio we send
+		// beacons in the other radios transmit window, and after
+		// yielding our own, so it can hear us whichever half of
+		// the round it is listening in
+		beacon = (!fhop_locked() &&
+			  beacon_count < LOCK_BEACONS &&
+			  (tdm_state == TDM_RECEIVE || transmit_yield));
+
+		// a hop sync answer to a beacon goes out straight away,
+		// before the searching radio moves its receive channel
+		if (hop_sync_channel == HOP_SYNC_NONE && !beacon) {
+			// we are allowed to transmit in our transmit window
+			// or in the other radios transmit window if we have
+			// bonus ticks
 #if USE_TICK_YIELD
-		if (tdm_state != TDM_TRANSMIT &&
-		    !(bonus_transmit && tdm_state == TDM_RECEIVE)) {
-			// we cannot transmit now
-			continue;
-		}
+			if (tdm_state != TDM_TRANSMIT &&
+			    !(bonus_transmit && tdm_state == TDM_RECEIVE)) {
+				// we cannot transmit now
+				continue;
+			}
 #else
-		if (tdm_state != TDM_TRANSMIT) {
-			continue;
-		}		
+			if (tdm_state != TDM_TRANSMIT) {
+				continue;
+			}		
 #endif
 
-		if (transmit_yield != 0) {
-			// we've give up our window
-			continue;
+			if (transmit_yield != 0) {
+				// we've give up our window
+				continue;
+			}
 		}
 
 		if (transmit_wait != 0) {
@@ -660,17 +1302,78 @@ tdm_serial_loop(void)
 			max_xmit = max_data_packet_length;
 		}
 
+		if ((beacon || hop_sync_channel != HOP_SYNC_NONE) && max_xmit < 2) {
+			// no room for a beacon or hop sync, and we may
+			// not be allowed to send anything else
+			continue;
+		}
+
+		channel = fhop_transmit_channel();
+		control = false;
+		user_data = false;
+		prepared = false;
+
+		// leave room for a slice of our statistics in data packets
+		data_max = max_xmit;
+		if ((remote_capabilities & TDM_CAP_STATS_SEND) == TDM_CAP_STATS_SEND) {
+			if (data_max > sizeof(struct stats_slice)) {
+				data_max -= sizeof(struct stats_slice);
+			} else {
+				data_max = 0;
+			}
+		}
+
 		// ask the packet system for the next packet to send
-		if (send_at_command && 
-		    max_xmit >= strlen(remote_at_cmd)) {
-			// send a remote AT command
-			len = strlen(remote_at_cmd);
-			memcpy(pbuf, remote_at_cmd, len);
+		if (hop_sync_channel != HOP_SYNC_NONE) {
+			// tell a searching radio where we are in the
+			// hopping sequence, on the channel it is
+			// listening on
+			channel = hop_sync_channel;
+			pbuf[0] = fhop_transmit_index();
+			pbuf[1] = hop_sync_channel;
+			len = 2;
+			trailer.command = 0;
+			control = true;
+			hop_sync_channel = HOP_SYNC_NONE;
+		} else if (beacon) {
+			// tell any radio that hears us which channel
+			// we are listening on
+			pbuf[0] = fhop_receive_channel();
+			len = 1;
+			trailer.command = 0;
+			control = true;
+			beacon_count++;
+#ifdef ENABLE_OTA
+		} else if ((len = ota_next_block(pbuf, data_max)) != 0) {
+			// an over the air update request or reply
+			trailer.command = 1;
+#endif
+		} else if ((len = remote_at_next(data_max)) != 0) {
+			// remote AT commands
 			trailer.command = 1;
-			send_at_command = false;
+		} else if (tdm_state == TDM_TRANSMIT &&
+			   capabilities_due &&
+			   max_xmit >= sizeof(struct tdm_capabilities)) {
+			// leave the serial data for the next packet, and
+			// send our capabilities below
+			len = 0;
+			trailer.command = 0;
+		} else if (next_prepared && radio_transmit_prepared() &&
+			   next_len <= max_xmit) {
+			// the next packet of a burst, encoded while the
+			// last one went out
+			len = next_len;
+			trailer.command = 0;
+			next_prepared = false;
+			prepared = true;
 		} else {
+			if (next_prepared) {
+				// a packet we received took its place, or
+				// it no longer fits, so fetch it again
+				drop_next();
+			}
 			// get a packet from the serial port
-			len = packet_get_next(max_xmit, pbuf);
+			len = packet_get_next(data_max, pbuf);
 			trailer.command = packet_is_injected();
 		}
 
@@ -679,9 +1382,18 @@ tdm_serial_loop(void)
 		}
 
 		trailer.bonus = (tdm_state == TDM_RECEIVE);
-		trailer.resend = packet_is_resend();
 
-		if (tdm_state == TDM_TRANSMIT &&
+		// a command is never a resend, and the two together mark
+		// an extended trailer
+		trailer.resend = !trailer.command && packet_is_resend();
+
+		if (control) {
+			// beacons and hop syncs are sent as control
+			// packets, so they don't move the other radios
+			// transmit window
+			trailer.window = 0;
+			trailer.resend = 0;
+		} else if (tdm_state == TDM_TRANSMIT &&
 		    len == 0 && 
 		    send_statistics && 
 		    max_xmit >= sizeof(statistics)) {
@@ -693,7 +1405,38 @@ tdm_serial_loop(void)
 			// mark a stats packet with a zero window
 			trailer.window = 0;
 			trailer.resend = 0;
+		} else if (tdm_state == TDM_TRANSMIT &&
+			   len == 0 &&
+			   (send_capabilities || capabilities_due) &&
+			   max_xmit >= sizeof(struct tdm_capabilities)) {
+			// tell the other radio what we can do
+			send_capabilities = 0;
+			capabilities_due = 0;
+			pbuf[0] = TDM_CAPABILITY_MAGIC;
+			pbuf[1] = TDM_CAPABILITY_VERSION;
+			pbuf[2] = TDM_CAP_BURST | TDM_CAP_STATS_TRAILER | TDM_CAP_AT_BATCH;
+			if (remote_capabilities != 0) {
+				pbuf[2] |= TDM_CAP_HEARD;
+			}
+			if (radio_receive_short_preamble()) {
+				pbuf[2] |= TDM_CAP_SHORT_PREAMBLE;
+			}
+#ifdef ENABLE_OTA
+			if (ota_supported()) {
+				pbuf[2] |= TDM_CAP_OTA;
+			}
+#endif
+			len = sizeof(struct tdm_capabilities);
+			trailer.window = 0;
+			trailer.resend = 0;
 		} else {
+			user_data = (len != 0 && trailer.command == 0);
+			if (len != 0 && !prepared &&
+			    (remote_capabilities & TDM_CAP_STATS_SEND) == TDM_CAP_STATS_SEND) {
+				// carry a slice of our statistics
+				len = send_stats_slice(len);
+			}
+
 			// calculate the control word as the number of
 			// 16usec ticks that will be left in this
 			// tdm state after this packet is transmitted
@@ -701,7 +1444,7 @@ tdm_serial_loop(void)
 		}
 
 		// set right transmit channel
-		radio_set_channel(fhop_transmit_channel());
+		radio_set_channel(channel);
 
 		memcpy(&pbuf[len], &trailer, sizeof(trailer));
 
@@ -717,10 +1460,25 @@ tdm_serial_loop(void)
 			transmit_yield = 1;
 		}
 
+		if (burst_follows && user_data &&
+		    (remote_capabilities & TDM_CAP_SHORT_PREAMBLE)) {
+			// the other radio is already listening, so
+			// this packet needs less preamble
+			radio_transmit_short_preamble();
+		}
+
 		// after sending a packet leave a bit of time before
 		// sending the next one. The receivers don't cope well
-		// with back to back packets
-		transmit_wait = packet_latency;
+		// with back to back packets, unless the other radio
+		// can take a burst and we have more data waiting
+		transmit_burst = ((remote_capabilities & TDM_CAP_BURST) &&
+				  user_data && serial_read_available() != 0);
+		burst_follows = transmit_burst;
+		if (transmit_burst) {
+			transmit_wait = burst_gap;
+		} else {
+			transmit_wait = packet_latency;
+		}
 
 		// if we're implementing a duty cycle, add the
 		// transmit time to the number of ticks we've been transmitting
@@ -728,90 +1486,111 @@ tdm_serial_loop(void)
 			transmitted_ticks += flight_time_estimate(len+sizeof(trailer));
 		}
 
-		// start transmitting the packet
-		if (!radio_transmit(len + sizeof(trailer), pbuf, tdm_state_remaining + (silence_period/2)) &&
-		    len != 0 && trailer.window != 0 && trailer.command == 0) {
-			packet_force_resend();
+		// start transmitting the packet. The radio interrupt
+		// feeds it out while we carry on round the loop
+		if (prepared) {
+			radio_transmit_start_prepared(&pbuf[len], tdm_state_remaining + (silence_period/2));
+		} else {
+			radio_transmit_start(len + sizeof(trailer), pbuf, tdm_state_remaining + (silence_period/2));
 		}
+		transmit_pending = true;
+		transmit_user_data = user_data;
+		transmit_activity = (len != 0 && trailer.window != 0);
+	}
+}
 
-		if (lbt_rssi != 0) {
-			// reset the LBT listen time
-			lbt_listen_time = 0;
-			lbt_rand = 0;
-		}
+/// number of packets of each size sent while calibrating
+#define CALIBRATION_ROUNDS 4
 
-		// set right receive channel
-		radio_set_channel(fhop_receive_channel());
-
-		// re-enable the receiver
-		radio_receiver_on();
+/// time the transmission of one packet
+///
+/// @param len			number of bytes to send, including the trailer
+///
+/// @return			16usec ticks taken, or zero on failure
+static uint16_t
+calibrate_transmit_time(__pdata uint8_t len)
+{
+	__pdata uint16_t t1, t2;
 
-		if (len != 0 && trailer.window != 0) {
-			LED_ACTIVITY = LED_OFF;
-		}
+	radio_receiver_on();
+	t1 = timer2_tick();
+	if (!radio_transmit(len, pbuf, 0xFFFF)) {
+		return 0;
 	}
+	t2 = timer2_tick();
+	return t2 - t1;
 }
 
-#if 0
-/// build the timing table
-static void 
-tdm_build_timing_table(void)
+/// measure the real packet latency and per byte cost
+///
+/// This times the send of a packet holding just a trailer and of a
+/// full sized packet for the current air rate, preamble and ECC
+/// settings, keeping the slowest of each. The per byte cost is rounded
+/// down and the latency is taken from the full packet, so flight time
+/// estimates are exact for full packets and never too short for
+/// smaller ones.
+///
+bool
+tdm_calibrate_timing(void)
 {
-	__pdata uint8_t j;
-	__pdata uint16_t rate;
-	bool golay_saved = feature_golay;
-	feature_golay = false;
-
-	for (rate=2; rate<256; rate=(rate*3)/2) {
-		__pdata uint32_t latency_sum=0, per_byte_sum=0;
-		uint8_t size = MAX_PACKET_LENGTH;
-		radio_configure(rate);
-		for (j=0; j<50; j++) {
-			__pdata uint16_t time_0, time_max, t1, t2;
-			radio_set_channel(1);
-			radio_receiver_on();
-			if (serial_read_available() > 0) {
-				feature_golay = golay_saved;
-				return;
-			}
-			t1 = timer2_tick();
-			if (!radio_transmit(0, pbuf, 0xFFFF)) {
-				break;
-			}
-			t2 = timer2_tick();
-			radio_receiver_on();
+	__pdata uint8_t i, small, large;
+	__pdata uint16_t t, t_small, t_large;
 
-			time_0 = t2-t1;
+	small = sizeof(trailer);
+	large = max_data_packet_length + sizeof(trailer);
 
-			radio_set_channel(2);
-			t1 = timer2_tick();
-			if (!radio_transmit(size, pbuf, 0xFFFF)) {
-				if (size == 0) {
-					break;
-				}
-				size /= 4;
-				j--;
-				continue;
-			}
+	// a full packet can take more than a second at the lowest
+	// rates, which would wrap the 16 bit tick counter
+	while (large > small+1 && flight_time_estimate(large) > 0xC000) {
+		large /= 2;
+	}
 
-			t2 = timer2_tick();
-			radio_receiver_on();
+	// let the last packet from the main loop finish
+	while (radio_transmit_busy()) /* noop */ ;
 
-			time_max = t2-t1;
-			latency_sum += time_0;
-			per_byte_sum += ((size/2) + (time_max - time_0))/size;
+	memset(pbuf, 0, large);
+	radio_set_channel(fhop_transmit_channel());
+
+	t_small = t_large = 0;
+	for (i=0; i<CALIBRATION_ROUNDS; i++) {
+		t = calibrate_transmit_time(small);
+		if (t == 0) {
+			goto failed;
+		}
+		if (t > t_small) {
+			t_small = t;
 		}
-		if (j > 0) {
-			printf("{ %u, %u, %u },\n",
-			       (unsigned)(radio_air_rate()),
-			       (unsigned)(latency_sum/j),
-			       (unsigned)(per_byte_sum/j));
+		t = calibrate_transmit_time(large);
+		if (t == 0) {
+			goto failed;
+		}
+		if (t > t_large) {
+			t_large = t;
 		}
 	}
-	feature_golay = golay_saved;
-}
+	radio_receiver_on();
+
+	if (t_large <= t_small) {
+		return false;
+	}
+
+	t = (t_large - t_small) / (large - small);
+	if (t == 0) {
+		t = 1;
+	}
+	param_set(PARAM_CAL_BYTE_TICKS, t);
+	param_set(PARAM_CAL_LATENCY, t_large - (large * t));
 
+	// recalculate the timings with the new values
+	tdm_init();
+	return true;
 
+failed:
+	radio_receiver_on();
+	return false;
+}
+
+#if 0
 // test hardware CRC code
 static void 
 crc_test(void)
@@ -874,7 +1653,8 @@ tdm_init(void)
 #define REGULATORY_MAX_WINDOW (((1000000UL/16)*4)/10)
 #define LBT_MIN_TIME_USEC 5000
 
-	// tdm_build_timing_table();
+	// tell the other radio what we can do as soon as we can
+	capabilities_due = 1;
 
 	// calculate how many 16usec ticks it takes to send each byte
 	ticks_per_byte = (8+(8000000UL/(air_rate*1000UL)))/16;
@@ -929,6 +1709,32 @@ tdm_init(void)
 	// not changing the round timings
 	packet_latency += ((settings.preamble_length-10)/2) * ticks_per_byte;
 
+	// if AT&C has measured the real timings for this configuration
+	// then use them for flight time estimates instead. The round
+	// timings above are left alone so that we stay in step with a
+	// radio that has not been calibrated
+	if (param_get(PARAM_CAL_LATENCY) != 0 &&
+	    param_get(PARAM_CAL_BYTE_TICKS) != 0) {
+		packet_latency = param_get(PARAM_CAL_LATENCY);
+		ticks_per_byte = param_get(PARAM_CAL_BYTE_TICKS);
+	}
+
+	// a receiver that can take a burst restarts itself as soon as
+	// a packet arrives, so within a burst we only need to allow for
+	// the radio turnaround plus a couple of bytes of preamble
+	burst_gap = 13 + 2*ticks_per_byte;
+
+	// declare the link lost after 8 rounds without a packet, but no
+	// sooner than 2 seconds, counted in 0.5 second link updates
+	i = (8*2*(uint32_t)(silence_period+tx_window_width)) / 32768 + 1;
+	if (i < 4) {
+		i = 4;
+	} else if (i > 40) {
+		i = 40;
+	}
+	unlock_limit = i;
+	hop_sync_channel = HOP_SYNC_NONE;
+
 	// tell the packet subsystem our max packet size, which it
 	// needs to know for MAVLink packet boundary detection
 	i = (tx_window_width - packet_latency) / ticks_per_byte;
@@ -953,5 +1759,7 @@ tdm_report_timing(void)
 	printf("silence_period: %u\n", (unsigned)silence_period); delay_msec(1);
 	printf("tx_window_width: %u\n", (unsigned)tx_window_width); delay_msec(1);
 	printf("max_data_packet_length: %u\n", (unsigned)max_data_packet_length); delay_msec(1);
+	printf("packet_latency: %u\n", (unsigned)packet_latency); delay_msec(1);
+	printf("ticks_per_byte: %u\n", (unsigned)ticks_per_byte); delay_msec(1);
 }
 
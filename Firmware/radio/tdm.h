@@ -47,9 +47,25 @@ extern void tdm_serial_loop(void);
 ///
 extern void tdm_report_timing(void);
 
-/// dispatch a remote AT command
+/// measure packet timings for the current radio settings
+///
+/// @return			true if the timings were measured and stored
+///				in the CAL_* parameters
+extern bool tdm_calibrate_timing(void);
+
+/// queue a remote AT command
 extern void tdm_remote_at(void);
 
+/// control batches of remote AT commands. Commands sent with RT
+/// between AT&RB and AT&RC go to the other radio in one packet, and
+/// it puts every parameter back if any of them fails. An AT&W among
+/// them only saves once all the others have worked
+///
+/// @param op		'B' to begin holding commands, 'C' to send them
+///			as one atomic batch, 'A' to drop them
+/// @return		true if the op was accepted
+extern bool tdm_remote_batch(char op);
+
 /// change tdm phase (for testing recovery)
 extern void tdm_change_phase(void);
 
@@ -59,6 +75,20 @@ extern void tdm_show_rssi(void);
 /// the long term duty cycle we are aiming for
 extern __pdata uint8_t duty_cycle;
 
+/// one percent of duty cycle in the 8.8 fixed point average
+#define DUTY_CYCLE_ONE_PERCENT 256
+
+/// the average duty cycle we have been transmitting, as a
+/// percentage in 8.8 fixed point
+extern __pdata uint16_t average_duty_cycle;
+
+/// fold one TDM round into average_duty_cycle
+///
+/// @param transmitted_ticks	ticks spent transmitting this round
+/// @param round_ticks		length of a full TDM round in ticks
+///
+extern void duty_cycle_update(__pdata uint16_t transmitted_ticks, __pdata uint16_t round_ticks);
+
 /// the LBT threshold
 extern __pdata uint8_t lbt_rssi;
 
@@ -0,0 +1,180 @@
+// Cycle benchmark for the serial interrupt.
+//
+// This is built with SDCC and run in the s51 simulator that comes with
+// it, using the real radio/serial.c. The receive and transmit paths
+// of serial_interrupt() are timed with timer 0 by raising RI0 and TI0
+// in software, and the results are printed on the simulated UART with
+// the interrupt disabled.
+//
+// s51 simulates a classic 8051, so timer 0 counts machine cycles. The
+// CIP-51 in the Si1000 runs most instructions in one or two clocks,
+// and the slowest ones the interrupt uses (RETI and LCALL) in at most
+// 2.5 clocks per classic machine cycle, so the load figures take each
+// machine cycle as 3 clocks of the 24.5MHz SYSCLK, which errs on the
+// side of too slow. The last line says whether 460800 is fast enough
+// to go in the rate table in serial.c.
+
+#include "radio/serial.c"
+
+#define SYSCLK			24500000UL
+#define CLOCKS_PER_CYCLE	3
+#define ROUNDS			16
+
+// the most of the CPU the interrupt may take receiving and sending
+// at 460800 for that rate to go in the table. The rest is left for
+// the radio interrupt and the TDM loop
+#define LOAD_LIMIT_460800	50
+
+// what serial.c needs from the rest of the firmware
+__pdata struct error_counts errors;
+bool feature_rtscts;
+bool at_mode_active;
+__data volatile uint8_t at_plus_count;
+volatile __bit at_plus_other;
+
+void
+packet_set_serial_speed(uint16_t speed)
+{
+	(void)speed;
+}
+
+static __xdata uint8_t bench_rx[SERIAL_RX_BUF_DEFAULT];
+static __xdata uint8_t bench_tx[SERIAL_TX_BUF_DEFAULT];
+static __xdata uint8_t bench_data[ROUNDS];
+
+// timer 0 cycles to run the code between starting and stopping it,
+// raising the interrupt flags given. The interrupt is taken after the
+// instruction that raises the flag
+static uint16_t
+timed(bool rx, bool tx)
+{
+	TL0 = 0;
+	TH0 = 0;
+	TR0 = 1;
+	if (rx) {
+		RI0 = 1;
+	}
+	if (tx) {
+		TI0 = 1;
+	}
+	TR0 = 0;
+	return ((uint16_t)TH0 << 8) | TL0;
+}
+
+// the worst interrupt time over a number of rounds, less the time
+// taken to measure nothing
+static uint16_t
+worst(bool rx, bool tx)
+{
+	__pdata uint16_t base, t, max;
+	__pdata uint8_t i;
+
+	base = timed(0, 0);
+	max = 0;
+	for (i = 0; i < ROUNDS; i++) {
+		if (tx) {
+			// give the transmit path a byte to send
+			ES0 = 0;
+			serial_write_buf(&bench_data[i], 1);
+			TI0 = 0;
+			ES0 = 1;
+		}
+		t = timed(rx, tx) - base;
+		if (t > max) {
+			max = t;
+		}
+		if (tx) {
+			// let the byte go out before the next round
+			ES0 = 0;
+			while (!TI0)
+				;
+			TI0 = 0;
+			ES0 = 1;
+		}
+	}
+	return max;
+}
+
+static void
+out(char c)
+{
+	SBUF0 = c;
+	while (!TI0)
+		;
+	TI0 = 0;
+}
+
+static void
+out_str(const char *s)
+{
+	while (*s) {
+		out(*s++);
+	}
+}
+
+static void
+out_num(uint32_t v)
+{
+	char buf[11];
+	uint8_t n = 0;
+
+	do {
+		buf[n++] = '0' + (v % 10);
+		v /= 10;
+	} while (v != 0);
+	while (n != 0) {
+		out(buf[--n]);
+	}
+}
+
+// print the cycle count for a path, the byte rate it could keep up
+// with, and the share of the CPU it takes at 230400 and 460800
+static void
+report(const char *name, uint16_t cycles)
+{
+	__pdata uint32_t clocks = (uint32_t)cycles * CLOCKS_PER_CYCLE;
+
+	out_str(name);
+	out_str(": ");
+	out_num(cycles);
+	out_str(" cycles, max ");
+	out_num(SYSCLK / clocks);
+	out_str(" bytes/s, load ");
+	out_num(23040UL * clocks * 100 / SYSCLK);
+	out_str("% at 230400, ");
+	out_num(46080UL * clocks * 100 / SYSCLK);
+	out_str("% at 460800\n");
+}
+
+void
+main(void)
+{
+	__pdata uint16_t rx, tx, both;
+
+	serial_set_buffers(bench_rx, sizeof(bench_rx), bench_tx, sizeof(bench_tx));
+	serial_init(230);
+
+	// timer 0 as a 16 bit counter
+	TMOD = (TMOD & ~0x0f) | 0x01;
+	EA = 1;
+
+	rx = worst(1, 0);
+	tx = worst(0, 1);
+	both = worst(1, 1);
+
+	ES0 = 0;
+	TI0 = 0;
+	report("rx", rx);
+	report("tx", tx);
+	report("rx+tx", both);
+	if (46080UL * both * CLOCKS_PER_CYCLE * 100 / SYSCLK < LOAD_LIMIT_460800) {
+		out_str("460800: fast enough, {460, 0xe5, 0x08} can go in serial_rates\n");
+	} else {
+		out_str("460800: too slow\n");
+	}
+
+	// stop the simulator
+	__asm
+	.db	0xa5
+	__endasm;
+}
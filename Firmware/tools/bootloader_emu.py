@@ -0,0 +1,409 @@
+#!/usr/bin/env python
+'''
+emulate the SiK bootloader on a pseudo terminal
+
+This follows bootloader.c a byte at a time, with a model of the flash
+in which programming can only clear bits and only erasing sets them
+again, so the uploader can be tested without a board. The name of the
+pty to upload to is printed on startup, and the emulator exits when it
+is told to reboot with a valid application loaded.
+
+With --v1 only the version 1 commands are understood, as with older
+bootloaders, so the fallback path in the uploader can be tested too.
+
+Replies are held back until the bytes before them would have arrived
+at --baud, plus --latency for the USB-serial adapter, so upload times
+come out close to those with a real board. Programming a PROG_PAGE chunk
+takes --program-time a byte, and like the real UART the emulator loses
+anything sent while it is busy, so a host that doesn't wait for CONTINUE
+shows up as overruns. Working out a READ_CRC takes --crc-time a byte,
+and what arrives meanwhile goes into the PROTO_RX_BUFFER byte receive
+buffer, any more being overrun. --corrupt, --corrupt-header and --drop
+damage one PROG_PAGE command to exercise the uploader's error recovery.
+'''
+
+from __future__ import print_function
+import argparse, os, select, sys, threading, time, tty
+try:
+    import queue
+except ImportError:
+    import Queue as queue
+
+# from bootloader.h
+OK = 0x10
+FAILED = 0x11
+INSYNC = 0x12
+CONTINUE = 0x13
+EOC = 0x20
+GET_SYNC = 0x21
+GET_DEVICE = 0x22
+CHIP_ERASE = 0x23
+LOAD_ADDRESS = 0x24
+PROG_FLASH = 0x25
+READ_FLASH = 0x26
+PROG_MULTI = 0x27
+READ_MULTI = 0x28
+PARAM_ERASE = 0x29
+PROG_PAGE = 0x2a
+READ_CRC = 0x2b
+ERASE_PAGE = 0x2c
+REBOOT = 0x30
+
+PROG_MULTI_MAX = 64
+PROG_PAGE_MAX = 1024
+PROG_PAGE_CHUNK = 128
+RX_BUFFER = 32
+DEVICE_V2 = 0x02
+CAPABILITIES = 0x0f
+BL_VERSION = 2
+
+# from flash_layout.h
+FLASH_PAGE_SIZE = 0x400
+FLASH_APP_START = 0x400
+FLASH_INFO_PAGE = 0xf800
+FLASH_SCRATCH_SIZE = 0x400
+FLASH_SIG0 = 0x3d
+FLASH_SIG1 = 0xc2
+
+
+def crc16(data, crc=0xffff):
+    '''CRC-16/CCITT as used by the v2 commands'''
+    for c in bytearray(data):
+        crc ^= c << 8
+        for i in range(8):
+            if crc & 0x8000:
+                crc = ((crc << 1) ^ 0x1021) & 0xffff
+            else:
+                crc = (crc << 1) & 0xffff
+    return crc
+
+
+class BadCommand(Exception):
+    pass
+
+
+class Reboot(Exception):
+    pass
+
+
+class Bootloader(object):
+    '''the bootloader protocol handler, reading and writing a file descriptor'''
+
+    def __init__(self, fd, board, freq, v1=False, baud=0, latency=0.0, program_time=0.0, crc_time=0.0):
+        self.fd = fd
+        self.board = board
+        self.freq = freq
+        self.v1 = v1
+        self.byte_time = 10.0 / baud if baud else 0.0
+        self.latency = latency
+        self.program_time = program_time
+        self.crc_time = crc_time
+        self.line_clock = 0.0
+        self.pages = 0
+        self.corrupt = 0
+        self.corrupt_header = 0
+        self.drop = 0
+        self.flash = bytearray([0xff] * 0x10000)
+        self.scratch = bytearray([0xff] * FLASH_SCRATCH_SIZE)
+        self.address = 0
+        self.crc = 0xffff
+        self.reply = bytearray()
+        self.rx = bytearray()
+        self.replies = queue.Queue()
+        self.stats = {'writes': 0, 'erases': 0, 'commands': 0, 'overruns': 0, 'buffered': 0}
+
+    def cin(self):
+        if self.rx:
+            # arrived while the bootloader was working
+            c = self.rx[0]
+            del self.rx[0]
+            return c
+        c = os.read(self.fd, 1)
+        if len(c) == 0:
+            raise EOFError()
+        # when the byte would have finished arriving
+        self.line_clock = max(self.line_clock, time.time()) + self.byte_time
+        return bytearray(c)[0]
+
+    def cin_word(self, damage=0):
+        lo = self.cin()
+        hi = self.cin() ^ damage
+        self.crc = crc16(bytearray([lo, hi]), self.crc)
+        return lo | (hi << 8)
+
+    def cout(self, c):
+        self.reply.append(c)
+
+    def busy(self, seconds):
+        '''spend time away from the UART, losing whatever arrives meanwhile'''
+        self.line_clock = max(self.line_clock, time.time()) + seconds
+        delay = self.line_clock - time.time()
+        if delay > 0:
+            time.sleep(delay)
+        while select.select([self.fd], [], [], 0)[0]:
+            self.stats['overruns'] += len(os.read(self.fd, 256))
+
+    def compute(self, seconds):
+        '''spend time away from reading commands, keeping what arrives
+        meanwhile in the receive buffer, as far as it will go'''
+        self.line_clock = max(self.line_clock, time.time()) + seconds
+        delay = self.line_clock - time.time()
+        if delay > 0:
+            time.sleep(delay)
+        while select.select([self.fd], [], [], 0)[0]:
+            data = bytearray(os.read(self.fd, 256))
+            room = RX_BUFFER - len(self.rx)
+            self.rx += data[:room]
+            self.stats['overruns'] += len(data[room:])
+        self.stats['buffered'] = max(self.stats['buffered'], len(self.rx))
+
+    def flush(self):
+        '''queue the reply once the command would have been received. The
+        adapter latency is added on the way back, without holding up the
+        bytes that follow'''
+        if self.reply:
+            delay = self.line_clock - time.time()
+            if delay > 0:
+                time.sleep(delay)
+            self.replies.put((self.line_clock + self.latency, bytes(self.reply)))
+            self.reply = bytearray()
+
+    def deliver(self):
+        '''write replies out as they fall due'''
+        while True:
+            due, reply = self.replies.get()
+            if reply is None:
+                return
+            delay = due - time.time()
+            if delay > 0:
+                time.sleep(delay)
+            os.write(self.fd, reply)
+
+    def visible(self, address):
+        return FLASH_APP_START <= address < FLASH_INFO_PAGE
+
+    def write_byte(self, address, c):
+        address &= 0xffff
+        if self.visible(address):
+            self.flash[address] &= c
+            self.stats['writes'] += 1
+
+    def erase_page(self, address):
+        if self.visible(address):
+            base = address & ~(FLASH_PAGE_SIZE - 1)
+            self.flash[base:base + FLASH_PAGE_SIZE] = bytearray([0xff] * FLASH_PAGE_SIZE)
+            self.stats['erases'] += 1
+
+    def app_valid(self):
+        return self.flash[FLASH_INFO_PAGE - 2:FLASH_INFO_PAGE] == bytearray([FLASH_SIG0, FLASH_SIG1])
+
+    def expect_eoc(self):
+        if self.cin() != EOC:
+            raise BadCommand()
+
+    def command(self):
+        '''handle one command, as bootloader() does'''
+        c = self.cin()
+        if c in (GET_SYNC, CHIP_ERASE, PARAM_ERASE, READ_FLASH):
+            self.expect_eoc()
+
+        if c == GET_SYNC:
+            pass
+
+        elif c == GET_DEVICE:
+            c = self.cin()
+            if c == DEVICE_V2 and not self.v1:
+                self.expect_eoc()
+            elif c != EOC:
+                raise BadCommand()
+            self.cout(self.board)
+            self.cout(self.freq)
+            if c == DEVICE_V2:
+                self.cout(BL_VERSION)
+                self.cout(CAPABILITIES)
+
+        elif c == CHIP_ERASE:
+            for address in range(FLASH_INFO_PAGE - FLASH_PAGE_SIZE, FLASH_APP_START - 1, -FLASH_PAGE_SIZE):
+                self.erase_page(address)
+
+        elif c == PARAM_ERASE:
+            self.scratch = bytearray([0xff] * FLASH_SCRATCH_SIZE)
+
+        elif c == LOAD_ADDRESS:
+            self.address = self.cin()
+            self.address |= self.cin() << 8
+            self.expect_eoc()
+
+        elif c == PROG_FLASH:
+            c = self.cin()
+            self.expect_eoc()
+            self.write_byte(self.address, c)
+            self.address += 1
+
+        elif c == READ_FLASH:
+            self.cout(self.flash[self.address & 0xffff])
+            self.address += 1
+
+        elif c == PROG_MULTI:
+            count = self.cin()
+            if count > PROG_MULTI_MAX:
+                raise BadCommand()
+            data = [self.cin() for i in range(count)]
+            self.expect_eoc()
+            for c in data:
+                self.write_byte(self.address, c)
+                self.address += 1
+
+        elif c == READ_MULTI:
+            count = self.cin()
+            self.expect_eoc()
+            for i in range(count):
+                self.cout(self.flash[self.address & 0xffff])
+                self.address += 1
+
+        elif c == PROG_PAGE and not self.v1:
+            self.pages += 1
+            self.crc = 0xffff
+            self.address = self.cin_word(0x08 if self.pages == self.corrupt_header else 0)
+            length = self.cin_word()
+            crc = self.cin()
+            crc |= self.cin() << 8
+            if crc != self.crc:
+                self.cout(INSYNC)
+                self.cout(FAILED)
+                raise BadCommand()
+            if length > PROG_PAGE_MAX:
+                raise BadCommand()
+            self.cout(CONTINUE)
+            self.flush()
+            for start in range(0, length, PROG_PAGE_CHUNK):
+                chunk = bytearray()
+                for i in range(start, min(start + PROG_PAGE_CHUNK, length)):
+                    c = self.cin()
+                    if self.pages == self.corrupt and i == length // 2:
+                        c ^= 0x01
+                    if self.pages == self.drop and i == length // 2:
+                        # as if the byte had been lost on the line
+                        c = self.cin()
+                    chunk.append(c)
+                self.crc = crc16(chunk, self.crc)
+                for c in chunk:
+                    self.write_byte(self.address, c)
+                    self.address += 1
+                self.busy(len(chunk) * self.program_time)
+                self.cout(CONTINUE)
+                self.flush()
+            length = self.cin()
+            length |= self.cin() << 8
+            self.expect_eoc()
+            if length != self.crc:
+                self.cout(INSYNC)
+                self.cout(FAILED)
+                raise BadCommand()
+
+        elif c == READ_CRC and not self.v1:
+            self.address = self.cin_word()
+            length = self.cin_word()
+            self.expect_eoc()
+            start = self.address & 0xffff
+            crc = crc16(self.flash[start:start + length])
+            self.address += length
+            self.compute(length * self.crc_time)
+            self.cout(crc & 0xff)
+            self.cout(crc >> 8)
+
+        elif c == ERASE_PAGE and not self.v1:
+            self.address = self.cin_word()
+            self.expect_eoc()
+            self.erase_page(self.address)
+
+        elif c == REBOOT:
+            # the bootloader comes straight back if there is no application
+            if self.app_valid():
+                raise Reboot()
+            self.address = 0
+            return
+
+        else:
+            raise BadCommand()
+
+        self.cout(INSYNC)
+        self.cout(OK)
+        self.stats['commands'] += 1
+
+    def run(self):
+        '''handle commands until told to reboot or the host goes away'''
+        writer = threading.Thread(target=self.deliver)
+        writer.start()
+        try:
+            while True:
+                try:
+                    self.command()
+                except BadCommand:
+                    pass
+                finally:
+                    self.flush()
+        except (Reboot, EOFError):
+            pass
+        finally:
+            self.replies.put((0, None))
+            writer.join()
+
+    def load(self, path):
+        '''program an Intel hex file into the application area'''
+        for line in open(path):
+            record = bytearray.fromhex(line.strip()[1:])
+            if record[3] == 0:
+                address = (record[1] << 8) | record[2]
+                for i, c in enumerate(record[4:-1]):
+                    self.write_byte(address + i, c)
+
+    def dump(self, path):
+        '''write the application area out as Intel hex'''
+        f = open(path, 'w')
+        for address in range(FLASH_APP_START, FLASH_INFO_PAGE, 16):
+            data = self.flash[address:address + 16]
+            if min(data) == 0xff:
+                continue
+            record = bytearray([len(data), address >> 8, address & 0xff, 0]) + data
+            f.write(':%s%02X\n' % (''.join('%02X' % b for b in record), -sum(record) & 0xff))
+        f.write(':00000001FF\n')
+        f.close()
+
+
+parser = argparse.ArgumentParser(description='SiK bootloader emulator')
+parser.add_argument('--v1', action='store_true', help='only understand the version 1 commands')
+parser.add_argument('--board', type=lambda v: int(v, 0), default=0x4e, help='board ID')
+parser.add_argument('--freq', type=lambda v: int(v, 0), default=0x43, help='frequency code')
+parser.add_argument('--baud', type=int, default=115200, help='line speed to pace replies to, 0 for no limit')
+parser.add_argument('--latency', type=float, default=0.0, help='seconds to add before each reply')
+parser.add_argument('--program-time', type=float, default=71e-6,
+                    help='seconds to program a flash byte, by default the slow end of the C8051F93x figure')
+parser.add_argument('--crc-time', type=float, default=16e-6,
+                    help='seconds to add a flash byte to a READ_CRC, by default an estimate for 24.5MHz')
+parser.add_argument('--corrupt', type=int, default=0, metavar='N', help='flip a bit in the Nth PROG_PAGE')
+parser.add_argument('--corrupt-header', type=int, default=0, metavar='N',
+                    help='flip a bit in the address of the Nth PROG_PAGE')
+parser.add_argument('--drop', type=int, default=0, metavar='N', help='lose a byte from the Nth PROG_PAGE')
+parser.add_argument('--load', metavar='HEX', help='start with this already programmed')
+parser.add_argument('--dump', metavar='HEX', help='write the application area here on exit')
+args = parser.parse_args()
+
+master, slave = os.openpty()
+tty.setraw(master)
+tty.setraw(slave)
+print(os.ttyname(slave))
+sys.stdout.flush()
+
+bl = Bootloader(master, args.board, args.freq, v1=args.v1, baud=args.baud, latency=args.latency,
+                program_time=args.program_time, crc_time=args.crc_time)
+bl.corrupt = args.corrupt
+bl.corrupt_header = args.corrupt_header
+bl.drop = args.drop
+if args.load:
+    bl.load(args.load)
+    bl.stats['writes'] = 0
+bl.run()
+print('%(commands)u commands, %(writes)u bytes written, %(erases)u pages erased, %(overruns)u bytes overrun, %(buffered)u bytes buffered at most' % bl.stats)
+if args.dump:
+    bl.dump(args.dump)
@@ -0,0 +1,332 @@
+#!/usr/bin/env python
+'''
+measure the throughput and latency of a radio link
+
+Sends sequence numbered, timestamped frames into one radio and reads
+them back, either from the other radio on the same host (one way
+latency) or from a reflector on the far side of the link (round trip
+latency). For each offered load it reports goodput, loss, reordering,
+duplicates and latency percentiles, and can write them out as CSV or
+JSON so runs of different firmware can be compared.
+
+  one way, both radios on this host:
+    link_bench.py run --tx /dev/ttyUSB0 --rx /dev/ttyUSB1 --load 1000,2000,4000
+
+  round trip, with the far radio looped back:
+    link_bench.py reflect /dev/ttyUSB1          (on the far host)
+    link_bench.py run --tx /dev/ttyUSB0 --sweep 500:5000:500 --json run.json
+
+Frames are either raw, for radios with MAVLINK=0, or MAVLink 1.0, so
+that radios with MAVLink framing keep them whole. Ports can be serial
+devices, ptys from a firmware simulator, or pyserial URLs such as
+loop://. This replaces pattern.py and reflector.py.
+'''
+
+from __future__ import print_function
+import argparse, json, math, struct, sys, threading, time
+import serial
+
+RAW_MAGIC = bytearray([0xa5, 0x5a])
+MAVLINK10_STX = 254
+
+# a MAVLink frame from a system that isn't the radio's '3D', so the
+# radio won't take it for one of its own
+BENCH_SYSTEM = ord('B')
+BENCH_COMPONENT = ord('N')
+BENCH_MSG_ID = 239
+
+# <step><seq><send time> at the start of every frame body
+BODY = '<BId'
+BODY_SIZE = struct.calcsize(BODY)
+
+FRAMINGS = {
+    # header length, offset of the length byte
+    'raw': (3, 2),
+    'mavlink': (6, 1),
+}
+
+LATENCY_PERCENTILES = [50, 90, 99]
+
+
+def x25_crc(data):
+    '''the MAVLink checksum, which raw frames use too'''
+    crc = 0xffff
+    for c in bytearray(data):
+        tmp = c ^ (crc & 0xff)
+        tmp = (tmp ^ (tmp << 4)) & 0xff
+        crc = (crc >> 8) ^ (tmp << 8) ^ (tmp << 3) ^ (tmp >> 4)
+    return crc & 0xffff
+
+
+def frame_overhead(framing):
+    return FRAMINGS[framing][0] + 2
+
+
+def make_frame(framing, size, step, seq, now):
+    '''a frame of size bytes carrying step, seq and the time'''
+    body = bytearray(struct.pack(BODY, step, seq & 0xffffffff, now))
+    body += bytearray((seq + i) & 0xff for i in range(size - frame_overhead(framing) - len(body)))
+    if framing == 'raw':
+        header = RAW_MAGIC + bytearray([len(body)])
+        crc = x25_crc(header[2:] + body)
+    else:
+        header = bytearray([MAVLINK10_STX, len(body), seq & 0xff, BENCH_SYSTEM, BENCH_COMPONENT, BENCH_MSG_ID])
+        crc = x25_crc(header[1:] + body)
+    return header + body + bytearray([crc & 0xff, crc >> 8])
+
+
+class Receiver(object):
+    '''finds frames in the bytes coming back and keeps the statistics
+    for the current step'''
+
+    def __init__(self, framing):
+        self.framing = framing
+        self.buf = bytearray()
+        self.lock = threading.Lock()
+        self.start_step(0)
+
+    def start_step(self, step):
+        with self.lock:
+            self.step = step
+            self.seen = set()
+            self.highest = -1
+            self.received = 0
+            self.received_bytes = 0
+            self.duplicates = 0
+            self.reordered = 0
+            self.corrupt = 0
+            self.latencies = []
+
+    def header_ok(self, buf):
+        if self.framing == 'raw':
+            return buf[:2] == RAW_MAGIC[:len(buf)] and (len(buf) < 3 or buf[2] >= BODY_SIZE)
+        return (buf[0] == MAVLINK10_STX and (len(buf) < 2 or buf[1] >= BODY_SIZE) and
+                (len(buf) < 4 or buf[3] == BENCH_SYSTEM) and
+                (len(buf) < 5 or buf[4] == BENCH_COMPONENT) and
+                (len(buf) < 6 or buf[5] == BENCH_MSG_ID))
+
+    def feed(self, data, now):
+        '''take bytes read at time now'''
+        header_len, len_offset = FRAMINGS[self.framing]
+        self.buf += bytearray(data)
+        while True:
+            # skip to something that could be a frame
+            start = 0
+            while start < len(self.buf) and not self.header_ok(self.buf[start:start + header_len]):
+                start += 1
+            del self.buf[:start]
+            if len(self.buf) < header_len:
+                return
+            size = header_len + self.buf[len_offset] + 2
+            if len(self.buf) < size:
+                return
+            f = self.buf[:size]
+            if x25_crc(f[len_offset:-2]) != f[-2] | (f[-1] << 8):
+                # not a frame, or a damaged one
+                with self.lock:
+                    self.corrupt += 1
+                del self.buf[:1]
+                continue
+            del self.buf[:size]
+            step, seq, sent = struct.unpack(BODY, bytes(f[header_len:header_len + BODY_SIZE]))
+            self.frame(step, seq, sent, size, now)
+
+    def frame(self, step, seq, sent, size, now):
+        with self.lock:
+            if step != self.step:
+                # left over from an earlier step
+                return
+            if seq in self.seen:
+                self.duplicates += 1
+                return
+            self.seen.add(seq)
+            if seq < self.highest:
+                self.reordered += 1
+            self.highest = max(self.highest, seq)
+            self.received += 1
+            self.received_bytes += size
+            self.latencies.append(now - sent)
+
+
+def percentile(values, p):
+    '''nearest rank percentile of a sorted list'''
+    if not values:
+        return None
+    rank = int(math.ceil(p / 100.0 * len(values))) - 1
+    return values[max(0, min(rank, len(values) - 1))]
+
+
+def reader(port, receiver, stop):
+    while not stop.is_set():
+        data = port.read(max(1, port.in_waiting))
+        if data:
+            receiver.feed(data, time.time())
+
+
+def run_step(args, tx, receiver, step, load):
+    '''offer load bytes/s for args.duration seconds and measure what
+    comes back'''
+    receiver.start_step(step)
+    interval = args.size / float(load)
+    sent = 0
+    start = time.time()
+    next_send = start
+    while True:
+        now = time.time()
+        if now - start >= args.duration:
+            break
+        if now < next_send:
+            time.sleep(min(next_send - now, 0.01))
+            continue
+        tx.write(bytes(make_frame(args.framing, args.size, step, sent, now)))
+        sent += 1
+        next_send += interval
+        if next_send < now - 1:
+            # the port is blocking us, don't build up a burst
+            next_send = now
+    elapsed = time.time() - start
+    time.sleep(args.drain)
+
+    with receiver.lock:
+        latencies = sorted(receiver.latencies)
+        result = {
+            'step': step,
+            'offered': load,
+            'sent': sent,
+            'sent_rate': sent * args.size / elapsed,
+            'received': receiver.received,
+            'goodput': receiver.received_bytes / elapsed,
+            'lost': sent - receiver.received,
+            'loss': (sent - receiver.received) / float(sent) if sent else 0.0,
+            'duplicates': receiver.duplicates,
+            'reordered': receiver.reordered,
+            'corrupt': receiver.corrupt,
+        }
+    for p in LATENCY_PERCENTILES:
+        v = percentile(latencies, p)
+        result['latency_p%u' % p] = v * 1000 if v is not None else None
+    result['latency_max'] = latencies[-1] * 1000 if latencies else None
+    return result
+
+
+def loads(args):
+    if args.sweep:
+        first, last, step = [float(x) for x in args.sweep.split(':')]
+        result = []
+        load = first
+        while load <= last + 1e-9:
+            result.append(load)
+            load += step
+        return result
+    return [float(x) for x in args.load.split(',')]
+
+
+def open_port(name, args):
+    return serial.serial_for_url(name, args.baudrate, timeout=0.05, rtscts=args.rtscts)
+
+
+COLUMNS = ['step', 'offered', 'sent', 'sent_rate', 'received', 'goodput', 'lost', 'loss',
+           'duplicates', 'reordered', 'corrupt'] + \
+          ['latency_p%u' % p for p in LATENCY_PERCENTILES] + ['latency_max']
+
+
+def heading(c):
+    '''column name for the table, which says above it what the latencies are'''
+    return c[len('latency_'):] if c.startswith('latency_') else c
+
+
+def fmt(v):
+    if v is None:
+        return '-'
+    if isinstance(v, float):
+        return '%.3f' % v if v < 1 else '%.1f' % v
+    return str(v)
+
+
+def run(args):
+    if args.size < BODY_SIZE + frame_overhead(args.framing) or args.size > 255 + frame_overhead(args.framing):
+        print('--size must be between %u and %u for %s frames' % (
+            BODY_SIZE + frame_overhead(args.framing), 255 + frame_overhead(args.framing), args.framing))
+        sys.exit(1)
+
+    tx = open_port(args.tx, args)
+    rx = open_port(args.rx, args) if args.rx else tx
+    receiver = Receiver(args.framing)
+    stop = threading.Event()
+    thread = threading.Thread(target=reader, args=(rx, receiver, stop))
+    thread.daemon = True
+    thread.start()
+
+    latency = 'one way' if args.rx else 'round trip'
+    print('%s frames of %u bytes, %s latency in ms' % (args.framing, args.size, latency))
+    print(' '.join('%10s' % heading(c) for c in COLUMNS[1:]))
+    results = []
+    try:
+        for step, load in enumerate(loads(args)):
+            result = run_step(args, tx, receiver, (step + 1) & 0xff, load)
+            result['step'] = step
+            results.append(result)
+            print(' '.join('%10s' % fmt(result[c]) for c in COLUMNS[1:]))
+            sys.stdout.flush()
+    except KeyboardInterrupt:
+        pass
+    stop.set()
+    thread.join()
+
+    if args.csv:
+        f = open(args.csv, 'w')
+        f.write(','.join(COLUMNS) + '\n')
+        for r in results:
+            f.write(','.join('' if r[c] is None else str(r[c]) for c in COLUMNS) + '\n')
+        f.close()
+    if args.json:
+        f = open(args.json, 'w')
+        json.dump({'framing': args.framing, 'size': args.size, 'latency': latency,
+                   'duration': args.duration, 'results': results}, f, indent=2)
+        f.close()
+
+
+def reflect(args):
+    '''send back whatever comes in'''
+    port = open_port(args.port, args)
+    while True:
+        try:
+            data = port.read(max(1, port.in_waiting))
+            if data:
+                port.write(data)
+        except KeyboardInterrupt:
+            return
+
+
+def main():
+    parser = argparse.ArgumentParser(description='radio link throughput and latency benchmark')
+    parser.add_argument('--baudrate', type=int, default=57600, help='serial baud rate')
+    parser.add_argument('--rtscts', action='store_true', help='enable rtscts')
+    sub = parser.add_subparsers(dest='command')
+
+    p = sub.add_parser('run', help='send frames and measure what comes back')
+    p.add_argument('--tx', required=True, help='port to send into')
+    p.add_argument('--rx', help='port the frames come out of, or leave out to read the reflected frames from --tx')
+    p.add_argument('--framing', choices=sorted(FRAMINGS), default='raw', help='frame format')
+    p.add_argument('--size', type=int, default=64, help='bytes per frame, framing included')
+    p.add_argument('--load', default='1000', help='offered loads in bytes/s, comma separated')
+    p.add_argument('--sweep', help='offered loads as first:last:step bytes/s')
+    p.add_argument('--duration', type=float, default=10.0, help='seconds at each load')
+    p.add_argument('--drain', type=float, default=2.0, help='seconds to wait for the last frames at each load')
+    p.add_argument('--csv', help='write the results to a CSV file')
+    p.add_argument('--json', help='write the results to a JSON file')
+
+    p = sub.add_parser('reflect', help='send back everything received, for round trip tests')
+    p.add_argument('port', help='port to reflect')
+
+    args = parser.parse_args()
+    if args.command == 'run':
+        run(args)
+    elif args.command == 'reflect':
+        reflect(args)
+    else:
+        parser.print_help()
+
+
+if __name__ == '__main__':
+    main()
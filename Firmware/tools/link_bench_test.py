@@ -0,0 +1,127 @@
+#!/usr/bin/env python
+'''
+test for the link benchmark
+
+First the frame parser is fed a stream with a frame lost, one sent
+twice, two swapped, one damaged and some noise, in both framings and
+in odd sized pieces, and must count each of them. Then link_bench.py
+is run over a pair of ptys joined by a simulated link with a fixed
+delay, one way and round trip through link_bench.py reflect, and the
+results it writes must show everything arriving with at least that
+delay.
+'''
+
+from __future__ import print_function
+import json, os, pty, random, select, subprocess, sys, tempfile, threading, time, tty
+
+TOOLS = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, TOOLS)
+import link_bench
+
+# one way delay of the simulated link
+DELAY = 0.02
+
+failed = False
+
+
+def check(ok, what):
+    global failed
+    if not ok:
+        print('%s FAILED' % what)
+        failed = True
+
+
+def check_parser(framing):
+    frames = [link_bench.make_frame(framing, 40, 1, seq, 100.0 + seq) for seq in range(20)]
+    stream = bytearray(b'noise')
+    for seq, f in enumerate(frames):
+        if seq == 3:
+            continue
+        if seq == 8:
+            stream += frames[9] + f
+            continue
+        if seq == 9:
+            continue
+        if seq == 12:
+            f = bytearray(f)
+            f[20] ^= 0x01
+        stream += f
+        if seq == 15:
+            stream += f + bytearray([0x5a, 0xa5, 254])
+
+    r = link_bench.Receiver(framing)
+    r.start_step(1)
+    i = 0
+    while i < len(stream):
+        n = random.randint(1, 50)
+        r.feed(stream[i:i + n], 200.0)
+        i += n
+    check(r.received == 18, '%s received %u' % (framing, r.received))
+    check(r.duplicates == 1, '%s duplicates' % framing)
+    check(r.reordered == 1, '%s reordered' % framing)
+    check(r.corrupt >= 1, '%s corrupt' % framing)
+    check(sorted(r.seen) == [s for s in range(20) if s not in (3, 12)], '%s sequence numbers' % framing)
+    check(max(r.latencies) == 100.0, '%s latency' % framing)
+
+
+def link(src, dst, stop):
+    '''carry bytes from one pty master to another after DELAY'''
+    queue = []
+    while not stop.is_set():
+        wait = max(0, queue[0][0] - time.time()) if queue else 0.1
+        if select.select([src], [], [], wait)[0]:
+            try:
+                queue.append((time.time() + DELAY, os.read(src, 4096)))
+            except OSError:
+                return
+        while queue and queue[0][0] <= time.time():
+            os.write(dst, queue.pop(0)[1])
+
+
+def open_pty():
+    master, slave = pty.openpty()
+    tty.setraw(slave)
+    return master, os.ttyname(slave)
+
+
+def bench(name, tx, rx, loads, delay):
+    out = os.path.join(tempfile.mkdtemp(), 'bench.json')
+    args = [sys.executable, os.path.join(TOOLS, 'link_bench.py'), 'run', '--tx', tx,
+            '--load', ','.join(str(l) for l in loads), '--duration', '1', '--drain', '0.5',
+            '--framing', 'mavlink', '--json', out]
+    if rx:
+        args += ['--rx', rx]
+    subprocess.check_call(args)
+    results = json.load(open(out))['results']
+    check(len(results) == len(loads), '%s steps' % name)
+    for load, r in zip(loads, results):
+        check(r['lost'] == 0 and r['duplicates'] == 0 and r['reordered'] == 0, '%s at %u loss' % (name, load))
+        check(abs(r['goodput'] - load) < load * 0.15, '%s at %u goodput %.0f' % (name, load, r['goodput']))
+        check(r['latency_p50'] >= delay * 1000, '%s at %u latency' % (name, load))
+        print('%s at %u bytes/s: goodput %.0f, latency p50 %.1fms' % (name, load, r['goodput'], r['latency_p50']))
+
+
+random.seed(0)
+check_parser('raw')
+check_parser('mavlink')
+
+stop = threading.Event()
+a, a_name = open_pty()
+b, b_name = open_pty()
+for src, dst in ((a, b), (b, a)):
+    t = threading.Thread(target=link, args=(src, dst, stop))
+    t.daemon = True
+    t.start()
+bench('one way', a_name, b_name, [2000, 8000], DELAY)
+
+reflector = subprocess.Popen([sys.executable, os.path.join(TOOLS, 'link_bench.py'), 'reflect', b_name])
+try:
+    bench('round trip', a_name, None, [4000], 2 * DELAY)
+finally:
+    reflector.kill()
+stop.set()
+
+if failed:
+    print('-- test FAILED')
+    sys.exit(1)
+print('-- test passed.')
@@ -0,0 +1,261 @@
+#!/usr/bin/env python
+'''
+generate EZRadioPro modem register tables for any set of air data rates
+
+This works out the registers that radio.c takes from its per band
+register tables (IF filter bandwidth, clock recovery, AFC limiter,
+data rate and deviation) from the Si443x formulas, for GFSK with AFC
+enabled, no manchester coding and a modulation index of 2, which is
+what the existing tables use. The output is a C table in the layout
+radio.c expects, one row per rate.
+
+With --check it instead compares its results against the tables in
+radio.c, so changes to the formulas can be checked against the
+register values that came from the Silabs calculator.
+'''
+
+from __future__ import print_function
+import argparse, math, re, sys
+
+# rates in the firmware are held in kbps in a uint8_t
+MAX_RATE_KBPS = 255
+
+# the deviation register is 8 bits here, as the high bit lives in
+# modulation mode control 2, which the firmware writes as 0x23
+MAX_FD_REG = 254
+
+# clock recovery gain is 11 bits
+MAX_CRGAIN = 0x7FF
+
+# the most deviation we ask for, whatever the rate. Above this the
+# clock recovery gain is worked out for this deviation
+MAX_DEVIATION_HZ = 160000.0
+
+# base IF filter bandwidths in kHz by filset, for ndec_exp=0 and
+# dwn3_bypass=0. The bandwidth halves for each step of ndec_exp and
+# is three times wider with dwn3_bypass set
+FILSET_KHZ = {
+    1: 75.2, 2: 83.2, 3: 90.0, 4: 95.3, 5: 112.1, 6: 127.9, 7: 137.9,
+    8: 111.8, 9: 120.6, 10: 140.1, 11: 156.1, 12: 172.9, 13: 192.3,
+    14: 206.9, 15: 63.8,
+}
+
+# the IF filter settings listed in the Si4432 datasheet, with their
+# bandwidths in kHz. We only pick from these
+IF_FILTERS = {
+    0x51: 2.6, 0x52: 2.8, 0x53: 3.1, 0x54: 3.2, 0x55: 3.7, 0x56: 4.2, 0x57: 4.5,
+    0x41: 4.9, 0x42: 5.4, 0x43: 5.9, 0x44: 6.1, 0x45: 7.2, 0x46: 8.2, 0x47: 8.8,
+    0x31: 9.5, 0x32: 10.6, 0x33: 11.5, 0x34: 12.1, 0x35: 14.2, 0x36: 16.2, 0x37: 17.5,
+    0x21: 18.9, 0x22: 21.0, 0x23: 22.7, 0x24: 24.0, 0x25: 28.2, 0x26: 32.2, 0x27: 34.7,
+    0x11: 37.7, 0x12: 41.7, 0x13: 45.2, 0x14: 47.9, 0x15: 56.2, 0x16: 64.1, 0x17: 69.2,
+    0x01: 75.2, 0x02: 83.2, 0x03: 90.0, 0x04: 95.3, 0x05: 112.1, 0x06: 127.9, 0x07: 137.9,
+    0x94: 142.8, 0x95: 167.8, 0x99: 181.1, 0x8F: 191.5, 0x81: 225.1, 0x82: 248.8,
+    0x83: 269.3, 0x84: 284.9, 0x88: 335.5, 0x89: 361.8, 0x8A: 420.2, 0x8B: 468.4,
+    0x8C: 518.8, 0x8D: 577.0, 0x8E: 620.7,
+}
+
+BANDS = {
+    '433': 433e6,
+    '470': 470e6,
+    '868': 868e6,
+    '915': 915e6,
+}
+
+DEFAULT_RATES = [2, 4, 8, 16, 19, 24, 32, 48, 64, 96, 128, 192, 250]
+
+def round_half_up(v):
+    return int(math.floor(v + 0.5))
+
+
+def if_bandwidth(code):
+    '''IF filter bandwidth in Hz for a filter setting'''
+    if code in IF_FILTERS:
+        return 1000.0 * IF_FILTERS[code]
+    dwn3, ndec, filset = code >> 7, (code >> 4) & 7, code & 0xF
+    return 1000.0 * FILSET_KHZ[filset] * (3 if dwn3 else 1) / (1 << ndec)
+
+
+def choose_if_filter(bw_hz):
+    '''the narrowest listed IF filter at least bw_hz wide'''
+    best = None
+    for code in IF_FILTERS:
+        bw = if_bandwidth(code)
+        if bw >= bw_hz and (best is None or bw < if_bandwidth(best)):
+            best = code
+    if best is None:
+        raise ValueError('no IF filter is %.1fkHz wide' % (bw_hz / 1000.0))
+    return best
+
+
+def modem_registers(rate_kbps, freq_hz, ppm):
+    '''return the table row for one rate and band'''
+    rb = rate_kbps * 1000.0
+    hbsel = 1 if freq_hz >= 480e6 else 0
+
+    # data rate, with the low rate scaling bit set below 30kbps, as
+    # the firmware does in modulation mode control 1
+    scale = 5 if rb < 30000 else 0
+    txdr = round_half_up(rb * (1 << (16 + scale)) / 1e6)
+    if txdr > 0xFFFF:
+        raise ValueError('%ukbps is too fast' % rate_kbps)
+
+    # deviation equal to the data rate, in 625Hz steps
+    deviation = min(rb, MAX_DEVIATION_HZ)
+    fd = min(round_half_up(rb / 625.0), MAX_FD_REG)
+
+    # the IF filter must pass the signal (Carson's rule) and the
+    # worst case frequency error between two crystals
+    freq_error = 2 * ppm * 1e-6 * freq_hz
+    ifbw = choose_if_filter(max(rb + 2 * deviation, 2 * freq_error))
+    dwn3, ndec = ifbw >> 7, (ifbw >> 4) & 7
+
+    # clock recovery oversampling ratio, in 1/8ths
+    osr = round_half_up(500e3 * (1 + 2 * dwn3) * 8 / ((1 << ndec) * rb))
+    if osr > 0x7FF:
+        raise ValueError('%ukbps is too slow for the IF filter' % rate_kbps)
+
+    # clock recovery offset
+    ncoff = round_half_up(rb * (1 << (20 + ndec)) / (500e3 * (1 + 2 * dwn3)))
+
+    # clock recovery timing loop gain
+    crgain = min(round_half_up(2 + 65536.0 * rb / (osr * deviation)), MAX_CRGAIN)
+
+    # AFC pull in range, covering the crystal error and growing with
+    # the data rate
+    afc = min(max(int(math.ceil(freq_error / (625.0 * (1 + hbsel)))),
+                  round_half_up(rb / 1000.0)), 0x50)
+
+    return [
+        ifbw,
+        0x03,
+        osr & 0xFF,
+        ((osr >> 3) & 0xE0) | ((ncoff >> 16) & 0x0F),
+        (ncoff >> 8) & 0xFF,
+        ncoff & 0xFF,
+        (crgain >> 8) & 0x07,
+        crgain & 0xFF,
+        afc,
+        txdr >> 8,
+        txdr & 0xFF,
+        fd,
+    ]
+
+
+def format_table(band, rates, rows):
+    '''format a table in the layout used by radio.c'''
+    lines = ['// register images for %sMHz radios, one row per air data rate' % band,
+             '__code static const uint8_t reg_table_%s[NUM_DATA_RATES][NUM_RADIO_REGISTERS] = {' % band]
+    for i, (rate, row) in enumerate(zip(rates, rows)):
+        sep = ',' if i != len(rows) - 1 else ''
+        lines.append('\t{%s}%s\t// %u' % (',\t'.join('0x%02X' % v for v in row), sep, rate))
+    lines.append('};')
+    return '\n'.join(lines)
+
+
+def format_rates(rates):
+    return '\n'.join([
+        '#define NUM_DATA_RATES %u' % len(rates),
+        '',
+        '// air data rates in kbps units',
+        '__code static const uint8_t air_data_rates[NUM_DATA_RATES] = {',
+        '\t' + ',\t'.join('%u' % r for r in rates),
+        '};'])
+
+
+def read_tables(path):
+    '''read the rates and register tables out of radio.c'''
+    src = open(path).read()
+    m = re.search(r'air_data_rates\[NUM_DATA_RATES\] = \{(.*?)\};', src, re.S)
+    rates = [int(v) for v in m.group(1).replace('\n', ' ').split(',') if v.strip()]
+    tables = {}
+    for band in BANDS:
+        m = re.search(r'reg_table_%s\[NUM_DATA_RATES\]\[NUM_RADIO_REGISTERS\] = \{(.*?)\n\};' % band, src, re.S)
+        tables[band] = [[int(v, 16) for v in row.split(',')]
+                        for row in re.findall(r'\{([^}]*)\}', m.group(1))]
+    return rates, tables
+
+
+def unpack(row):
+    '''split a table row into its fields'''
+    return {
+        'ifbw': row[0],
+        'osr': ((row[3] & 0xE0) << 3) | row[2],
+        'ncoff': ((row[3] & 0x0F) << 16) | (row[4] << 8) | row[5],
+        'crgain': ((row[6] & 0x07) << 8) | row[7],
+        'afc': row[8],
+        'txdr': (row[9] << 8) | row[10],
+        'fd': row[11],
+    }
+
+
+def check(path, ppm):
+    '''compare against the tables in radio.c
+
+    The data rate, deviation and the clock recovery registers for the
+    IF filter radio.c uses must match. The IF filter and AFC limiter
+    choices are only reported, as the Silabs calculator picks them
+    with rules of its own'''
+    rates, tables = read_tables(path)
+    failures = 0
+    notes = 0
+    for band in sorted(tables):
+        for rate, row in zip(rates, tables[band]):
+            want = unpack(row)
+            got = unpack(modem_registers(rate, BANDS[band], ppm))
+
+            # redo the clock recovery for the filter radio.c uses
+            dwn3, ndec = row[0] >> 7, (row[0] >> 4) & 7
+            rb = rate * 1000.0
+            osr = round_half_up(500e3 * (1 + 2 * dwn3) * 8 / ((1 << ndec) * rb))
+            ncoff = round_half_up(rb * (1 << (20 + ndec)) / (500e3 * (1 + 2 * dwn3)))
+            crgain = min(round_half_up(2 + 65536.0 * rb / (osr * min(rb, MAX_DEVIATION_HZ))), MAX_CRGAIN)
+
+            errors = []
+            for name, a, b in [('txdr', got['txdr'], want['txdr']),
+                               ('fd', got['fd'], want['fd']),
+                               ('osr', osr, want['osr']),
+                               ('ncoff', ncoff, want['ncoff'])]:
+                if a != b:
+                    errors.append('%s %u != %u' % (name, a, b))
+            # the calculator rounds the oversampling ratio
+            # differently in places, so allow 1% here
+            if abs(crgain - want['crgain']) > max(2, want['crgain'] // 100):
+                errors.append('crgain %u != %u' % (crgain, want['crgain']))
+            if errors:
+                print('%sMHz %3ukbps: %s' % (band, rate, ', '.join(errors)))
+                failures += 1
+
+            if got['ifbw'] != want['ifbw'] or got['afc'] != want['afc']:
+                notes += 1
+                print('%sMHz %3ukbps: note IF 0x%02X (%.1fkHz) vs 0x%02X (%.1fkHz), AFC %u vs %u' % (
+                    band, rate, got['ifbw'], if_bandwidth(got['ifbw']) / 1000.0,
+                    want['ifbw'], if_bandwidth(want['ifbw']) / 1000.0,
+                    got['afc'], want['afc']))
+    print('%u rows checked, %u failed, %u with different filter or AFC choices' % (
+        len(rates) * len(tables), failures, notes))
+    return failures == 0
+
+
+parser = argparse.ArgumentParser(description='EZRadioPro modem register table generator')
+parser.add_argument('--band', action='append', choices=sorted(BANDS.keys()),
+                    help='band to generate a table for, may be repeated (default all)')
+parser.add_argument('--rates', default=','.join(str(r) for r in DEFAULT_RATES),
+                    help='comma separated air data rates in kbps')
+parser.add_argument('--ppm', type=float, default=20.0, help='crystal tolerance in ppm')
+parser.add_argument('--check', metavar='RADIO_C',
+                    help='compare with the tables in radio.c instead of generating')
+args = parser.parse_args()
+
+if args.check:
+    sys.exit(0 if check(args.check, args.ppm) else 1)
+
+rates = sorted(set(int(r) for r in args.rates.split(',')))
+if rates[0] < 1 or rates[-1] > MAX_RATE_KBPS:
+    print('rates must be between 1 and %u kbps' % MAX_RATE_KBPS)
+    sys.exit(1)
+
+print(format_rates(rates))
+for band in args.band or sorted(BANDS.keys()):
+    rows = [modem_registers(r, BANDS[band], args.ppm) for r in rates]
+    print('')
+    print(format_table(band, rates, rows))
@@ -0,0 +1,246 @@
+#!/usr/bin/env python
+'''
+update the firmware of a remote radio over the air
+
+This talks to the radio on the serial port, which must be linked to the
+radio being updated, and both must be running firmware built with OTA=1.
+The remote radio also needs version 2 or later of the bootloader, as
+older ones don't apply staged pages, and refuses the update without it.
+The code pages of the remote radio are compared with the new image, and
+those that differ are sent over the link into its staging area. Once
+they are all there and checked, the remote radio resets and its
+bootloader copies them into place, which is checked by comparing the
+pages again.
+
+Only FLASH_STAGING_SLOTS pages can be staged at a time, so this is for
+small changes. Anything bigger has to go through the bootloader with
+uploader.py. See radio/ota.h for the protocol.
+'''
+
+from __future__ import print_function
+import argparse, sys, time
+import serial
+
+# from flash_layout.h
+FLASH_PAGE_SIZE = 0x400
+FLASH_PAGE_SHIFT = 10
+FLASH_APP_START = 0x400
+FLASH_INFO_PAGE = 0xf800
+FLASH_STAGING_PAGES = 8
+FLASH_STAGING_START = FLASH_INFO_PAGE - FLASH_PAGE_SIZE - FLASH_STAGING_PAGES * FLASH_PAGE_SIZE
+FLASH_STAGING_SLOTS = FLASH_STAGING_PAGES - 1
+FLASH_SIGNATURE_BYTES = FLASH_INFO_PAGE - 2
+
+# from ota.h
+OTA_MAGIC = 0xb7
+OTA_REPLY = 0x80
+OP_START = 1
+OP_PAGE_CRC = 2
+OP_WRITE = 3
+OP_STAGE = 4
+OP_COMMIT = 5
+OP_APPLY = 6
+OP_END = 7
+OTA_OK = 0
+OTA_ERR_NO_REMOTE = 4
+OTA_DATA_MAX = 64
+
+STATUS = ['ok', 'bad arguments', 'CRC mismatch', 'wrong state',
+          'no remote radio, or it can not be updated over the air']
+
+
+def crc16(data, crc=0xffff):
+    '''CRC-16/CCITT, as the bootloader uses'''
+    for c in bytearray(data):
+        crc ^= c << 8
+        for i in range(8):
+            if crc & 0x8000:
+                crc = ((crc << 1) ^ 0x1021) & 0xffff
+            else:
+                crc = (crc << 1) & 0xffff
+    return crc
+
+
+def read_hex(path):
+    '''read an Intel hex file into a flash image'''
+    image = bytearray([0xff] * 0x10000)
+    used = set()
+    for line in open(path):
+        line = line.strip()
+        if not line.startswith(':'):
+            continue
+        record = bytearray.fromhex(line[1:])
+        if record[3] != 0:
+            continue
+        address = (record[1] << 8) | record[2]
+        for i, c in enumerate(record[4:-1]):
+            image[address + i] = c
+            used.add(address + i)
+    return image, used
+
+
+class OTAError(Exception):
+    pass
+
+
+class link(object):
+    '''OTA requests to the remote radio, through the local one'''
+
+    def __init__(self, port, baudrate, timeout, retries):
+        self.port = serial.Serial(port, baudrate, timeout=0.1)
+        self.timeout = timeout
+        self.retries = retries
+        self.seq = int(time.time()) & 0xff
+        self.rx = bytearray()
+
+    def start(self):
+        '''put the local radio into relay mode'''
+        time.sleep(1.2)
+        self.port.write(b'+++')
+        time.sleep(1.2)
+        self.port.write(b'\r\nAT&OTA\r\n')
+        deadline = time.time() + 2
+        reply = b''
+        while time.time() < deadline and b'OK' not in reply:
+            reply += self.port.read(100)
+        if b'OK' not in reply:
+            raise OTAError('the local radio did not take AT&OTA')
+        time.sleep(0.2)
+        self.port.reset_input_buffer()
+
+    def reply(self, seq, op):
+        '''look for the reply to a request in what has come in'''
+        while True:
+            start = self.rx.find(bytearray([OTA_MAGIC]))
+            if start < 0:
+                self.rx = bytearray()
+                return None
+            self.rx = self.rx[start:]
+            if len(self.rx) < 2 or len(self.rx) < 2 + self.rx[1]:
+                return None
+            frame = self.rx[2:2 + self.rx[1]]
+            if len(frame) >= 3 and frame[0] == seq and frame[1] == op | OTA_REPLY:
+                self.rx = self.rx[2 + len(frame):]
+                return frame[2], frame[3:]
+            # user data from the other radio, or an old reply
+            self.rx = self.rx[1:]
+
+    def request(self, op, args=b'', wait_remote=0):
+        '''send a request, repeating it until the answer comes back'''
+        self.seq = (self.seq + 1) & 0xff
+        args = bytearray(args)
+        frame = bytearray([OTA_MAGIC, len(args) + 2, self.seq, op]) + args
+        tries = 0
+        deadline = time.time() + wait_remote
+        while True:
+            self.port.write(bytes(frame))
+            end = time.time() + self.timeout
+            result = None
+            while result is None and time.time() < end:
+                self.rx += bytearray(self.port.read(256))
+                result = self.reply(self.seq, op)
+            if result is not None:
+                status, data = result
+                if status == OTA_ERR_NO_REMOTE and time.time() < deadline:
+                    time.sleep(1)
+                    continue
+                if status != OTA_OK:
+                    raise OTAError('request %u failed: %s' % (op, STATUS[status] if status < len(STATUS) else status))
+                return data
+            tries += 1
+            if tries > self.retries:
+                raise OTAError('no reply to request %u' % op)
+
+    def page_crc(self, page, wait_remote=0):
+        data = self.request(OP_PAGE_CRC, [page], wait_remote)
+        return data[0] | (data[1] << 8)
+
+
+def pages_to_send(ota, image, wait_remote=0):
+    '''the code pages of the remote radio that differ from the image'''
+    changed = []
+    for page in range(FLASH_APP_START >> FLASH_PAGE_SHIFT, FLASH_STAGING_START >> FLASH_PAGE_SHIFT):
+        address = page << FLASH_PAGE_SHIFT
+        if ota.page_crc(page, wait_remote) != crc16(image[address:address + FLASH_PAGE_SIZE]):
+            changed.append(page)
+    return changed
+
+
+def update(ota, image, block):
+    print('Comparing pages')
+    changed = pages_to_send(ota, image, wait_remote=10)
+    if len(changed) == 0:
+        print('The remote radio is up to date')
+        return
+    if len(changed) > FLASH_STAGING_SLOTS:
+        raise OTAError('%u pages have changed, but only %u can be sent over the air'
+                       % (len(changed), FLASH_STAGING_SLOTS))
+
+    ota.request(OP_START)
+    for slot, page in enumerate(changed):
+        print('Sending page 0x%04x' % (page << FLASH_PAGE_SHIFT))
+        address = page << FLASH_PAGE_SHIFT
+        data = image[address:address + FLASH_PAGE_SIZE]
+        for offset in range(0, FLASH_PAGE_SIZE, block):
+            chunk = data[offset:offset + block]
+            if offset != 0 and min(chunk) == 0xff:
+                # already erased
+                continue
+            ota.request(OP_WRITE, bytearray([slot, offset & 0xff, offset >> 8]) + chunk)
+        crc = crc16(data)
+        ota.request(OP_STAGE, [slot, page, crc & 0xff, crc >> 8])
+    ota.request(OP_COMMIT)
+
+    print('Applying the update')
+    try:
+        ota.request(OP_APPLY)
+    except OTAError:
+        # the reply may have been lost as the remote radio reset
+        pass
+
+    # wait for the link to come back and check that the staged pages
+    # are now in place
+    time.sleep(3)
+    old = pages_to_send(ota, image, wait_remote=30)
+    if old:
+        raise OTAError('the remote radio did not apply the update, pages %s still differ'
+                       % ', '.join('0x%04x' % (page << FLASH_PAGE_SHIFT) for page in old))
+    print('Remote radio updated')
+
+
+parser = argparse.ArgumentParser(description='update a remote radio over the air')
+parser.add_argument('--port', required=True, help='serial port of the local radio')
+parser.add_argument('--baudrate', type=int, default=57600, help='serial baud rate')
+parser.add_argument('--block', type=int, default=OTA_DATA_MAX,
+                    help='bytes per packet, lower this for air rates with short packets')
+parser.add_argument('--timeout', type=float, default=2.0, help='seconds to wait for each reply')
+parser.add_argument('--retries', type=int, default=10, help='times to repeat a request')
+parser.add_argument('firmware', help='Intel hex file to send')
+args = parser.parse_args()
+
+if not 0 < args.block <= OTA_DATA_MAX:
+    print('--block must be between 1 and %u' % OTA_DATA_MAX)
+    sys.exit(1)
+
+image, used = read_hex(args.firmware)
+if [a for a in used if not (FLASH_APP_START <= a < FLASH_STAGING_START or a >= FLASH_SIGNATURE_BYTES)]:
+    print('%s has code outside the pages that can be updated over the air' % args.firmware)
+    sys.exit(1)
+
+ota = link(args.port, args.baudrate, args.timeout, args.retries)
+try:
+    ota.start()
+except OTAError as e:
+    print(e)
+    sys.exit(1)
+try:
+    update(ota, image, args.block)
+except OTAError as e:
+    print(e)
+    sys.exit(1)
+finally:
+    # back to passing user data
+    try:
+        ota.request(OP_END)
+    except OTAError:
+        pass
@@ -0,0 +1,214 @@
+#!/usr/bin/env python
+'''
+read and write radio settings with the binary configuration protocol
+
+The frames go in with the serial data, so this works without entering
+AT command mode and while a link is carrying MAVLink traffic. See
+radio/config.h for the protocol.
+
+  radio_config.py --port /dev/ttyUSB0 info
+  radio_config.py --port /dev/ttyUSB0 get
+  radio_config.py --port /dev/ttyUSB0 set NETID=30 TXPOWER=17 --save
+  radio_config.py --port /dev/ttyUSB0 stats
+  radio_config.py --port /dev/ttyUSB0 calibration
+'''
+
+from __future__ import print_function
+import argparse, struct, sys, time
+import serial
+
+# from config.h
+MAVLINK10_STX = 254
+RADIO_SOURCE_SYSTEM = ord('3')
+RADIO_SOURCE_COMPONENT = ord('D')
+CONFIG_MSG_ID = 238
+CONFIG_CRC_EXTRA = 104
+CONFIG_REPLY = 0x80
+OP_INFO = 0
+OP_GET_PARAMS = 1
+OP_SET_PARAMS = 2
+OP_GET_STATS = 3
+OP_GET_CALIBRATION = 4
+CONFIG_SAVE = 0x01
+STATUS = ['ok', 'bad arguments', 'value rejected', 'not supported']
+
+# from parameters.c, in S-register order
+PARAM_NAMES = ['FORMAT', 'SERIAL_SPEED', 'AIR_SPEED', 'NETID', 'TXPOWER', 'ECC', 'MAVLINK',
+               'OPPRESEND', 'MIN_FREQ', 'MAX_FREQ', 'NUM_CHANNELS', 'DUTY_CYCLE', 'LBT_RSSI',
+               'MANCHESTER', 'RTSCTS', 'CAL_LATENCY', 'CAL_BYTE_TICKS', 'SER_RX_BUF', 'SER_TX_BUF', 'FRAME_GAP']
+
+# struct statistics and struct error_counts from radio.h
+STATISTICS = '<BBH'
+ERROR_COUNTS = '<7H'
+ERROR_NAMES = ['rx_errors', 'tx_errors', 'serial_tx_overflow', 'serial_rx_overflow',
+               'corrected_errors', 'corrected_packets', 'radio_rx_full']
+
+
+def x25_crc(data):
+    '''the MAVLink checksum'''
+    crc = 0xffff
+    for c in bytearray(data):
+        tmp = c ^ (crc & 0xff)
+        tmp = (tmp ^ (tmp << 4)) & 0xff
+        crc = (crc >> 8) ^ (tmp << 8) ^ (tmp << 3) ^ (tmp >> 4)
+    return crc & 0xffff
+
+
+def frame(seq, payload):
+    '''a configuration frame holding payload'''
+    body = bytearray([len(payload), seq, RADIO_SOURCE_SYSTEM, RADIO_SOURCE_COMPONENT,
+                      CONFIG_MSG_ID]) + bytearray(payload)
+    crc = x25_crc(body + bytearray([CONFIG_CRC_EXTRA]))
+    return bytearray([MAVLINK10_STX]) + body + bytearray([crc & 0xff, crc >> 8])
+
+
+class ConfigError(Exception):
+    pass
+
+
+class radio(object):
+    '''a radio on a serial port'''
+
+    def __init__(self, port, baudrate, timeout):
+        self.port = serial.Serial(port, baudrate, timeout=0.05)
+        self.timeout = timeout
+        self.seq = 0
+        self.rx = bytearray()
+
+    def reply(self, seq, op):
+        '''find the reply in the data that has come in, which may have
+        other MAVLink traffic around it'''
+        while True:
+            start = self.rx.find(bytearray([MAVLINK10_STX]))
+            if start < 0:
+                self.rx = bytearray()
+                return None
+            self.rx = self.rx[start:]
+            if len(self.rx) < 8 or len(self.rx) < self.rx[1] + 8:
+                return None
+            f = self.rx[:self.rx[1] + 8]
+            body = f[1:-2] + bytearray([CONFIG_CRC_EXTRA])
+            if (f[2] == seq and f[3] == RADIO_SOURCE_SYSTEM and f[4] == RADIO_SOURCE_COMPONENT and
+                    f[5] == CONFIG_MSG_ID and f[6] == op | CONFIG_REPLY and
+                    x25_crc(body) == f[-2] | (f[-1] << 8)):
+                self.rx = self.rx[len(f):]
+                return f[7], f[8:-2]
+            self.rx = self.rx[1:]
+
+    def request(self, op, args=b''):
+        '''send a request and wait for the answer'''
+        self.seq = (self.seq + 1) & 0xff
+        start = time.time()
+        self.port.write(bytes(frame(self.seq, bytearray([op]) + bytearray(args))))
+        while time.time() - start < self.timeout:
+            self.rx += bytearray(self.port.read(256))
+            result = self.reply(self.seq, op)
+            if result is not None:
+                status, data = result
+                self.elapsed = time.time() - start
+                if status != 0:
+                    raise ConfigError('request failed: %s' % (STATUS[status] if status < len(STATUS) else status))
+                return data
+        raise ConfigError('no answer from the radio')
+
+    def params(self):
+        data = self.request(OP_GET_PARAMS, [0, 255])
+        first = data[0]
+        values = struct.unpack('<%uI' % ((len(data) - 1) // 4), bytes(data[1:]))
+        return dict((first + i, v) for i, v in enumerate(values))
+
+
+def param_name(i):
+    return PARAM_NAMES[i] if i < len(PARAM_NAMES) else 'S%u' % i
+
+
+def param_id(name):
+    name = name.upper()
+    if name in PARAM_NAMES:
+        return PARAM_NAMES.index(name)
+    if name.startswith('S') and name[1:].isdigit():
+        return int(name[1:])
+    raise ConfigError('unknown parameter %s' % name)
+
+
+def show_info(r, args):
+    data = r.request(OP_INFO)
+    print('firmware %u.%u, board 0x%02x, frequency 0x%02x, bootloader %u, %u parameters' % tuple(data[:6]))
+
+
+def show_params(r, args):
+    for i, v in sorted(r.params().items()):
+        print('S%u: %s=%u' % (i, param_name(i), v))
+
+
+def set_params(r, args):
+    values = {}
+    for setting in args.settings:
+        if '=' not in setting:
+            raise ConfigError('expected NAME=VALUE, not %s' % setting)
+        name, value = setting.split('=', 1)
+        values[param_id(name)] = int(value, 0)
+    if not values:
+        raise ConfigError('nothing to set')
+
+    # one request for the whole run, filling any gaps with the current
+    # values, so they are all set or none are
+    first, last = min(values), max(values)
+    current = r.params()
+    run = [values.get(i, current.get(i, 0)) for i in range(first, last + 1)]
+    flags = CONFIG_SAVE if args.save else 0
+    try:
+        r.request(OP_SET_PARAMS, bytearray([flags, first]) + bytearray(struct.pack('<%uI' % len(run), *run)))
+    except ConfigError as e:
+        raise ConfigError('%s, nothing was changed' % e)
+    print('set %u parameters%s' % (len(values), ' and saved them' if args.save else ''))
+
+
+def show_stats(r, args):
+    data = bytes(r.request(OP_GET_STATS))
+    ns = struct.calcsize(STATISTICS)
+    ne = struct.calcsize(ERROR_COUNTS)
+    local = struct.unpack(STATISTICS, data[:ns])
+    remote = struct.unpack(STATISTICS, data[ns:2 * ns])
+    errors = struct.unpack(ERROR_COUNTS, data[2 * ns:2 * ns + ne])
+    remote_errors = struct.unpack(ERROR_COUNTS, data[2 * ns + ne:2 * ns + 2 * ne])
+    print('%-20s %8s %8s' % ('', 'local', 'remote'))
+    for i, name in enumerate(['rssi', 'noise', 'receive_count']):
+        print('%-20s %8u %8u' % (name, local[i], remote[i]))
+    for i, name in enumerate(ERROR_NAMES):
+        print('%-20s %8u %8u' % (name, errors[i], remote_errors[i]))
+    print('remote serial space %u%%' % bytearray(data)[2 * ns + 2 * ne])
+
+
+def show_calibration(r, args):
+    data = r.request(OP_GET_CALIBRATION)
+    if data[0] == 0:
+        print('no transmit power calibration on this board')
+    for level, value in enumerate(data[1:1 + data[0]]):
+        print('%2u dBm: %u' % (level, value))
+
+
+COMMANDS = {
+    'info': show_info,
+    'get': show_params,
+    'set': set_params,
+    'stats': show_stats,
+    'calibration': show_calibration,
+}
+
+parser = argparse.ArgumentParser(description='radio configuration over the binary protocol')
+parser.add_argument('--port', required=True, help='serial port of the radio')
+parser.add_argument('--baudrate', type=int, default=57600, help='serial baud rate')
+parser.add_argument('--timeout', type=float, default=2.0, help='seconds to wait for an answer')
+parser.add_argument('--save', action='store_true', help='save the parameters once set')
+parser.add_argument('command', choices=sorted(COMMANDS))
+parser.add_argument('settings', nargs='*', help='NAME=VALUE for set')
+args = parser.parse_args()
+
+r = radio(args.port, args.baudrate, args.timeout)
+try:
+    COMMANDS[args.command](r, args)
+except ConfigError as e:
+    print(e)
+    sys.exit(1)
+print('answered in %.0fms' % (r.elapsed * 1000))
@@ -8,6 +8,7 @@ parser.add_option("--baudrate", type='int', default=57600, help='baud rate')
 parser.add_option("--cmd", action='append', default=[], help='at command')
 parser.add_option("--reset", action='store_true', help='reset after set')
 parser.add_option("--write", action='store_true', help='write after set')
+parser.add_option("--remote", action='store_true', help='set the radio at the other end of the link, all or nothing')
 parser.add_option("--rtscts", action='store_true', default=False, help='enable rtscts')
 parser.add_option("--dsrdtr", action='store_true', default=False, help='enable dsrdtr')
 parser.add_option("--xonxoff", action='store_true', default=False, help='enable xonxoff')
@@ -19,6 +20,26 @@ if len(args) == 0:
     sys.exit(1)
 
 
+def set_remote(ser):
+    '''send the registers to the other radio as one batch, which it
+    applies all or none of'''
+    ser.send('AT&RB\r\n')
+    ser.expect('OK')
+    for cmd in opts.cmd:
+        ser.send('RT%s\r\n' % cmd[2:])
+    if opts.write:
+        ser.send('RT&W\r\n')
+    ser.send('AT&RC\r\n')
+    ser.expect('OK')
+    time.sleep(1)
+    try:
+        reply = ser.read_nonblocking(300, timeout=1)
+    except fdpexpect.TIMEOUT:
+        reply = ''
+    if 'OK' not in reply or 'ERROR' in reply:
+        print("remote radio did not take the settings")
+
+
 def set_speed(device):
     '''set some registers'''
     port = serial.Serial(device, opts.baudrate, timeout=0,
@@ -32,13 +53,19 @@ def set_speed(device):
     except fdpexpect.TIMEOUT:
         print("timeout")
         return
-    for cmd in opts.cmd:
-        ser.send('%s\r\n' % cmd)
-    ser.expect('OK')
-    if opts.write:
-        ser.send('AT&W\r\n')
+    if opts.remote:
+        set_remote(ser)
+    else:
+        for cmd in opts.cmd:
+            ser.send('%s\r\n' % cmd)
         ser.expect('OK')
-    if opts.reset:
+        if opts.write:
+            ser.send('AT&W\r\n')
+            ser.expect('OK')
+    if opts.reset and opts.remote:
+        ser.send('RTZ\r\n')
+        ser.send('ATO\r\n')
+    elif opts.reset:
         ser.send('ATZ\r\n')
     else:
         ser.send('ATO\r\n')
@@ -3,7 +3,10 @@
 # Serial firmware uploader for the SiK bootloader
 #
 
-import sys, argparse, binascii, serial, glob
+import sys, argparse, binascii, serial, glob, threading, time
+
+# serialises output from uploads running in parallel
+output_lock = threading.Lock()
 
 class firmware(object):
 	'''Loads a firmware file'''
@@ -62,6 +65,7 @@ class uploader(object):
 	OK		= chr(0x10)
 	FAILED		= chr(0x11)
 	INSYNC		= chr(0x12)
+	CONTINUE	= chr(0x13)
 	EOC		= chr(0x20)
 	GET_SYNC	= chr(0x21)
 	GET_DEVICE	= chr(0x22)
@@ -72,15 +76,62 @@ class uploader(object):
 	PROG_MULTI	= chr(0x27)
 	READ_MULTI	= chr(0x28)
 	PARAM_ERASE	= chr(0x29)
+	PROG_PAGE	= chr(0x2a)
+	READ_CRC	= chr(0x2b)
+	ERASE_PAGE	= chr(0x2c)
 	REBOOT		= chr(0x30)
+
+	DEVICE_V2	= chr(0x02)
+	CAP_PROG_PAGE	= 0x01
+	CAP_READ_CRC	= 0x02
+	CAP_ERASE_PAGE	= 0x04
+	CAP_RX_BUFFER	= 0x08
+	CAP_V2		= CAP_PROG_PAGE | CAP_READ_CRC | CAP_ERASE_PAGE
 	
 	PROG_MULTI_MAX	= 32 # 64 causes serial hangs with some USB-serial adapters
 	READ_MULTI_MAX	= 255
+	PROG_PAGE_MAX	= 1024
+	PROG_PAGE_CHUNK	= 128
+	RX_BUFFER	= 32
+	READ_CRC_LEN	= 6
+	PAGE_SIZE	= 1024
+	APP_START	= 0x0400
+	APP_END		= 0xf800
+	PAGE_RETRIES	= 3
+	RESYNC_RETRIES	= 5
 
-	def __init__(self, portname, atbaudrate=57600):
-		print("Connecting to %s" % portname)
+	def __init__(self, portname, atbaudrate=57600, tagged=False):
+		self.portname = portname
+		self.tagged = tagged
+		self.log("Connecting to %s" % portname)
 		self.port = serial.Serial(portname, 115200, timeout=3)
 		self.atbaudrate = atbaudrate
+		self.bl_version = 1
+		self.caps = 0
+
+	# print a message, tagged with the port when uploading to more than one
+	def log(self, msg):
+		with output_lock:
+			if (self.tagged):
+				print("%s: %s" % (self.portname, msg))
+			else:
+				print(msg)
+			sys.stdout.flush()
+
+	# start reporting progress through a stage of the upload
+	def __progress_start(self, stage, total):
+		self.stage = stage
+		self.total = max(total, 1)
+		self.done = 0
+		self.reported = 0
+
+	# report progress every 10%
+	def __progress_step(self):
+		self.done += 1
+		percent = min(self.done * 100 // self.total, 100)
+		if (percent >= self.reported + 10):
+			self.reported = percent - percent % 10
+			self.log("%s %u%%" % (self.stage, self.reported))
 
 	def __send(self, c):
 		#print("send " + binascii.hexlify(c))
@@ -102,12 +153,28 @@ class uploader(object):
 			raise RuntimeError("unexpected 0x%x instead of OK (0x%x)" % (ord(c), ord(self.OK)))
 		return True
 
+	# throw away replies until the bootloader goes quiet, so that none left
+	# over from an abandoned command can be taken for new ones
+	def __drain(self):
+		timeout = self.port.timeout
+		self.port.timeout = 0.25
+		try:
+			while (len(self.port.read(256)) > 0):
+				pass
+		finally:
+			self.port.timeout = timeout
+
 	# attempt to get back into sync with the bootloader
 	def __sync(self):
-		# send a stream of ignored bytes longer than the longest possible conversation
-		# that we might still have in progress
-		self.__send(uploader.NOP * (uploader.PROG_MULTI_MAX + 2))
-		self.port.flushInput()
+		# send ignored bytes to finish the longest possible conversation that
+		# we might still have in progress. If that is a PROG_PAGE the NOPs
+		# will be programmed, but its CRC will fail and the page will be
+		# rewritten. The bootloader loses bytes while it programs a chunk, so
+		# they go a chunk at a time, waiting for it to finish each one
+		for i in range(uploader.PROG_PAGE_MAX / uploader.PROG_PAGE_CHUNK + 1):
+			self.__send(uploader.NOP * uploader.PROG_PAGE_CHUNK)
+			self.port.flush()
+			self.__drain()
 		self.__send(uploader.GET_SYNC 
 				+ uploader.EOC)
 		return self.__getSync()
@@ -118,9 +185,13 @@ class uploader(object):
 				+ uploader.EOC)
 		self.__getSync()
 		if (erase_params):
-			self.__send(uploader.PARAM_ERASE 
-					+ uploader.EOC)
-			self.__getSync()
+			self.__erase_params()
+
+	# send the PARAM_ERASE command
+	def __erase_params(self):
+		self.__send(uploader.PARAM_ERASE 
+				+ uploader.EOC)
+		self.__getSync()
 
 	# send a LOAD_ADDRESS command
 	def __set_address(self, address):
@@ -165,6 +236,101 @@ class uploader(object):
 		self.__getSync()
 		return True
 		
+	# CRC-16/CCITT as used by the v2 commands
+	def __crc16(self, data, crc = 0xffff):
+		for c in bytearray(data):
+			crc ^= c << 8
+			for i in range(8):
+				if (crc & 0x8000):
+					crc = ((crc << 1) ^ 0x1021) & 0xffff
+				else:
+					crc = (crc << 1) & 0xffff
+		return crc
+
+	# send a PROG_PAGE command, a chunk at a time as the bootloader asks for
+	# them, returns False if the bootloader saw a bad CRC
+	def __prog_page(self, address, data):
+		header = (chr(address & 0xff)
+				+ chr(address >> 8)
+				+ chr(len(data) & 0xff)
+				+ chr(len(data) >> 8))
+		crc = self.__crc16(header)
+		self.__send(uploader.PROG_PAGE
+				+ header
+				+ chr(crc & 0xff)
+				+ chr(crc >> 8))
+		# nothing has been programmed if the header was damaged
+		c = self.__recv()
+		if (c == uploader.INSYNC):
+			c = self.__recv()
+			if (c == uploader.FAILED):
+				return False
+		if (c != uploader.CONTINUE):
+			raise RuntimeError("unexpected 0x%x instead of CONTINUE starting page at 0x%x" % (ord(c), address))
+		for chunk in self.__split_len(data, uploader.PROG_PAGE_CHUNK):
+			self.__send(chunk)
+			c = self.__recv()
+			if (c != uploader.CONTINUE):
+				raise RuntimeError("unexpected 0x%x instead of CONTINUE programming page at 0x%x" % (ord(c), address))
+		crc = self.__crc16(header + str(data))
+		self.__send(chr(crc & 0xff)
+				+ chr(crc >> 8)
+				+ uploader.EOC)
+		return self.__page_status(address)
+
+	# get the reply to a PROG_PAGE, returns False if the bootloader saw a bad CRC
+	def __page_status(self, address):
+		c = self.__recv()
+		if (c != uploader.INSYNC):
+			raise RuntimeError("unexpected 0x%x instead of INSYNC programming page at 0x%x" % (ord(c), address))
+		c = self.__recv()
+		if (c == uploader.FAILED):
+			return False
+		if (c != uploader.OK):
+			raise RuntimeError("unexpected 0x%x instead of OK programming page at 0x%x" % (ord(c), address))
+		return True
+
+	# send an ERASE_PAGE command
+	def __erase_page(self, address):
+		self.__send(uploader.ERASE_PAGE
+				+ chr(address & 0xff)
+				+ chr(address >> 8)
+				+ uploader.EOC)
+		self.__getSync()
+
+	# send a READ_CRC command
+	def __send_read_crc(self, address, length):
+		self.__send(uploader.READ_CRC
+				+ chr(address & 0xff)
+				+ chr(address >> 8)
+				+ chr(length & 0xff)
+				+ chr(length >> 8)
+				+ uploader.EOC)
+
+	# get the reply to a READ_CRC
+	def __crc_reply(self):
+		crc = ord(self.__recv())
+		crc |= ord(self.__recv()) << 8
+		self.__getSync()
+		return crc
+
+	# get the CRCs of a list of (address, length) ranges of flash. When the
+	# bootloader can buffer them, the commands go out as many ahead of the
+	# replies as fit in its receive buffer, so that the adapter latency is
+	# paid once rather than for every range
+	def __read_crcs(self, ranges):
+		window = 1
+		if (self.caps & uploader.CAP_RX_BUFFER):
+			window = uploader.RX_BUFFER // uploader.READ_CRC_LEN
+		crcs = []
+		sent = 0
+		while (len(crcs) < len(ranges)):
+			while (sent < len(ranges) and sent - len(crcs) < window):
+				self.__send_read_crc(*ranges[sent])
+				sent += 1
+			crcs.append(self.__crc_reply())
+		return crcs
+
 	# send the reboot command
 	def __reboot(self):
 		self.__send(uploader.REBOOT)
@@ -176,11 +342,13 @@ class uploader(object):
 	# upload code
 	def __program(self, fw):
 		code = fw.code()
+		self.__progress_start("program", sum([len(code[a]) for a in code.keys()]) // uploader.PROG_MULTI_MAX)
 		for address in sorted(code.keys()):
 			self.__set_address(address)
 			groups = self.__split_len(code[address], uploader.PROG_MULTI_MAX)
 			for bytes in groups:
 				self.__program_multi(bytes)
+				self.__progress_step()
 
 	# verify code
 	def __verify(self, fw):
@@ -192,13 +360,119 @@ class uploader(object):
 				if (not self.__verify_multi(bytes)):
 					raise RuntimeError("Verification failed in group at 0x%x" % address)
 
+	# split the code into whole flash pages, filling the gaps with erased bytes
+	def __page_images(self, fw):
+		pages = dict()
+		code = fw.code()
+		for address in code.keys():
+			for i in range(len(code[address])):
+				base = (address + i) & ~(uploader.PAGE_SIZE - 1)
+				if (base not in pages):
+					pages[base] = bytearray([0xff] * uploader.PAGE_SIZE)
+				pages[base][address + i - base] = code[address][i]
+		return pages
+
+	# trim the erased bytes off the ends of a page, as there is no need to send them
+	def __trim(self, base, data):
+		start = 0
+		while (data[start] == 0xff):
+			start += 1
+		end = len(data)
+		while (data[end - 1] == 0xff):
+			end -= 1
+		return (base + start, data[start:end])
+
+	# the code as a list of trimmed pages
+	def __pages(self, fw):
+		pages = self.__page_images(fw)
+		return [self.__trim(base, pages[base]) for base in sorted(pages.keys()) if min(pages[base]) != 0xff]
+
+	# program pages one after another. If the replies stop making sense, get
+	# back in sync and carry on from the page that was being programmed,
+	# erasing it first as it may have been partly programmed. Returns the
+	# pages that failed their CRC
+	def __prog_pages(self, pages):
+		failed = []
+		done = 0
+		resyncs = 0
+		while (done < len(pages)):
+			try:
+				if (not self.__prog_page(*pages[done])):
+					failed.append(pages[done])
+				done += 1
+				self.__progress_step()
+			except RuntimeError as e:
+				resyncs += 1
+				if (resyncs > uploader.RESYNC_RETRIES):
+					raise
+				self.log("%s, resuming from 0x%x" % (e, pages[done][0]))
+				self.__sync()
+				self.__erase_page(pages[done][0])
+		return failed
+
+	# erase a page and program it again
+	def __rewrite_page(self, address, data):
+		self.log("rewriting page at 0x%x" % address)
+		self.__erase_page(address)
+		self.__prog_pages([(address, data)])
+
+	# program a set of pages and check their CRCs, rewriting any that fail
+	def __program_pages(self, pages):
+		for address, data in self.__prog_pages(pages):
+			self.__rewrite_page(address, data)
+		crcs = self.__read_crcs([(address, len(data)) for address, data in pages])
+		for (address, data), crc in zip(pages, crcs):
+			tries = 0
+			while (crc != self.__crc16(data)):
+				tries += 1
+				if (tries > uploader.PAGE_RETRIES):
+					raise RuntimeError("Verification failed in page at 0x%x" % address)
+				self.__rewrite_page(address, data)
+				crc = self.__read_crcs([(address, len(data))])[0]
+
+	# upload code in pages. The page holding the signature goes last, so that
+	# the application is not marked valid until everything else checks out
+	def __program_v2(self, fw):
+		pages = self.__pages(fw)
+		self.__progress_start("program", len(pages))
+		self.__program_pages(pages[:-1])
+		self.__program_pages(pages[-1:])
+
+	# rewrite only the pages that differ from the new code, found by comparing
+	# the CRC of each page in flash with the CRC it should have. Returns False
+	# if nothing needed doing
+	def __program_delta(self, fw):
+		images = self.__page_images(fw)
+		erased = bytearray([0xff] * uploader.PAGE_SIZE)
+		bases = range(uploader.APP_START, uploader.APP_END, uploader.PAGE_SIZE)
+		crcs = self.__read_crcs([(base, uploader.PAGE_SIZE) for base in bases])
+		changed = [base for base, crc in zip(bases, crcs)
+				if crc != self.__crc16(images.get(base, erased))]
+		self.log("%u of %u pages changed" % (len(changed), (uploader.APP_END - uploader.APP_START) / uploader.PAGE_SIZE))
+		if (not changed):
+			return False
+
+		# the page holding the signature is erased first and programmed
+		# last, so that a partial update will not be run
+		last = max(images.keys())
+		self.__erase_page(last)
+		for base in changed:
+			if (base != last):
+				self.__erase_page(base)
+		pages = [self.__trim(base, images[base]) for base in changed
+				if base != last and base in images and min(images[base]) != 0xff]
+		self.__progress_start("program", len(pages) + 1)
+		self.__program_pages(pages)
+		self.__program_pages([self.__trim(last, images[last])])
+		return True
+
 	def autosync(self):
 		'''use AT&UPDATE to put modem in update mode'''
 		import fdpexpect, time
 		ser = fdpexpect.fdspawn(self.port.fileno(), logfile=sys.stdout)
 		if self.atbaudrate != 115200:
 			self.port.setBaudrate(self.atbaudrate)
-		print("Trying autosync")
+		self.log("Trying autosync")
 		ser.send('\r\n')
 		time.sleep(1.0)
 		ser.send('+++')
@@ -231,7 +505,7 @@ class uploader(object):
 		for i in range(3):
 			try:
 				if self.__sync():
-					print("Got sync")
+					self.log("Got sync")
 					return True
 				self.autosync()
 			except RuntimeError:
@@ -239,6 +513,23 @@ class uploader(object):
 		return False
 
 	def identify(self):
+		# a v2 bootloader also returns its version and capabilities, a v1
+		# bootloader ignores the request and has to be asked again
+		self.__send(uploader.GET_DEVICE
+				+ uploader.DEVICE_V2
+				+ uploader.EOC)
+		timeout = self.port.timeout
+		self.port.timeout = 0.5
+		try:
+			reply = self.port.read(6)
+		finally:
+			self.port.timeout = timeout
+		if (len(reply) == 6 and reply[4:] == uploader.INSYNC + uploader.OK):
+			self.bl_version = ord(reply[2])
+			self.caps = ord(reply[3])
+			return ord(reply[0]), ord(reply[1])
+
+		self.__sync()
 		self.__send(uploader.GET_DEVICE
 				+ uploader.EOC)
 		board_id = ord(self.__recv()[0])
@@ -246,39 +537,89 @@ class uploader(object):
 		self.__getSync()
 		return board_id, board_freq
 
-	def upload(self, fw, erase_params = False):
-		print("erase...")
+	def upload(self, fw, erase_params = False, full = False):
+		if (not full and (self.caps & uploader.CAP_V2) == uploader.CAP_V2):
+			self.log("compare, program and verify...")
+			if (not self.__program_delta(fw)):
+				self.log("already up to date")
+			if (erase_params):
+				self.__erase_params()
+			self.log("done.")
+			self.__reboot()
+			return
+
+		self.log("erase...")
 		self.__erase(erase_params)
-		print("program...")
-		self.__program(fw)
-		print("verify...")
-		self.__verify(fw)
-		print("done.")
+		if ((self.caps & uploader.CAP_V2) == uploader.CAP_V2):
+			self.log("program and verify...")
+			self.__program_v2(fw)
+		else:
+			self.log("program...")
+			self.__program(fw)
+			self.log("verify...")
+			self.__verify(fw)
+		self.log("done.")
 		self.__reboot()
 	
 
+# upload to one port, recording the outcome in results
+def flash(port, fw, args, results):
+	start = time.time()
+	up = None
+	try:
+		up = uploader(port, atbaudrate=args.baudrate, tagged=(len(ports) > 1))
+		if not up.check():
+			raise RuntimeError("Failed to contact bootloader")
+		id, freq = up.identify()
+		up.log("board %x  freq %x  bootloader v%u" % (id, freq, up.bl_version))
+		up.upload(fw,args.resetparams,args.full)
+		results[port] = (True, "board %x freq %x" % (id, freq), time.time() - start)
+	except (RuntimeError, serial.SerialException) as e:
+		with output_lock:
+			print("%s: %s" % (port, e))
+		results[port] = (False, str(e), time.time() - start)
+	if up is not None:
+		up.port.close()
+
 # Parse commandline arguments
 parser = argparse.ArgumentParser(description="Firmware uploader for the SiK radio system.")
-parser.add_argument('--port', action="store", help="port to upload to")
+parser.add_argument('--port', action="append", required=True, help="port to upload to, may be a pattern and may be repeated")
+parser.add_argument('--parallel', action="store_true", help="upload to all the ports at once")
 parser.add_argument('--resetparams', action="store_true", help="reset all parameters to defaults")
 parser.add_argument("--baudrate", type=int, default=57600, help='baud rate')
+parser.add_argument('--full', action="store_true", help="erase and program everything, even if the bootloader can update just the pages that changed")
 parser.add_argument('firmware', action="store", help="Firmware file to be uploaded")
 args = parser.parse_args()
 
-# Load the firmware file
+# Load the firmware file, once for all the ports
 fw = firmware(args.firmware)
 
-ports = glob.glob(args.port)
+ports = []
+for pattern in args.port:
+	for port in sorted(glob.glob(pattern)):
+		if port not in ports:
+			ports.append(port)
 if not ports:
-	print("No matching ports for %s" % args.port)
+	print("No matching ports for %s" % " ".join(args.port))
+	sys.exit(1)
+
+results = dict()
+if args.parallel:
+	threads = [threading.Thread(target=flash, args=(port, fw, args, results)) for port in ports]
+	for t in threads:
+		t.start()
+	for t in threads:
+		t.join()
+else:
+	for port in ports:
+		print("uploading to port %s" % port)
+		flash(port, fw, args, results)
+
+if len(ports) > 1:
+	print("")
+	for port in ports:
+		ok, detail, elapsed = results[port]
+		print("%-20s %-6s %5.1fs  %s" % (port, "ok" if ok else "FAILED", elapsed, detail))
+	print("%u of %u uploads succeeded" % (len([p for p in ports if results[p][0]]), len(ports)))
+if not all([results[port][0] for port in ports]):
 	sys.exit(1)
-# Connect to the device and identify it
-for port in glob.glob(args.port):
-	print("uploading to port %s" % port)
-	up = uploader(port, atbaudrate=args.baudrate)
-	if not up.check():
-		print("Failed to contact bootloader")
-		sys.exit(1)
-	id, freq = up.identify()
-	print("board %x  freq %x" % (id, freq))
-	up.upload(fw,args.resetparams)
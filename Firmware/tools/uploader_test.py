@@ -0,0 +1,175 @@
+#!/usr/bin/env python
+'''
+loopback test for the firmware uploader
+
+Uploads a full radio image to the bootloader emulator over a pty, with
+the v1 commands and with v2, and then with a corrupted and a dropped
+byte part way through and with a damaged page address. Then it updates
+a radio holding that image to one with a few pages changed, which
+should only rewrite those pages and should send its READ_CRC commands
+ahead of the replies, and lastly uploads to several radios at once. Each time the flash image
+left in the emulator must match the firmware, and apart from getting
+back in sync after the dropped byte no byte may be sent while the
+emulator is programming flash. The times are printed so the upload
+modes can be compared.
+
+uploader.py is Python 2 only, so it is run with $UPLOADER_PYTHON,
+python2 by default.
+'''
+
+from __future__ import print_function
+import os, random, subprocess, sys, tempfile, time
+
+TOOLS = os.path.dirname(os.path.abspath(__file__))
+UPLOADER_PYTHON = os.environ.get('UPLOADER_PYTHON', 'python2')
+
+FLASH_APP_START = 0x400
+FLASH_INFO_PAGE = 0xf800
+
+# the default latency timer of FTDI USB-serial adapters
+LATENCY = '0.016'
+
+CASES = [
+    ('v1', ['--v1'], []),
+    ('v2', [], ['--full']),
+    ('v2, CRC error', ['--corrupt', '10'], ['--full']),
+    ('v2, bad address', ['--corrupt-header', '15'], ['--full']),
+    ('v2, lost byte', ['--drop', '20'], ['--full']),
+]
+
+# pages changed in the update
+DELTA_PAGES = [0x0400, 0x2000, 0x8800]
+
+PARALLEL_RADIOS = 4
+
+
+def write_hex(path, image):
+    '''write a dict of address: byte out as Intel hex'''
+    f = open(path, 'w')
+    addresses = sorted(image)
+    for i in range(0, len(addresses), 16):
+        address = addresses[i]
+        data = [image[a] for a in addresses[i:i + 16]]
+        record = bytearray([len(data), address >> 8, address & 0xff, 0] + data)
+        f.write(':%s%02X\n' % (''.join('%02X' % b for b in record), -sum(record) & 0xff))
+    f.write(':00000001FF\n')
+    f.close()
+
+
+def read_hex(path):
+    '''read Intel hex back into a dict, leaving out erased bytes'''
+    image = {}
+    for line in open(path):
+        record = bytearray.fromhex(line.strip()[1:])
+        if record[3] == 0:
+            address = (record[1] << 8) | record[2]
+            for i, b in enumerate(record[4:-1]):
+                if b != 0xff:
+                    image[address + i] = b
+    return image
+
+
+def upload(name, fw, expected, emu_args, uploader_args, tmp, erases=None, radios=1, pipelined=False):
+    emus = []
+    ports = []
+    for i in range(radios):
+        dump = os.path.join(tmp, 'flash%u.hex' % i)
+        emu = subprocess.Popen([sys.executable, os.path.join(TOOLS, 'bootloader_emu.py'),
+                                '--latency', LATENCY, '--dump', dump] + emu_args,
+                               stdout=subprocess.PIPE, universal_newlines=True)
+        emus.append((emu, dump))
+        ports += ['--port', emu.stdout.readline().strip()]
+    start = time.time()
+    log = open(os.path.join(tmp, 'uploader.log'), 'w')
+    status = subprocess.call(UPLOADER_PYTHON.split() + [os.path.join(TOOLS, 'uploader.py')]
+                             + ports + uploader_args + [fw],
+                             stdout=log, stderr=subprocess.STDOUT)
+    elapsed = time.time() - start
+    log.close()
+
+    ok = status == 0
+    for emu, dump in emus:
+        for i in range(20):
+            if emu.poll() is not None:
+                break
+            time.sleep(0.1)
+        else:
+            emu.kill()
+        stats = emu.communicate()[0].strip()
+        if not os.path.exists(dump) or read_hex(dump) != expected:
+            ok = False
+        if erases is not None and ('%u pages erased' % erases) not in stats:
+            ok = False
+        if '--drop' not in emu_args and ' 0 bytes overrun' not in stats:
+            ok = False
+        if pipelined and ' 0 bytes buffered' in stats:
+            ok = False
+        if os.path.exists(dump):
+            os.unlink(dump)
+    print('%-28s %6.1fs  %s  %s' % (name, elapsed, 'ok' if ok else 'FAILED', stats))
+    if not ok:
+        print(open(os.path.join(tmp, 'uploader.log')).read())
+    return ok, elapsed
+
+
+def main():
+    # a full image of random code, with the signature at the end
+    rng = random.Random(1)
+    image = dict((a, rng.randrange(0xff)) for a in range(FLASH_APP_START, FLASH_INFO_PAGE - 2))
+    image[FLASH_INFO_PAGE - 2] = 0x3d
+    image[FLASH_INFO_PAGE - 1] = 0xc2
+    expected = dict((a, b) for a, b in image.items() if b != 0xff)
+
+    tmp = tempfile.mkdtemp()
+    fw = os.path.join(tmp, 'radio.hex')
+    write_hex(fw, image)
+    print('uploading %u bytes at 115200 with %sms latency' % (len(image), float(LATENCY) * 1000))
+
+    results = {}
+    passed = True
+    for name, emu_args, uploader_args in CASES:
+        ok, results[name] = upload(name, fw, expected, emu_args, uploader_args, tmp)
+        passed = passed and ok
+
+    # the update, changing a byte in a few pages. The signature page is
+    # rewritten as well
+    update = dict(image)
+    for base in DELTA_PAGES:
+        update[base + 100] ^= 0x55
+    expected = dict((a, b) for a, b in update.items() if b != 0xff)
+    fw_update = os.path.join(tmp, 'update.hex')
+    write_hex(fw_update, update)
+    ok, results['v2, delta'] = upload('v2, delta', fw_update, expected, ['--load', fw], [], tmp,
+                                      erases=len(DELTA_PAGES) + 1, pipelined=True)
+    passed = passed and ok
+    ok, results['v2, delta, no change'] = upload('v2, delta, no change', fw, dict(
+        (a, b) for a, b in image.items() if b != 0xff), ['--load', fw], [], tmp, erases=0, pipelined=True)
+    passed = passed and ok
+
+    # a bench of radios at once, which should take about as long as one
+    name = 'v2, %u radios in parallel' % PARALLEL_RADIOS
+    ok, results[name] = upload(name, fw_update, expected, [], ['--full', '--parallel'], tmp,
+                               radios=PARALLEL_RADIOS)
+    passed = passed and ok
+
+    os.unlink(fw)
+    for f in os.listdir(tmp):
+        os.unlink(os.path.join(tmp, f))
+    os.rmdir(tmp)
+
+    if results['v2'] >= results['v1']:
+        print('v2 was no quicker than v1')
+        passed = False
+    if results['v2, delta'] >= results['v2']:
+        print('the delta update was no quicker than a full one')
+        passed = False
+    if results['v2, %u radios in parallel' % PARALLEL_RADIOS] >= 2 * results['v2']:
+        print('uploading in parallel took much longer than uploading to one radio')
+        passed = False
+    if not passed:
+        print('-- test FAILED')
+        sys.exit(1)
+    print('-- test passed.')
+
+
+main()